@@ -10,7 +10,10 @@
 
 #include <cstdlib>
 #include <cstdint>
-#include <bitset> // std::bitset
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <qmf/DatasetReader.h>
 
@@ -18,6 +21,7 @@
 #include <qmf/Matrix.h>
 #include <qmf/FactorData.h>
 
+#include <distributed/common/BucketBits.h>
 #include <distributed/common/Common.h>
 #include <distributed/common/Message.h>
 
@@ -25,9 +29,6 @@ namespace distributed {
 
 struct BigData {
 
-  // TODO: dynamic create task_bits for performance
-  using bucket_bits_type = std::bitset<kBucketBits>;
-
   BigData() {
 
     // ::srandom(::time(NULL));
@@ -56,14 +57,111 @@ struct BigData {
     return confidence_;
   }
 
-  // start new epcho
+  // the desired payload encoding, negotiated with each Labor before sending
+  uint8_t rating_encoding() const {
+    return rating_encoding_;
+  }
+
+  uint8_t factor_encoding() const {
+    return factor_encoding_;
+  }
+
+  void set_encoding(uint8_t rating_encoding, uint8_t factor_encoding) {
+    rating_encoding_ = rating_encoding;
+    factor_encoding_ = factor_encoding;
+  }
+
+  // continue the task from a checkpoint
+  void resume_epchoid(uint32_t epchoid) {
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    epchoid_ = epchoid;
+  }
+
+  // start new epcho, the buckets are sized by start_buckets later
   uint32_t incr_epchoid() {
-    bucket_bits_.reset();
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    bucket_bits_.reset(0);
+    loss_sum_ = 0;
+    loss_rows_ = 0;
     return ++epchoid_;
   }
 
-  // user rating matrix, also unknown as dataset
-  std::vector<qmf::DatasetElem> rating_vec_;
+  // the training loss of current half epcho, averaged by the solved rows
+  double loss() {
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    return loss_rows_ == 0 ? 0 : loss_sum_ / loss_rows_;
+  }
+
+  // the desired wall-clock seconds of one bucket, and the bucket size used
+  // before any solve cost measured
+  double bucket_seconds() const {
+    return bucket_seconds_;
+  }
+
+  uint32_t init_bucket_size() const {
+    return init_bucket_size_;
+  }
+
+  void set_bucket(double bucket_seconds, uint32_t init_bucket_size) {
+    bucket_seconds_ = bucket_seconds;
+    init_bucket_size_ = init_bucket_size;
+  }
+
+  uint32_t bucket_size() const {
+    return bucket_size_;
+  }
+
+  // called by Scheduler at the beginning of each half epcho
+  void start_buckets(uint64_t bucket_number, uint32_t bucket_size) {
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    bucket_bits_.reset(bucket_number);
+    bucket_size_ = bucket_size;
+  }
+
+  // the measured solve seconds per row, 0 if not measured yet
+  double row_cost(bool iterate_user) {
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    return row_cost_[iterate_user ? 1 : 0];
+  }
+
+  void record_cost(bool iterate_user, uint64_t rows, double seconds) {
+    if (rows == 0 || seconds <= 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    double& cost = row_cost_[iterate_user ? 1 : 0];
+    const double sample = seconds / rows;
+    cost = cost == 0 ? sample : cost * 0.8 + sample * 0.2;
+  }
+
+  // let each bucket takes about bucket_seconds on one Labor, but every Labor
+  // should still get at least kLaborPrefetch buckets to keep busy
+  uint32_t tune_bucket_size(bool iterate_user,
+                            uint64_t nrows,
+                            uint64_t labors) {
+
+    uint64_t bucket_size = init_bucket_size_;
+
+    const double cost = row_cost(iterate_user);
+    if (cost > 0 && bucket_seconds_ > 0)
+      bucket_size = static_cast<uint64_t>(bucket_seconds_ / cost);
+
+    labors = std::max<uint64_t>(labors, 1);
+    bucket_size =
+      std::min<uint64_t>(bucket_size, nrows / (labors * kLaborPrefetch));
+
+    bucket_size = std::max<uint64_t>(bucket_size, kMinBucketSize);
+    bucket_size = std::min<uint64_t>(bucket_size, kMaxBucketSize);
+    return static_cast<uint32_t>(bucket_size);
+  }
+
+  // user rating matrix, also unknown as dataset. read only once loaded, so
+  // the tasks on the same dataset share it
+  std::shared_ptr<const std::vector<qmf::DatasetElem>> rating_ptr_;
+
+  uint64_t nratings() const {
+    return rating_ptr_ ? rating_ptr_->size() : 0;
+  }
 
   // epcho_id_ = 1, 3, 5, ... fix item, cal user
   // epcho_id_ = 2, 4, 6, ... fix user, cal item
@@ -73,20 +171,42 @@ struct BigData {
   std::shared_ptr<qmf::Matrix> YtY_ptr_;
 
   // used in scheduler
-  bucket_bits_type bucket_bits_;
+  BucketBits bucket_bits_;
+
+  // the results are received by multiple threads concurrently, and the late
+  // results of the previous epcho should not touch the new bits
+  // the loss is accumulated only once even if the bucket solved repeatedly
+  bool mark_bucket(uint32_t epchoid,
+                   uint32_t bucket,
+                   double loss,
+                   uint64_t rows) {
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    if (epchoid != epchoid_ || !bucket_bits_.set(bucket))
+      return false;
+
+    loss_sum_ += loss;
+    loss_rows_ += rows;
+    return true;
+  }
 
   // reset actin for new task
   // called by Scheduler
-  void start_term(uint32_t nfactors, double lambda, double confidence) {
+  void start_term(uint32_t taskid,
+                  uint32_t nfactors,
+                  double lambda,
+                  double confidence) {
 
-    ++taskid_;
+    taskid_ = taskid;
 
     epchoid_ = 0;
     nfactors_ = nfactors;
     lambda_ = lambda;
     confidence_ = confidence;
 
-    bucket_bits_.reset();
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    bucket_bits_.reset(0);
+    bucket_size_ = 0;
+    row_cost_[0] = row_cost_[1] = 0;
   }
 
   // called by Labor, update local info
@@ -106,7 +226,21 @@ struct BigData {
   uint32_t nfactors_;
   double lambda_;     // regulation lambda
   double confidence_; // confidence weight
-  
+
+  std::mutex bucket_mutex_;
+
+  double bucket_seconds_ = 0;
+  uint32_t init_bucket_size_ = kDefaultBucketSize;
+  uint32_t bucket_size_ = 0;
+  double row_cost_[2] = {0, 0}; // [item, user]
+
+  // the summed loss and rows of the finished buckets
+  double loss_sum_ = 0;
+  uint64_t loss_rows_ = 0;
+
+  uint8_t rating_encoding_ = 0;
+  uint8_t factor_encoding_ = 0;
+
 };
 
 } // end namespace distributed
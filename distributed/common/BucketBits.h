@@ -0,0 +1,82 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_COMMON_BUCKET_BITS_H__
+#define __DISTRIBUTED_COMMON_BUCKET_BITS_H__
+
+/**
+ * The finished flags of the buckets in one half epcho, sized when the bucket
+ * number is decided. The count is kept incrementally, so checking the
+ * progress is O(1) for millions of buckets.
+ *
+ * The words are atomic, so test() and count() are safe against a concurrent
+ * set(). reset() must not race with any other call.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace distributed {
+
+class BucketBits {
+
+ public:
+  BucketBits() : nbits_(0), count_(0) {
+  }
+
+  // clear all, and resize to nbits
+  void reset(std::size_t nbits) {
+    const std::size_t nwords = (nbits + 63) / 64;
+    words_.reset(nwords == 0 ? nullptr : new std::atomic<uint64_t>[nwords]);
+    for (std::size_t i = 0; i < nwords; ++i)
+      words_[i].store(0, std::memory_order_relaxed);
+    nbits_ = nbits;
+    count_ = 0;
+  }
+
+  std::size_t size() const {
+    return nbits_;
+  }
+
+  std::size_t count() const {
+    return count_;
+  }
+
+  bool all() const {
+    return count_ == nbits_;
+  }
+
+  bool test(std::size_t pos) const {
+    if (pos >= nbits_)
+      return false;
+    return words_[pos / 64].load() & (1ULL << (pos % 64));
+  }
+
+  // return true when pos newly set
+  bool set(std::size_t pos) {
+    if (pos >= nbits_)
+      return false;
+
+    const uint64_t mask = 1ULL << (pos % 64);
+    if (words_[pos / 64].fetch_or(mask) & mask)
+      return false;
+
+    ++count_;
+    return true;
+  }
+
+ private:
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+  std::size_t nbits_;
+  std::atomic<std::size_t> count_;
+};
+
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_COMMON_BUCKET_BITS_H__
@@ -0,0 +1,704 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <distributed/common/Codec.h>
+
+#include <glog/logging.h>
+
+namespace distributed {
+
+namespace {
+
+inline void put_varint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+inline bool get_varint(const char*& ptr, const char* end, uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift <= 63 && ptr < end; shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(*ptr++);
+    result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline uint16_t to_bfloat16(float value) {
+  uint32_t bits = 0;
+  ::memcpy(&bits, &value, sizeof(bits));
+  bits += 0x7FFF + ((bits >> 16) & 1);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float from_bfloat16(uint16_t value) {
+  const uint32_t bits = static_cast<uint32_t>(value) << 16;
+  float result = 0;
+  ::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// bytes of one encoded factor row, 0 for unknown encoding
+size_t factor_row_bytes(Encoding elem, uint32_t ncols) {
+  switch (elem) {
+  case Encoding::kRaw:
+    return ncols * sizeof(qmf::Double);
+  case Encoding::kFloat32:
+    return ncols * sizeof(float);
+  case Encoding::kBFloat16:
+    return ncols * sizeof(uint16_t);
+  case Encoding::kInt8:
+    return sizeof(float) + ncols;
+  default:
+    return 0;
+  }
+}
+
+// the integral rating value (the common case) are stored as varint, or else
+// as the raw double, the lowest bit distinguish them
+const double kMaxVarintValue = static_cast<double>(1LL << 40);
+
+} // end namespace
+
+void Codec::encode_factor_rows(Encoding elem,
+                               const qmf::Double* data,
+                               uint32_t rows,
+                               uint32_t ncols,
+                               std::string* out) {
+
+  const size_t offset = out->size();
+  out->resize(offset + factor_row_bytes(elem, ncols) * rows);
+  char* ptr = &(*out)[offset];
+
+  const uint64_t count = static_cast<uint64_t>(rows) * ncols;
+  switch (elem) {
+
+  case Encoding::kRaw:
+    ::memcpy(ptr, data, count * sizeof(qmf::Double));
+    break;
+
+  case Encoding::kFloat32:
+    for (uint64_t i = 0; i < count; ++i) {
+      const float value = static_cast<float>(data[i]);
+      ::memcpy(ptr + i * sizeof(float), &value, sizeof(float));
+    }
+    break;
+
+  case Encoding::kBFloat16:
+    for (uint64_t i = 0; i < count; ++i) {
+      const uint16_t value = to_bfloat16(static_cast<float>(data[i]));
+      ::memcpy(ptr + i * sizeof(uint16_t), &value, sizeof(uint16_t));
+    }
+    break;
+
+  case Encoding::kInt8:
+    for (uint32_t r = 0; r < rows; ++r) {
+      const qmf::Double* row = data + static_cast<uint64_t>(r) * ncols;
+      qmf::Double maxabs = 0;
+      for (uint32_t c = 0; c < ncols; ++c) {
+        maxabs = std::max(maxabs, std::fabs(row[c]));
+      }
+
+      const float scale = static_cast<float>(maxabs / 127.0);
+      ::memcpy(ptr, &scale, sizeof(float));
+      ptr += sizeof(float);
+
+      for (uint32_t c = 0; c < ncols; ++c) {
+        const long q = scale > 0 ? std::lround(row[c] / scale) : 0;
+        *ptr++ = static_cast<char>(std::max(-127L, std::min(127L, q)));
+      }
+    }
+    break;
+
+  default:
+    LOG(FATAL) << "invalid factor encoding " << static_cast<int>(elem);
+    break;
+  }
+}
+
+bool Codec::decode_factor_rows(Encoding elem,
+                               const char* src,
+                               size_t len,
+                               uint32_t rows,
+                               uint32_t ncols,
+                               qmf::Double* dest) {
+
+  const size_t expect = factor_row_bytes(elem, ncols) * rows;
+  if (expect == 0 || len != expect) {
+    LOG(ERROR) << "factor chunk size mismatch, expect " << expect << ", but get "
+               << len;
+    return false;
+  }
+
+  const uint64_t count = static_cast<uint64_t>(rows) * ncols;
+  switch (elem) {
+
+  case Encoding::kRaw:
+    ::memcpy(dest, src, count * sizeof(qmf::Double));
+    break;
+
+  case Encoding::kFloat32:
+    for (uint64_t i = 0; i < count; ++i) {
+      float value = 0;
+      ::memcpy(&value, src + i * sizeof(float), sizeof(float));
+      dest[i] = value;
+    }
+    break;
+
+  case Encoding::kBFloat16:
+    for (uint64_t i = 0; i < count; ++i) {
+      uint16_t value = 0;
+      ::memcpy(&value, src + i * sizeof(uint16_t), sizeof(uint16_t));
+      dest[i] = from_bfloat16(value);
+    }
+    break;
+
+  case Encoding::kInt8:
+    for (uint32_t r = 0; r < rows; ++r) {
+      float scale = 0;
+      ::memcpy(&scale, src, sizeof(float));
+      src += sizeof(float);
+
+      qmf::Double* row = dest + static_cast<uint64_t>(r) * ncols;
+      for (uint32_t c = 0; c < ncols; ++c) {
+        row[c] = static_cast<qmf::Double>(static_cast<int8_t>(*src++)) * scale;
+      }
+    }
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+void Codec::seal_chunk(uint8_t encoding,
+                       uint32_t rows,
+                       const std::string& plain,
+                       std::string* out) {
+
+  ChunkHead head;
+  head.rows = rows;
+  head.plain = plain.size();
+
+  if (encoding & kEncodingLZ) {
+    out->resize(sizeof(ChunkHead) + lz_bound(plain.size()));
+    head.bytes =
+      lz_compress(plain.data(), plain.size(), &(*out)[sizeof(ChunkHead)]);
+    out->resize(sizeof(ChunkHead) + head.bytes);
+  } else {
+    head.bytes = plain.size();
+    out->resize(sizeof(ChunkHead));
+    out->append(plain);
+  }
+
+  ::memcpy(&(*out)[0], &head, sizeof(ChunkHead));
+}
+
+uint64_t Codec::factor_chunk_rows(uint32_t ncols) {
+  return std::max<uint64_t>(
+    1, kCodecChunkSize / (static_cast<uint64_t>(ncols) * sizeof(qmf::Double)));
+}
+
+uint64_t Codec::factor_chunks(uint64_t nrows, uint32_t ncols) {
+  const uint64_t chunk_rows = factor_chunk_rows(ncols);
+  return (nrows + chunk_rows - 1) / chunk_rows;
+}
+
+void Codec::encode_factors_chunk(uint8_t encoding,
+                                 const qmf::Double* data,
+                                 uint64_t nrows,
+                                 uint32_t ncols,
+                                 uint64_t index,
+                                 std::string* out) {
+
+  const Encoding elem = static_cast<Encoding>(encoding & kEncodingMask);
+  CHECK(is_factor_encoding(encoding))
+    << "invalid factor encoding " << static_cast<int>(encoding);
+  CHECK_NE(encoding, static_cast<uint8_t>(Encoding::kRaw))
+    << "plain kRaw factors are not chunked, send them as they are";
+
+  const uint64_t chunk_rows = factor_chunk_rows(ncols);
+  const uint64_t start = index * chunk_rows;
+  const uint32_t rows = std::min(chunk_rows, nrows - start);
+
+  std::string plain;
+  encode_factor_rows(elem, data + start * ncols, rows, ncols, &plain);
+  seal_chunk(encoding, rows, plain, out);
+}
+
+uint64_t Codec::encode_factors(uint8_t encoding,
+                               const qmf::Double* data,
+                               uint64_t nrows,
+                               uint32_t ncols,
+                               std::vector<std::string>* chunks) {
+
+  const int64_t nchunks = factor_chunks(nrows, ncols);
+  chunks->resize(nchunks);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t i = 0; i < nchunks; ++i) {
+    encode_factors_chunk(encoding, data, nrows, ncols, i, &(*chunks)[i]);
+  }
+
+  uint64_t total = 0;
+  for (const auto& chunk : *chunks) {
+    total += chunk.size();
+  }
+  return total;
+}
+
+uint64_t Codec::rating_chunks(uint64_t count) {
+  const uint64_t chunk_count =
+    std::max<uint64_t>(1, kCodecChunkSize / sizeof(qmf::DatasetElem));
+  return (count + chunk_count - 1) / chunk_count;
+}
+
+void Codec::encode_rating_chunk(uint8_t encoding,
+                                const qmf::DatasetElem* data,
+                                uint64_t count,
+                                uint64_t index,
+                                std::string* out) {
+
+  const Encoding elem = static_cast<Encoding>(encoding & kEncodingMask);
+  CHECK(is_rating_encoding(encoding))
+    << "invalid rating encoding " << static_cast<int>(encoding);
+  CHECK_NE(encoding, static_cast<uint8_t>(Encoding::kRaw))
+    << "plain kRaw rating are not chunked, send them as they are";
+
+  const uint64_t chunk_count =
+    std::max<uint64_t>(1, kCodecChunkSize / sizeof(qmf::DatasetElem));
+  const uint64_t start = index * chunk_count;
+  const uint32_t rows = std::min(chunk_count, count - start);
+
+  std::string plain;
+  if (elem == Encoding::kRaw) {
+    plain.assign(reinterpret_cast<const char*>(data + start),
+                 rows * sizeof(qmf::DatasetElem));
+  } else {
+
+    // each chunk starts from zero, so they can be decoded independently
+    plain.reserve(rows * 4);
+    int64_t prev_user = 0;
+    int64_t prev_item = 0;
+    for (uint64_t k = start; k < start + rows; ++k) {
+      const int64_t user = data[k].userId;
+      const int64_t item = data[k].itemId;
+      const double value = data[k].value;
+
+      put_varint(zigzag(user - prev_user), &plain);
+      if (user != prev_user)
+        prev_item = 0;
+      put_varint(zigzag(item - prev_item), &plain);
+      prev_user = user;
+      prev_item = item;
+
+      if (std::fabs(value) < kMaxVarintValue &&
+          value == static_cast<double>(static_cast<int64_t>(value))) {
+        put_varint(zigzag(static_cast<int64_t>(value)) << 1, &plain);
+      } else {
+        put_varint(1, &plain);
+        plain.append(reinterpret_cast<const char*>(&value), sizeof(value));
+      }
+    }
+  }
+
+  seal_chunk(encoding, rows, plain, out);
+}
+
+uint64_t Codec::encode_rating(uint8_t encoding,
+                              const qmf::DatasetElem* data,
+                              uint64_t count,
+                              std::vector<std::string>* chunks) {
+
+  const int64_t nchunks = rating_chunks(count);
+  chunks->resize(nchunks);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t i = 0; i < nchunks; ++i) {
+    encode_rating_chunk(encoding, data, count, i, &(*chunks)[i]);
+  }
+
+  uint64_t total = 0;
+  for (const auto& chunk : *chunks) {
+    total += chunk.size();
+  }
+  return total;
+}
+
+bool Codec::decode_factors_chunk(uint8_t encoding,
+                                 const ChunkHead& head,
+                                 const char* body,
+                                 qmf::Double* dest,
+                                 uint32_t ncols,
+                                 std::string* scratch) {
+
+  const Encoding elem = static_cast<Encoding>(encoding & kEncodingMask);
+
+  const char* plain = body;
+  if (encoding & kEncodingLZ) {
+    scratch->resize(head.plain);
+    if (!lz_decompress(body, head.bytes, &(*scratch)[0], head.plain)) {
+      LOG(ERROR) << "decompress factors chunk failed.";
+      return false;
+    }
+    plain = scratch->data();
+  } else if (head.plain != head.bytes) {
+    LOG(ERROR) << "chunk plain " << head.plain << " but bytes " << head.bytes;
+    return false;
+  }
+
+  return decode_factor_rows(elem, plain, head.plain, head.rows, ncols, dest);
+}
+
+bool Codec::decode_rating_chunk(uint8_t encoding,
+                                const ChunkHead& head,
+                                const char* body,
+                                qmf::DatasetElem* dest,
+                                std::string* scratch) {
+
+  const Encoding elem = static_cast<Encoding>(encoding & kEncodingMask);
+
+  const char* plain = body;
+  if (encoding & kEncodingLZ) {
+    scratch->resize(head.plain);
+    if (!lz_decompress(body, head.bytes, &(*scratch)[0], head.plain)) {
+      LOG(ERROR) << "decompress rating chunk failed.";
+      return false;
+    }
+    plain = scratch->data();
+  } else if (head.plain != head.bytes) {
+    LOG(ERROR) << "chunk plain " << head.plain << " but bytes " << head.bytes;
+    return false;
+  }
+
+  if (elem == Encoding::kRaw) {
+    if (head.plain != head.rows * sizeof(qmf::DatasetElem)) {
+      LOG(ERROR) << "rating chunk size mismatch: " << head.plain;
+      return false;
+    }
+    ::memcpy(dest, plain, head.plain);
+    return true;
+  }
+
+  if (elem != Encoding::kVarint) {
+    LOG(ERROR) << "invalid rating encoding " << static_cast<int>(encoding);
+    return false;
+  }
+
+  const char* ptr = plain;
+  const char* end = plain + head.plain;
+  int64_t prev_user = 0;
+  int64_t prev_item = 0;
+  for (uint32_t k = 0; k < head.rows; ++k) {
+
+    uint64_t user = 0;
+    uint64_t item = 0;
+    uint64_t value = 0;
+    if (!get_varint(ptr, end, &user) || !get_varint(ptr, end, &item) ||
+        !get_varint(ptr, end, &value)) {
+      LOG(ERROR) << "truncated rating chunk at element " << k;
+      return false;
+    }
+
+    const int64_t user_id = prev_user + unzigzag(user);
+    if (user_id != prev_user)
+      prev_item = 0;
+    const int64_t item_id = prev_item + unzigzag(item);
+    prev_user = user_id;
+    prev_item = item_id;
+
+    dest[k].userId = user_id;
+    dest[k].itemId = item_id;
+    if (value & 1) {
+      if (end - ptr < static_cast<ptrdiff_t>(sizeof(double))) {
+        LOG(ERROR) << "truncated rating value at element " << k;
+        return false;
+      }
+      double raw = 0;
+      ::memcpy(&raw, ptr, sizeof(raw));
+      ptr += sizeof(raw);
+      dest[k].value = raw;
+    } else {
+      dest[k].value = static_cast<qmf::Double>(unzigzag(value >> 1));
+    }
+  }
+
+  return ptr == end;
+}
+
+bool Codec::decode_factors(uint8_t encoding,
+                           const char* data,
+                           uint64_t len,
+                           qmf::Double* dest,
+                           uint64_t nrows,
+                           uint32_t ncols) {
+
+  if (encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+    if (len != nrows * ncols * sizeof(qmf::Double)) {
+      LOG(ERROR) << "length check failed, expect "
+                 << nrows * ncols * sizeof(qmf::Double) << ", but get " << len;
+      return false;
+    }
+    ::memcpy(dest, data, len);
+    return true;
+  }
+
+  std::string scratch;
+  uint64_t offset = 0;
+  uint64_t rows = 0;
+  while (offset < len) {
+
+    ChunkHead head;
+    if (len - offset < sizeof(ChunkHead)) {
+      LOG(ERROR) << "truncated chunk head at " << offset;
+      return false;
+    }
+    ::memcpy(&head, data + offset, sizeof(ChunkHead));
+    offset += sizeof(ChunkHead);
+
+    if (head.bytes > len - offset || rows + head.rows > nrows) {
+      LOG(ERROR) << "chunk overflow, rows " << rows + head.rows << " of "
+                 << nrows;
+      return false;
+    }
+
+    if (!decode_factors_chunk(encoding, head, data + offset, dest + rows * ncols,
+                              ncols, &scratch)) {
+      return false;
+    }
+
+    offset += head.bytes;
+    rows += head.rows;
+  }
+
+  if (rows != nrows) {
+    LOG(ERROR) << "decoded rows " << rows << ", but expect " << nrows;
+    return false;
+  }
+
+  return true;
+}
+
+bool Codec::factor_rows(uint8_t encoding,
+                        const char* data,
+                        uint64_t len,
+                        uint32_t ncols,
+                        uint64_t* nrows) {
+
+  const uint64_t row_bytes = ncols * sizeof(qmf::Double);
+  if (encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+    if (row_bytes == 0 || len % row_bytes != 0)
+      return false;
+    *nrows = len / row_bytes;
+    return true;
+  }
+
+  *nrows = 0;
+  uint64_t offset = 0;
+  while (offset < len) {
+    ChunkHead head;
+    if (len - offset < sizeof(ChunkHead))
+      return false;
+    ::memcpy(&head, data + offset, sizeof(ChunkHead));
+    offset += sizeof(ChunkHead) + head.bytes;
+    *nrows += head.rows;
+  }
+
+  return offset == len;
+}
+
+namespace {
+
+const int kLZHashLog = 16;
+const size_t kLZMinMatch = 4;
+const size_t kLZLastLiterals = 5;
+const size_t kLZMatchFindLimit = 12;
+const size_t kLZMaxOffset = 65535;
+
+inline uint32_t read32(const char* ptr) {
+  uint32_t value = 0;
+  ::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+inline uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - kLZHashLog);
+}
+
+inline void put_length(size_t len, char*& op) {
+  while (len >= 255) {
+    *op++ = static_cast<char>(255);
+    len -= 255;
+  }
+  *op++ = static_cast<char>(len);
+}
+
+inline bool get_length(const char*& ip, const char* end, size_t* len) {
+  uint8_t byte = 0;
+  do {
+    if (ip >= end)
+      return false;
+    byte = static_cast<uint8_t>(*ip++);
+    *len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// emit one sequence: literals [anchor, anchor + literals) and the match
+char* emit_sequence(const char* anchor,
+                    size_t literals,
+                    size_t offset,
+                    size_t match,
+                    char* op) {
+
+  char* token = op++;
+  const size_t match_code = match - kLZMinMatch;
+  *token = static_cast<char>((std::min<size_t>(literals, 15) << 4) |
+                             std::min<size_t>(match_code, 15));
+  if (literals >= 15)
+    put_length(literals - 15, op);
+
+  ::memcpy(op, anchor, literals);
+  op += literals;
+
+  *op++ = static_cast<char>(offset & 0xFF);
+  *op++ = static_cast<char>(offset >> 8);
+
+  if (match_code >= 15)
+    put_length(match_code - 15, op);
+  return op;
+}
+
+} // end namespace
+
+size_t Codec::lz_compress(const char* src, size_t len, char* dst) {
+
+  char* op = dst;
+  const char* anchor = src;
+
+  if (len > kLZMatchFindLimit) {
+
+    std::vector<int64_t> table(1 << kLZHashLog, -1);
+    const char* ip = src;
+    const char* match_limit = src + len - kLZMatchFindLimit;
+    const char* end_limit = src + len - kLZLastLiterals;
+
+    while (ip < match_limit) {
+
+      const uint32_t sequence = read32(ip);
+      const uint32_t h = lz_hash(sequence);
+      const int64_t ref = table[h];
+      table[h] = ip - src;
+
+      if (ref < 0 || static_cast<size_t>(ip - src - ref) > kLZMaxOffset ||
+          read32(src + ref) != sequence) {
+
+        // skip faster when the data is not compressible
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      const char* match = src + ref;
+      size_t length = kLZMinMatch;
+      while (ip + length < end_limit && match[length] == ip[length]) {
+        ++length;
+      }
+
+      op = emit_sequence(anchor, ip - anchor, ip - match, length, op);
+      ip += length;
+      anchor = ip;
+    }
+  }
+
+  // the last literals
+  const size_t literals = src + len - anchor;
+  *op++ = static_cast<char>(std::min<size_t>(literals, 15) << 4);
+  if (literals >= 15)
+    put_length(literals - 15, op);
+  ::memcpy(op, anchor, literals);
+  op += literals;
+
+  return op - dst;
+}
+
+bool Codec::lz_decompress(const char* src,
+                          size_t len,
+                          char* dst,
+                          size_t dst_len) {
+
+  const char* ip = src;
+  const char* end = src + len;
+  char* op = dst;
+  char* op_end = dst + dst_len;
+
+  while (ip < end) {
+
+    const uint8_t token = static_cast<uint8_t>(*ip++);
+
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(ip, end, &literals))
+      return false;
+    if (literals > static_cast<size_t>(end - ip) ||
+        literals > static_cast<size_t>(op_end - op))
+      return false;
+
+    ::memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+
+    // the last sequence has no match part
+    if (ip == end)
+      break;
+
+    if (end - ip < 2)
+      return false;
+    const size_t offset = static_cast<uint8_t>(ip[0]) |
+                          (static_cast<size_t>(static_cast<uint8_t>(ip[1])) << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst))
+      return false;
+
+    size_t match = token & 0x0F;
+    if (match == 15 && !get_length(ip, end, &match))
+      return false;
+    match += kLZMinMatch;
+    if (match > static_cast<size_t>(op_end - op))
+      return false;
+
+    // the match may overlap with the output, copy byte by byte
+    const char* ref = op - offset;
+    for (size_t i = 0; i < match; ++i) {
+      op[i] = ref[i];
+    }
+    op += match;
+  }
+
+  return op == op_end;
+}
+
+} // end namespace distributed
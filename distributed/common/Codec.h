@@ -0,0 +1,215 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_COMMON_CODEC_H__
+#define __DISTRIBUTED_COMMON_CODEC_H__
+
+/**
+ * Payload encoding for the bulk messages (kPushRate, kPushFixed, kCalcRsp).
+ *
+ * The encoded payload is a sequence of independent chunks, each one starts
+ * with a ChunkHead, so the sender can encode them in parallel and the receiver
+ * can decode each chunk as soon as it arrived.
+ *
+ * On the wire the payload is streamed: the Head.length is kStreamLength and
+ * the chunks are followed by an empty ChunkHead, so the sender can send each
+ * chunk once encoded, without knowing the total length.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/Types.h>
+
+namespace distributed {
+
+enum class Encoding : uint8_t {
+
+  // packed DatasetElem or Double, not chunked
+  kRaw = 0,
+
+  // rating: delta + zigzag varint user/item ids
+  kVarint = 1,
+
+  // factors: each value narrowed to float
+  kFloat32 = 2,
+
+  // factors: the high 16 bits of float, round to nearest even
+  kBFloat16 = 3,
+
+  // factors: int8 quantized, with float scale for each row
+  kInt8 = 4,
+};
+
+// the low bits select the element encoding
+const uint8_t kEncodingMask = 0x0F;
+
+// flag: each chunk further compressed by the LZ4 style block compressor
+const uint8_t kEncodingLZ = 0x80;
+
+// the raw size each chunk covers
+const size_t kCodecChunkSize = 1 << 20; // 1M
+
+struct ChunkHead {
+  uint32_t rows;  // elements (rating) or rows (factors) in this chunk
+  uint32_t plain; // bytes after the element encoding, before LZ
+  uint32_t bytes; // bytes following this ChunkHead
+
+  // the end of the streamed payload
+  bool is_end() const {
+    return rows == 0 && bytes == 0;
+  }
+} __attribute__((aligned(1), __packed__));
+
+class Codec {
+
+ public:
+  // announced by the Labor in kAttachLabor
+  static uint8_t supported_mask() {
+    return (1 << static_cast<uint8_t>(Encoding::kRaw)) |
+           (1 << static_cast<uint8_t>(Encoding::kVarint)) |
+           (1 << static_cast<uint8_t>(Encoding::kFloat32)) |
+           (1 << static_cast<uint8_t>(Encoding::kBFloat16)) |
+           (1 << static_cast<uint8_t>(Encoding::kInt8)) | kEncodingLZ;
+  }
+
+  // the encoding can be used with the peer, else fallback to kRaw
+  static uint8_t negotiate(uint8_t encoding, uint8_t peer_mask) {
+    const uint8_t elem = encoding & kEncodingMask;
+    if (elem >= 7 || !(peer_mask & (1 << elem)))
+      return 0;
+    if ((encoding & kEncodingLZ) && !(peer_mask & kEncodingLZ))
+      return elem;
+    return encoding;
+  }
+
+  static bool is_factor_encoding(uint8_t encoding) {
+    switch (static_cast<Encoding>(encoding & kEncodingMask)) {
+    case Encoding::kRaw:
+    case Encoding::kFloat32:
+    case Encoding::kBFloat16:
+    case Encoding::kInt8:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  static bool is_rating_encoding(uint8_t encoding) {
+    switch (static_cast<Encoding>(encoding & kEncodingMask)) {
+    case Encoding::kRaw:
+    case Encoding::kVarint:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // encode the nrows * ncols factors into chunks, each chunk begins with its
+  // ChunkHead. return the total bytes of all chunks. the plain kRaw payload is
+  // the packed values without any ChunkHead, as decode_factors expects, so it
+  // is rejected here.
+  static uint64_t encode_factors(uint8_t encoding,
+                                 const qmf::Double* data,
+                                 uint64_t nrows,
+                                 uint32_t ncols,
+                                 std::vector<std::string>* chunks);
+
+  static uint64_t encode_rating(uint8_t encoding,
+                                const qmf::DatasetElem* data,
+                                uint64_t count,
+                                std::vector<std::string>* chunks);
+
+  // the chunks of the factors, and encode the index-th of them to out with
+  // its ChunkHead. the chunks can be encoded in any order.
+  static uint64_t factor_chunks(uint64_t nrows, uint32_t ncols);
+
+  static void encode_factors_chunk(uint8_t encoding,
+                                   const qmf::Double* data,
+                                   uint64_t nrows,
+                                   uint32_t ncols,
+                                   uint64_t index,
+                                   std::string* out);
+
+  static uint64_t rating_chunks(uint64_t count);
+
+  static void encode_rating_chunk(uint8_t encoding,
+                                  const qmf::DatasetElem* data,
+                                  uint64_t count,
+                                  uint64_t index,
+                                  std::string* out);
+
+  // decode one chunk body (not include ChunkHead) to dest, which should have
+  // space for head.rows rows. scratch is used for the LZ decompress.
+  static bool decode_factors_chunk(uint8_t encoding,
+                                   const ChunkHead& head,
+                                   const char* body,
+                                   qmf::Double* dest,
+                                   uint32_t ncols,
+                                   std::string* scratch);
+
+  static bool decode_rating_chunk(uint8_t encoding,
+                                  const ChunkHead& head,
+                                  const char* body,
+                                  qmf::DatasetElem* dest,
+                                  std::string* scratch);
+
+  // decode the whole encoded payload already in memory, the decoded rows
+  // should be exactly nrows
+  static bool decode_factors(uint8_t encoding,
+                             const char* data,
+                             uint64_t len,
+                             qmf::Double* dest,
+                             uint64_t nrows,
+                             uint32_t ncols);
+
+  // the rows carried by the encoded payload, without decode it
+  static bool factor_rows(uint8_t encoding,
+                          const char* data,
+                          uint64_t len,
+                          uint32_t ncols,
+                          uint64_t* nrows);
+
+  // LZ4 block format compatible compressor, dst should have at least
+  // lz_bound(len) space. return the compressed size.
+  static size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+  }
+
+  static size_t lz_compress(const char* src, size_t len, char* dst);
+
+  static bool
+    lz_decompress(const char* src, size_t len, char* dst, size_t dst_len);
+
+ private:
+  static uint64_t factor_chunk_rows(uint32_t ncols);
+
+  static void encode_factor_rows(Encoding elem,
+                                 const qmf::Double* data,
+                                 uint32_t rows,
+                                 uint32_t ncols,
+                                 std::string* out);
+
+  static bool decode_factor_rows(Encoding elem,
+                                 const char* src,
+                                 size_t len,
+                                 uint32_t rows,
+                                 uint32_t ncols,
+                                 qmf::Double* dest);
+
+  // append ChunkHead and the optional LZ compressed plain to out
+  static void seal_chunk(uint8_t encoding,
+                         uint32_t rows,
+                         const std::string& plain,
+                         std::string* out);
+};
+
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_COMMON_CODEC_H__
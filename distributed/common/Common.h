@@ -13,12 +13,57 @@
 namespace distributed {
 
 // all Labors share the same dataset with Scheduler, so we just need to pass the
-// calculate segment index, the Labor inference the actual range
-const size_t kBucketSize = 10000;
-const size_t kBucketBits = 10000; // support maxium 100m users/items
+// calculate segment index and size, the Labor inference the actual range.
+// the bucket size is tuned each half epcho by the measured solve cost.
+const uint32_t kDefaultBucketSize = 10000;
+const uint32_t kMinBucketSize = 256;
+const uint32_t kMaxBucketSize = 1 << 20;
 
 const size_t kTrivalMsgSize = 128;
 
+// the Labor sends back the bucket result every these rows solved, so the
+// network transfer overlaps with the remaining solve
+const size_t kCalcStreamRows = 1024;
+
+// the buckets dispatched to one Labor at the same time, the Labor receives the
+// next bucket while solving the current one
+const size_t kLaborPrefetch = 2;
+
+// the Scheduler threads receiving the kCalcRsp results
+const size_t kRecvThreads = 8;
+
+// the Scheduler threads pushing the rating and fixed factors to the late
+// joined or stale Labors, apart from the receive threads
+const size_t kPushThreads = 2;
+
+// bulk payload larger than this will try MSG_ZEROCOPY, for small payload the
+// page pinning and notification cost more than the copy itself
+const size_t kZeroCopyThreshold = 16 << 20; // 16M
+
+// the maxium bytes for one transfer syscall
+const size_t kTransferChunkSize = 64 << 20; // 64M
+
+// the Codec chunks encoded in parallel as one batch when streaming a payload,
+// and the encoded batches buffered ahead of the socket
+const size_t kStreamBatchChunks = 16;
+const size_t kStreamQueueBatches = 2;
+
+// the buffer size used when drop the unwanted message body
+const size_t kDropBuffSize = 1 << 20; // 1M
+
+// the tasks run concurrently in the Scheduler, sharing all the Labors
+const size_t kRunningTasks = 4;
+
+// the tasks data kept in the Labor, the older ones will be evicted. the
+// finished tasks are kept for the following tasks on the same train_set.
+const size_t kLaborTasks = kRunningTasks + 2;
+
+// the test users evaluated by one kEval
+const uint32_t kEvalBucketUsers = 1000;
+
+// the kEval not responsed in this seconds is dispatched again
+const time_t kEvalTimeout = 60;
+
 // force to send kHeartBeat
 const time_t kHeartBeatInternal = 30;
 
@@ -35,7 +35,7 @@
 namespace distributed {
 
 const static uint16_t kHeaderMagic = 0x4D46; // 'M' 'F'
-const static uint8_t kHeaderVersion = 0x01;
+const static uint8_t kHeaderVersion = 0x07;
 
 enum class OpCode : uint8_t {
 
@@ -55,7 +55,8 @@ enum class OpCode : uint8_t {
   kPushFixed = 7,
   kPushFixedRsp = 8,
 
-  // do the calculate task
+  // do the calculate task, the body is "CA", or the directory the Labor
+  // writes the solved rows as a shard file when the result is sharded
   kCalc = 9,
   kCalcRsp = 10,
 
@@ -66,15 +67,85 @@ enum class OpCode : uint8_t {
   // Scheduler with its local info
   kInfoRsp = 12,
 
+  // Scheduler push the test ratings of the sampled test users, right after
+  // the kPushRate of the task
+  kPushTest = 13,
+  kPushTestRsp = 14,
+
+  // evaluate the test users of the bucket, the body is the comma separated
+  // metrics. the response body is the packed doubles of the users count and
+  // the summed metrics, or "NONE" when the Labor can't evaluate
+  kEval = 15,
+  kEvalRsp = 16,
+
+  // instead of kPushRate, the Labor reuses the rating and index of another
+  // task on the same dataset, the body is that taskid. responsed with
+  // kPushRateRsp
+  kReuseRate = 17,
+
   kUnspecified = 100,
 };
 
+// the largest opcode sent on the wire
+const static uint8_t kMaxOpCode = static_cast<uint8_t>(OpCode::kReuseRate);
+
+// the snake case name of the opcode, for the logs and the instrumentation
+inline const char* opcode_name(uint8_t opcode) {
+  switch (opcode) {
+  case static_cast<uint8_t>(OpCode::kSubmitTask):
+    return "submit_task";
+  case static_cast<uint8_t>(OpCode::kSubmitTaskRsp):
+    return "submit_task_rsp";
+  case static_cast<uint8_t>(OpCode::kAttachLabor):
+    return "attach_labor";
+  case static_cast<uint8_t>(OpCode::kAttachLaborRsp):
+    return "attach_labor_rsp";
+  case static_cast<uint8_t>(OpCode::kPushRate):
+    return "push_rate";
+  case static_cast<uint8_t>(OpCode::kPushRateRsp):
+    return "push_rate_rsp";
+  case static_cast<uint8_t>(OpCode::kPushFixed):
+    return "push_fixed";
+  case static_cast<uint8_t>(OpCode::kPushFixedRsp):
+    return "push_fixed_rsp";
+  case static_cast<uint8_t>(OpCode::kCalc):
+    return "calc";
+  case static_cast<uint8_t>(OpCode::kCalcRsp):
+    return "calc_rsp";
+  case static_cast<uint8_t>(OpCode::kHeartBeat):
+    return "heart_beat";
+  case static_cast<uint8_t>(OpCode::kInfoRsp):
+    return "info_rsp";
+  case static_cast<uint8_t>(OpCode::kPushTest):
+    return "push_test";
+  case static_cast<uint8_t>(OpCode::kPushTestRsp):
+    return "push_test_rsp";
+  case static_cast<uint8_t>(OpCode::kEval):
+    return "eval";
+  case static_cast<uint8_t>(OpCode::kEvalRsp):
+    return "eval_rsp";
+  case static_cast<uint8_t>(OpCode::kReuseRate):
+    return "reuse_rate";
+  default:
+    return "unknown";
+  }
+}
+
+// the Head.length of the Codec encoded payload, which is streamed chunk by
+// chunk and ended by an empty ChunkHead, see Codec.h
+const static uint64_t kStreamLength = UINT64_MAX;
+
 struct Head {
 
   Head()
     : magic(kHeaderMagic),
       version(kHeaderVersion),
       opcode(static_cast<uint8_t>(OpCode::kUnspecified)),
+      encoding(0),
+      offset(0),
+      bucket_size(0),
+      cost(0),
+      loss(0),
       length(0) {
   }
 
@@ -82,6 +153,11 @@ struct Head {
     : magic(kHeaderMagic),
       version(kHeaderVersion),
       opcode(static_cast<uint8_t>(code)),
+      encoding(0),
+      offset(0),
+      bucket_size(0),
+      cost(0),
+      loss(0),
       length(0) {
   }
 
@@ -89,6 +165,10 @@ struct Head {
   uint8_t version;  // 1
   uint8_t opcode;   // indicate current message type
 
+  // payload encoding, see Codec.h. 0 means the raw packed payload.
+  // for kAttachLabor, it is the bitmask of the encodings the labor supported.
+  uint8_t encoding;
+
   uint32_t taskid;  // 
   uint32_t epchoid; // 
 
@@ -98,21 +178,29 @@ struct Head {
   // ! the same architecture is possible
 
   uint32_t nfactors;
-  uint32_t bucket;  // the bucket index number splitted
+  // the bucket index number splitted. for kInfoRsp, the Labor's unfinished
+  // bucket count.
+  uint32_t bucket;
+  uint32_t offset;  // the first row inside the bucket, for streamed kCalcRsp
+  uint32_t bucket_size; // the rows of each bucket in this half epcho
 
   double lambda;    // regulation lambda
   double confidence; // confidence weight
+  double cost;      // the Labor's solve seconds of the kCalcRsp rows
+  double loss;      // the bucket's summed loss, in the last kCalcRsp piece
 
-  uint64_t length;  // playload length ( NOT include header)
+  uint64_t length;  // playload length ( NOT include header), or kStreamLength
 
   std::string dump() const {
     char msg[256]{};
     ::snprintf(
       msg, sizeof(msg),
-      "magic:%0x, version:%0x, opcode:%0x, taskid:%0x, epchoid: %0x, nfactors: "
-      "%0x, bucket: %0x, lambda: %.2f confidence: %.2f len: %lu",
-      magic, version, opcode, taskid, epchoid, nfactors, bucket, lambda,
-      confidence, length);
+      "magic:%0x, version:%0x, opcode:%0x, encoding:%0x, taskid:%0x, "
+      "epchoid: %0x, nfactors: %0x, bucket: %0x, offset: %0x, "
+      "bucket_size: %u, lambda: %.2f confidence: %.2f cost: %.4f "
+      "loss: %.4f len: %lu",
+      magic, version, opcode, encoding, taskid, epchoid, nfactors, bucket,
+      offset, bucket_size, lambda, confidence, cost, loss, length);
     return msg;
   }
 
@@ -129,12 +217,17 @@ struct Head {
     magic = be16toh(magic);
     version = version;
     opcode = opcode;
+    encoding = encoding;
     taskid = be32toh(taskid);
     epchoid = be32toh(epchoid);
     nfactors = be32toh(nfactors);
     bucket = be32toh(bucket);
+    offset = be32toh(offset);
+    bucket_size = be32toh(bucket_size);
     lambda = lambda;
     confidence = confidence;
+    cost = cost;
+    loss = loss;
     length = be64toh(length);
   }
 
@@ -143,12 +236,17 @@ struct Head {
     magic = htobe16(magic);
     version = version;
     opcode = opcode;
+    encoding = encoding;
     taskid = htobe32(taskid);
     epchoid = htobe32(epchoid);
     nfactors = htobe32(nfactors);
     bucket = htobe32(bucket);
+    offset = htobe32(offset);
+    bucket_size = htobe32(bucket_size);
     lambda = lambda;
     confidence = confidence;
+    cost = cost;
+    loss = loss;
     length = htobe64(length);
   }
 
@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <distributed/common/MetricsServer.h>
+
+#include <glog/logging.h>
+
+namespace distributed {
+
+namespace {
+
+// the request line and headers we read at most, the scrapes are tiny
+const size_t kMaxRequestSize = 8192;
+
+// the poll timeout, bounds the stop latency and the slow clients
+const int kPollMsec = 200;
+const int kRequestMsec = 2000;
+
+const double kQuantiles[] = {0.5, 0.9, 0.99};
+
+// the rss from /proc/self/statm, 0 if not available
+double resident_bytes() {
+  FILE* fp = ::fopen("/proc/self/statm", "r");
+  if (!fp)
+    return 0;
+
+  unsigned long long size = 0;
+  unsigned long long resident = 0;
+  const int n = ::fscanf(fp, "%llu %llu", &size, &resident);
+  ::fclose(fp);
+  return n == 2 ? static_cast<double>(resident) * ::sysconf(_SC_PAGESIZE) : 0;
+}
+
+double cpu_seconds() {
+  struct rusage usage {};
+  if (::getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+bool send_all(int socketfd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t len =
+      ::send(socketfd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    sent += len;
+  }
+  return true;
+}
+
+std::string response(const char* status, const std::string& body) {
+  std::string rsp = std::string("HTTP/1.0 ") + status + "\r\n";
+  rsp += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+  rsp += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  rsp += "Connection: close\r\n\r\n";
+  rsp += body;
+  return rsp;
+}
+} // end namespace
+
+bool MetricsServer::start() {
+
+  int socketfd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (socketfd < 0) {
+    LOG(ERROR) << "create metrics socket error: " << ::strerror(errno);
+    return false;
+  }
+
+  bool success = false;
+  do {
+
+    int reuseaddr = 1;
+    if (::setsockopt(
+          socketfd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(int)) < 0) {
+      LOG(ERROR) << "reuse address failed: " << ::strerror(errno);
+      break;
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port_));
+    addr.sin_addr.s_addr = inet_addr(addr_.c_str());
+
+    if (::bind(socketfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      LOG(ERROR) << "bind metrics " << addr_ << ":" << port_
+                 << " error: " << ::strerror(errno);
+      break;
+    }
+
+    socklen_t len = sizeof(addr);
+    if (::getsockname(socketfd, (struct sockaddr*)&addr, &len) < 0) {
+      LOG(ERROR) << "getsockname error: " << ::strerror(errno);
+      break;
+    }
+    port_ = ntohs(addr.sin_port);
+
+    if (::listen(socketfd, 16) < 0) {
+      LOG(ERROR) << "listen metrics error: " << ::strerror(errno);
+      break;
+    }
+
+    success = true;
+
+  } while (0);
+
+  if (!success) {
+    ::close(socketfd);
+    return false;
+  }
+
+  listenfd_ = socketfd;
+  serve_thread_ = std::thread(&MetricsServer::serve_run, this);
+  LOG(INFO) << "metrics server listen on " << addr_ << ":" << port_;
+  return true;
+}
+
+void MetricsServer::stop() {
+
+  terminate_ = true;
+  if (serve_thread_.joinable())
+    serve_thread_.join();
+
+  if (listenfd_ >= 0) {
+    ::close(listenfd_);
+    listenfd_ = -1;
+  }
+}
+
+void MetricsServer::serve_run() {
+
+  while (!terminate_) {
+
+    struct pollfd pfd {};
+    pfd.fd = listenfd_;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, kPollMsec) <= 0)
+      continue;
+
+    int socketfd = ::accept(listenfd_, nullptr, nullptr);
+    if (socketfd < 0) {
+      if (errno != EINTR && errno != EAGAIN)
+        LOG(ERROR) << "accept metrics client error: " << ::strerror(errno);
+      continue;
+    }
+
+    serve(socketfd);
+    ::close(socketfd);
+  }
+}
+
+void MetricsServer::serve(int socketfd) const {
+
+  // read the request line and the headers, the body is ignored
+  std::string request;
+  char buff[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.find("\n\n") == std::string::npos &&
+         request.size() < kMaxRequestSize) {
+
+    struct pollfd pfd {};
+    pfd.fd = socketfd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, kRequestMsec) <= 0)
+      return;
+
+    ssize_t len = ::recv(socketfd, buff, sizeof(buff), 0);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return;
+    request.append(buff, len);
+  }
+
+  const std::string line = request.substr(0, request.find_first_of("\r\n"));
+  char method[16]{};
+  char path[256]{};
+  if (::sscanf(line.c_str(), "%15s %255s", method, path) != 2) {
+    send_all(socketfd, response("400 Bad Request", "bad request\n"));
+    return;
+  }
+
+  if (::strcmp(method, "GET") != 0) {
+    send_all(socketfd, response("405 Method Not Allowed", "only GET\n"));
+    return;
+  }
+
+  // the query string is ignored
+  std::string target(path);
+  target = target.substr(0, target.find('?'));
+  if (target != "/metrics") {
+    send_all(socketfd, response("404 Not Found", "try /metrics\n"));
+    return;
+  }
+
+  send_all(socketfd, response("200 OK", render()));
+}
+
+std::string MetricsServer::render() const {
+
+  const qmf::Instrumentation::Snapshot snapshot =
+    qmf::Instrumentation::get().snapshot();
+
+  std::string out;
+  append_header(&out, "process_resident_memory_bytes", "gauge",
+                "Resident memory size in bytes.");
+  append_sample(&out, "process_resident_memory_bytes", "", resident_bytes());
+  append_header(&out, "process_cpu_seconds_total", "counter",
+                "Total user and system CPU time spent in seconds.");
+  append_sample(&out, "process_cpu_seconds_total", "", cpu_seconds());
+
+  for (const auto& counter : snapshot.counters) {
+    const std::string name = metric_name(counter.first) + "_total";
+    append_header(&out, name, "counter", counter.first);
+    append_sample(&out, name, "", counter.second);
+  }
+
+  for (const auto& histogram : snapshot.histograms) {
+    const std::string name = metric_name(histogram.first) + "_seconds";
+    const auto& h = histogram.second;
+    append_header(&out, name, "summary", histogram.first);
+    for (double q : kQuantiles) {
+      char labels[32];
+      ::snprintf(labels, sizeof(labels), "quantile=\"%g\"", q);
+      append_sample(&out, name, labels, h.percentileSeconds(q));
+    }
+    append_sample(&out, name + "_sum", "", h.sumNanos / 1e9);
+    append_sample(&out, name + "_count", "", h.count);
+  }
+
+  if (collector_)
+    collector_(snapshot, &out);
+
+  return out;
+}
+
+std::string MetricsServer::metric_name(const std::string& name) {
+  std::string metric = "qmf_" + name;
+  for (size_t i = 4; i < metric.size(); ++i) {
+    const char c = metric[i];
+    if (!::isalnum(static_cast<unsigned char>(c)) && c != '_')
+      metric[i] = '_';
+  }
+  return metric;
+}
+
+void MetricsServer::append_header(std::string* out,
+                                  const std::string& name,
+                                  const char* type,
+                                  const std::string& help) {
+  out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void MetricsServer::append_sample(std::string* out,
+                                  const std::string& name,
+                                  const std::string& labels,
+                                  double value) {
+  // the counters are exact integers, the others keep 9 digits
+  char buff[64];
+  if (value == std::floor(value) && std::fabs(value) < 1e15)
+    ::snprintf(buff, sizeof(buff), " %.0f\n", value);
+  else
+    ::snprintf(buff, sizeof(buff), " %.9g\n", value);
+  out->append(name);
+  if (!labels.empty())
+    out->append("{").append(labels).append("}");
+  out->append(buff);
+}
+
+void MetricsServer::append_gauge(std::string* out,
+                                 const std::string& name,
+                                 const std::string& help,
+                                 double value) {
+  append_header(out, name, "gauge", help);
+  append_sample(out, name, "", value);
+}
+
+} // end namespace distributed
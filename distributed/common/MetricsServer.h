@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_COMMON_METRICS_SERVER_H__
+#define __DISTRIBUTED_COMMON_METRICS_SERVER_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <qmf/utils/Instrumentation.h>
+
+namespace distributed {
+
+// A minimal HTTP server answers "GET /metrics" in the Prometheus text
+// exposition format: the counters and histograms of the Instrumentation,
+// the RSS and CPU time of the process, and the gauges appended by the
+// collector. One thread serves the scrapes one by one, it never touches the
+// sockets of the Scheduler and Labors.
+class MetricsServer {
+
+ public:
+  using collector_type = std::function<void(
+    const qmf::Instrumentation::Snapshot& snapshot, std::string* out)>;
+
+  // port 0 binds an ephemeral port, see port()
+  MetricsServer(const std::string& addr,
+                int32_t port,
+                const collector_type& collector)
+    : addr_(addr), port_(port), collector_(collector) {
+  }
+
+  ~MetricsServer() {
+    stop();
+  }
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  bool start();
+  void stop();
+
+  // the bound port after start()
+  int32_t port() const {
+    return port_;
+  }
+
+  // the whole /metrics page
+  std::string render() const;
+
+  // "scheduler.handle.calc" -> "qmf_scheduler_handle_calc"
+  static std::string metric_name(const std::string& name);
+
+  // the "# HELP" and "# TYPE" lines, once before the samples of the metric
+  static void append_header(std::string* out,
+                            const std::string& name,
+                            const char* type,
+                            const std::string& help);
+  // labels is like "taskid=\"1\"", empty for none
+  static void append_sample(std::string* out,
+                            const std::string& name,
+                            const std::string& labels,
+                            double value);
+  static void append_gauge(std::string* out,
+                           const std::string& name,
+                           const std::string& help,
+                           double value);
+
+ private:
+  void serve_run();
+  void serve(int socketfd) const;
+
+  const std::string addr_;
+  int32_t port_;
+  const collector_type collector_;
+
+  int listenfd_ = -1;
+  std::atomic<bool> terminate_{false};
+  std::thread serve_thread_;
+};
+
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_COMMON_METRICS_SERVER_H__
@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_COMMON_NET_STATS_H__
+#define __DISTRIBUTED_COMMON_NET_STATS_H__
+
+#include <string>
+#include <vector>
+
+#include <distributed/common/Message.h>
+#include <qmf/utils/Instrumentation.h>
+
+namespace distributed {
+
+// the messages and bytes (head included) sent and received of each opcode,
+// counted with the head still in host endian. the unknown opcodes share the
+// "unknown" counters
+class NetStats {
+
+ public:
+  static void sent(const Head& head) {
+    sent_counters().add(head);
+  }
+
+  static void received(const Head& head) {
+    received_counters().add(head);
+  }
+
+  // the body of the streamed payload, counted after it is done since the
+  // Head does not carry its length
+  static void sent_stream(uint8_t opcode, uint64_t bytes) {
+    sent_counters().add_bytes(opcode, bytes);
+  }
+
+  static void received_stream(uint8_t opcode, uint64_t bytes) {
+    received_counters().add_bytes(opcode, bytes);
+  }
+
+ private:
+  struct Counters {
+
+    explicit Counters(const std::string& prefix) {
+      for (uint8_t op = 0; op <= kMaxOpCode; ++op) {
+        messages.emplace_back(prefix + "_messages." + opcode_name(op));
+        bytes.emplace_back(prefix + "_bytes." + opcode_name(op));
+      }
+    }
+
+    void add(const Head& head) const {
+      const uint8_t op = head.opcode <= kMaxOpCode ? head.opcode : 0;
+      messages[op].add();
+      bytes[op].add(kHeadSize +
+                    (head.length == kStreamLength ? 0 : head.length));
+    }
+
+    void add_bytes(uint8_t opcode, uint64_t body) const {
+      bytes[opcode <= kMaxOpCode ? opcode : 0].add(body);
+    }
+
+    std::vector<qmf::Counter> messages;
+    std::vector<qmf::Counter> bytes;
+  };
+
+  static const Counters& sent_counters() {
+    static const Counters counters("net.sent");
+    return counters;
+  }
+
+  static const Counters& received_counters() {
+    static const Counters counters("net.received");
+    return counters;
+  }
+};
+
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_COMMON_NET_STATS_H__
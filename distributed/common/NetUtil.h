@@ -10,6 +10,9 @@
 
 #include <sys/types.h> /* See NOTES */
 #include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
 
 #include <glog/logging.h>
 
@@ -53,6 +56,52 @@ class NetUtil {
 
     return;
   }
+
+  // Enable SO_ZEROCOPY, then the bulk payload can be sent with MSG_ZEROCOPY,
+  // old kernels do not support it, and SendOps will fallback to normal copy.
+  // The result is recorded for is_zerocopy.
+  static bool enable_zerocopy(int socketfd) {
+
+    bool enabled = false;
+#if defined(SO_ZEROCOPY)
+    int enable = 1;
+    if (::setsockopt(socketfd, SOL_SOCKET, SO_ZEROCOPY, &enable,
+                     sizeof(enable)) < 0) {
+      LOG(INFO) << "set SO_ZEROCOPY failed " << strerror(errno);
+    } else {
+      enabled = true;
+    }
+#endif
+
+    set_zerocopy(socketfd, enabled);
+    return enabled;
+  }
+
+  // whether enable_zerocopy succeeded on this socket, without a syscall
+  static bool is_zerocopy(int socketfd) {
+    return socketfd >= 0 && socketfd < kMaxZeroCopyFds &&
+           zerocopy_fds()[socketfd].load(std::memory_order_relaxed);
+  }
+
+  // close the socket and forget its zerocopy state, the fd may be reused
+  static void close_socket(int socketfd) {
+    set_zerocopy(socketfd, false);
+    ::close(socketfd);
+  }
+
+ private:
+  // the sockets with larger fds are never sent with zerocopy
+  static const int kMaxZeroCopyFds = 1 << 16;
+
+  static std::atomic<bool>* zerocopy_fds() {
+    static std::atomic<bool> fds[kMaxZeroCopyFds]{};
+    return fds;
+  }
+
+  static void set_zerocopy(int socketfd, bool enabled) {
+    if (socketfd >= 0 && socketfd < kMaxZeroCopyFds)
+      zerocopy_fds()[socketfd].store(enabled, std::memory_order_relaxed);
+  }
 };
 
 } // end namespace distributed
@@ -10,13 +10,19 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <cstdint>
 #include <algorithm>
+#include <functional>
 #include <string>
+#include <vector>
 
+#include <distributed/common/Codec.h>
+#include <distributed/common/Common.h>
 #include <distributed/common/Message.h>
+#include <distributed/common/NetStats.h>
 #include <glog/logging.h>
 
 namespace distributed {
@@ -32,7 +38,7 @@ class RecvOps {
     char* ptr = reinterpret_cast<char*>(head);
     uint64_t recv = 0;
     while (recv < kHeadSize) {
-      int retval = ::read(socketfd, ptr + recv, kHeadSize - recv);
+      ssize_t retval = ::read(socketfd, ptr + recv, kHeadSize - recv);
       if (retval < 0) {
 
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -74,6 +80,7 @@ class RecvOps {
       return false;
     }
 
+    NetStats::received(*head);
     return true;
   }
 
@@ -82,13 +89,18 @@ class RecvOps {
     if (head.length == 0 || !buff)
       return false;
 
+    return recv_lite(socketfd, buff, head.length);
+  }
+
+  static bool recv_lite(int socketfd, char* buff, uint64_t len) {
+
     uint64_t recv = 0;
-    while (recv < head.length) {
-      int retval = ::read(socketfd, buff + recv, head.length - recv);
+    while (recv < len) {
+      ssize_t retval = ::read(socketfd, buff + recv, len - recv);
       if (retval < 0) {
 
         // receive timeout occurs, but still try to read for Body
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
           continue;
 
         LOG(ERROR) << "RecvOps read error: " << strerror(errno);
@@ -102,29 +114,229 @@ class RecvOps {
 
       recv += retval;
       VLOG(3) << "retval " << retval << ", and already " << recv << " of total "
-              << head.length;
+              << len;
     }
 
     VLOG(3) << "total recv " << recv;
     return true;
   }
 
+  // called with (first row, rows) after these rows are ready in dest
+  using rows_callback_type = std::function<void(uint64_t, uint64_t)>;
+
+  // receive the Codec encoded factors into dest, which has space for nrows *
+  // ncols. each chunk is decoded as soon as it arrived, so the whole encoded
+  // payload never buffered. the remaining payload will be dropped on error.
+  //
+  // when decoded is given, nrows is the maximum rows accepted and the actual
+  // rows will be returned by it.
+  static bool recv_factors(int socketfd,
+                           const Head& head,
+                           qmf::Double* dest,
+                           uint64_t nrows,
+                           uint32_t ncols,
+                           const rows_callback_type& callback = nullptr,
+                           uint64_t* decoded = nullptr) {
+
+    if (head.encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+      const uint64_t row_bytes = ncols * sizeof(qmf::Double);
+      const uint64_t expect = decoded ? head.length / row_bytes : nrows;
+      if (head.length != expect * row_bytes || expect > nrows) {
+        LOG(ERROR) << "length check failed, expect " << nrows * row_bytes
+                   << ", but get " << head.length;
+        recv_and_drop(socketfd, head.length);
+        return false;
+      }
+
+      nrows = expect;
+      if (decoded)
+        *decoded = nrows;
+
+      if (!callback)
+        return recv_message(socketfd, head, reinterpret_cast<char*>(dest));
+
+      // receive with the same granularity as the encoded chunks
+      const uint64_t step = std::max<uint64_t>(1, kCodecChunkSize / row_bytes);
+      for (uint64_t row = 0; row < nrows; row += step) {
+        const uint64_t rows = std::min(step, nrows - row);
+        if (!recv_lite(socketfd, reinterpret_cast<char*>(dest + row * ncols),
+                       rows * row_bytes))
+          return false;
+        callback(row, rows);
+      }
+      return true;
+    }
+
+    if (head.length != kStreamLength) {
+      LOG(ERROR) << "encoded factors not streamed: " << head.dump();
+      recv_and_drop(socketfd, head.length);
+      return false;
+    }
+
+    std::string body;
+    std::string scratch;
+    uint64_t recv = 0;
+    uint64_t rows = 0;
+    while (true) {
+
+      ChunkHead chunk;
+      if (!recv_lite(socketfd, reinterpret_cast<char*>(&chunk),
+                     sizeof(ChunkHead)))
+        return false;
+      recv += sizeof(ChunkHead);
+
+      if (chunk.is_end())
+        break;
+
+      if (rows + chunk.rows > nrows) {
+        LOG(ERROR) << "factors chunk overflow, rows " << rows + chunk.rows
+                   << " of " << nrows;
+        drop_chunks(socketfd, chunk.bytes);
+        return false;
+      }
+
+      body.resize(chunk.bytes);
+      if (!recv_lite(socketfd, &body[0], chunk.bytes))
+        return false;
+      recv += chunk.bytes;
+
+      if (!Codec::decode_factors_chunk(head.encoding, chunk, body.data(),
+                                       dest + rows * ncols, ncols, &scratch)) {
+        drop_chunks(socketfd, 0);
+        return false;
+      }
+
+      if (callback)
+        callback(rows, chunk.rows);
+      rows += chunk.rows;
+    }
+
+    NetStats::received_stream(head.opcode, recv);
+
+    if (decoded) {
+      *decoded = rows;
+    } else if (rows != nrows) {
+      LOG(ERROR) << "decoded rows " << rows << ", but expect " << nrows;
+      return false;
+    }
+
+    return true;
+  }
+
+  static bool recv_rating(int socketfd,
+                          const Head& head,
+                          std::vector<qmf::DatasetElem>* rating) {
+
+    if (head.encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+      if (head.length % sizeof(qmf::DatasetElem) != 0) {
+        LOG(ERROR) << "rating length " << head.length << " is not aligned.";
+        recv_and_drop(socketfd, head.length);
+        return false;
+      }
+      rating->resize(head.length / sizeof(qmf::DatasetElem));
+      return recv_message(socketfd, head,
+                          reinterpret_cast<char*>(rating->data()));
+    }
+
+    if (head.length != kStreamLength) {
+      LOG(ERROR) << "encoded rating not streamed: " << head.dump();
+      recv_and_drop(socketfd, head.length);
+      return false;
+    }
+
+    rating->clear();
+
+    std::string body;
+    std::string scratch;
+    uint64_t recv = 0;
+    while (true) {
+
+      ChunkHead chunk;
+      if (!recv_lite(socketfd, reinterpret_cast<char*>(&chunk),
+                     sizeof(ChunkHead)))
+        return false;
+      recv += sizeof(ChunkHead);
+
+      if (chunk.is_end())
+        break;
+
+      body.resize(chunk.bytes);
+      if (!recv_lite(socketfd, &body[0], chunk.bytes))
+        return false;
+      recv += chunk.bytes;
+
+      const size_t offset = rating->size();
+      rating->resize(offset + chunk.rows);
+      if (!Codec::decode_rating_chunk(head.encoding, chunk, body.data(),
+                                      rating->data() + offset, &scratch)) {
+        drop_chunks(socketfd, 0);
+        return false;
+      }
+    }
+
+    NetStats::received_stream(head.opcode, recv);
+    return true;
+  }
+
+  // read out the whole body of the message, streamed or not
+  static bool drop_payload(int socketfd, const Head& head) {
+    if (head.length == kStreamLength)
+      return drop_chunks(socketfd, 0);
+    return recv_and_drop(socketfd, head.length);
+  }
+
+  // drop the remaining bytes of the current chunk, and then the following
+  // chunks until the end of the streamed payload
+  static bool drop_chunks(int socketfd, uint64_t bytes) {
+
+    while (true) {
+      if (!recv_and_drop(socketfd, bytes))
+        return false;
+
+      ChunkHead chunk;
+      if (!recv_lite(socketfd, reinterpret_cast<char*>(&chunk),
+                     sizeof(ChunkHead)))
+        return false;
+
+      if (chunk.is_end())
+        return true;
+      bytes = chunk.bytes;
+    }
+  }
+
   // read out len's data, drop the content
   static bool recv_and_drop(int socketfd, uint64_t len) {
 
     if (len == 0)
       return true;
 
-    char buff[1 * 1024 * 1024]{};
+#if defined(__linux__)
+    uint64_t recv = 0;
+    if (drop_by_splice(socketfd, len, &recv))
+      return true;
+
+    // splice not supported by this socket, drop the remaining by read
+    return drop_by_read(socketfd, len - recv);
+#else
+    return drop_by_read(socketfd, len);
+#endif
+  }
+
+  static bool drop_by_read(int socketfd, uint64_t len) {
+
+    if (len == 0)
+      return true;
+
+    std::vector<char> buff(std::min<uint64_t>(len, kDropBuffSize));
     uint64_t recv = 0;
 
     while (recv < len) {
 
-      int retval =
-        ::read(socketfd, buff, std::min<uint64_t>(sizeof(buff), len - recv));
+      ssize_t retval = ::read(socketfd, buff.data(),
+                              std::min<uint64_t>(buff.size(), len - recv));
       if (retval < 0) {
 
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
           continue;
 
         LOG(ERROR) << "read error: " << strerror(errno);
@@ -144,6 +356,73 @@ class RecvOps {
     VLOG(3) << "total recv " << recv;
     return true;
   }
+
+#if defined(__linux__)
+  // move the data socket -> pipe -> /dev/null inside the kernel, the content
+  // never copied to the userspace. *recv records the already dropped size,
+  // so the caller can fallback when return false.
+  static bool drop_by_splice(int socketfd, uint64_t len, uint64_t* recv) {
+
+    static const int devnull = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull < 0)
+      return false;
+
+    int pipefd[2];
+    if (::pipe2(pipefd, O_CLOEXEC) < 0) {
+      LOG(ERROR) << "create pipe error: " << strerror(errno);
+      return false;
+    }
+
+    bool success = true;
+    while (*recv < len) {
+
+      ssize_t retval =
+        ::splice(socketfd, NULL, pipefd[1], NULL,
+                 std::min<uint64_t>(kDropBuffSize, len - *recv),
+                 SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (retval < 0) {
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          continue;
+
+        VLOG(3) << "splice from socket error: " << strerror(errno);
+        success = false;
+        break;
+
+      } else if (retval == 0) {
+
+        LOG(ERROR) << "peer close down: " << socketfd;
+        success = false;
+        break;
+      }
+
+      // drain the pipe, it holds nothing else
+      ssize_t drained = 0;
+      while (drained < retval) {
+        ssize_t n = ::splice(pipefd[0], NULL, devnull, NULL, retval - drained,
+                             SPLICE_F_MOVE);
+        if (n <= 0) {
+          if (n < 0 && errno == EINTR)
+            continue;
+
+          LOG(ERROR) << "splice to /dev/null error: " << strerror(errno);
+          ::close(pipefd[0]);
+          ::close(pipefd[1]);
+          return false;
+        }
+        drained += n;
+      }
+
+      *recv += retval;
+    }
+
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+
+    VLOG(3) << "total spliced " << *recv;
+    return success;
+  }
+#endif
 };
 
 } // end namespace distributed
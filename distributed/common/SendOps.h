@@ -9,14 +9,33 @@
 #define __DISTRIBUTED_COMMON_SEND_OPS_H__
 
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#include <limits.h>
+#include <poll.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <distributed/common/Codec.h>
+#include <distributed/common/Common.h>
 #include <distributed/common/Message.h>
-#include <distributed/common/SendOps.h>
+#include <distributed/common/NetStats.h>
+#include <distributed/common/NetUtil.h>
 #include <glog/logging.h>
 
 namespace distributed {
@@ -30,8 +49,11 @@ class SendOps {
 
     uint64_t sent = 0;
     while (sent < len) {
-      int retval = ::write(socketfd, buff + sent, len - sent);
+      ssize_t retval = ::write(socketfd, buff + sent, len - sent);
       if (retval < 0) {
+        if (errno == EINTR)
+          continue;
+
         LOG(ERROR) << "SendOps write error: " << strerror(errno);
         return false;
       }
@@ -44,6 +66,42 @@ class SendOps {
     return true;
   }
 
+  // writev all the iovecs, the iov array will be modified when partial write
+  // happens, so the caller should not reuse it.
+  static bool send_iov(int socketfd, struct iovec* iov, int iovcnt) {
+
+    uint64_t sent = 0;
+    while (iovcnt > 0) {
+
+      ssize_t retval = ::writev(socketfd, iov, std::min(iovcnt, IOV_MAX));
+      if (retval < 0) {
+        if (errno == EINTR)
+          continue;
+
+        LOG(ERROR) << "SendOps writev error: " << strerror(errno);
+        return false;
+      }
+
+      sent += retval;
+
+      // skip the fully sent iovecs, and adjust the partial one
+      size_t left = retval;
+      while (iovcnt > 0 && left >= iov->iov_len) {
+        left -= iov->iov_len;
+        ++iov;
+        --iovcnt;
+      }
+
+      if (iovcnt > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+        iov->iov_len -= left;
+      }
+    }
+
+    VLOG(3) << "total writev sent " << sent;
+    return true;
+  }
+
   static bool send_message(int socketfd,
                            enum OpCode code,
                            const std::string& msg,
@@ -52,7 +110,8 @@ class SendOps {
                            uint32_t nfactors = 0,
                            uint32_t bucket = 0,
                            double lambda = 0,
-                           double confidence = 0) {
+                           double confidence = 0,
+                           uint8_t encoding = 0) {
 
     // combine the Head and body send with one syscall
 
@@ -68,6 +127,8 @@ class SendOps {
     head.bucket = bucket;
     head.lambda = lambda;
     head.confidence = confidence;
+    head.encoding = encoding;
+    NetStats::sent(head);
     head.to_net_endian();
     ::memcpy(buff, reinterpret_cast<const char*>(&head), kHeadSize);
     ::memcpy(buff + kHeadSize, msg.c_str(), msg.size());
@@ -84,7 +145,63 @@ class SendOps {
                         uint32_t nfactors = 0,
                         uint32_t bucket = 0,
                         double lambda = 0,
-                        double confidence = 0) {
+                        double confidence = 0,
+                        uint8_t encoding = 0) {
+
+    Head head(code);
+    head.taskid = taskid;
+    head.epchoid = epchoid;
+    head.nfactors = nfactors;
+    head.bucket = bucket;
+    head.lambda = lambda;
+    head.confidence = confidence;
+    head.encoding = encoding;
+    return send_bulk(socketfd, head, buff, len);
+  }
+
+  // the Head is prepared by the caller in host endian, the length is filled
+  static bool send_bulk(int socketfd,
+                        Head head,
+                        const char* buff,
+                        uint64_t len) {
+
+    if (!buff)
+      return false;
+
+    head.length = len;
+    NetStats::sent(head);
+    head.to_net_endian();
+
+    // multi-GB factors and ratings, try to avoid copy them into the kernel
+    if (len >= kZeroCopyThreshold && NetUtil::is_zerocopy(socketfd)) {
+      return send_more(socketfd, reinterpret_cast<const char*>(&head),
+                       kHeadSize) &&
+             send_zerocopy(socketfd, buff, len);
+    }
+
+    // coalesce the Head and body with one syscall
+    struct iovec iov[2];
+    iov[0].iov_base = reinterpret_cast<char*>(&head);
+    iov[0].iov_len = kHeadSize;
+    iov[1].iov_base = const_cast<char*>(buff);
+    iov[1].iov_len = len;
+    return send_iov(socketfd, iov, 2);
+  }
+
+  // send the [offset, offset + len) content of filefd as the body, the kernel
+  // transfer the page cache directly to the socket.
+  static bool send_file(int socketfd,
+                        enum OpCode code,
+                        int filefd,
+                        uint64_t offset,
+                        uint64_t len,
+                        uint32_t taskid = 0,
+                        uint32_t epchoid = 0,
+                        uint32_t nfactors = 0,
+                        uint32_t bucket = 0,
+                        double lambda = 0,
+                        double confidence = 0,
+                        uint8_t encoding = 0) {
 
     Head head(code);
 
@@ -95,14 +212,370 @@ class SendOps {
     head.bucket = bucket;
     head.lambda = lambda;
     head.confidence = confidence;
+    head.encoding = encoding;
+    NetStats::sent(head);
     head.to_net_endian();
 
-    return send_lite(
-             socketfd, reinterpret_cast<const char*>(&head), sizeof(Head)) &&
-           send_lite(socketfd, buff, len);
+    if (!send_more(
+          socketfd, reinterpret_cast<const char*>(&head), kHeadSize)) {
+      return false;
+    }
+
+#if defined(__linux__)
+    off_t pos = offset;
+    uint64_t sent = 0;
+    while (sent < len) {
+      ssize_t retval = ::sendfile(socketfd, filefd, &pos, len - sent);
+      if (retval < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        LOG(ERROR) << "SendOps sendfile error: " << strerror(errno);
+        return false;
+      } else if (retval == 0) {
+        LOG(ERROR) << "SendOps sendfile unexpected EOF, sent " << sent
+                   << " of total " << len;
+        return false;
+      }
+
+      sent += retval;
+    }
+
+    VLOG(3) << "total sendfile sent " << sent;
+    return true;
+#else
+    std::vector<char> buff(std::min<uint64_t>(len, kTransferChunkSize));
+    uint64_t sent = 0;
+    while (sent < len) {
+      ssize_t retval = ::pread(filefd, buff.data(),
+                               std::min<uint64_t>(buff.size(), len - sent),
+                               offset + sent);
+      if (retval <= 0) {
+        LOG(ERROR) << "SendOps pread error: " << strerror(errno);
+        return false;
+      }
+
+      if (!send_lite(socketfd, buff.data(), retval))
+        return false;
+      sent += retval;
+    }
+    return true;
+#endif
+  }
+
+  // the factors encoded with Codec are streamed by send_stream. kRaw keeps
+  // the original layout and zerocopy path.
+  static bool send_factors(int socketfd,
+                           enum OpCode code,
+                           const qmf::Double* data,
+                           uint64_t nrows,
+                           uint32_t ncols,
+                           uint8_t encoding,
+                           uint32_t taskid = 0,
+                           uint32_t epchoid = 0,
+                           uint32_t nfactors = 0,
+                           uint32_t bucket = 0,
+                           double lambda = 0,
+                           double confidence = 0) {
+
+    Head head(code);
+    head.taskid = taskid;
+    head.epchoid = epchoid;
+    head.nfactors = nfactors;
+    head.bucket = bucket;
+    head.lambda = lambda;
+    head.confidence = confidence;
+    head.encoding = encoding;
+    return send_factors(socketfd, head, data, nrows, ncols);
+  }
+
+  // the Head is prepared by the caller in host endian, with head.encoding
+  static bool send_factors(int socketfd,
+                           const Head& head,
+                           const qmf::Double* data,
+                           uint64_t nrows,
+                           uint32_t ncols) {
+
+    if (head.encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+      return send_bulk(socketfd, head, reinterpret_cast<const char*>(data),
+                       nrows * ncols * sizeof(qmf::Double));
+    }
+
+    const uint8_t encoding = head.encoding;
+    return send_stream(socketfd, head, Codec::factor_chunks(nrows, ncols),
+                       [=](uint64_t index, std::string* out) {
+                         Codec::encode_factors_chunk(encoding, data, nrows,
+                                                     ncols, index, out);
+                       });
+  }
+
+  static bool send_rating(int socketfd,
+                          enum OpCode code,
+                          const qmf::DatasetElem* data,
+                          uint64_t count,
+                          uint8_t encoding,
+                          uint32_t taskid = 0,
+                          uint32_t epchoid = 0,
+                          uint32_t nfactors = 0,
+                          uint32_t bucket = 0,
+                          double lambda = 0,
+                          double confidence = 0) {
+
+    if (encoding == static_cast<uint8_t>(Encoding::kRaw)) {
+      return send_bulk(socketfd, code, reinterpret_cast<const char*>(data),
+                       count * sizeof(qmf::DatasetElem), taskid, epchoid,
+                       nfactors, bucket, lambda, confidence);
+    }
+
+    Head head(code);
+    head.taskid = taskid;
+    head.epchoid = epchoid;
+    head.nfactors = nfactors;
+    head.bucket = bucket;
+    head.lambda = lambda;
+    head.confidence = confidence;
+    head.encoding = encoding;
+    return send_stream(socketfd, head, Codec::rating_chunks(count),
+                       [=](uint64_t index, std::string* out) {
+                         Codec::encode_rating_chunk(encoding, data, count,
+                                                    index, out);
+                       });
+  }
+
+  // encode the index-th chunk to out, with its ChunkHead
+  using encode_type = std::function<void(uint64_t, std::string*)>;
+
+  // stream the nchunks chunks with Head.length kStreamLength, and end them
+  // with an empty ChunkHead. the chunks are encoded in parallel by batches on
+  // another thread while the previous batches being sent, at most
+  // kStreamQueueBatches batches are buffered whatever the payload size.
+  static bool send_stream(int socketfd,
+                          Head head,
+                          uint64_t nchunks,
+                          const encode_type& encode) {
+
+    const uint8_t opcode = head.opcode;
+    head.length = kStreamLength;
+    NetStats::sent(head);
+    head.to_net_endian();
+
+    // the common small payload, encode and send with one writev
+    if (nchunks <= kStreamBatchChunks) {
+      std::vector<std::string> chunks;
+      encode_batch(encode, 0, nchunks, &chunks);
+      chunks.push_back(end_chunk());
+
+      uint64_t bytes = 0;
+      if (!send_chunks(socketfd, reinterpret_cast<const char*>(&head),
+                       chunks, &bytes))
+        return false;
+      NetStats::sent_stream(opcode, bytes);
+      return true;
+    }
+
+    if (!send_more(socketfd, reinterpret_cast<const char*>(&head), kHeadSize))
+      return false;
+
+    std::mutex lock;
+    std::condition_variable notify;
+    std::deque<std::vector<std::string>> batches;
+    bool stopped = false;
+
+    std::thread encoder([&] {
+      for (uint64_t first = 0; first < nchunks; first += kStreamBatchChunks) {
+        std::vector<std::string> batch;
+        encode_batch(encode, first,
+                     std::min<uint64_t>(kStreamBatchChunks, nchunks - first),
+                     &batch);
+
+        std::unique_lock<std::mutex> guard(lock);
+        notify.wait(guard, [&] {
+          return stopped || batches.size() < kStreamQueueBatches;
+        });
+        if (stopped)
+          return;
+        batches.push_back(std::move(batch));
+        notify.notify_all();
+      }
+    });
+
+    bool success = true;
+    uint64_t bytes = 0;
+    for (uint64_t first = 0; success && first < nchunks;
+         first += kStreamBatchChunks) {
+
+      std::vector<std::string> batch;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        notify.wait(guard, [&] { return !batches.empty(); });
+        batch = std::move(batches.front());
+        batches.pop_front();
+        notify.notify_all();
+      }
+
+      if (first + kStreamBatchChunks >= nchunks)
+        batch.push_back(end_chunk());
+      success = send_chunks(socketfd, nullptr, batch, &bytes);
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopped = true;
+      notify.notify_all();
+    }
+    encoder.join();
+
+    if (success)
+      NetStats::sent_stream(opcode, bytes);
+    return success;
+  }
+
+  // send with MSG_ZEROCOPY, and wait until the kernel release all the pages,
+  // so the caller can modify the buff safely after return.
+  static bool send_zerocopy(int socketfd, const char* buff, uint64_t len) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    uint64_t sent = 0;
+    uint32_t issued = 0;
+    while (sent < len) {
+      ssize_t retval = ::send(socketfd, buff + sent,
+                              std::min<uint64_t>(len - sent, kTransferChunkSize),
+                              MSG_ZEROCOPY);
+      if (retval < 0) {
+        if (errno == EINTR)
+          continue;
+
+        // the optmem limit reached, reap some notifications and retry
+        if (errno == ENOBUFS && issued > 0) {
+          if (!reap_zerocopy(socketfd, &issued, true))
+            return false;
+          continue;
+        }
+
+        LOG(ERROR) << "SendOps zerocopy send error: " << strerror(errno);
+        return false;
+      }
+
+      sent += retval;
+      ++issued;
+    }
+
+    VLOG(3) << "total zerocopy sent " << sent << " with " << issued
+            << " notifications";
+
+    while (issued > 0) {
+      if (!reap_zerocopy(socketfd, &issued, true))
+        return false;
+    }
+    return true;
+#else
+    return send_lite(socketfd, buff, len);
+#endif
+  }
+
+ private:
+  static void encode_batch(const encode_type& encode,
+                           uint64_t first,
+                           uint64_t count,
+                           std::vector<std::string>* batch) {
+    batch->resize(count);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < static_cast<int64_t>(count); ++i) {
+      encode(first + i, &(*batch)[i]);
+    }
+  }
+
+  static std::string end_chunk() {
+    ChunkHead chunk{0, 0, 0};
+    return std::string(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+  }
+
+  // writev the optional Head and the chunks, *bytes accumulates the chunks
+  static bool send_chunks(int socketfd,
+                          const char* head,
+                          const std::vector<std::string>& chunks,
+                          uint64_t* bytes) {
+
+    std::vector<struct iovec> iov;
+    iov.reserve(chunks.size() + 1);
+    if (head)
+      iov.push_back({const_cast<char*>(head), kHeadSize});
+    for (const auto& chunk : chunks) {
+      iov.push_back({const_cast<char*>(chunk.data()), chunk.size()});
+      *bytes += chunk.size();
+    }
+
+    return send_iov(socketfd, iov.data(), iov.size());
+  }
+
+  // used before a body sent by another syscall, let the kernel coalesce them
+  static bool send_more(int socketfd, const char* buff, uint64_t len) {
+#if defined(MSG_MORE)
+    uint64_t sent = 0;
+    while (sent < len) {
+      ssize_t retval = ::send(socketfd, buff + sent, len - sent, MSG_MORE);
+      if (retval < 0) {
+        if (errno == EINTR)
+          continue;
+
+        LOG(ERROR) << "SendOps send error: " << strerror(errno);
+        return false;
+      }
+      sent += retval;
+    }
+    return true;
+#else
+    return send_lite(socketfd, buff, len);
+#endif
+  }
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+  // each notification covers a range [ee_info, ee_data] of the issued sends
+  static bool reap_zerocopy(int socketfd, uint32_t* issued, bool block) {
+
+    struct pollfd pfd;
+    pfd.fd = socketfd;
+    pfd.events = 0; // only POLLERR, which is always reported
+    pfd.revents = 0;
+    if (block && ::poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+      LOG(ERROR) << "SendOps poll errqueue error: " << strerror(errno);
+      return false;
+    }
+
+    char control[128];
+    struct msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t retval = ::recvmsg(socketfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+    if (retval < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return true;
+
+      LOG(ERROR) << "SendOps recv errqueue error: " << strerror(errno);
+      return false;
+    }
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+
+      const struct sock_extended_err* serr =
+        reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      const uint32_t completed = serr->ee_data - serr->ee_info + 1;
+      *issued -= std::min(*issued, completed);
+      VLOG_IF(3, serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        << "zerocopy fallback to copy by kernel";
+    }
+
+    return true;
   }
+#endif
 };
 
 } // end namespace distributed
 
-#endif // __DISTRIBUTED_COMMON_SEND_OPS_H__
\ No newline at end of file
+#endif // __DISTRIBUTED_COMMON_SEND_OPS_H__
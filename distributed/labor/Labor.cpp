@@ -9,10 +9,21 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 
+#include <cstdlib>
 #include <thread>
+#include <tuple>
 #include <chrono> // std::chrono::seconds
 
+#include <qmf/metrics/MetricsManager.h>
+#include <qmf/utils/FactorWriter.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Trace.h>
+#include <qmf/utils/Util.h>
+#include <qmf/wals/WALSSolver.h>
+
 #include <distributed/labor/Labor.h>
+#include <distributed/common/Codec.h>
+#include <distributed/common/MetricsServer.h>
 #include <distributed/common/SendOps.h>
 #include <distributed/common/RecvOps.h>
 #include <distributed/common/NetUtil.h>
@@ -22,8 +33,32 @@
 namespace distributed {
 namespace labor {
 
+namespace {
+
+// the handling time of each opcode, the unknown ones share one histogram
+const qmf::Histogram& handle_time(uint8_t opcode) {
+  static const std::vector<qmf::Histogram> histograms = []() {
+    std::vector<qmf::Histogram> histograms;
+    for (uint8_t op = 0; op <= kMaxOpCode; ++op)
+      histograms.emplace_back(std::string("labor.handle.") + opcode_name(op));
+    return histograms;
+  }();
+  return histograms[opcode <= kMaxOpCode ? opcode : 0];
+}
+
+// the args of the trace events, not formatted if the trace is disabled
+std::string trace_args(const Head& head) {
+  if (!qmf::Trace::get().enabled())
+    return "";
+  return "\"taskid\":" + std::to_string(head.taskid) +
+         ",\"epchoid\":" + std::to_string(head.epchoid) +
+         ",\"bucket\":" + std::to_string(head.bucket);
+}
+} // end namespace
+
 static const char* OK = "OK";
 static const char* FAIL = "FAIL";
+static const char* NONE = "NONE";
 
 bool Labor::init() {
 
@@ -33,18 +68,6 @@ bool Labor::init() {
   if (!start_attach())
     return false;
 
-  bigdata_ptr_ = std::make_unique<BigData>();
-  if (!bigdata_ptr_) {
-    LOG(ERROR) << "create BigData failed.";
-    return false;
-  }
-
-  engine_ptr_ = std::make_unique<qmf::WALSEngineLite>(bigdata_ptr_);
-  if (!engine_ptr_) {
-    LOG(ERROR) << "create WALSEngineLite failed.";
-    return false;
-  }
-
   return true;
 }
 
@@ -59,6 +82,7 @@ bool Labor::start_connect() {
   do {
 
     NetUtil::optimize_send_recv_buff(socketfd_);
+    NetUtil::enable_zerocopy(socketfd_);
 
     // If a receive operation has blocked for this much time without receiving
     // additional data, it shall return with a partial count or errno set to
@@ -93,7 +117,7 @@ bool Labor::start_connect() {
   } while (0);
 
   if (!success) {
-    close(socketfd_);
+    NetUtil::close_socket(socketfd_);
     return false;
   }
 
@@ -104,8 +128,11 @@ bool Labor::start_connect() {
 
 bool Labor::start_attach() {
 
+  // announce the payload encodings we can decode
   std::string message = "attach_labor";
-  if (!SendOps::send_message(socketfd_, OpCode::kAttachLabor, message)) {
+  const int64_t send_micros = qmf::Trace::wallMicros();
+  if (!SendOps::send_message(socketfd_, OpCode::kAttachLabor, message, 0, 0, 0,
+                             0, 0, 0, Codec::supported_mask())) {
     LOG(ERROR) << "labor start_attach send failed.";
     return false;
   }
@@ -133,6 +160,8 @@ bool Labor::start_attach() {
 
     if (ret) {
       LOG(INFO) << "response: " << std::string(msg.data(), msg.size());
+      sync_clock(std::string(msg.data(), msg.size()), send_micros,
+                 qmf::Trace::wallMicros());
     }
 
     break;
@@ -142,9 +171,33 @@ bool Labor::start_attach() {
   return ret;
 }
 
+void Labor::sync_clock(const std::string& response,
+                       int64_t send_micros,
+                       int64_t recv_micros) {
+
+  // the Scheduler's clock in the response is taken in the middle of the
+  // round trip, the error is within half of the round trip
+  const std::string prefix = "attach_labor_rsp_ok ";
+  if (response.compare(0, prefix.size(), prefix) != 0) {
+    LOG(INFO) << "no scheduler clock in the attach response.";
+    return;
+  }
+
+  const int64_t scheduler_micros =
+    std::strtoll(response.c_str() + prefix.size(), nullptr, 10);
+  const int64_t offset = scheduler_micros - (send_micros + recv_micros) / 2;
+  qmf::Trace::get().setClockOffset(offset);
+  LOG(INFO) << "clock offset to scheduler " << offset << " us, round trip "
+            << recv_micros - send_micros << " us.";
+}
+
 void Labor::loop() {
 
   LOG(INFO) << "start loop thread ...";
+  qmf::Trace::get().nameThread("loop");
+
+  compute_thread_ = std::thread(&Labor::compute_run, this);
+  send_thread_ = std::thread(&Labor::send_run, this);
 
   while (!terminate_) {
 
@@ -168,29 +221,452 @@ void Labor::loop() {
     }
   }
 
+  terminate_ = true;
+  pending_notify_.notify_all();
+  compute_thread_.join();
+  send_thread_.join();
+
   LOG(INFO) << "terminate loop thread ...";
 }
 
+void Labor::compute_run() {
+
+  LOG(INFO) << "start compute thread ...";
+  qmf::Trace::get().nameThread("compute");
+
+  static const qmf::Histogram eval_time("labor.eval_bucket");
+  static const qmf::Histogram calc_time("labor.calc_bucket");
+  static const qmf::Counter calc_rows("labor.calc_rows");
+
+  Calc calc;
+  while (!terminate_) {
+
+    if (!calc_queue_.POP(calc, 100))
+      continue;
+
+    // evaluated in order with the buckets, so the factors are not touched
+    // by the following buckets yet
+    if (calc.head.opcode == static_cast<uint8_t>(OpCode::kEval)) {
+      qmf::ScopedTimer timer(eval_time);
+      qmf::TraceScope scope("labor", "eval_bucket", trace_args(calc.head));
+      evaluate(calc.head, calc.task, calc.metrics);
+      finish_bucket(calc.task);
+      continue;
+    }
+
+    // the main calculate part, iterate the range's factors' update
+    const Head& head = calc.head;
+    auto& bigdata_ptr = calc.task->bigdata_ptr_;
+    auto& engine_ptr = calc.task->engine_ptr_;
+
+    bool iterate_user = head.epchoid % 2;
+    const uint64_t nrows =
+      iterate_user ? engine_ptr->nusers() : engine_ptr->nitems();
+    const uint64_t start_idx =
+      static_cast<uint64_t>(head.bucket) * head.bucket_size;
+    const uint64_t end_idx =
+      std::min<uint64_t>(start_idx + head.bucket_size, nrows);
+
+    if (head.bucket_size == 0 || start_idx >= end_idx) {
+      LOG(ERROR) << "invalid bucket " << head.stepinfo() << " for rows "
+                 << nrows;
+      finish_bucket(calc.task);
+      continue;
+    }
+
+    // solve and send back piece by piece, the send thread transfers the
+    // previous rows while we are solving the following ones
+    qmf::ScopedTimer timer(calc_time);
+    qmf::TraceScope scope("labor", "calc_bucket", trace_args(head));
+    calc_rows.add(end_idx - start_idx);
+    qmf::Double loss = 0;
+    for (uint64_t idx = start_idx; idx < end_idx; idx += kCalcStreamRows) {
+
+      const uint64_t stop = std::min<uint64_t>(idx + kCalcStreamRows, end_idx);
+      const auto begin = std::chrono::steady_clock::now();
+      if (iterate_user) {
+        loss += engine_ptr->iterate(
+                  idx, stop, *bigdata_ptr->user_factor_ptr_,
+                  engine_ptr->userIndex(), engine_ptr->userSignals(),
+                  *bigdata_ptr->item_factor_ptr_, engine_ptr->itemIndex()) *
+                (stop - idx);
+      } else {
+        loss += engine_ptr->iterate(
+                  idx, stop, *bigdata_ptr->item_factor_ptr_,
+                  engine_ptr->itemIndex(), engine_ptr->itemSignals(),
+                  *bigdata_ptr->user_factor_ptr_, engine_ptr->userIndex()) *
+                (stop - idx);
+      }
+
+      // the solve time is reported to the Scheduler for the bucket size tune
+      const std::chrono::duration<double> cost =
+        std::chrono::steady_clock::now() - begin;
+      piece_queue_.PUSH(Piece{head, calc.task, calc.shard_dir, idx, stop - idx,
+                              cost.count(), stop == end_idx ? loss : 0,
+                              stop == end_idx});
+    }
+
+    LOG(INFO) << "bucket " << head.stepinfo()
+              << " loss: " << loss / (end_idx - start_idx);
+  }
+
+  LOG(INFO) << "terminate compute thread ...";
+}
+
+void Labor::send_run() {
+
+  LOG(INFO) << "start send thread ...";
+  qmf::Trace::get().nameThread("send");
+
+  Piece piece;
+  while (!terminate_) {
+
+    if (!piece_queue_.POP(piece, 100))
+      continue;
+
+    const Head& head = piece.head;
+    auto& bigdata_ptr = piece.task->bigdata_ptr_;
+    const qmf::Matrix& matrix =
+      (head.epchoid % 2) ? bigdata_ptr->user_factor_ptr_->getFactors()
+                         : bigdata_ptr->item_factor_ptr_->getFactors();
+    const qmf::Double* dat =
+      const_cast<qmf::Matrix&>(matrix).data(piece.start_idx);
+
+    Head rsp(OpCode::kCalcRsp);
+    rsp.taskid = head.taskid;
+    rsp.epchoid = head.epchoid;
+    rsp.nfactors = head.nfactors;
+    rsp.bucket = head.bucket;
+    rsp.bucket_size = head.bucket_size;
+    rsp.offset =
+      piece.start_idx - static_cast<uint64_t>(head.bucket) * head.bucket_size;
+    rsp.encoding = head.encoding;
+    rsp.cost = piece.cost;
+    rsp.loss = piece.loss;
+
+    // the shard is written before the bucket's last rows are sent back, so it
+    // exists once the Scheduler marks the bucket finished
+    if (piece.last && !piece.shard_dir.empty())
+      write_shard(piece);
+
+    {
+      std::lock_guard<std::mutex> lock(send_mutex_);
+      if (!SendOps::send_factors(socketfd_, rsp, dat, piece.rows,
+                                 head.nfactors)) {
+        LOG(ERROR) << "send OpCode::kCalcRsp failed.";
+      }
+    }
+
+    if (piece.last)
+      finish_bucket(piece.task);
+  }
+
+  LOG(INFO) << "terminate send thread ...";
+}
+
+void Labor::write_shard(const Piece& piece) {
+
+  const Head& head = piece.head;
+  auto& bigdata_ptr = piece.task->bigdata_ptr_;
+  auto& engine_ptr = piece.task->engine_ptr_;
+  bool iterate_user = head.epchoid % 2;
+
+  const uint64_t start_idx =
+    static_cast<uint64_t>(head.bucket) * head.bucket_size;
+  const uint64_t end_idx = piece.start_idx + piece.rows;
+
+  // the shards in name order are the complete factors file
+  char name[32];
+  snprintf(name, sizeof(name), "/part-%012lu", start_idx);
+
+  if (!qmf::FactorWriter::saveShard(
+        iterate_user ? *bigdata_ptr->user_factor_ptr_
+                     : *bigdata_ptr->item_factor_ptr_,
+        iterate_user ? engine_ptr->userIndex() : engine_ptr->itemIndex(),
+        start_idx, end_idx, piece.shard_dir + name)) {
+    LOG(ERROR) << "write shard of bucket " << head.stepinfo() << " failed.";
+  }
+}
+
+void Labor::build_test(const std::shared_ptr<Task>& task,
+                       const std::vector<qmf::DatasetElem>& test_vec) {
+
+  auto& engine_ptr = task->engine_ptr_;
+  task->test_users_.clear();
+  task->test_labels_.clear();
+
+  // sorted by the Scheduler, each user's ratings are adjacent
+  for (size_t i = 0; i < test_vec.size(); ++i) {
+    const size_t uidx = engine_ptr->userIndex().idx(test_vec[i].userId);
+    const size_t pidx = engine_ptr->itemIndex().idx(test_vec[i].itemId);
+    if (uidx == qmf::IdIndex::missingIdx || pidx == qmf::IdIndex::missingIdx)
+      continue;
+
+    if (task->test_users_.empty() || task->test_users_.back() != uidx) {
+      task->test_users_.push_back(uidx);
+      task->test_labels_.emplace_back();
+    }
+    task->test_labels_.back().emplace_back(pidx, test_vec[i].value);
+  }
+
+  LOG(INFO) << "task " << task->bigdata_ptr_->taskid() << " test users "
+            << task->test_users_.size() << ", ratings " << test_vec.size();
+}
+
+void Labor::evaluate(const Head& head,
+                     const std::shared_ptr<Task>& task,
+                     const std::string& metrics) {
+
+  auto& bigdata_ptr = task->bigdata_ptr_;
+  const std::vector<std::string> names = qmf::split(metrics, ',');
+  const uint64_t start_idx =
+    static_cast<uint64_t>(head.bucket) * head.bucket_size;
+  const uint64_t end_idx =
+    std::min<uint64_t>(start_idx + head.bucket_size, task->test_users_.size());
+
+  // [users, metric sums ...]
+  std::vector<double> sums(names.size() + 1, 0);
+  bool valid = start_idx < end_idx;
+  for (const auto& name : names) {
+    if (!qmf::MetricsManager::get().exists(name)) {
+      LOG(ERROR) << "unknown metric " << name;
+      valid = false;
+    }
+  }
+
+  if (valid) {
+
+    const qmf::FactorData& users = *bigdata_ptr->user_factor_ptr_;
+    const qmf::FactorData& items = *bigdata_ptr->item_factor_ptr_;
+    const size_t nfactors = users.nfactors();
+
+#pragma omp parallel
+    {
+      std::vector<double> local(names.size(), 0);
+      std::vector<qmf::Double> labels(items.nelems());
+      std::vector<qmf::Double> scores(items.nelems());
+
+#pragma omp for
+      for (uint64_t i = start_idx; i < end_idx; ++i) {
+        const size_t uidx = task->test_users_[i];
+        for (size_t idx = 0; idx < items.nelems(); ++idx) {
+          qmf::Double score = 0;
+          for (size_t fidx = 0; fidx < nfactors; ++fidx) {
+            score += users.at(uidx, fidx) * items.at(idx, fidx);
+          }
+          scores[idx] = score;
+        }
+
+        std::fill(labels.begin(), labels.end(), 0);
+        for (const auto& label : task->test_labels_[i]) {
+          labels[label.first] = label.second;
+        }
+
+        for (size_t m = 0; m < names.size(); ++m) {
+          local[m] += qmf::MetricsManager::get().getMetric(names[m])->compute(
+            labels, scores);
+        }
+      }
+
+#pragma omp critical
+      for (size_t m = 0; m < names.size(); ++m) {
+        sums[m + 1] += local[m];
+      }
+    }
+
+    sums[0] = end_idx - start_idx;
+  }
+
+  Head rsp(OpCode::kEvalRsp);
+  rsp.taskid = head.taskid;
+  rsp.epchoid = head.epchoid;
+  rsp.bucket = head.bucket;
+  rsp.bucket_size = head.bucket_size;
+
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  bool success = false;
+  if (valid) {
+    success = SendOps::send_bulk(socketfd_, rsp,
+                                 reinterpret_cast<const char*>(sums.data()),
+                                 sums.size() * sizeof(double));
+  } else {
+    success = SendOps::send_bulk(socketfd_, rsp, NONE, strlen(NONE));
+  }
+  if (!success) {
+    LOG(ERROR) << "send OpCode::kEvalRsp failed.";
+  }
+}
+
+std::shared_ptr<Labor::Task> Labor::task(uint32_t taskid) {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  auto iter = tasks_.find(taskid);
+  return iter == tasks_.end() ? nullptr : iter->second;
+}
+
+// the rating of the task is pushed again, or a new task started
+std::shared_ptr<Labor::Task> Labor::create_task(uint32_t taskid) {
+
+  auto previous = task(taskid);
+  if (previous)
+    drain(previous);
+
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  tasks_.erase(taskid);
+
+  // evict the oldest idle tasks, the Scheduler will push again if needed
+  for (auto iter = tasks_.begin();
+       iter != tasks_.end() && tasks_.size() >= kLaborTasks;) {
+    if (pending(iter->second) == 0) {
+      LOG(INFO) << "evict the data of task " << iter->first;
+      iter = tasks_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  auto task = std::make_shared<Task>();
+  tasks_[taskid] = task;
+  return task;
+}
+
+void Labor::accept_rating(const std::shared_ptr<Task>& task) {
+
+  // the fixed factors of current epcho not received yet, report epcho 0 so
+  // that the Scheduler will push them to us
+  Head param = head_;
+  param.epchoid = 0;
+  task->bigdata_ptr_->set_param(param);
+
+  //
+  // g++ will complain for "cannot bind packed field to xxx &"
+  // copy to avoid it
+  //
+  auto nfactors = head_.nfactors;
+  auto& bigdata_ptr = task->bigdata_ptr_;
+  auto& engine_ptr = task->engine_ptr_;
+  bigdata_ptr->item_factor_ptr_ =
+    std::make_shared<qmf::FactorData>(engine_ptr->nitems(), nfactors);
+  bigdata_ptr->user_factor_ptr_ =
+    std::make_shared<qmf::FactorData>(engine_ptr->nusers(), nfactors);
+
+  // only setFactors can allocate internal space
+  bigdata_ptr->item_factor_ptr_->setFactors();
+  bigdata_ptr->user_factor_ptr_->setFactors();
+
+  bigdata_ptr->YtY_ptr_ = std::make_shared<qmf::Matrix>(nfactors, nfactors);
+
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  if (!SendOps::send_bulk(socketfd_, OpCode::kPushRateRsp, OK, strlen(OK),
+                          head_.taskid, 0)) {
+    LOG(ERROR) << "send OpCode::kPushRateRsp failed.";
+  }
+}
+
+void Labor::send_info(uint32_t taskid,
+                      const std::shared_ptr<Task>& task,
+                      const char* message) {
+
+  const uint32_t epchoid = task ? task->bigdata_ptr_->epchoid() : 0;
+  const uint32_t pending = task ? this->pending(task) : 0;
+  if (!task)
+    message = NONE;
+
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  if (!SendOps::send_bulk(socketfd_, OpCode::kInfoRsp, message,
+                          strlen(message), taskid, epchoid, 0, pending)) {
+    LOG(ERROR) << "send OpCode::kInfoRsp failed.";
+  }
+}
+
+void Labor::drain(const std::shared_ptr<Task>& task) {
+  std::unique_lock<std::mutex> lock(pending_mutex_);
+  while (task->pending_ > 0 && !terminate_) {
+    pending_notify_.wait_for(lock, std::chrono::milliseconds(100));
+  }
+}
+
+size_t Labor::pending(const std::shared_ptr<Task>& task) {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  return task->pending_;
+}
+
+void Labor::finish_bucket(const std::shared_ptr<Task>& task) {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  --task->pending_;
+  pending_notify_.notify_all();
+}
+
+void Labor::collect_metrics(const qmf::Instrumentation::Snapshot& snapshot,
+                            std::string* out) {
+
+  // taskid, epchoid and pending buckets
+  std::vector<std::tuple<uint32_t, uint32_t, size_t>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+    for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter)
+      tasks.emplace_back(iter->first, iter->second->bigdata_ptr_->epchoid(),
+                         iter->second->pending_);
+  }
+
+  MetricsServer::append_gauge(out, "qmf_labor_tasks",
+                              "Tasks held by the Labor.", tasks.size());
+  MetricsServer::append_header(out, "qmf_labor_task_epchoid", "gauge",
+                               "The epchoid of the task held.");
+  for (const auto& task : tasks) {
+    MetricsServer::append_sample(
+      out, "qmf_labor_task_epchoid",
+      "taskid=\"" + std::to_string(std::get<0>(task)) + "\"",
+      std::get<1>(task));
+  }
+  MetricsServer::append_header(out, "qmf_labor_task_pending_buckets", "gauge",
+                               "Buckets received and not fully sent back.");
+  for (const auto& task : tasks) {
+    MetricsServer::append_sample(
+      out, "qmf_labor_task_pending_buckets",
+      "taskid=\"" + std::to_string(std::get<0>(task)) + "\"",
+      std::get<2>(task));
+  }
+
+  MetricsServer::append_gauge(out, "qmf_labor_calc_queue",
+                              "Buckets queued for the compute thread.",
+                              calc_queue_.SIZE());
+  MetricsServer::append_gauge(out, "qmf_labor_piece_queue",
+                              "Solved pieces queued for the send thread.",
+                              piece_queue_.SIZE());
+
+  // the compute thread is busy in the calc and eval buckets only
+  uint64_t busy_nanos = 0;
+  for (const auto& histogram : snapshot.histograms) {
+    if (histogram.first == "labor.calc_bucket" ||
+        histogram.first == "labor.eval_bucket")
+      busy_nanos += histogram.second.sumNanos;
+  }
+  const double uptime = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_)
+                          .count();
+  MetricsServer::append_gauge(
+    out, "qmf_labor_compute_utilization",
+    "Fraction of the uptime the compute thread spent solving.",
+    uptime > 0 ? std::min(busy_nanos / 1e9 / uptime, 1.0) : 0);
+}
+
 bool Labor::handle_head() {
 
   bool retval = true;
+  qmf::ScopedTimer timer(handle_time(head_.opcode));
+  qmf::TraceScope scope("labor", opcode_name(head_.opcode), trace_args(head_));
   switch (head_.opcode) {
 
   case static_cast<int>(OpCode::kHeartBeat): {
 
-    // Send back our latest local info to the Scheduler
+    // Send back our latest local info of the task to the Scheduler, with the
+    // count of the buckets still in processing
 
     VLOG(3) << "dump OpCode::kHeartBeat head " << std::endl << head_.dump();
 
     RecvOps::recv_and_drop(socketfd_, head_.length);
-
-    const std::string message = "OK";
-    if (!SendOps::send_message(socketfd_, OpCode::kInfoRsp, message,
-                               bigdata_ptr_->taskid(),
-                               bigdata_ptr_->epchoid())) {
-      LOG(ERROR) << "send OpCode::kInfoRsp failed.";
-    }
-
+    send_info(head_.taskid, task(head_.taskid), OK);
     break;
   }
 
@@ -203,48 +679,61 @@ bool Labor::handle_head() {
 
     VLOG(3) << "dump OpCode::kPushRate head " << std::endl << head_.dump();
 
-    int64_t item_sz = head_.length / sizeof(qmf::DatasetElem);
-    bigdata_ptr_->rating_vec_.resize(item_sz);
-    char* dat = reinterpret_cast<char*>(bigdata_ptr_->rating_vec_.data());
+    // the queued buckets still use the old dataset
+    auto task = create_task(head_.taskid);
 
-    retval = RecvOps::recv_message(socketfd_, head_, dat);
+    auto rating = std::make_shared<std::vector<qmf::DatasetElem>>();
+    retval = RecvOps::recv_rating(socketfd_, head_, rating.get());
     if (!retval) {
       LOG(ERROR) << "recv rating matrix failed.";
       break;
     }
-
-    bigdata_ptr_->set_param(head_);
+    task->bigdata_ptr_->rating_ptr_ = std::move(rating);
 
     // build index ...
-    engine_ptr_->init();
+    task->engine_ptr_->init();
+    accept_rating(task);
+    break;
+  }
 
-    //
-    // g++ will complain for "cannot bind packed field to xxx &"
-    // copy to avoid it
-    //
-    auto nfactors = head_.nfactors;
-    bigdata_ptr_->item_factor_ptr_ =
-      std::make_shared<qmf::FactorData>(engine_ptr_->nitems(), nfactors);
-    bigdata_ptr_->user_factor_ptr_ =
-      std::make_shared<qmf::FactorData>(engine_ptr_->nusers(), nfactors);
+  case static_cast<int>(OpCode::kReuseRate): {
 
-    // only setFactors can allocate internal space
-    bigdata_ptr_->item_factor_ptr_->setFactors();
-    bigdata_ptr_->user_factor_ptr_->setFactors();
+    // reuse the rating and index of another task on the same dataset
 
-    bigdata_ptr_->YtY_ptr_ = std::make_shared<qmf::Matrix>(nfactors, nfactors);
+    VLOG(3) << "dump OpCode::kReuseRate head " << std::endl << head_.dump();
 
-    if (!SendOps::send_bulk(socketfd_, OpCode::kPushRateRsp, OK, strlen(OK),
-                            head_.taskid, head_.epchoid)) {
-      LOG(ERROR) << "send OpCode::kPushRateRsp failed.";
+    std::string message(head_.length, '\0');
+    if (!RecvOps::recv_message(socketfd_, head_, &message[0])) {
+      LOG(ERROR) << "recv OpCode::kReuseRate message failed.";
+      break;
+    }
+
+    const uint32_t source_id = ::strtoul(message.c_str(), NULL, 10);
+    auto source = this->task(source_id);
+    if (!source || !source->engine_ptr_->initialized()) {
+      LOG(ERROR) << "the reused task " << source_id << " not found.";
+      std::lock_guard<std::mutex> lock(send_mutex_);
+      if (!SendOps::send_bulk(socketfd_, OpCode::kPushRateRsp, FAIL,
+                              strlen(FAIL), head_.taskid, 0)) {
+        LOG(ERROR) << "send OpCode::kPushRateRsp failed.";
+      }
+      break;
     }
 
+    // the index and signals are read only after built
+    auto task = create_task(head_.taskid);
+    task->bigdata_ptr_->rating_ptr_ = source->bigdata_ptr_->rating_ptr_;
+    task->engine_ptr_->share(*source->engine_ptr_);
+    LOG(INFO) << "task " << head_.taskid << " reuse the rating of task "
+              << source_id;
+
+    accept_rating(task);
     break;
   }
 
   case static_cast<int>(OpCode::kPushFixed): {
 
-    // we only accept this kPushFixed when taskid match
+    // we only accept this kPushFixed when we have the task's rating
     //
     // ! even though we may check failed, we still need to read the content out
     // ! (head.length), else it will be treated as the following session
@@ -252,69 +741,55 @@ bool Labor::handle_head() {
 
     VLOG(3) << "OpCode::kPushFixed head " << std::endl << head_.dump();
 
-    if (head_.taskid != bigdata_ptr_->taskid()) {
-      LOG(ERROR) << "taskid mismatch, local " << bigdata_ptr_->taskid()
-                 << ", but recv " << head_.taskid;
-
-      RecvOps::recv_and_drop(socketfd_, head_.length);
-
-      if (!SendOps::send_bulk(socketfd_, OpCode::kInfoRsp, FAIL, strlen(FAIL),
-                              bigdata_ptr_->taskid(),
-                              bigdata_ptr_->epchoid())) {
-        LOG(ERROR) << "send OpCode::kInfoRsp failed.";
-      }
+    auto task = this->task(head_.taskid);
+    if (!task) {
+      LOG(ERROR) << "task " << head_.taskid << " not found for fixed factors";
+      RecvOps::drop_payload(socketfd_, head_);
+      send_info(head_.taskid, task, FAIL);
       break;
     }
 
-    const size_t infer_sz =
-      head_.length / (head_.nfactors * sizeof(qmf::Double));
-    VLOG(3) << "detected factors item/user size: " << infer_sz;
+    // the queued buckets still use the old factors
+    drain(task);
 
     // epcho_id_ = 1, 3, 5, ... fix item, cal user
     // epcho_id_ = 2, 4, 6, ... fix user, cal item
 
-    char* dat = nullptr;
+    auto& bigdata_ptr = task->bigdata_ptr_;
+    auto& engine_ptr = task->engine_ptr_;
     bool iterate_user = head_.epchoid % 2;
-    if (iterate_user) {
-
-      if (infer_sz != engine_ptr_->nitems()) {
-        LOG(FATAL) << "inference items size " << infer_sz << ", but dataset "
-                   << engine_ptr_->nitems();
-      }
-
-      const qmf::Matrix& matrix = bigdata_ptr_->item_factor_ptr_->getFactors();
-      dat = reinterpret_cast<char*>(const_cast<qmf::Matrix&>(matrix).data());
-
-    } else {
-
-      if (infer_sz != engine_ptr_->nusers()) {
-        LOG(FATAL) << "inference users size " << infer_sz << ", but dataset "
-                   << engine_ptr_->nusers();
-      }
-
-      const qmf::Matrix& matrix = bigdata_ptr_->user_factor_ptr_->getFactors();
-      dat = reinterpret_cast<char*>(const_cast<qmf::Matrix&>(matrix).data());
-    }
-
-    if (!RecvOps::recv_message(socketfd_, head_, dat)) {
+    const qmf::Matrix& matrix =
+      iterate_user ? bigdata_ptr->item_factor_ptr_->getFactors()
+                   : bigdata_ptr->user_factor_ptr_->getFactors();
+    const uint64_t nrows =
+      iterate_user ? engine_ptr->nitems() : engine_ptr->nusers();
+
+    VLOG(3) << "YtY matrix size: (" << bigdata_ptr->YtY_ptr_->ncols() << ","
+            << bigdata_ptr->YtY_ptr_->ncols() << ")";
+
+    // accumulate the YtY for each piece as soon as it arrived, so it is
+    // ready when the last row received
+    qmf::Matrix* YtY = bigdata_ptr->YtY_ptr_.get();
+    YtY->clear();
+    auto accumulate = [&matrix, YtY](uint64_t row, uint64_t rows) {
+      static const qmf::Histogram xtxTime("wals_lite.xtx");
+      qmf::ScopedTimer timer(xtxTime);
+      qmf::WALSSolver::accumulateXtX(matrix, row, row + rows, YtY);
+    };
+
+    // the rows are checked against our local dataset when decoding
+    if (!RecvOps::recv_factors(socketfd_, head_,
+                               const_cast<qmf::Matrix&>(matrix).data(), nrows,
+                               head_.nfactors, accumulate)) {
       LOG(ERROR) << "recv fixed factors length " << head_.length << " failed.";
       break;
     }
 
-    bigdata_ptr_->set_param(head_);
-
-    VLOG(3) << "YtY matrix size: (" << bigdata_ptr_->YtY_ptr_->ncols() << ","
-            << bigdata_ptr_->YtY_ptr_->ncols() << ")";
-
-    // clear before calculate
-    if (iterate_user) {
-      const qmf::Matrix& matrix = bigdata_ptr_->item_factor_ptr_->getFactors();
-      engine_ptr_->computeXtX(matrix, bigdata_ptr_->YtY_ptr_.get());
-    } else {
-      const qmf::Matrix& matrix = bigdata_ptr_->user_factor_ptr_->getFactors();
-      engine_ptr_->computeXtX(matrix, bigdata_ptr_->YtY_ptr_.get());
-    }
+    bigdata_ptr->set_param(head_);
+    if (!iterate_user)
+      task->users_epchoid_ = head_.epchoid;
 
+    std::lock_guard<std::mutex> lock(send_mutex_);
     if (!SendOps::send_bulk(socketfd_, OpCode::kPushFixedRsp, OK, strlen(OK),
                             head_.taskid, head_.epchoid)) {
       LOG(ERROR) << "send OpCode::kPushFixedRsp failed.";
@@ -330,76 +805,100 @@ bool Labor::handle_head() {
     // check only if our local taskid and epchoid matches the requests, then we
     // can proceed the calculate task.
 
-    if (head_.taskid != bigdata_ptr_->taskid() ||
-        head_.epchoid != bigdata_ptr_->epchoid()) {
-      LOG(ERROR) << "taskid/epchoid mismatch, local " << bigdata_ptr_->taskid()
-                 << ":" << bigdata_ptr_->epchoid() << ", but recvived "
-                 << head_.taskid << ":" << head_.epchoid;
+    auto task = this->task(head_.taskid);
+    if (!task || head_.epchoid != task->bigdata_ptr_->epchoid()) {
+      LOG(ERROR) << "task " << head_.taskid << " epchoid mismatch, local "
+                 << (task ? task->bigdata_ptr_->epchoid() : 0)
+                 << ", but recvived " << head_.epchoid;
 
       RecvOps::recv_and_drop(socketfd_, head_.length);
-      if (!SendOps::send_bulk(socketfd_, OpCode::kInfoRsp, FAIL, strlen(FAIL),
-                              bigdata_ptr_->taskid(),
-                              bigdata_ptr_->epchoid())) {
-        LOG(ERROR) << "send OpCode::kInfoRsp failed.";
-      }
+      send_info(head_.taskid, task, FAIL);
       break;
     }
 
-    // nonsense "CA"
-    RecvOps::recv_and_drop(socketfd_, head_.length);
+    // "CA", or the shard directory
+    std::string message(head_.length, '\0');
+    if (!RecvOps::recv_message(socketfd_, head_, &message[0])) {
+      LOG(ERROR) << "recv OpCode::kCalc message failed.";
+      break;
+    }
 
-    // the main calculate part, iterate the range's factors' update
-    bool iterate_user = bigdata_ptr_->epchoid() % 2;
-    if (iterate_user) {
-
-      const uint64_t start_idx = head_.bucket * kBucketSize;
-      const uint64_t end_idx =
-        std::min<uint64_t>(start_idx + kBucketSize, engine_ptr_->nusers());
-
-      qmf::Double loss = engine_ptr_->iterate(
-        start_idx, end_idx, *bigdata_ptr_->user_factor_ptr_,
-        engine_ptr_->userIndex_, engine_ptr_->userSignals_,
-        *bigdata_ptr_->item_factor_ptr_, engine_ptr_->itemIndex_);
-      LOG(INFO) << "bucket " << head_.stepinfo() << " loss: " << loss;
-
-      // send back
-      const qmf::Matrix& matrix = bigdata_ptr_->user_factor_ptr_->getFactors();
-      const char* dat = reinterpret_cast<char*>(
-        const_cast<qmf::Matrix&>(matrix).data(start_idx));
-      uint64_t len =
-        (end_idx - start_idx) * sizeof(qmf::Double) * head_.nfactors;
-
-      if (!SendOps::send_bulk(socketfd_, OpCode::kCalcRsp, dat, len,
-                              bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
-                              head_.nfactors, head_.bucket)) {
-        LOG(ERROR) << "send OpCode::kCalcRsp failed.";
-      }
+    // queue to the compute thread, and we can receive the next bucket while
+    // this one is solving
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      ++task->pending_;
+    }
+    calc_queue_.PUSH(
+      Calc{head_, task, message == "CA" ? std::string() : message, ""});
 
-    } else {
+    break;
+  }
 
-      const uint64_t start_idx = head_.bucket * kBucketSize;
-      const uint64_t end_idx =
-        std::min<uint64_t>(start_idx + kBucketSize, engine_ptr_->nitems());
-
-      qmf::Double loss = engine_ptr_->iterate(
-        start_idx, end_idx, *bigdata_ptr_->item_factor_ptr_,
-        engine_ptr_->itemIndex_, engine_ptr_->itemSignals_,
-        *bigdata_ptr_->user_factor_ptr_, engine_ptr_->userIndex_);
-      LOG(INFO) << "bucket " << head_.stepinfo() << " loss: " << loss;
-
-      // send back
-      const qmf::Matrix& matrix = bigdata_ptr_->item_factor_ptr_->getFactors();
-      const char* dat = reinterpret_cast<char*>(
-        const_cast<qmf::Matrix&>(matrix).data(start_idx));
-      uint64_t len =
-        (end_idx - start_idx) * sizeof(qmf::Double) * head_.nfactors;
-
-      if (!SendOps::send_bulk(socketfd_, OpCode::kCalcRsp, dat, len,
-                              bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
-                              head_.nfactors, head_.bucket)) {
-        LOG(ERROR) << "send OpCode::kCalcRsp failed.";
+  case static_cast<int>(OpCode::kPushTest): {
+
+    // follows the kPushRate of the task, so the index is ready
+
+    VLOG(3) << "OpCode::kPushTest head " << std::endl << head_.dump();
+
+    std::vector<qmf::DatasetElem> test_vec;
+    retval = RecvOps::recv_rating(socketfd_, head_, &test_vec);
+    if (!retval) {
+      LOG(ERROR) << "recv test ratings failed.";
+      break;
+    }
+
+    auto task = this->task(head_.taskid);
+    const char* message = FAIL;
+    if (task) {
+      drain(task);
+      build_test(task, test_vec);
+      message = OK;
+    }
+
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (!SendOps::send_bulk(socketfd_, OpCode::kPushTestRsp, message,
+                            strlen(message), head_.taskid, head_.epchoid)) {
+      LOG(ERROR) << "send OpCode::kPushTestRsp failed.";
+    }
+
+    break;
+  }
+
+  case static_cast<int>(OpCode::kEval): {
+
+    VLOG(3) << "OpCode::kEval head " << std::endl << head_.dump();
+
+    std::string metrics(head_.length, '\0');
+    if (!RecvOps::recv_message(socketfd_, head_, &metrics[0])) {
+      LOG(ERROR) << "recv OpCode::kEval message failed.";
+      break;
+    }
+
+    // evaluated with the factors of the same epcho as the Scheduler, the late
+    // joined Labor may not have the user factors
+    auto task = this->task(head_.taskid);
+    if (!task || head_.epchoid != task->bigdata_ptr_->epchoid() ||
+        head_.epchoid != task->users_epchoid_ + 1 ||
+        task->test_users_.empty()) {
+      LOG(ERROR) << "can not evaluate " << head_.stepinfo();
+
+      Head rsp(OpCode::kEvalRsp);
+      rsp.taskid = head_.taskid;
+      rsp.epchoid = head_.epchoid;
+      rsp.bucket = head_.bucket;
+      std::lock_guard<std::mutex> lock(send_mutex_);
+      if (!SendOps::send_bulk(socketfd_, rsp, NONE, strlen(NONE))) {
+        LOG(ERROR) << "send OpCode::kEvalRsp failed.";
       }
+      break;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      ++task->pending_;
     }
+    calc_queue_.PUSH(Calc{head_, task, "", metrics});
 
     break;
   }
@@ -412,6 +911,8 @@ bool Labor::handle_head() {
   case static_cast<int>(OpCode::kPushFixedRsp):
   case static_cast<int>(OpCode::kCalcRsp):
   case static_cast<int>(OpCode::kInfoRsp):
+  case static_cast<int>(OpCode::kPushTestRsp):
+  case static_cast<int>(OpCode::kEvalRsp):
   default:
     LOG(FATAL) << "invalid OpCode received by Labor:"
                << static_cast<int>(head_.opcode);
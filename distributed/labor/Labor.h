@@ -8,18 +8,34 @@
 #ifndef __DISTRIBUTED_LABOR_LABOR_H__
 #define __DISTRIBUTED_LABOR_LABOR_H__
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include <qmf/utils/Instrumentation.h>
 #include <qmf/wals/WALSEngineLite.h>
 
 #include <distributed/common/BigData.h>
 #include <distributed/common/Common.h>
+#include <distributed/common/EQueue.h>
 #include <distributed/common/Message.h>
 
 namespace distributed {
 namespace labor {
 
+// The Labor runs with three threads:
+//   loop thread:    receive and handle all the requests
+//   compute thread: solve the queued buckets with the OpenMP pool
+//   send thread:    stream the solved rows back to the Scheduler
+// so the network transfer overlaps with the solve.
 class Labor {
 
  public:
@@ -33,6 +49,11 @@ class Labor {
     terminate_ = true;
   }
 
+  // the gauges of the tasks and queues, and the compute thread utilization
+  // for the metrics server
+  void collect_metrics(const qmf::Instrumentation::Snapshot& snapshot,
+                       std::string* out);
+
  private:
   int socketfd_ = -1;
 
@@ -40,16 +61,114 @@ class Labor {
   const int32_t port_;
   bool start_connect();
   bool start_attach();
+  // set the trace clock offset to the Scheduler's clock in the attach response
+  void sync_clock(const std::string& response,
+                  int64_t send_micros,
+                  int64_t recv_micros);
 
   bool handle_head();
 
-  bool terminate_ = false;
+  void compute_run();
+  void send_run();
+
+  // the data of one task, the Labor serves several concurrent tasks of the
+  // Scheduler. kept until evicted by the newer tasks.
+  struct Task {
+    Task()
+      : bigdata_ptr_(std::make_unique<BigData>()),
+        engine_ptr_(std::make_unique<qmf::WALSEngineLite>(bigdata_ptr_)) {
+    }
+
+    std::unique_ptr<BigData> bigdata_ptr_;
+    std::unique_ptr<qmf::WALSEngineLite> engine_ptr_;
+
+    // the test users' idx in the order of the Scheduler's buckets, and their
+    // (item idx, rating) of the test set
+    std::vector<size_t> test_users_;
+    std::vector<std::vector<std::pair<size_t, qmf::Double>>> test_labels_;
+
+    // the epcho of the fixed user factors received, the model of the epcho
+    // is complete after the following items are received
+    uint32_t users_epchoid_ = 0;
+
+    // the buckets received, but not fully sent back
+    size_t pending_ = 0;
+  };
+
+  std::shared_ptr<Task> task(uint32_t taskid);
+  std::shared_ptr<Task> create_task(uint32_t taskid);
+
+  // the rating and index of the task are ready, allocate its factors and
+  // response kPushRateRsp
+  void accept_rating(const std::shared_ptr<Task>& task);
+
+  // report our local status of the task, NONE if we don't have it
+  void send_info(uint32_t taskid,
+                 const std::shared_ptr<Task>& task,
+                 const char* message);
+
+  // wait all the queued buckets of the task solved and sent back, the factors
+  // and rating can be updated safely after it return
+  void drain(const std::shared_ptr<Task>& task);
+  size_t pending(const std::shared_ptr<Task>& task);
+  void finish_bucket(const std::shared_ptr<Task>& task);
+
+  // group the received test ratings by users with our local index
+  void build_test(const std::shared_ptr<Task>& task,
+                  const std::vector<qmf::DatasetElem>& test_vec);
+
+  // the summed metrics of the test users in the bucket, computed with the
+  // current factors in the compute thread
+  void evaluate(const Head& head,
+                const std::shared_ptr<Task>& task,
+                const std::string& metrics);
+
+  std::atomic<bool> terminate_;
+
+  // the compute utilization is the solve time since then
+  const std::chrono::steady_clock::time_point start_ =
+    std::chrono::steady_clock::now();
+
+  // the bucket to solve
+  struct Calc {
+    Head head;
+    std::shared_ptr<Task> task;
+    std::string shard_dir; // write the bucket's rows here if not empty
+    std::string metrics;   // for kEval
+  };
+
+  // the solved rows of one bucket, wait for sending back
+  struct Piece {
+    Head head;          // the kCalc request
+    std::shared_ptr<Task> task;
+    std::string shard_dir;
+    uint64_t start_idx; // the first row
+    uint64_t rows;
+    double cost;        // solve seconds of these rows
+    double loss;        // the bucket's summed loss, only in the last piece
+    bool last;          // the last piece of the bucket
+  };
+
+  // the bucket's rows as a file in the shard directory
+  void write_shard(const Piece& piece);
+
+  // the socket is shared by loop thread and send thread
+  std::mutex send_mutex_;
+
+  EQueue<Calc> calc_queue_;
+  EQueue<Piece> piece_queue_;
+  std::thread compute_thread_;
+  std::thread send_thread_;
+
+  // protect the pending_ of all the tasks
+  std::mutex pending_mutex_;
+  std::condition_variable pending_notify_;
 
   Head head_;
   int head_idx_;
 
-  std::unique_ptr<BigData> bigdata_ptr_;
-  std::unique_ptr<qmf::WALSEngineLite> engine_ptr_;
+  std::mutex tasks_mutex_;
+  std::map<uint32_t, std::shared_ptr<Task>> tasks_;
 };
 
 } // end namespace labor
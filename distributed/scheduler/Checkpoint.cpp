@@ -0,0 +1,189 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <distributed/scheduler/Checkpoint.h>
+
+#include <glog/logging.h>
+
+namespace distributed {
+namespace scheduler {
+
+static const uint64_t kCheckpointMagic = 0x54504B43464D51; // "QMFCKPT"
+static const uint32_t kCheckpointVersion = 1;
+
+std::string Checkpoint::path(const std::string& dir, bool user) {
+  return dir + (user ? "/user.ckpt" : "/item.ckpt");
+}
+
+bool Checkpoint::save(const std::string& path,
+                      uint32_t epchoid,
+                      uint64_t nratings,
+                      const qmf::Matrix& factors) {
+
+  CheckpointHeader header{};
+  header.magic = kCheckpointMagic;
+  header.version = kCheckpointVersion;
+  header.epchoid = epchoid;
+  header.nrows = factors.nrows();
+  header.ncols = factors.ncols();
+  header.nratings = nratings;
+  header.value_size = sizeof(qmf::Double);
+
+  const std::string tmpfile = path + ".tmp";
+  int fd = ::open(tmpfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "open checkpoint " << tmpfile
+               << " failed: " << strerror(errno);
+    return false;
+  }
+
+  const char* data = reinterpret_cast<const char*>(factors.data(0));
+  const uint64_t len = header.nrows * header.ncols * sizeof(qmf::Double);
+
+  bool success = false;
+  do {
+
+    if (::write(fd, &header, sizeof(header)) != sizeof(header)) {
+      LOG(ERROR) << "write checkpoint header failed: " << strerror(errno);
+      break;
+    }
+
+    uint64_t written = 0;
+    while (written < len) {
+      ssize_t retval = ::write(fd, data + written, len - written);
+      if (retval < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      written += retval;
+    }
+
+    if (written < len) {
+      LOG(ERROR) << "write checkpoint factors failed: " << strerror(errno);
+      break;
+    }
+
+    if (::fsync(fd) < 0) {
+      LOG(ERROR) << "fsync checkpoint failed: " << strerror(errno);
+      break;
+    }
+
+    success = true;
+  } while (0);
+
+  ::close(fd);
+
+  if (!success || ::rename(tmpfile.c_str(), path.c_str()) < 0) {
+    LOG(ERROR) << "save checkpoint " << path << " failed.";
+    ::unlink(tmpfile.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool Checkpoint::load(const std::string& path,
+                      uint64_t nratings,
+                      qmf::Matrix* factors,
+                      uint32_t* epchoid) {
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(INFO) << "checkpoint " << path << " not available.";
+    return false;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0 || st.st_size < 0 ||
+      static_cast<uint64_t>(st.st_size) < sizeof(CheckpointHeader)) {
+    LOG(ERROR) << "invalid checkpoint file " << path;
+    ::close(fd);
+    return false;
+  }
+
+  void* addr = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR) << "mmap checkpoint " << path << " failed: " << strerror(errno);
+    return false;
+  }
+
+  const CheckpointHeader* header =
+    reinterpret_cast<const CheckpointHeader*>(addr);
+  const uint64_t len = header->nrows * header->ncols * sizeof(qmf::Double);
+
+  bool success = false;
+  if (header->magic != kCheckpointMagic ||
+      header->version != kCheckpointVersion ||
+      header->value_size != sizeof(qmf::Double) ||
+      static_cast<uint64_t>(st.st_size) != sizeof(CheckpointHeader) + len) {
+    LOG(ERROR) << "corrupted checkpoint file " << path;
+  } else if (header->nrows != factors->nrows() ||
+             header->ncols != factors->ncols() ||
+             header->nratings != nratings) {
+    LOG(ERROR) << "checkpoint " << path << " (" << header->nrows << ","
+               << header->ncols << "), dataset " << header->nratings
+               << " mismatch the task (" << factors->nrows() << ","
+               << factors->ncols() << "), dataset " << nratings;
+  } else {
+    ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    ::memcpy(factors->data(), reinterpret_cast<const char*>(addr) +
+                                sizeof(CheckpointHeader),
+             len);
+    *epchoid = header->epchoid;
+    success = true;
+  }
+
+  ::munmap(addr, st.st_size);
+  return success;
+}
+
+uint32_t Checkpoint::resume(const std::string& dir,
+                            uint64_t nratings,
+                            qmf::Matrix* user,
+                            qmf::Matrix* item) {
+
+  // the checkpoint of one side may be absent or corrupted, each is loaded into
+  // a scratch matrix first, so the initialized factors are kept for failure
+  qmf::Matrix user_ckpt(user->nrows(), user->ncols());
+  qmf::Matrix item_ckpt(item->nrows(), item->ncols());
+  uint32_t user_epcho = 0;
+  uint32_t item_epcho = 0;
+  const bool has_user =
+    load(path(dir, true), nratings, &user_ckpt, &user_epcho);
+  const bool has_item =
+    load(path(dir, false), nratings, &item_ckpt, &item_epcho);
+
+  uint32_t epchoid = 0;
+  if (has_user && user_epcho % 2 == 1)
+    epchoid = user_epcho;
+  if (has_item && item_epcho % 2 == 0 && item_epcho > epchoid)
+    epchoid = item_epcho;
+
+  if (epchoid == 0)
+    return 0;
+
+  const bool latest_user = epchoid % 2;
+  if (latest_user || (has_user && user_epcho == epchoid - 1))
+    *user = std::move(user_ckpt);
+  if (!latest_user || (has_item && item_epcho == epchoid - 1))
+    *item = std::move(item_ckpt);
+
+  return epchoid;
+}
+
+} // end namespace scheduler
+} // end namespace distributed
@@ -0,0 +1,67 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_SCHEDULER_CHECKPOINT_H__
+#define __DISTRIBUTED_SCHEDULER_CHECKPOINT_H__
+
+#include <cstdint>
+#include <string>
+
+#include <qmf/Matrix.h>
+
+namespace distributed {
+namespace scheduler {
+
+// the factors of one side after a half epcho, the file is the fixed Header
+// followed by the raw row-major factors, so it can be mmap and used directly.
+struct CheckpointHeader {
+
+  uint64_t magic;    // "QMFCKPT"
+  uint32_t version;
+  uint32_t epchoid;  // the half epcho produced this factors
+  uint64_t nrows;
+  uint64_t ncols;
+  uint64_t nratings; // the size of the training dataset, detect mismatch
+  uint32_t value_size;
+  char reserved[20];
+
+} __attribute__((__packed__));
+
+static_assert(sizeof(CheckpointHeader) == 64, "keep the factors aligned");
+
+class Checkpoint {
+
+ public:
+  // the checkpoint file of user or item factors in dir
+  static std::string path(const std::string& dir, bool user);
+
+  // written to a temporary file and renamed, the previous checkpoint is kept
+  // when crashed in the middle
+  static bool save(const std::string& path,
+                   uint32_t epchoid,
+                   uint64_t nratings,
+                   const qmf::Matrix& factors);
+
+  // the shape and nratings must match, return the epchoid by the pointer
+  static bool load(const std::string& path,
+                   uint64_t nratings,
+                   qmf::Matrix* factors,
+                   uint32_t* epchoid);
+
+  // load the latest consistent user and item checkpoints in dir, users are
+  // produced at odd epcho and items at even. the factors are replaced only
+  // when loaded, return the epcho to continue from, 0 if none.
+  static uint32_t resume(const std::string& dir,
+                         uint64_t nratings,
+                         qmf::Matrix* user,
+                         qmf::Matrix* item);
+};
+
+} // end namespace scheduler
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_SCHEDULER_CHECKPOINT_H__
@@ -15,14 +15,31 @@
 #include <google/protobuf/text_format.h>
 #include <distributed/proto/task.pb.h>
 
+#include <distributed/common/Codec.h>
 #include <distributed/common/SendOps.h>
 #include <distributed/common/RecvOps.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Trace.h>
 
 #include <glog/logging.h>
 
 namespace distributed {
 namespace scheduler {
 
+namespace {
+
+// the handling time of each opcode, the unknown ones share one histogram
+const qmf::Histogram& handle_time(uint8_t opcode) {
+  static const std::vector<qmf::Histogram> histograms = []() {
+    std::vector<qmf::Histogram> histograms;
+    for (uint8_t op = 0; op <= kMaxOpCode; ++op)
+      histograms.emplace_back(std::string("scheduler.handle.") + opcode_name(op));
+    return histograms;
+  }();
+  return histograms[opcode <= kMaxOpCode ? opcode : 0];
+}
+} // end namespace
+
 bool Connection::event() {
 
   if (stage_ == Stage::kHead) {
@@ -56,6 +73,7 @@ bool Connection::event() {
       return false;
     }
 
+    NetStats::received(head_);
     VLOG(3) << "read head successful, transmit to  kBody: " << addr();
     stage_ = Stage::kBody;
     return handle_head();
@@ -114,8 +132,14 @@ bool Connection::handle_head() {
   case static_cast<int>(OpCode::kAttachLabor):
   case static_cast<int>(OpCode::kPushRateRsp):
   case static_cast<int>(OpCode::kPushFixedRsp):
-  case static_cast<int>(OpCode::kCalcRsp):
   case static_cast<int>(OpCode::kInfoRsp):
+  case static_cast<int>(OpCode::kPushTestRsp):
+  case static_cast<int>(OpCode::kEvalRsp):
+    break;
+
+  // the large result, let the Scheduler hand it over to the receive pool
+  case static_cast<int>(OpCode::kCalcRsp):
+    stage_ = Stage::kAsync;
     break;
 
   case static_cast<int>(OpCode::kSubmitTaskRsp):
@@ -124,6 +148,9 @@ bool Connection::handle_head() {
   case static_cast<int>(OpCode::kPushFixed):
   case static_cast<int>(OpCode::kCalc):
   case static_cast<int>(OpCode::kHeartBeat):
+  case static_cast<int>(OpCode::kPushTest):
+  case static_cast<int>(OpCode::kEval):
+  case static_cast<int>(OpCode::kReuseRate):
   default:
     LOG(FATAL) << "invalid OpCode received by scheduler:"
                << static_cast<int>(head_.opcode);
@@ -137,6 +164,7 @@ bool Connection::handle_head() {
 bool Connection::handle_body() {
 
   bool retval = true;
+  qmf::ScopedTimer timer(handle_time(head_.opcode));
 
   this->touch();
   switch (head_.opcode) {
@@ -188,9 +216,11 @@ bool Connection::handle_body() {
     std::string message = std::string(data_.data(), data_idx_);
     VLOG(3) << "kAttachLabor recv with " << message;
     is_labor_ = true;
+    codecs_ = head_.encoding;
 
     reset();
-    message = "attach_labor_rsp_ok";
+    // the Labor estimates its clock offset to ours by the round trip
+    message = "attach_labor_rsp_ok " + std::to_string(qmf::Trace::wallMicros());
     SendOps::send_message(socket_, OpCode::kAttachLaborRsp, message);
     break;
   }
@@ -202,8 +232,12 @@ bool Connection::handle_body() {
 
     if (message == "OK") {
       LOG(INFO) << "kPushRateRsp return OK, update our status";
-      taskid_ = head_.taskid;
-      epchoid_ = head_.epchoid;
+      update_task(head_.taskid, head_.epchoid);
+    } else {
+      // the reused rating is not available, push the full rating next time
+      LOG(INFO) << "kPushRateRsp " << message << " from " << addr()
+                << " for task " << head_.taskid;
+      drop_task(head_.taskid);
     }
     reset();
     break;
@@ -216,198 +250,69 @@ bool Connection::handle_body() {
 
     if (message == "OK") {
       LOG(INFO) << "kPushFixedRsp OK from " << addr() << ", update our status";
-      taskid_ = head_.taskid;
-      epchoid_ = head_.epchoid;
+      update_task(head_.taskid, head_.epchoid);
     }
     reset();
     break;
   }
 
-  case static_cast<int>(OpCode::kCalcRsp): {
-
-    auto& bigdata_ptr = scheduler_.bigdata_ptr();
-    auto& engine_ptr = scheduler_.engine_ptr();
+  case static_cast<int>(OpCode::kInfoRsp): {
 
-    // note: we can not download the data directly to the destination, because
-    // we should check whether the result is valid
-    VLOG(3) << "already recv data size: " << data_idx_;
+    // this is the backup schema part
+    // when Labors receive the kHeartBeat message, or the Scheduler's request
+    // check failed, then the Labor will send its local epchoid of the task,
+    // indicates the already received data, then the Task can decide whether
+    // the Labor is in stale status, and sync it in the push pool.
 
-    do {
+    std::string message = std::string(data_.data(), data_idx_);
+    VLOG(3) << "kInfoRsp recv with " << message << ", " << head_.stepinfo();
 
-      // the result is not our desire, drop and return
-      if (head_.taskid != bigdata_ptr->taskid() ||
-          head_.epchoid != bigdata_ptr->epchoid()) {
-        LOG(ERROR) << "unmatch calc response: " << head_.dump();
-        break;
-      }
+    auto task = scheduler_.task(head_.taskid);
+    if (message == "NONE") {
 
-      // copy the result to the destination, and then update bucket_bits_
-
-      char* dest = nullptr;
-      uint64_t len = 0;
-
-      bool iterate_user = bigdata_ptr->epchoid() % 2;
-      if (iterate_user) {
-
-        const uint64_t start_idx = head_.bucket * kBucketSize;
-        const uint64_t end_idx =
-          std::min<uint64_t>(start_idx + kBucketSize, engine_ptr->nusers());
-
-        // users factors
-        const qmf::Matrix& matrix = bigdata_ptr->user_factor_ptr_->getFactors();
-        dest = reinterpret_cast<char*>(
-          const_cast<qmf::Matrix&>(matrix).data(start_idx));
-        len = (end_idx - start_idx) * sizeof(qmf::Double) * head_.nfactors;
-
-        if (len != head_.length) {
-          LOG(ERROR) << "length check failed, expect " << len << ", but get "
-                     << head_.length;
-          dest = nullptr;
-          break;
-        }
-
-      } else {
-
-        const uint64_t start_idx = head_.bucket * kBucketSize;
-        const uint64_t end_idx =
-          std::min<uint64_t>(start_idx + kBucketSize, engine_ptr->nitems());
-
-        // items factors
-        const qmf::Matrix& matrix = bigdata_ptr->item_factor_ptr_->getFactors();
-        dest = reinterpret_cast<char*>(
-          const_cast<qmf::Matrix&>(matrix).data(start_idx));
-        len = (end_idx - start_idx) * sizeof(qmf::Double) * head_.nfactors;
-
-        if (len != head_.length) {
-          LOG(ERROR) << "length check failed, expect " << len << ", but get "
-                     << head_.length;
-          dest = nullptr;
-          break;
-        }
-      }
+      LOG(INFO) << "labor " << addr() << " has no data of task "
+                << head_.taskid;
+      drop_task(head_.taskid);
 
-      if (dest && len) {
+    } else if (task) {
 
-        // this bucket calculate successfully, we update the time cost to
-        // the bigdata for stale estimate.
+      update_task(head_.taskid, head_.epchoid);
 
-        ::memcpy(dest, data_.data(), len);
-        bigdata_ptr->bucket_bits_[head_.bucket] = true;
-        time_t cost = ::time(NULL) - bucket_start_;
-        LOG(INFO) << "bucket calculate task " << head_.stepinfo()
-                  << " successfully, time cost " << cost << " secs. ";
+      if (head_.epchoid != task->bigdata_ptr()->epchoid()) {
+        LOG(INFO) << "found for taskid " << head_.taskid
+                  << ", remote epchoid: " << head_.epchoid << ", expect "
+                  << task->bigdata_ptr()->epchoid();
+        reset_synced(head_.taskid);
+      } else if (head_.bucket == 0) {
+        // the bucket field carries the Labor's unfinished bucket count, the
+        // dispatched buckets are lost when it has nothing to do
+        clear_inflight(head_.taskid);
       }
-
-    } while (0);
+    }
 
     reset();
     break;
   }
 
-  case static_cast<int>(OpCode::kInfoRsp): {
-
-    // this is the backup schema part
-    // when Labors receive the kHeartBeat message, or the Scheduler's request
-    // check failed, then the Labor will send its local taskid and epchoid,
-    // indicates the already received data, then Scheduler can decide whether
-    // the Labor is in stale status.
-
-    auto& bigdata_ptr = scheduler_.bigdata_ptr();
-
-    do {
-      if (head_.taskid != bigdata_ptr->taskid()) {
+  case static_cast<int>(OpCode::kPushTestRsp): {
 
-        LOG(INFO) << "found remote taskid: " << head_.taskid
-                  << ", update it with " << bigdata_ptr->taskid();
-
-        if (lock_socket_.test_and_set()) {
-          LOG(INFO) << "connection socket used by other ..." << addr();
-          break;
-        }
-
-        VLOG(3) << "== LUCKY resent task " << bigdata_ptr->taskid()
-                << " rating to remote " << addr();
-
-        const auto& dataset = bigdata_ptr->rating_vec_;
-        const char* dat = reinterpret_cast<const char*>(dataset.data());
-        uint64_t len = sizeof(dataset[0]) * dataset.size();
-
-        if (!SendOps::send_bulk(
-              socket_, OpCode::kPushRate, dat, len, bigdata_ptr->taskid(),
-              bigdata_ptr->epchoid(), bigdata_ptr->nfactors(), 0,
-              bigdata_ptr->lambda(), bigdata_ptr->confidence())) {
-          LOG(ERROR) << "fallback sending rating to " << addr() << " failed.";
-        }
-
-        lock_socket_.clear();
-
-      } else if (head_.epchoid != bigdata_ptr->epchoid()) {
-
-        LOG(INFO) << "found for taskid " << head_.taskid
-                  << ", remote epchoid: " << head_.epchoid
-                  << ", update it with " << bigdata_ptr->epchoid();
-
-        if (lock_socket_.test_and_set()) {
-          LOG(INFO) << "connection socket used by other ..." << addr();
-          break;
-        }
-
-        VLOG(3) << "== LUCKY resent fixedfactor " << bigdata_ptr->taskid()
-                << ":" << bigdata_ptr->epchoid() << " rating to remote "
-                << addr();
-
-        const char* dat = nullptr;
-        uint64_t len = 0;
-        if (bigdata_ptr->epchoid() % 2) {
-          const qmf::Matrix& matrix =
-            bigdata_ptr->item_factor_ptr_->getFactors();
-          dat = reinterpret_cast<const char*>(
-            const_cast<qmf::Matrix&>(matrix).data());
-          len =
-            sizeof(qmf::Matrix::value_type) * matrix.nrows() * matrix.ncols();
-          LOG(INFO) << "epcho_id " << bigdata_ptr->epchoid()
-                    << " transform itemFactors with size " << len;
-        } else {
-          const qmf::Matrix& matrix =
-            bigdata_ptr->user_factor_ptr_->getFactors();
-          dat = reinterpret_cast<const char*>(
-            const_cast<qmf::Matrix&>(matrix).data());
-          len =
-            sizeof(qmf::Matrix::value_type) * matrix.nrows() * matrix.ncols();
-          LOG(INFO) << "epcho_id " << bigdata_ptr->epchoid()
-                    << " transform userFactors with size " << len;
-        }
-
-        if (!SendOps::send_bulk(
-              socket_, OpCode::kPushFixed, dat, len, bigdata_ptr->taskid(),
-              bigdata_ptr->epchoid(), bigdata_ptr->nfactors(), 0,
-              bigdata_ptr->lambda(), bigdata_ptr->confidence())) {
-          LOG(ERROR) << "fallback sending fixed to " << addr() << " failed.";
-        }
-
-        lock_socket_.clear();
-
-      } else {
-
-        // GOOD, latest info for this connection.
-        // don't forget to update the latest labor information to our Scheduler
-        // local record
-
-        std::string message = std::string(data_.data(), data_idx_);
-        VLOG(3) << "kPushFixedRsp recv with " << message;
-
-        if (message == "OK") {
-          LOG(INFO) << "kPushFixedRsp OK from " << addr()
-                    << ", update our status";
-          taskid_ = head_.taskid;
-          epchoid_ = head_.epchoid;
-        }
-        reset();
-        break;
-      }
+    std::string message = std::string(data_.data(), data_idx_);
+    if (message != "OK") {
+      LOG(ERROR) << "kPushTestRsp " << message << " from " << addr()
+                 << " for task " << head_.taskid;
+    }
+    reset();
+    break;
+  }
 
-    } while (0);
+  case static_cast<int>(OpCode::kEvalRsp): {
 
+    // the partial sums of the evaluated bucket
+    auto task = scheduler_.task(head_.taskid);
+    if (task) {
+      task->eval_result(socket_, head_.epchoid, head_.bucket,
+                        std::string(data_.data(), data_idx_));
+    }
     reset();
     break;
   }
@@ -418,6 +323,9 @@ bool Connection::handle_body() {
   case static_cast<int>(OpCode::kPushFixed):
   case static_cast<int>(OpCode::kCalc):
   case static_cast<int>(OpCode::kHeartBeat):
+  case static_cast<int>(OpCode::kPushTest):
+  case static_cast<int>(OpCode::kEval):
+  case static_cast<int>(OpCode::kReuseRate):
   default:
     LOG(FATAL) << "invalid OpCode received by Scheduler:"
                << static_cast<int>(head_.opcode);
@@ -428,5 +336,103 @@ bool Connection::handle_body() {
   return retval;
 }
 
+bool Connection::recv_calc_rsp() {
+
+  qmf::ScopedTimer timer(handle_time(head_.opcode));
+  this->touch();
+
+  // validate from the header, then the rows can be received directly to the
+  // destination without buffered
+  do {
+
+    // the task may be finished already
+    auto task = scheduler_.task(head_.taskid);
+    if (!task) {
+      LOG(ERROR) << "unknown task of calc response: " << head_.dump();
+      break;
+    }
+
+    auto& bigdata_ptr = task->bigdata_ptr();
+    auto& engine_ptr = task->engine_ptr();
+
+    // the result is not our desire, drop and return
+    if (head_.epchoid != bigdata_ptr->epchoid() ||
+        head_.bucket_size != bigdata_ptr->bucket_size()) {
+      LOG(ERROR) << "unmatch calc response: " << head_.dump();
+      break;
+    }
+
+    const bool iterate_user = bigdata_ptr->epchoid() % 2;
+    const uint64_t nrows =
+      iterate_user ? engine_ptr->nusers() : engine_ptr->nitems();
+    const uint64_t bucket_idx =
+      static_cast<uint64_t>(head_.bucket) * head_.bucket_size;
+    const uint64_t end_idx =
+      std::min<uint64_t>(bucket_idx + head_.bucket_size, nrows);
+    const uint64_t start_idx = bucket_idx + head_.offset;
+
+    const qmf::Matrix& matrix =
+      iterate_user ? bigdata_ptr->user_factor_ptr_->getFactors()
+                   : bigdata_ptr->item_factor_ptr_->getFactors();
+
+    if (head_.nfactors != matrix.ncols() || start_idx >= end_idx) {
+      LOG(ERROR) << "invalid calc response: " << head_.dump();
+      break;
+    }
+
+    // decode the result rows to the destination, and then update
+    // bucket_bits_ when all the rows of this bucket received
+
+    uint64_t rows = 0;
+    qmf::Double* dest = const_cast<qmf::Matrix&>(matrix).data(start_idx);
+    if (!RecvOps::recv_factors(socket_, head_, dest, end_idx - start_idx,
+                               head_.nfactors, nullptr, &rows)) {
+      LOG(ERROR) << "recv calc response failed: " << head_.dump();
+      reset();
+      return true;
+    }
+
+    // the Labor's solve cost tunes the bucket size of the next half epcho
+    bigdata_ptr->record_cost(iterate_user, rows, head_.cost);
+
+    double cost = 0;
+    if (recv_rows(head_.taskid, head_.bucket, rows, end_idx - bucket_idx,
+                  &cost) &&
+        bigdata_ptr->mark_bucket(head_.epchoid, head_.bucket, head_.loss,
+                                 end_idx - bucket_idx)) {
+      static const qmf::Counter buckets_completed("scheduler.buckets_completed");
+      static const qmf::Histogram bucket_time("scheduler.bucket");
+      buckets_completed.add();
+      bucket_time.recordSeconds(cost);
+
+      // one track of overlapped buckets per Labor, unique by the id
+      qmf::Trace& trace = qmf::Trace::get();
+      if (trace.enabled()) {
+        const uint64_t id = static_cast<uint64_t>(head_.taskid) << 48 |
+                            static_cast<uint64_t>(head_.epchoid) << 24 |
+                            head_.bucket;
+        trace.async("bucket",
+                    "bucket " + addr_ + ":" + std::to_string(port_), id,
+                    trace.now() - static_cast<int64_t>(cost * 1e6),
+                    "\"taskid\":" + std::to_string(head_.taskid) +
+                      ",\"epchoid\":" + std::to_string(head_.epchoid) +
+                      ",\"bucket\":" + std::to_string(head_.bucket) +
+                      ",\"rows\":" + std::to_string(end_idx - bucket_idx));
+      }
+      LOG(INFO) << "bucket calculate task " << head_.stepinfo()
+                << " successfully, time cost " << cost << " secs. ";
+    }
+
+    reset();
+    return true;
+
+  } while (0);
+
+  // read out the unwanted body to keep the stream in sync
+  bool retval = RecvOps::drop_payload(socket_, head_);
+  reset();
+  return retval;
+}
+
 } // end namespace scheduler
 } // end namespace distributed
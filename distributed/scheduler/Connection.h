@@ -9,11 +9,17 @@
 #define __DISTRIBUTED_SCHEDULER_CONNECTION_H__
 
 #include <sys/select.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <map>
+#include <mutex>
 #include <atomic> // std::atomic_flag
+#include <chrono>
 
 #include <distributed/common/Common.h>
 #include <distributed/common/Message.h>
@@ -25,22 +31,60 @@ namespace scheduler {
 
 class Scheduler;
 
+// the fds may be added back by the receive pool threads, so all the access
+// are protected by lock_, and the select loop is woke up by the wakeup pipe.
 struct Select {
 
   Select(int socket) : listenfd_(socket) {
     maxfd_ = listenfd_;
     FD_ZERO(&readfds_);
     FD_SET(listenfd_, &readfds_);
+
+    if (::pipe(wakeupfd_) == 0) {
+      ::fcntl(wakeupfd_[0], F_SETFL, O_NONBLOCK);
+      ::fcntl(wakeupfd_[1], F_SETFL, O_NONBLOCK);
+      maxfd_ = std::max(maxfd_, wakeupfd_[0]);
+      FD_SET(wakeupfd_[0], &readfds_);
+    } else {
+      LOG(ERROR) << "create wakeup pipe failed: " << strerror(errno);
+      wakeupfd_[0] = wakeupfd_[1] = -1;
+    }
   }
 
   void add_fd(int socketfd) {
-    maxfd_ = socketfd > maxfd_ ? socketfd : maxfd_;
-    FD_SET(socketfd, &readfds_);
-    VLOG(3) << "add fd " << socketfd << ", maxfd " << maxfd_;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      maxfd_ = socketfd > maxfd_ ? socketfd : maxfd_;
+      FD_SET(socketfd, &readfds_);
+      VLOG(3) << "add fd " << socketfd << ", maxfd " << maxfd_;
+    }
+
+    if (wakeupfd_[1] >= 0) {
+      char c = 'W';
+      (void)::write(wakeupfd_[1], &c, 1);
+    }
+  }
+
+  // the fds set to be select currently
+  void snapshot(fd_set* fds, int* maxfd) {
+    std::lock_guard<std::mutex> lock(lock_);
+    *fds = readfds_;
+    *maxfd = maxfd_;
+  }
+
+  bool is_wakeup(int socketfd) const {
+    return socketfd == wakeupfd_[0];
+  }
+
+  void drain_wakeup() {
+    char buff[64];
+    while (::read(wakeupfd_[0], buff, sizeof(buff)) > 0) {
+    }
   }
 
   void del_fd(int socketfd) {
 
+    std::lock_guard<std::mutex> lock(lock_);
     FD_CLR(socketfd, &readfds_);
 
     int n = 0;
@@ -59,11 +103,15 @@ struct Select {
   int listenfd_ = 0;
   int maxfd_ = 0;
   fd_set readfds_;
+
+  int wakeupfd_[2];
+  std::mutex lock_;
 };
 
 class Connection {
 
   friend class Scheduler;
+  friend class Task;
 
  public:
   Connection(Scheduler& scheduler,
@@ -73,9 +121,7 @@ class Connection {
     : scheduler_(scheduler),
       addr_(addr),
       port_(port),
-      socket_(socket),
-      taskid_(0),
-      epchoid_(0) {
+      socket_(socket) {
 
     stage_ = Stage::kHead;
     head_idx_ = 0;
@@ -88,6 +134,11 @@ class Connection {
   bool handle_head();
   bool handle_body();
 
+  // the kCalcRsp body is received by the Scheduler's receive pool directly to
+  // the factors, the socket is removed from select in the meantime. return
+  // false on critical socket error.
+  bool recv_calc_rsp();
+
   std::string addr() const {
     std::stringstream ss;
     ss << "(" << socket_ << ") " << addr_ << ":" << port_;
@@ -100,7 +151,113 @@ class Connection {
     data_idx_ = 0;
 
     stage_ = Stage::kHead;
-    is_busy_ = false;
+  }
+
+  // the buckets dispatched to this Labor and not fully responsed yet, the
+  // Labor streams each bucket back with several kCalcRsp
+  size_t inflight() {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    return inflight_.size();
+  }
+
+  size_t inflight(uint32_t taskid) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    auto begin = inflight_.lower_bound(inflight_key(taskid, 0));
+    auto end = inflight_.lower_bound(inflight_key(taskid + 1, 0));
+    return std::distance(begin, end);
+  }
+
+  bool is_inflight(uint32_t taskid, uint32_t bucket) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    return inflight_.find(inflight_key(taskid, bucket)) != inflight_.end();
+  }
+
+  // start is taken before sending the kCalc, the Labor may begin right away
+  void add_inflight(uint32_t taskid,
+                    uint32_t bucket,
+                    std::chrono::steady_clock::time_point start) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    inflight_[inflight_key(taskid, bucket)] = InflightBucket{0, start};
+  }
+
+  void clear_inflight(uint32_t taskid) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    inflight_.erase(inflight_.lower_bound(inflight_key(taskid, 0)),
+                    inflight_.lower_bound(inflight_key(taskid + 1, 0)));
+  }
+
+  // return true when all the total rows of this bucket received, and the
+  // seconds since the bucket dispatched will be returned. the bucket may be
+  // cleared already, when its duplicate completed on another Labor and the
+  // epcho advanced, such late rows are ignored.
+  bool recv_rows(uint32_t taskid,
+                 uint32_t bucket,
+                 uint64_t rows,
+                 uint64_t total,
+                 double* cost) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    auto iter = inflight_.find(inflight_key(taskid, bucket));
+    if (iter == inflight_.end())
+      return false;
+
+    auto& item = iter->second;
+    item.rows += rows;
+    if (item.rows < total)
+      return false;
+
+    *cost = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          item.start)
+              .count();
+    inflight_.erase(iter);
+    return true;
+  }
+
+  // the Labor holds the rating of taskid, and the fixed factors of epchoid
+  bool has_task(uint32_t taskid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    return tasks_.find(taskid) != tasks_.end();
+  }
+
+  bool is_ready(uint32_t taskid, uint32_t epchoid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    auto iter = tasks_.find(taskid);
+    return iter != tasks_.end() && iter->second == epchoid;
+  }
+
+  void update_task(uint32_t taskid, uint32_t epchoid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_[taskid] = epchoid;
+  }
+
+  // the Labor evicted the task, or the rating push failed
+  void drop_task(uint32_t taskid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_.erase(taskid);
+    synced_.erase(taskid);
+  }
+
+  // the epcho of the latest rating / fixed factors pushed, avoid pushing
+  // again before the Labor response
+  bool is_synced(uint32_t taskid, uint32_t epchoid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    auto iter = synced_.find(taskid);
+    return iter != synced_.end() && iter->second == epchoid;
+  }
+
+  void mark_synced(uint32_t taskid, uint32_t epchoid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    synced_[taskid] = epchoid;
+  }
+
+  void reset_synced(uint32_t taskid) {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    synced_.erase(taskid);
+  }
+
+  // the task is finished in Scheduler, but its data is kept in the Labor
+  void finish_task(uint32_t taskid) {
+    clear_inflight(taskid);
+    reset_synced(taskid);
   }
 
   // when Labor has some problem and Scheduler need compute resources, the
@@ -123,11 +280,6 @@ class Connection {
   std::atomic_flag lock_socket_ = ATOMIC_FLAG_INIT;
   // latest action of this connection
   time_t timestamp_;
-  time_t bucket_start_;
-
-  // indicats when the corresponding Labor has already been distributed a
-  // calcuate task
-  bool is_busy_ = false;
 
  private:
   // because of the Scheduler uniform "select" designe, the wals_submit will
@@ -135,15 +287,32 @@ class Connection {
   // critical case
   bool is_labor_ = false;
 
-  // the taskid_ and epchoid_ somehow indicates the client's status, but
+  // the tasks (taskid -> epchoid) somehow indicates the client's status, but
   // remember in distributed situation, it is not in strong consensus.
-  uint32_t taskid_ = 0;
-  uint32_t epchoid_ = 0;
+  std::mutex tasks_mutex_;
+  std::map<uint32_t, uint32_t> tasks_;
+  std::map<uint32_t, uint32_t> synced_;
+
+  // the payload encodings announced by the Labor in kAttachLabor
+  uint8_t codecs_ = 0;
+
+  struct InflightBucket {
+    uint64_t rows; // already received rows
+    std::chrono::steady_clock::time_point start; // dispatch time
+  };
+
+  static uint64_t inflight_key(uint32_t taskid, uint32_t bucket) {
+    return static_cast<uint64_t>(taskid) << 32 | bucket;
+  }
+
+  std::mutex inflight_mutex_;
+  std::map<uint64_t, InflightBucket> inflight_;
 
   enum class Stage {
     kHead = 1, // in reading head period
     kBody = 2, // in reading body period
     kDone = 3, // already processed
+    kAsync = 4, // body handed over to the receive pool
   } stage_;
 
   Head head_;
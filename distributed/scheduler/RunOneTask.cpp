@@ -5,15 +5,36 @@
  *
  */
 
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <future>
 #include <random>
 
 #include <distributed/scheduler/Scheduler.h>
+#include <distributed/scheduler/Checkpoint.h>
+#include <distributed/common/Codec.h>
+#include <distributed/common/SendOps.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
+#include <qmf/utils/Trace.h>
 
 #include <glog/logging.h>
 
 namespace distributed {
 namespace scheduler {
 
+namespace {
+
+// the args of the trace events
+std::string trace_args(uint32_t taskid, uint32_t epchoid) {
+  return "\"taskid\":" + std::to_string(taskid) +
+         ",\"epchoid\":" + std::to_string(epchoid);
+}
+} // end namespace
+
 std::string task_def_dump(const std::shared_ptr<TaskDef>& taskdef) {
 
   std::stringstream ss;
@@ -30,35 +51,119 @@ std::string task_def_dump(const std::shared_ptr<TaskDef>& taskdef) {
      << "\ttrain_set: " << taskdef->train_set() << std::endl
      << "\tuser_factors: " << taskdef->user_factors() << std::endl
      << "\titem_factors: " << taskdef->item_factors() << std::endl
+     << "\tfactor_encoding: " << FactorEncoding_Name(taskdef->factor_encoding())
+     << std::endl
+     << "\trating_varint: " << taskdef->rating_varint() << std::endl
+     << "\tblock_compress: " << taskdef->block_compress() << std::endl
+     << "\tbucket_seconds: " << taskdef->bucket_seconds() << std::endl
+     << "\tbucket_size: " << taskdef->bucket_size() << std::endl
+     << "\tcheckpoint_dir: " << taskdef->checkpoint_dir() << std::endl
+     << "\tresume: " << taskdef->resume() << std::endl
+     << "\tpriority: " << taskdef->priority() << std::endl
+     << "\tshard_factors: " << taskdef->shard_factors() << std::endl
+     << "\ttolerance: " << taskdef->tolerance() << std::endl
+     << "\ttest_set: " << taskdef->test_set() << std::endl
+     << "\tnum_test_users: " << taskdef->num_test_users() << std::endl
+     << "\ttest_always: " << taskdef->test_always() << std::endl
      << "------    end    ------" << std::endl;
 
   return ss.str();
 }
 
-bool Scheduler::RunOneTask(const std::shared_ptr<TaskDef>& taskdef) {
+Task::Task(Scheduler& scheduler,
+           const std::shared_ptr<TaskDef>& taskdef,
+           uint32_t taskid)
+  : scheduler_(scheduler), taskdef_(taskdef), taskid_(taskid) {
 
-  LOG(INFO) << task_def_dump(taskdef);
+  bigdata_ptr_ = std::make_unique<BigData>();
+  engine_ptr_ = std::make_unique<qmf::WALSEngineLite>(bigdata_ptr_);
+}
 
-  bigdata_ptr_->start_term(taskdef->nfactors(),
-                           taskdef->regularization_lambda(),
-                           taskdef->confidence_weight());
+std::string Task::dataset_key() const {
+  // the varint encoding sorts the rating, so the index differs
+  return taskdef_->train_set() + (taskdef_->rating_varint() ? ":sorted" : "");
+}
 
-  // step 1. load train set
+bool Task::load_dataset() {
+
+  // share with the running task on the same dataset, avoid parsing and
+  // indexing again
+  auto loaded = scheduler_.loaded_task(dataset_key(), taskid_);
+  if (loaded) {
+    LOG(INFO) << "reuse the training dataset of task " << loaded->taskid();
+    bigdata_ptr_->rating_ptr_ = loaded->bigdata_ptr()->rating_ptr_;
+    engine_ptr_->share(*loaded->engine_ptr());
+    return true;
+  }
 
   LOG(INFO) << "loading training dataset";
-  qmf::DatasetReader trainReader(taskdef->train_set());
-  trainReader.readAll(bigdata_ptr_->rating_vec_);
-  if (bigdata_ptr_->rating_vec_.empty()) {
-    LOG(ERROR) << "training dataset empty: " << taskdef->train_set();
+  auto dataset = std::make_shared<std::vector<qmf::DatasetElem>>();
+  qmf::DatasetReader trainReader(taskdef_->train_set());
+  trainReader.readAll(*dataset);
+  if (dataset->empty()) {
+    LOG(ERROR) << "training dataset empty: " << taskdef_->train_set();
     return false;
   }
-  LOG(INFO) << "total training dataset size: "
-            << bigdata_ptr_->rating_vec_.size();
 
-  // this will build users/items index
-  engine_ptr_->init();
+  // the varint encoding stores the delta of ids, group them to make it small
+  if (taskdef_->rating_varint()) {
+    std::sort(dataset->begin(), dataset->end(),
+              [](const qmf::DatasetElem& a, const qmf::DatasetElem& b) {
+                return a.userId < b.userId ||
+                       (a.userId == b.userId && a.itemId < b.itemId);
+              });
+  }
+
+  bigdata_ptr_->rating_ptr_ = std::move(dataset);
+  return true;
+}
+
+bool Task::RunOneTask() {
+
+  const auto& taskdef = taskdef_;
+  LOG(INFO) << "task " << taskid_ << task_def_dump(taskdef);
+
+  bigdata_ptr_->start_term(taskid_, taskdef->nfactors(),
+                           taskdef->regularization_lambda(),
+                           taskdef->confidence_weight());
+
+  const uint8_t compress = taskdef->block_compress() ? kEncodingLZ : 0;
+  bigdata_ptr_->set_encoding(
+    (taskdef->rating_varint() ? static_cast<uint8_t>(Encoding::kVarint) : 0) |
+      compress,
+    static_cast<uint8_t>(taskdef->factor_encoding()) | compress);
+  bigdata_ptr_->set_bucket(taskdef->bucket_seconds(), taskdef->bucket_size());
+
+  static const qmf::Histogram load_time("scheduler.load");
+  static const qmf::Histogram init_time("scheduler.init");
+  static const qmf::Histogram half_epcho_time("scheduler.half_epcho");
+  static const qmf::Histogram save_time("scheduler.save");
+
+  qmf::Trace& trace = qmf::Trace::get();
+  const std::string task_args = trace_args(taskid_, 0);
+
+  // step 1. load train set
+
+  qmf::Timer timer;
+  int64_t trace_start = trace.now();
+  if (!load_dataset())
+    return false;
+  LOG(INFO) << "total training dataset size: " << bigdata_ptr_->nratings();
+  load_time.recordSeconds(timer.seconds());
+  trace.complete("task", "load", trace_start, task_args);
+  LOG(INFO) << "phase load took " << timer.seconds() << "s";
+  timer.reset();
+  trace_start = trace.now();
+
+  // this will build users/items index, unless shared by load_dataset
+  if (!engine_ptr_->initialized())
+    engine_ptr_->init();
   LOG(INFO) << "detected item count: " << engine_ptr_->nitems();
   LOG(INFO) << "detected user count: " << engine_ptr_->nusers();
+  loaded_ = true;
+
+  if (!taskdef->test_set().empty() && !load_testset())
+    return false;
 
   // step 2. uniform the fixed factors
   bigdata_ptr_->item_factor_ptr_ = std::make_shared<qmf::FactorData>(
@@ -85,98 +190,504 @@ bool Scheduler::RunOneTask(const std::shared_ptr<TaskDef>& taskdef) {
               << taskdef->distribution_file();
   }
 
-  // step 3. push rating matrix to all labors
+  // continue from the latest checkpoint, the next half epcho only depends on
+  // the factors produced by the latest one
+  if (taskdef->resume() && !taskdef->checkpoint_dir().empty()) {
+    if (!resume_checkpoint(taskdef->checkpoint_dir())) {
+      LOG(INFO) << "no usable checkpoint in " << taskdef->checkpoint_dir()
+                << ", start from the beginning.";
+    }
+  }
 
-  // at least more than half Labors should available
-  const size_t kStartConnectionCount = connections_count();
-  const size_t kQuorumsConnectionCount = kStartConnectionCount / 2 + 1;
-  LOG(INFO) << "current total Labor count " << kStartConnectionCount
-            << ", at least available Labor: " << kQuorumsConnectionCount;
+  // step 3. push rating matrix to all labors
 
   if (!push_all_rating_matrix()) {
     LOG(ERROR) << "scheduler push rating matrix to all labor failed.";
     return false;
   }
-
-  size_t rate_count = 0;
-  while ((rate_count = connections_count(true)) < kQuorumsConnectionCount) {
-
-    LOG(INFO) << "waiting ... current rateload labor count " << rate_count
-              << ", expect at least " << kStartConnectionCount;
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-  }
+  init_time.recordSeconds(timer.seconds());
+  trace.complete("task", "init", trace_start, task_args);
+  LOG(INFO) << "phase init took " << timer.seconds() << "s";
 
   // step 4. iterate to do the m.f.
-  size_t fixed_count = 0;
-  for (size_t i = 0; i < taskdef->nepochs(); ++i) {
-
+  // epcho_id_ = 1, 3, 5, ... fix item, cal user
+  // epcho_id_ = 2, 4, 6, ... fix user, cal item
+  std::future<bool> saving;
+  bool user_sharded = false;
+  bool item_sharded = false;
+  double last_loss = 0;
+  const uint32_t total = taskdef->nepochs() * 2;
+  while (bigdata_ptr_->epchoid() < total) {
+
+    timer.reset();
+    trace_start = trace.now();
     bigdata_ptr_->incr_epchoid();
     push_all_fixed_factors();
 
-    // waiting more than half FixedLoad
-    while ((fixed_count = connections_count(true)) < kQuorumsConnectionCount) {
+    const bool iterate_user = bigdata_ptr_->epchoid() % 2;
+    wait_quorum(iterate_user ? "users" : "items");
 
-      LOG(INFO) << "waiting ... current fixedload labor count " << fixed_count
-                << ", expect at least " << kQuorumsConnectionCount;
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+    // the Labors hold both factors of the previous epcho now
+    if (iterate_user && taskdef->test_always() && test_users_ > 0 &&
+        bigdata_ptr_->epchoid() > 1) {
+      evaluate();
     }
 
-    LOG(INFO) << "begin iterate users factors ...";
-    if (!iterate_factors()) {
+    // the last half epcho of each side produces the final factors
+    shard_dir_.clear();
+    if (taskdef->shard_factors() && bigdata_ptr_->epchoid() + 2 > total) {
+      const std::string dir = (iterate_user ? taskdef->user_factors()
+                                            : taskdef->item_factors()) +
+                              ".shards";
+      if (prepare_shards(dir))
+        shard_dir_ = dir;
+    }
+
+    LOG(INFO) << "begin iterate " << (iterate_user ? "users" : "items")
+              << " factors ...";
+    iterating_ = true;
+    const bool success = iterate_factors();
+    iterating_ = false;
+    if (!shard_dir_.empty())
+      (iterate_user ? user_sharded : item_sharded) = true;
+    if (!success) {
       LOG(ERROR) << "task " << bigdata_ptr_->taskid() << ":"
-                 << bigdata_ptr_->epchoid()
-                 << " iterate users factors failed!!!";
+                 << bigdata_ptr_->epchoid() << " iterate "
+                 << (iterate_user ? "users" : "items") << " factors failed!!!";
       return false;
     }
 
+    // the next half epcho only reads these factors, so save them in
+    // background, but the previous saving must finish before the factors it
+    // saving are updated by the next half epcho
+    if (!taskdef->checkpoint_dir().empty()) {
+      if (saving.valid())
+        saving.get();
+      const uint32_t epchoid = bigdata_ptr_->epchoid();
+      saving = std::async(std::launch::async, [this, taskdef, epchoid]() {
+        return save_checkpoint(taskdef->checkpoint_dir(), epchoid);
+      });
+    }
+
+    // the loss of the items half is the loss of the whole epcho, stop when
+    // its relative improvement is below the tolerance
+    const double loss = bigdata_ptr_->loss();
+    half_epcho_time.recordSeconds(timer.seconds());
+    trace.complete("task", iterate_user ? "users" : "items", trace_start,
+                   trace_args(taskid_, bigdata_ptr_->epchoid()));
+    LOG(INFO) << "task " << taskid_ << ":" << bigdata_ptr_->epchoid() << " "
+              << (iterate_user ? "users" : "items") << " train loss = " << loss
+              << ", took " << timer.seconds() << "s";
+    if (!iterate_user && metrics_engine_)
+      metrics_engine_->recordInstrumentation(
+        bigdata_ptr_->epchoid() / 2, qmf::Instrumentation::get().snapshot());
+    if (!iterate_user) {
+      if (taskdef->tolerance() > 0 && last_loss > 0 &&
+          (last_loss - loss) / last_loss < taskdef->tolerance()) {
+        LOG(INFO) << "task " << taskid_ << " converged at epcho "
+                  << bigdata_ptr_->epchoid() / 2 << ", loss " << last_loss
+                  << " -> " << loss;
+        break;
+      }
+      last_loss = loss;
+    }
+  }
+
+  if (saving.valid())
+    saving.get();
+
+  // the Labors already hold the user factors of the last epcho, push the item
+  // factors once more for the final evaluation
+  if (test_users_ > 0) {
     bigdata_ptr_->incr_epchoid();
     push_all_fixed_factors();
+    wait_quorum("evaluation");
+    evaluate();
+  }
 
-    // waiting more then half FixedLoad
-    while ((fixed_count = connections_count(true)) < kQuorumsConnectionCount) {
+  // step 5. save the result to fs, the user and item factors are saved
+  // concurrently, each of them is formatted and written in parallel
+  LOG(INFO) << "saving user_factors and item_factors ";
+  timer.reset();
+  trace_start = trace.now();
+  auto save_user = std::async(std::launch::async, [&]() {
+    if (user_sharded) {
+      LOG(INFO) << "user factors are written as shards by the labors.";
+      return true;
+    }
+    return engine_ptr_->saveUserFactors(taskdef->user_factors());
+  });
+  auto save_item = std::async(std::launch::async, [&]() {
+    if (item_sharded) {
+      LOG(INFO) << "item factors are written as shards by the labors.";
+      return true;
+    }
+    return engine_ptr_->saveItemFactors(taskdef->item_factors());
+  });
 
-      LOG(INFO) << "waiting ... current fixedload labor count " << fixed_count
-                << ", expect at least " << kQuorumsConnectionCount;
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+  const bool user_saved = save_user.get();
+  const bool item_saved = save_item.get();
+  if (!user_saved || !item_saved) {
+    LOG(ERROR) << "task " << taskid_ << " save factors failed.";
+    return false;
+  }
+  save_time.recordSeconds(timer.seconds());
+  trace.complete("task", "save", trace_start, task_args);
+  LOG(INFO) << "phase save took " << timer.seconds() << "s";
+  qmf::Instrumentation::get().dump();
+
+  return true;
+}
+
+bool Task::load_testset() {
+
+  metrics_engine_ = std::make_unique<qmf::MetricsEngine>(metrics_config_);
+  for (const auto& metric : taskdef_->test_avg_metrics()) {
+    if (!metrics_engine_->addTestAvgMetric(metric)) {
+      LOG(ERROR) << "unknown test avg metric " << metric;
+      return false;
     }
+  }
 
-    LOG(INFO) << "begin iterate items factors ...";
-    if (!iterate_factors()) {
-      LOG(ERROR) << "task " << bigdata_ptr_->taskid() << ":"
-                 << bigdata_ptr_->epchoid()
-                 << " iterate items factors failed!!!";
+  if (metrics_engine_->testAvgMetrics().empty()) {
+    LOG(ERROR) << "no test_avg_metrics for test set " << taskdef_->test_set();
+    return false;
+  }
+
+  std::vector<qmf::DatasetElem> dataset;
+  qmf::DatasetReader testReader(taskdef_->test_set());
+  testReader.readAll(dataset);
+
+  // only the users and items known in training can be scored
+  const auto& userIndex = engine_ptr_->userIndex();
+  const auto& itemIndex = engine_ptr_->itemIndex();
+  std::vector<int64_t> users;
+  for (const auto& elem : dataset) {
+    if (userIndex.idx(elem.userId) != qmf::IdIndex::missingIdx &&
+        itemIndex.idx(elem.itemId) != qmf::IdIndex::missingIdx) {
+      users.push_back(elem.userId);
+    }
+  }
+  std::sort(users.begin(), users.end());
+  users.erase(std::unique(users.begin(), users.end()), users.end());
+
+  const size_t num_test_users = taskdef_->num_test_users();
+  if (num_test_users > 0 && num_test_users < users.size()) {
+    std::shuffle(users.begin(), users.end(),
+                 std::mt19937(taskdef_->eval_seed()));
+    users.resize(num_test_users);
+    std::sort(users.begin(), users.end());
+  }
+
+  // sorted by user, the Labors take each user's adjacent ratings
+  test_vec_.clear();
+  for (const auto& elem : dataset) {
+    if (std::binary_search(users.begin(), users.end(), elem.userId) &&
+        itemIndex.idx(elem.itemId) != qmf::IdIndex::missingIdx) {
+      test_vec_.push_back(elem);
+    }
+  }
+  qmf::WALSEngineLite::sortDataset(test_vec_);
+  test_users_ = users.size();
+
+  LOG(INFO) << "test users " << test_users_ << ", test ratings "
+            << test_vec_.size() << " of " << dataset.size();
+  return true;
+}
+
+bool Task::evaluate() {
+
+  const uint32_t epchoid = bigdata_ptr_->epchoid();
+  qmf::TraceScope scope("task", "evaluate", trace_args(taskid_, epchoid));
+  const size_t epoch = (epchoid - 1) / 2;
+  const uint32_t bucket_number =
+    (test_users_ + kEvalBucketUsers - 1) / kEvalBucketUsers;
+  const auto& names = metrics_engine_->testAvgMetrics();
+
+  std::string metrics;
+  for (const auto& name : names) {
+    metrics += (metrics.empty() ? "" : ",") + name;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(eval_mutex_);
+    eval_epchoid_ = epchoid;
+    eval_bits_.reset(bucket_number);
+    eval_sent_.assign(bucket_number, 0);
+    eval_sums_.assign(names.size() + 1, 0);
+    eval_unable_.clear();
+  }
+
+  LOG(INFO) << "begin evaluate epcho " << epoch << " with " << test_users_
+            << " test users in " << bucket_number << " buckets";
+
+  while (!eval_bits_.all()) {
+
+    if (scheduler_.is_terminate())
+      return false;
+
+    auto copy_connections = scheduler_.share_connections_ptr();
+    size_t capable = 0;
+    for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+         ++iter) {
+
+      auto connection = iter->second;
+      if (!connection->is_labor_ ||
+          !connection->is_ready(taskid_, epchoid))
+        continue;
+
+      std::unique_lock<std::mutex> lock(eval_mutex_);
+      if (eval_unable_.count(connection->socket_))
+        continue;
+      ++capable;
+
+      // the bucket never sent, or lost
+      const time_t now = ::time(NULL);
+      uint32_t bucket = 0;
+      while (bucket < bucket_number &&
+             (eval_bits_.test(bucket) ||
+              eval_sent_[bucket] + kEvalTimeout > now)) {
+        ++bucket;
+      }
+      if (bucket == bucket_number)
+        break;
+      eval_sent_[bucket] = now;
+      lock.unlock();
+
+      if (connection->lock_socket_.test_and_set()) {
+        std::lock_guard<std::mutex> relock(eval_mutex_);
+        eval_sent_[bucket] = 0;
+        continue;
+      }
+
+      Head head(OpCode::kEval);
+      head.taskid = taskid_;
+      head.epchoid = epchoid;
+      head.nfactors = bigdata_ptr_->nfactors();
+      head.bucket = bucket;
+      head.bucket_size = kEvalBucketUsers;
+      connection->touch();
+      if (!SendOps::send_bulk(connection->socket_, head, metrics.c_str(),
+                              metrics.size())) {
+        LOG(ERROR) << "sending eval to " << connection->addr() << " failed.";
+      }
+      connection->lock_socket_.clear();
+    }
+
+    if (capable == 0 && !eval_bits_.all()) {
+      LOG(ERROR) << "no labor can evaluate task " << taskid_ << ":" << epchoid
+                 << ", finished " << eval_bits_.count() << " of "
+                 << bucket_number << " buckets.";
       return false;
     }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 
-  // step 5. save the result to fs
-  LOG(INFO) << "saving user_factors and item_factors ";
-  engine_ptr_->saveUserFactors(taskdef->user_factors());
-  engine_ptr_->saveItemFactors(taskdef->item_factors());
+  std::lock_guard<std::mutex> lock(eval_mutex_);
+  for (size_t m = 0; m < names.size(); ++m) {
+    metrics_engine_->recordTestAvgMetric(names[m], epoch,
+                                         eval_sums_[m + 1] / eval_sums_[0]);
+  }
 
   return true;
 }
 
-bool Scheduler::iterate_factors() {
+void Task::eval_result(int socketfd,
+                       uint32_t epchoid,
+                       uint32_t bucket,
+                       const std::string& body) {
+
+  std::lock_guard<std::mutex> lock(eval_mutex_);
+  if (epchoid != eval_epchoid_ || bucket >= eval_bits_.size())
+    return;
+
+  // resend to the other Labors
+  if (body.size() != eval_sums_.size() * sizeof(double)) {
+    LOG(INFO) << "labor " << socketfd << " can not evaluate task " << taskid_
+              << ":" << epchoid << ", " << body;
+    eval_unable_.insert(socketfd);
+    if (!eval_bits_.test(bucket))
+      eval_sent_[bucket] = 0;
+    return;
+  }
+
+  if (!eval_bits_.set(bucket))
+    return;
+
+  const double* sums = reinterpret_cast<const double*>(body.data());
+  for (size_t i = 0; i < eval_sums_.size(); ++i) {
+    eval_sums_[i] += sums[i];
+  }
+}
+
+bool Task::prepare_shards(const std::string& dir) {
 
-  bool iterate_user = bigdata_ptr_->epchoid() % 2;
+  if (::mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOG(ERROR) << "create shard directory " << dir
+               << " failed: " << strerror(errno);
+    return false;
+  }
 
-  uint64_t bucket_number = 0;
-  if (iterate_user) {
-    bucket_number = (engine_ptr_->nusers() + kBucketSize - 1) / kBucketSize;
-    LOG(INFO) << "users factors count " << engine_ptr_->nusers()
-              << " mapped to " << bucket_number << " buckets.";
-  } else {
-    bucket_number = (engine_ptr_->nitems() + kBucketSize - 1) / kBucketSize;
-    LOG(INFO) << "items factors count " << engine_ptr_->nusers()
-              << " mapped to " << bucket_number << " buckets.";
+  // the shards of previous run may use another bucket size
+  DIR* dirp = ::opendir(dir.c_str());
+  if (!dirp) {
+    LOG(ERROR) << "open shard directory " << dir << " failed.";
+    return false;
+  }
+
+  struct dirent* entry = NULL;
+  while ((entry = ::readdir(dirp)) != NULL) {
+    if (::strncmp(entry->d_name, "part-", 5) == 0)
+      ::unlink((dir + "/" + entry->d_name).c_str());
+  }
+  ::closedir(dirp);
+
+  LOG(INFO) << "labors will write the factors to " << dir;
+  return true;
+}
+
+void Task::sync_labor(std::shared_ptr<Connection>& connection) {
+
+  const uint32_t taskid = taskid_;
+  const uint32_t epchoid = bigdata_ptr_->epchoid();
+
+  // already pushed and waiting for the response, check by kHeartBeat
+  if (connection->is_synced(taskid, epchoid)) {
+    if (connection->is_stale(kHeartBeatInternal))
+      push_heartbeat(connection);
+    return;
+  }
+
+  if (connection->lock_socket_.test_and_set())
+    return;
+
+  connection->mark_synced(taskid, epchoid);
+  connection->touch();
+  LOG(INFO) << "sync task " << taskid << ":" << epchoid << " to labor "
+            << connection->addr();
+
+  // the rating may be large, don't block the buckets dispatch
+  auto self = shared_from_this();
+  scheduler_.add_push_task([self, connection, taskid]() {
+    bool success = true;
+    if (!connection->has_task(taskid))
+      success = self->push_rating(connection);
+    if (success)
+      success = self->push_fixed(connection->socket_, connection->codecs_);
+
+    connection->lock_socket_.clear();
+    LOG_IF(ERROR, !success) << "sync to labor " << connection->addr()
+                            << " failed.";
+  });
+}
+
+// at least more than half of the current alive Labors should be ready, the
+// dead Labors are not counted, and the late joined ones are synced here
+void Task::wait_quorum(const char* stage) {
+
+  qmf::TraceScope scope(
+    "task", std::string("wait_quorum ") + stage,
+    trace_args(taskid_, bigdata_ptr_->epchoid()));
+
+  size_t ready = 0;
+  size_t alive = 0;
+  while (!scheduler_.is_terminate()) {
+
+    auto copy_connections = scheduler_.share_connections_ptr();
+    for (auto iter = copy_connections->begin();
+         iter != copy_connections->end(); ++iter) {
+      auto connection = iter->second;
+      if (connection->is_labor_ &&
+          !connection->is_ready(taskid_, bigdata_ptr_->epchoid()))
+        sync_labor(connection);
+    }
+
+    alive = connections_count();
+    ready = connections_count(true);
+    if (alive > 0 && ready >= alive / 2 + 1)
+      break;
+
+    LOG(INFO) << "waiting " << stage << " ... current ready labor count "
+              << ready << ", alive " << alive << ", expect at least "
+              << alive / 2 + 1;
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+}
+
+bool Task::save_checkpoint(const std::string& dir, uint32_t epchoid) {
+
+  const bool user = epchoid % 2;
+  const auto& factors = user ? bigdata_ptr_->user_factor_ptr_
+                             : bigdata_ptr_->item_factor_ptr_;
+  if (!Checkpoint::save(Checkpoint::path(dir, user), epchoid,
+                        bigdata_ptr_->nratings(),
+                        factors->getFactors())) {
+    LOG(ERROR) << "checkpoint " << (user ? "users" : "items")
+               << " factors of epcho " << epchoid << " failed.";
+    return false;
+  }
+
+  LOG(INFO) << "checkpoint " << (user ? "users" : "items")
+            << " factors of epcho " << epchoid << " to " << dir;
+  return true;
+}
+
+bool Task::resume_checkpoint(const std::string& dir) {
+
+  const uint32_t epchoid =
+    Checkpoint::resume(dir, bigdata_ptr_->nratings(),
+                       &bigdata_ptr_->user_factor_ptr_->getFactors(),
+                       &bigdata_ptr_->item_factor_ptr_->getFactors());
+  if (epchoid == 0)
+    return false;
+
+  bigdata_ptr_->resume_epchoid(epchoid);
+  LOG(INFO) << "resume from checkpoint epcho " << epchoid << " in " << dir;
+  return true;
+}
+
+bool Task::iterate_factors() {
+
+  static const qmf::Counter buckets_dispatched("scheduler.buckets_dispatched");
+
+  bool iterate_user = bigdata_ptr_->epchoid() % 2;
+  qmf::TraceScope scope("task", "iterate_factors",
+                        trace_args(taskid_, bigdata_ptr_->epchoid()));
+
+  const uint64_t nrows =
+    iterate_user ? engine_ptr_->nusers() : engine_ptr_->nitems();
+  const uint32_t bucket_size = bigdata_ptr_->tune_bucket_size(
+    iterate_user, nrows, scheduler_.labors_count());
+  const uint64_t bucket_number = (nrows + bucket_size - 1) / bucket_size;
+  bigdata_ptr_->start_buckets(bucket_number, bucket_size);
+
+  LOG(INFO) << (iterate_user ? "users" : "items") << " factors count " << nrows
+            << " mapped to " << bucket_number << " buckets with size "
+            << bucket_size << ", measured row cost "
+            << bigdata_ptr_->row_cost(iterate_user) << " secs.";
+
+  // the late responses of the previous epcho will be dropped
+  auto start_connections = scheduler_.share_connections_ptr();
+  for (auto iter = start_connections->begin(); iter != start_connections->end();
+       ++iter) {
+    iter->second->clear_inflight(taskid_);
   }
 
   uint64_t index = 0; // the incr bucket index
 
-  while (true) {
+  while (!scheduler_.is_terminate()) {
+
+    // the buckets of this task queued in all the Labors, which should not
+    // exceed our share when the other tasks are iterating too
+    auto copy_connections = scheduler_.share_connections_ptr();
+    size_t task_inflight = 0;
+    for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+         ++iter) {
+      task_inflight += iter->second->inflight(taskid_);
+    }
+    const size_t share = scheduler_.task_share(*this);
 
-    connections_ptr_type copy_connections = share_connections_ptr();
     for (auto iter = copy_connections->begin(); iter != copy_connections->end();
          ++iter) {
 
@@ -185,8 +696,16 @@ bool Scheduler::iterate_factors() {
       if (!connection->is_labor_)
         continue;
 
+      // the late joined or reconnected Labor, push the rating and fixed
+      // factors to it before dispatching buckets
+      if (!connection->is_ready(taskid_, bigdata_ptr_->epchoid())) {
+        sync_labor(connection);
+        continue;
+      }
+
       // check whether stale, and need to kHeartBeat
-      if (connection->is_busy_) {
+      const size_t inflight = connection->inflight();
+      if (inflight > 0) {
 
         time_t timeout = kHeartBeatInternal;
         if (connection->is_stale(timeout)) {
@@ -196,11 +715,16 @@ bool Scheduler::iterate_factors() {
                     << timeout << " seconds, send kHeartBeat message.";
         }
 
-        continue;
+        // keep at most kLaborPrefetch buckets queued in the Labor
+        if (inflight >= kLaborPrefetch)
+          continue;
       }
 
+      if (task_inflight >= share)
+        break;
+
       // find the unfinished bucket
-      while (bigdata_ptr_->bucket_bits_[index] &&
+      while (bigdata_ptr_->bucket_bits_.test(index) &&
              bigdata_ptr_->bucket_bits_.count() < bucket_number) {
         index = (index + 1) % bucket_number;
       }
@@ -217,14 +741,17 @@ bool Scheduler::iterate_factors() {
         continue;
       }
 
-      if (!bigdata_ptr_->bucket_bits_[index]) {
+      if (!bigdata_ptr_->bucket_bits_.test(index) &&
+          !connection->is_inflight(taskid_, index)) {
 
         // we may push failed, for socket lock problem
-        if (push_bucket(index, connection->socket_)) {
+        const auto start = std::chrono::steady_clock::now();
+        if (push_bucket(index, connection->socket_, connection->codecs_)) {
+          buckets_dispatched.add();
           connection->touch();
-          connection->bucket_start_ = ::time(NULL);
-          connection->is_busy_ = true;
+          connection->add_inflight(taskid_, index, start);
           index = (index + 1) % bucket_number;
+          ++task_inflight;
         }
       }
 
@@ -236,11 +763,235 @@ bool Scheduler::iterate_factors() {
       }
     }
 
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    // all the labors may be full with the duplicated buckets
+    if (bigdata_ptr_->bucket_bits_.count() == bucket_number) {
+      LOG(INFO) << "iterate done!";
+      return true;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  return false;
+}
+
+bool Task::push_all_rating_matrix() {
+
+  qmf::TraceScope scope("task", "push_all_rating_matrix",
+                        trace_args(taskid_, bigdata_ptr_->epchoid()));
+
+  auto copy_connections = scheduler_.share_connections_ptr();
+
+  // TODO: improve in the future
+  // when no labors available, we will do local standalone calculate.
+
+  if (copy_connections->empty()) {
+    LOG(ERROR) << "no labor available now.";
+    return false;
+  }
+
+  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+       ++iter) {
+
+    auto connection = iter->second;
+    if (!connection->is_labor_)
+      continue;
+
+    if (connection->lock_socket_.test_and_set()) {
+      LOG(INFO) << "connection socket used by other ..." << connection->addr();
+      continue;
+    }
+
+    connection->touch();
+    connection->mark_synced(taskid_, bigdata_ptr_->epchoid());
+    if (!push_rating(connection)) {
+      LOG(ERROR) << "sending rating to " << connection->addr() << " failed.";
+    }
+
+    connection->lock_socket_.clear();
+  }
+
+  return true;
+}
+
+bool Task::push_all_fixed_factors() {
+
+  qmf::TraceScope scope("task", "push_all_fixed_factors",
+                        trace_args(taskid_, bigdata_ptr_->epchoid()));
+
+  auto copy_connections = scheduler_.share_connections_ptr();
+
+  // TODO: 今后如果没有没有发现labor，则scheduler执行单机计算
+  if (copy_connections->empty()) {
+    LOG(ERROR) << "no labor available now.";
+    return false;
+  }
+
+  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+       ++iter) {
+
+    auto connection = iter->second;
+    if (!connection->is_labor_)
+      continue;
+
+    if (connection->lock_socket_.test_and_set()) {
+      LOG(INFO) << "connection socket used by other ..." << connection->addr();
+      continue;
+    }
+
+    connection->touch();
+    connection->mark_synced(taskid_, bigdata_ptr_->epchoid());
+    if (!push_fixed(connection->socket_, connection->codecs_)) {
+      LOG(ERROR) << "sending fixed factors to " << connection->addr()
+                 << " failed.";
+    }
+
+    connection->lock_socket_.clear();
+  }
+
+  return true;
+}
+
+// already lock the socketfd outside
+bool Task::push_rating(const std::shared_ptr<Connection>& connection) {
+
+  // the Labor already has the same rating and index of another task
+  const uint32_t reuse = scheduler_.reuse_task(*this, connection);
+  if (reuse != 0) {
+    LOG(INFO) << "labor " << connection->addr() << " reuse rating of task "
+              << reuse << " for task " << taskid_;
+    return SendOps::send_message(
+             connection->socket_, OpCode::kReuseRate, std::to_string(reuse),
+             taskid_, bigdata_ptr_->epchoid(), bigdata_ptr_->nfactors(), 0,
+             bigdata_ptr_->lambda(), bigdata_ptr_->confidence()) &&
+           push_test(connection);
+  }
+
+  const auto& dataset = *bigdata_ptr_->rating_ptr_;
+  const uint8_t encoding =
+    Codec::negotiate(bigdata_ptr_->rating_encoding(), connection->codecs_);
+
+  if (!SendOps::send_rating(connection->socket_, OpCode::kPushRate,
+                            dataset.data(), dataset.size(), encoding,
+                            bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
+                            bigdata_ptr_->nfactors(), 0, bigdata_ptr_->lambda(),
+                            bigdata_ptr_->confidence())) {
+    return false;
+  }
+
+  return push_test(connection);
+}
+
+bool Task::push_test(const std::shared_ptr<Connection>& connection) {
+
+  if (test_vec_.empty())
+    return true;
+
+  const uint8_t encoding =
+    Codec::negotiate(bigdata_ptr_->rating_encoding(), connection->codecs_);
+  return SendOps::send_rating(connection->socket_, OpCode::kPushTest,
+                              test_vec_.data(), test_vec_.size(), encoding,
+                              taskid_, bigdata_ptr_->epchoid());
+}
+
+// already lock the socketfd outside
+bool Task::push_fixed(int socketfd, uint8_t codecs) {
+
+  // epcho_id_ = 1, 3, 5, ... fix item, cal user
+  // epcho_id_ = 2, 4, 6, ... fix user, cal item
+
+  const bool fixed_item = bigdata_ptr_->epchoid() % 2;
+  const qmf::Matrix& matrix = fixed_item
+                                ? bigdata_ptr_->item_factor_ptr_->getFactors()
+                                : bigdata_ptr_->user_factor_ptr_->getFactors();
+  const uint8_t encoding =
+    Codec::negotiate(bigdata_ptr_->factor_encoding(), codecs);
+
+  LOG(INFO) << "{taskid:" << bigdata_ptr_->taskid()
+            << ", epchoid:" << bigdata_ptr_->epchoid() << "} transform "
+            << (fixed_item ? "itemFactors" : "userFactors") << " with size "
+            << sizeof(qmf::Matrix::value_type) * matrix.nrows() * matrix.ncols()
+            << ", encoding " << static_cast<int>(encoding);
+
+  return SendOps::send_factors(
+    socketfd, OpCode::kPushFixed, matrix.data(0), matrix.nrows(),
+    matrix.ncols(), encoding, bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
+    bigdata_ptr_->nfactors(), 0, bigdata_ptr_->lambda(),
+    bigdata_ptr_->confidence());
+}
+
+// already lock the socketfd outside
+bool Task::push_bucket(uint32_t bucket_idx, int socketfd, uint8_t codecs) {
+
+  // the encoding the labor should use for the kCalcRsp
+  const std::string msg = shard_dir_.empty() ? "CA" : shard_dir_;
+  Head head(OpCode::kCalc);
+  head.taskid = bigdata_ptr_->taskid();
+  head.epchoid = bigdata_ptr_->epchoid();
+  head.nfactors = bigdata_ptr_->nfactors();
+  head.bucket = bucket_idx;
+  head.bucket_size = bigdata_ptr_->bucket_size();
+  head.lambda = bigdata_ptr_->lambda();
+  head.confidence = bigdata_ptr_->confidence();
+  head.encoding = Codec::negotiate(bigdata_ptr_->factor_encoding(), codecs);
+  if (!SendOps::send_bulk(socketfd, head, msg.c_str(), msg.size())) {
+    LOG(ERROR) << "sending fixed to " << socketfd << " failed.";
+    return false;
   }
 
   return true;
 }
 
+void Task::push_heartbeat(std::shared_ptr<Connection>& connection) {
+
+  const std::string msg = "HB";
+
+  if (connection->lock_socket_.test_and_set()) {
+    LOG(INFO) << "connection socket used by other ..." << connection->addr();
+    return;
+  }
+
+  connection->touch();
+  if (!SendOps::send_message(
+        connection->socket_, OpCode::kHeartBeat, msg, bigdata_ptr_->taskid(),
+        bigdata_ptr_->epchoid(), bigdata_ptr_->nfactors(), 0,
+        bigdata_ptr_->lambda(), bigdata_ptr_->confidence())) {
+    LOG(ERROR) << "sending heartbeat to " << connection->addr() << " failed.";
+  }
+
+  connection->lock_socket_.clear();
+}
+
+size_t Task::connections_count(bool check) {
+
+  auto copy_connections = scheduler_.share_connections_ptr();
+  size_t count = 0;
+
+  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+       ++iter) {
+
+    auto connection = iter->second;
+    if (!connection->is_labor_)
+      continue;
+
+    if (!check) {
+      ++count;
+    } else if (connection->is_ready(taskid_, bigdata_ptr_->epchoid())) {
+      ++count;
+    } else {
+
+      // connection status may be stale, here send heartbeat to check
+      time_t timeout = kHeartBeatInternal;
+      if (connection->is_stale(timeout)) {
+        push_heartbeat(connection);
+        LOG(INFO) << "connection " << connection->addr() << " is stale for "
+                  << timeout << " seconds, send kHeartBeat message.";
+      }
+    }
+  }
+
+  return count;
+}
+
 } // end namespace scheduler
 } // end namespace distributed
\ No newline at end of file
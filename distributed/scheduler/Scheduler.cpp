@@ -13,8 +13,11 @@
 
 #include <chrono> // std::chrono::seconds
 
+#include <distributed/common/Codec.h>
+#include <distributed/common/MetricsServer.h>
 #include <distributed/common/SendOps.h>
 #include <distributed/common/NetUtil.h>
+#include <qmf/utils/Trace.h>
 
 #include <glog/logging.h>
 
@@ -23,26 +26,18 @@ namespace scheduler {
 
 bool Scheduler::init() {
 
-  if (!start_listen())
-    return false;
-
   connections_ptr_ = std::make_shared<connections_type>();
   if (!connections_ptr_) {
     LOG(ERROR) << "create Connections failed.";
     return false;
   }
 
-  bigdata_ptr_ = std::make_unique<BigData>();
-  if (!bigdata_ptr_) {
-    LOG(ERROR) << "create BigData failed.";
-    return false;
-  }
+  recv_pool_ = std::make_unique<qmf::ThreadPool>(kRecvThreads);
+  push_pool_ = std::make_unique<qmf::ThreadPool>(kPushThreads);
 
-  engine_ptr_ = std::make_unique<qmf::WALSEngineLite>(bigdata_ptr_);
-  if (!engine_ptr_) {
-    LOG(ERROR) << "create WALSEngineLite failed.";
+  // the task threads will be started
+  if (!start_listen())
     return false;
-  }
 
   return true;
 }
@@ -92,8 +87,10 @@ bool Scheduler::start_listen() {
       break;
     }
 
-    // start up task thread
-    task_thread_ = std::thread(std::bind(&Scheduler::task_run, this));
+    // start up task threads
+    for (size_t i = 0; i < kRunningTasks; ++i) {
+      task_threads_.emplace_back(std::bind(&Scheduler::task_run, this));
+    }
 
     success = true;
 
@@ -112,6 +109,7 @@ bool Scheduler::start_listen() {
 void Scheduler::select_loop() {
 
   LOG(INFO) << "start select loop thread ...";
+  qmf::Trace::get().nameThread("select loop");
 
   struct timeval tv;
 
@@ -121,8 +119,9 @@ void Scheduler::select_loop() {
     tv.tv_sec = 1;
     tv.tv_usec = 0;
 
-    int maxfd = select_ptr_->maxfd_;
-    fd_set rfds = select_ptr_->readfds_;
+    int maxfd = 0;
+    fd_set rfds;
+    select_ptr_->snapshot(&rfds, &maxfd);
     int retval = ::select(maxfd + 1, &rfds, NULL, NULL, &tv);
 
     if (retval < 0) {
@@ -144,6 +143,12 @@ void Scheduler::select_loop() {
         if (!FD_ISSET(ss, &rfds))
           continue;
 
+        // some socket given back by the receive pool
+        if (select_ptr_->is_wakeup(ss)) {
+          select_ptr_->drain_wakeup();
+          continue;
+        }
+
         if (ss == select_ptr_->listenfd_) {
 
           // handle new client
@@ -163,6 +168,7 @@ void Scheduler::select_loop() {
             LOG(INFO) << "accept new client from " << addr << ":" << port;
 
             NetUtil::optimize_send_recv_buff(sock);
+            NetUtil::enable_zerocopy(sock);
 
             auto connection =
               std::make_shared<Connection>(*this, addr, port, sock);
@@ -206,195 +212,187 @@ void Scheduler::handle_read(int socket) {
 
   auto connection = iter->second;
   if (!connection->event()) {
+    destroy_connection(socket, connection);
+    return;
+  }
 
-    // not select anymore
-    select_ptr_->del_fd(socket);
-
-    {
-      const std::lock_guard<std::mutex> lock(connections_mutex_);
-      connections_ptr_->erase(socket);
-    }
+  // the body will be received in the receive pool, and the select loop should
+  // not watch this socket in the meantime
+  if (connection->stage_ == Connection::Stage::kAsync) {
 
-    LOG(INFO) << "critical error, destroy the connection: " << socket
-              << std::endl
-              << "remote address: " << connection->addr_ << ":"
-              << connection->port_;
+    select_ptr_->del_fd(socket);
+    recv_pool_->addTask([this, socket, connection]() {
+      if (connection->recv_calc_rsp()) {
+        select_ptr_->add_fd(socket);
+      } else {
+        destroy_connection(socket, connection);
+      }
+    });
   }
 }
 
-bool Scheduler::push_all_rating_matrix() {
-
-  connections_ptr_type copy_connections = share_connections_ptr();
+void Scheduler::destroy_connection(
+  int socket, const std::shared_ptr<Connection>& connection) {
 
-  // TODO: improve in the future
-  // when no labors available, we will do local standalone calculate.
+  // not select anymore
+  select_ptr_->del_fd(socket);
 
-  if (copy_connections->empty()) {
-    LOG(ERROR) << "no labor available now.";
-    return false;
+  {
+    const std::lock_guard<std::mutex> lock(connections_mutex_);
+    connections_ptr_->erase(socket);
   }
 
-  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
-       ++iter) {
-
-    auto connection = iter->second;
-    if (!connection->is_labor_)
-      continue;
-
-    if (connection->lock_socket_.test_and_set()) {
-      LOG(INFO) << "connection socket used by other ..." << connection->addr();
-      continue;
-    }
-
-    const auto& dataset = bigdata_ptr_->rating_vec_;
-
-    const char* dat = reinterpret_cast<const char*>(dataset.data());
-    uint64_t len = sizeof(dataset[0]) * dataset.size();
+  LOG(INFO) << "critical error, destroy the connection: " << socket
+            << std::endl
+            << "remote address: " << connection->addr_ << ":"
+            << connection->port_;
+}
 
-    connection->touch();
-    if (!SendOps::send_bulk(connection->socket_, OpCode::kPushRate, dat, len,
-                            bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
-                            bigdata_ptr_->nfactors(), 0, bigdata_ptr_->lambda(),
-                            bigdata_ptr_->confidence())) {
-      LOG(ERROR) << "sending rating to " << connection->addr() << " failed.";
-    }
+std::shared_ptr<Task> Scheduler::task(uint32_t taskid) {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  auto iter = tasks_.find(taskid);
+  return iter == tasks_.end() ? nullptr : iter->second;
+}
 
-    connection->lock_socket_.clear();
+std::shared_ptr<Task> Scheduler::loaded_task(const std::string& dataset_key,
+                                             uint32_t except) {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+    if (iter->first != except && iter->second->is_loaded() &&
+        iter->second->dataset_key() == dataset_key)
+      return iter->second;
   }
-
-  return true;
+  return nullptr;
 }
 
-bool Scheduler::push_all_fixed_factors() {
-
-  connections_ptr_type copy_connections = share_connections_ptr();
+uint32_t Scheduler::reuse_task(const Task& task,
+                               const std::shared_ptr<Connection>& connection) {
+  const std::string dataset_key = task.dataset_key();
 
-  // TODO: 今后如果没有没有发现labor，则scheduler执行单机计算
-  if (copy_connections->empty()) {
-    LOG(ERROR) << "no labor available now.";
-    return false;
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  for (auto iter = datasets_.rbegin(); iter != datasets_.rend(); ++iter) {
+    if (iter->first != task.taskid() && iter->second == dataset_key &&
+        connection->has_task(iter->first))
+      return iter->first;
   }
+  return 0;
+}
 
-  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
-       ++iter) {
-
-    auto connection = iter->second;
-    if (!connection->is_labor_)
-      continue;
+void Scheduler::prune_datasets() {
 
-    if (connection->lock_socket_.test_and_set()) {
-      LOG(INFO) << "connection socket used by other ..." << connection->addr();
-      continue;
-    }
-
-    // epcho_id_ = 1, 3, 5, ... fix item, cal user
-    // epcho_id_ = 2, 4, 6, ... fix user, cal item
-
-    const char* dat = nullptr;
-    uint64_t len = 0;
-    if (bigdata_ptr_->epchoid() % 2) {
-      const qmf::Matrix& matrix = bigdata_ptr_->item_factor_ptr_->getFactors();
-      dat =
-        reinterpret_cast<const char*>(const_cast<qmf::Matrix&>(matrix).data());
-      len = sizeof(qmf::Matrix::value_type) * matrix.nrows() * matrix.ncols();
-      LOG(INFO) << "{taskid:" << bigdata_ptr_->taskid()
-                << ", epchoid:" << bigdata_ptr_->epchoid()
-                << "} transform itemFactors with size " << len;
-    } else {
-      const qmf::Matrix& matrix = bigdata_ptr_->user_factor_ptr_->getFactors();
-      dat =
-        reinterpret_cast<const char*>(const_cast<qmf::Matrix&>(matrix).data());
-      len = sizeof(qmf::Matrix::value_type) * matrix.nrows() * matrix.ncols();
-      LOG(INFO) << "{taskid:" << bigdata_ptr_->taskid()
-                << ", epchoid:" << bigdata_ptr_->epchoid()
-                << "} transform userFactors with size " << len;
-    }
+  connections_ptr_type copy_connections = share_connections_ptr();
+  std::vector<uint32_t> expired;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+
+    // the newest first, a Labor keeps at most kLaborTasks
+    size_t kept = 0;
+    for (auto iter = datasets_.rbegin(); iter != datasets_.rend(); ++iter) {
+      if (tasks_.find(iter->first) != tasks_.end())
+        continue;
+
+      bool held = false;
+      for (auto conn = copy_connections->begin();
+           conn != copy_connections->end() && !held; ++conn) {
+        held = conn->second->is_labor_ && conn->second->has_task(iter->first);
+      }
 
-    connection->touch();
-    if (!SendOps::send_bulk(connection->socket_, OpCode::kPushFixed, dat, len,
-                            bigdata_ptr_->taskid(), bigdata_ptr_->epchoid(),
-                            bigdata_ptr_->nfactors(), 0, bigdata_ptr_->lambda(),
-                            bigdata_ptr_->confidence())) {
-      LOG(ERROR) << "sending fixed factors to " << connection->addr()
-                 << " failed.";
+      if (held && kept < kLaborTasks) {
+        ++kept;
+        continue;
+      }
+      expired.push_back(iter->first);
     }
 
-    connection->lock_socket_.clear();
+    for (const auto& taskid : expired)
+      datasets_.erase(taskid);
   }
 
-  return true;
-}
-
-// already lock the socketfd outside
-bool Scheduler::push_bucket(uint32_t bucket_idx, int socketfd) {
-
-  const std::string msg = "CA";
-  if (!SendOps::send_message(
-        socketfd, OpCode::kCalc, msg, bigdata_ptr_->taskid(),
-        bigdata_ptr_->epchoid(), bigdata_ptr_->nfactors(), bucket_idx,
-        bigdata_ptr_->lambda(), bigdata_ptr_->confidence())) {
-    LOG(ERROR) << "sending fixed to " << socketfd << " failed.";
-    return false;
+  for (const auto& taskid : expired) {
+    for (auto iter = copy_connections->begin();
+         iter != copy_connections->end(); ++iter) {
+      iter->second->drop_task(taskid);
+    }
   }
-
-  return true;
 }
 
-void Scheduler::push_heartbeat(std::shared_ptr<Connection>& connection) {
+size_t Scheduler::task_share(const Task& task) {
 
-  const std::string msg = "HB";
+  const size_t slots = std::max<size_t>(labors_count(), 1) * kLaborPrefetch;
 
-  if (connection->lock_socket_.test_and_set()) {
-    LOG(INFO) << "connection socket used by other ..." << connection->addr();
-    return;
+  uint64_t total = 0;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
+      if (iter->second->is_iterating())
+        total += std::max<uint32_t>(iter->second->taskdef().priority(), 1);
+    }
   }
 
-  connection->touch();
-  if (!SendOps::send_message(
-        connection->socket_, OpCode::kHeartBeat, msg, bigdata_ptr_->taskid(),
-        bigdata_ptr_->epchoid(), bigdata_ptr_->nfactors(), 0,
-        bigdata_ptr_->lambda(), bigdata_ptr_->confidence())) {
-    LOG(ERROR) << "sending heartbeat to " << connection->addr() << " failed.";
-  }
+  const uint64_t priority = std::max<uint32_t>(task.taskdef().priority(), 1);
+  if (total <= priority)
+    return slots;
 
-  connection->lock_socket_.clear();
+  return std::max<size_t>(slots * priority / total, 1);
 }
 
-size_t Scheduler::connections_count(bool check) {
+size_t Scheduler::labors_count() {
 
   connections_ptr_type copy_connections = share_connections_ptr();
   size_t count = 0;
-
   for (auto iter = copy_connections->begin(); iter != copy_connections->end();
        ++iter) {
+    if (iter->second->is_labor_)
+      ++count;
+  }
+  return count;
+}
 
-    auto connection = iter->second;
-    if (!connection->is_labor_)
-      continue;
+void Scheduler::collect_metrics(std::string* out) {
 
-    if (!check) {
-      ++count;
-    } else if (connection->taskid_ == bigdata_ptr_->taskid() &&
-               connection->epchoid_ == bigdata_ptr_->epchoid()) {
-      ++count;
-    } else {
+  connections_ptr_type copy_connections = share_connections_ptr();
+  size_t labors = 0;
+  size_t inflight = 0;
+  for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+       ++iter) {
+    if (iter->second->is_labor_)
+      ++labors;
+    inflight += iter->second->inflight();
+  }
 
-      // connection status may be stale, here send heartbeat to check
-      time_t timeout = kHeartBeatInternal;
-      if (connection->is_stale(timeout)) {
-        push_heartbeat(connection);
-        LOG(INFO) << "connection " << connection->addr() << " is stale for "
-                  << timeout << " seconds, send kHeartBeat message.";
-      }
-    }
+  MetricsServer::append_gauge(out, "qmf_scheduler_labors",
+                              "Connected Labors.", labors);
+  MetricsServer::append_gauge(out, "qmf_scheduler_clients",
+                              "Connected clients other than the Labors.",
+                              copy_connections->size() - labors);
+  MetricsServer::append_gauge(out, "qmf_scheduler_inflight_buckets",
+                              "Buckets dispatched and not fully responsed.",
+                              inflight);
+  MetricsServer::append_gauge(out, "qmf_scheduler_taskid",
+                              "The latest taskid assigned.", taskid_);
+
+  std::vector<std::pair<uint32_t, uint32_t>> epchos;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter)
+      epchos.emplace_back(iter->first, iter->second->bigdata_ptr()->epchoid());
   }
 
-  return count;
+  MetricsServer::append_gauge(out, "qmf_scheduler_running_tasks",
+                              "Tasks running in the Scheduler.", epchos.size());
+  MetricsServer::append_header(out, "qmf_scheduler_task_epchoid", "gauge",
+                               "The current epchoid of the running task.");
+  for (const auto& epcho : epchos) {
+    MetricsServer::append_sample(
+      out, "qmf_scheduler_task_epchoid",
+      "taskid=\"" + std::to_string(epcho.first) + "\"", epcho.second);
+  }
 }
 
 void Scheduler::task_run() {
 
   LOG(INFO) << "start task loop thread ...";
+  qmf::Trace::get().nameThread("task loop");
 
   while (!terminate_) {
 
@@ -404,13 +402,33 @@ void Scheduler::task_run() {
       continue;
     }
 
-    if (RunOneTask(task_instance)) {
+    const uint32_t taskid = ++taskid_;
+    auto task = std::make_shared<Task>(*this, task_instance, taskid);
+    {
+      std::lock_guard<std::mutex> lock(tasks_mutex_);
+      tasks_[taskid] = task;
+      datasets_[taskid] = task->dataset_key();
+    }
+
+    if (task->RunOneTask()) {
       LOG(INFO) << "RunOneTask of " << task_instance->train_set()
                 << " successfully.";
     } else {
       LOG(ERROR) << "RunOneTask of " << task_instance->train_set()
                  << " failed.";
     }
+
+    {
+      std::lock_guard<std::mutex> lock(tasks_mutex_);
+      tasks_.erase(taskid);
+    }
+
+    connections_ptr_type copy_connections = share_connections_ptr();
+    for (auto iter = copy_connections->begin(); iter != copy_connections->end();
+         ++iter) {
+      iter->second->finish_task(taskid);
+    }
+    prune_datasets();
   }
 
   LOG(INFO) << "terminate task loop thread ...";
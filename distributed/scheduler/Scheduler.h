@@ -10,13 +10,17 @@
 
 #include <sys/select.h>
 
+#include <functional>
 #include <string>
 #include <thread>
 #include <map>
+#include <vector>
 
+#include <qmf/utils/ThreadPool.h>
 #include <qmf/wals/WALSEngineLite.h>
 
 #include <distributed/scheduler/Connection.h>
+#include <distributed/scheduler/Task.h>
 #include <distributed/proto/task.pb.h>
 
 #include <distributed/common/EQueue.h>
@@ -44,16 +48,43 @@ class Scheduler {
     terminate_ = true;
   }
 
+  bool is_terminate() const {
+    return terminate_;
+  }
+
   void add_task(const std::shared_ptr<TaskDef>& task) {
     task_queue_.PUSH(task);
   }
 
-  std::unique_ptr<BigData>& bigdata_ptr() {
-    return bigdata_ptr_;
-  }
+  // the running task, nullptr if already finished
+  std::shared_ptr<Task> task(uint32_t taskid);
+
+  // the loaded task on the same dataset, its rating can be copied
+  std::shared_ptr<Task> loaded_task(const std::string& dataset_key,
+                                    uint32_t except);
+
+  // the task on the same dataset held by the Labor, then the Labor can reuse
+  // the rating instead of receiving again. 0 if not found.
+  uint32_t reuse_task(const Task& task,
+                      const std::shared_ptr<Connection>& connection);
+
+  // forget the finished tasks no Labor holds, and the older ones beyond what
+  // a Labor can keep
+  void prune_datasets();
+
+  // the buckets the task can queue in all Labors at the same time, shared
+  // among the iterating tasks by their priority
+  size_t task_share(const Task& task);
 
-  std::unique_ptr<qmf::WALSEngineLite>& engine_ptr() {
-    return engine_ptr_;
+  // return our connected labors' count
+  size_t labors_count();
+
+  // the gauges of the connections, buckets and tasks for the metrics server
+  void collect_metrics(std::string* out);
+
+  // the late joined Labors are synced in the push pool
+  void add_push_task(const std::function<void()>& func) {
+    push_pool_->addTask(func);
   }
 
   connections_ptr_type share_connections_ptr() {
@@ -67,22 +98,15 @@ class Scheduler {
 
  private:
   void handle_read(int socket);
+  void destroy_connection(int socket,
+                          const std::shared_ptr<Connection>& connection);
 
-  // Scheduler will ONLY push rating matrix and fixed factors to ALL Labors only
-  // once in RunOnceTask procedure, and when error occurs, Scheduler will only
-  // send kHeartBeat request to specific Labor, and their KInfoRsp response will
-  // trigger lastest sendback actions.
-  bool push_all_rating_matrix();
-  bool push_all_fixed_factors();
-  void push_heartbeat(std::shared_ptr<Connection>& connection);
-  bool push_bucket(uint32_t bucket_idx, int socketfd);
+  // receive the kCalcRsp bodies from multiple Labors concurrently
+  std::unique_ptr<qmf::ThreadPool> recv_pool_;
 
-  // This is the core bucket distribution algorithm, improve it!
-  bool iterate_factors();
-
-  // return our connected labors' count
-  // when check == true, we will check the taskid and epchoid
-  size_t connections_count(bool check = false);
+  // push the rating and fixed factors to the late joined Labors, a large
+  // rating doesn't hold up the kCalcRsp receiving
+  std::unique_ptr<qmf::ThreadPool> push_pool_;
 
   std::unique_ptr<Select> select_ptr_;
 
@@ -97,13 +121,18 @@ class Scheduler {
   const int32_t port_;
   bool start_listen();
 
+  // kRunningTasks threads, each runs one task at a time
   EQueue<std::shared_ptr<TaskDef>> task_queue_;
-  std::thread task_thread_;
+  std::vector<std::thread> task_threads_;
   void task_run();
-  bool RunOneTask(const std::shared_ptr<TaskDef>& taskdef);
 
-  std::unique_ptr<BigData> bigdata_ptr_;
-  std::unique_ptr<qmf::WALSEngineLite> engine_ptr_;
+  std::mutex tasks_mutex_;
+  std::atomic<uint32_t> taskid_{0};
+  std::map<uint32_t, std::shared_ptr<Task>> tasks_;
+
+  // the dataset of the running and recently finished tasks, for the Labors
+  // reuse, pruned by prune_datasets
+  std::map<uint32_t, std::string> datasets_;
 };
 
 } // end namespace scheduler
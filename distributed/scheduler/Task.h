@@ -0,0 +1,150 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __DISTRIBUTED_SCHEDULER_TASK_H__
+#define __DISTRIBUTED_SCHEDULER_TASK_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <qmf/metrics/MetricsEngine.h>
+#include <qmf/wals/WALSEngineLite.h>
+
+#include <distributed/scheduler/Connection.h>
+#include <distributed/proto/task.pb.h>
+
+#include <distributed/common/BigData.h>
+#include <distributed/common/BucketBits.h>
+
+namespace distributed {
+namespace scheduler {
+
+class Scheduler;
+
+// one submitted TaskDef with its own BigData namespace, the tasks run
+// concurrently in the Scheduler's task threads and share all the Labors
+class Task : public std::enable_shared_from_this<Task> {
+
+ public:
+  Task(Scheduler& scheduler,
+       const std::shared_ptr<TaskDef>& taskdef,
+       uint32_t taskid);
+
+  bool RunOneTask();
+
+  uint32_t taskid() const {
+    return taskid_;
+  }
+
+  const TaskDef& taskdef() const {
+    return *taskdef_;
+  }
+
+  std::unique_ptr<BigData>& bigdata_ptr() {
+    return bigdata_ptr_;
+  }
+
+  std::unique_ptr<qmf::WALSEngineLite>& engine_ptr() {
+    return engine_ptr_;
+  }
+
+  // the rating_ptr_ and index are built, can be shared with the other tasks
+  bool is_loaded() const {
+    return loaded_;
+  }
+
+  // in iterate_factors, take part in the Labors share
+  bool is_iterating() const {
+    return iterating_;
+  }
+
+  // the tasks with the same key have identical rating and index
+  std::string dataset_key() const;
+
+  // the kEvalRsp body from the Labor of socketfd, "NONE" if it can't
+  // evaluate the bucket
+  void eval_result(int socketfd,
+                   uint32_t epchoid,
+                   uint32_t bucket,
+                   const std::string& body);
+
+ private:
+  // Scheduler will ONLY push rating matrix and fixed factors to ALL Labors only
+  // once per epcho, and when error occurs, Scheduler will only send kHeartBeat
+  // request to specific Labor, and the stale Labors are synced by sync_labor
+  bool push_all_rating_matrix();
+  bool push_all_fixed_factors();
+  bool push_rating(const std::shared_ptr<Connection>& connection);
+  bool push_fixed(int socketfd, uint8_t codecs);
+  bool push_test(const std::shared_ptr<Connection>& connection);
+  void push_heartbeat(std::shared_ptr<Connection>& connection);
+  bool push_bucket(uint32_t bucket_idx, int socketfd, uint8_t codecs);
+
+  // This is the core bucket distribution algorithm, improve it!
+  bool iterate_factors();
+
+  // bring the Labor not in current taskid:epchoid up to date
+  void sync_labor(std::shared_ptr<Connection>& connection);
+  void wait_quorum(const char* stage);
+
+  // return our connected labors' count
+  // when check == true, we will check the taskid and epchoid
+  size_t connections_count(bool check = false);
+
+  // the factors produced by epchoid
+  bool save_checkpoint(const std::string& dir, uint32_t epchoid);
+  bool resume_checkpoint(const std::string& dir);
+
+  bool load_dataset();
+
+  // sample the test users and their ratings of test_set
+  bool load_testset();
+
+  // evaluate the factors of the last epcho held by the Labors, called at the
+  // beginning of the users half epcho, after the item factors pushed
+  bool evaluate();
+
+  // clear the previous shards in the directory, create it if not exist
+  bool prepare_shards(const std::string& dir);
+
+  Scheduler& scheduler_;
+  const std::shared_ptr<TaskDef> taskdef_;
+  const uint32_t taskid_;
+
+  std::atomic<bool> loaded_{false};
+  std::atomic<bool> iterating_{false};
+
+  std::unique_ptr<BigData> bigdata_ptr_;
+  std::unique_ptr<qmf::WALSEngineLite> engine_ptr_;
+
+  // the Labors write the buckets of current half epcho here if not empty
+  std::string shard_dir_;
+
+  // pushed to the Labors following the rating, sorted by user
+  std::vector<qmf::DatasetElem> test_vec_;
+  size_t test_users_ = 0;
+
+  qmf::MetricsConfig metrics_config_{};
+  std::unique_ptr<qmf::MetricsEngine> metrics_engine_;
+
+  // [users, metric sums ...] of the finished eval buckets
+  std::mutex eval_mutex_;
+  uint32_t eval_epchoid_ = 0;
+  BucketBits eval_bits_;
+  std::vector<time_t> eval_sent_;
+  std::vector<double> eval_sums_;
+  std::set<int> eval_unable_;
+};
+
+} // end namespace scheduler
+} // end namespace distributed
+
+#endif // __DISTRIBUTED_SCHEDULER_TASK_H__
@@ -17,17 +17,52 @@
 #include <fstream>
 
 #include <qmf/DatasetReader.h>
+#include <qmf/utils/Instrumentation.h>
 
 #include <glog/logging.h>
 
 namespace qmf {
 
+const std::string DatasetReader::binaryMagic("QMFDSET1");
+
+namespace {
+
+const Counter& elemCount() {
+  static const Counter counter("dataset.elems");
+  return counter;
+}
+}
+
 DatasetReader::DatasetReader(const std::string& fileName)
-  : stream_(std::make_unique<std::ifstream>(fileName)) {
+  : stream_(std::make_unique<std::ifstream>(fileName, std::ios::binary)) {
+  detectFormat();
+}
+
+void DatasetReader::detectFormat() {
+  CHECK(stream_);
+  std::string magic(binaryMagic.size(), '\0');
+  stream_->read(&magic[0], magic.size());
+  binary_ = stream_->gcount() == static_cast<std::streamsize>(magic.size()) &&
+            magic == binaryMagic;
+  if (!binary_) {
+    stream_->clear();
+    stream_->seekg(0);
+  }
 }
 
 bool DatasetReader::readOne(DatasetElem& elem) {
   CHECK(stream_);
+  if (binary_) {
+    stream_->read(reinterpret_cast<char*>(&elem), sizeof(DatasetElem));
+    const std::streamsize bytes = stream_->gcount();
+    CHECK(bytes == 0 || bytes == sizeof(DatasetElem))
+      << "the binary dataset is truncated";
+    if (bytes == 0) {
+      return false;
+    }
+    elemCount().add();
+    return true;
+  }
   if (!std::getline(*stream_, line_)) {
     return false;
   }
@@ -38,24 +73,49 @@ bool DatasetReader::readOne(DatasetElem& elem) {
     sscanf(line_.c_str(), "%lld %lld %lf", &elem.userId, &elem.itemId, &value);
   CHECK_EQ(result, 3) << "the file format is incorrect: " << line_;
   elem.value = static_cast<Double>(value);
+  elemCount().add();
   return true;
 }
 
 std::vector<DatasetElem> DatasetReader::readAll() {
   std::vector<DatasetElem> dataset;
-  DatasetElem elem;
-  while (readOne(elem)) {
-    dataset.push_back(elem);
-  }
+  readAll(dataset);
   return dataset;
 }
 
 void DatasetReader::readAll(std::vector<DatasetElem>& dataset) {
+  static const Histogram readTime("dataset.read_all");
+  ScopedTimer timer(readTime);
   dataset.clear();
+  if (binary_) {
+    readBinary(dataset);
+    return;
+  }
   DatasetElem elem;
   while (readOne(elem)) {
     dataset.push_back(elem);
   }
 }
 
+void DatasetReader::readBinary(std::vector<DatasetElem>& dataset) {
+  CHECK(stream_);
+  // the records are read in blocks directly to the dataset
+  const size_t kBlockElems = 1 << 16;
+  size_t nelems = 0;
+  while (true) {
+    dataset.resize(nelems + kBlockElems);
+    stream_->read(reinterpret_cast<char*>(dataset.data() + nelems),
+                  kBlockElems * sizeof(DatasetElem));
+    const size_t bytes = stream_->gcount();
+    CHECK_EQ(bytes % sizeof(DatasetElem), 0)
+      << "the binary dataset is truncated";
+    nelems += bytes / sizeof(DatasetElem);
+    if (bytes < kBlockElems * sizeof(DatasetElem)) {
+      break;
+    }
+  }
+  dataset.resize(nelems);
+  elemCount().add(nelems);
+}
+
 } // namespace qmf
@@ -19,6 +19,7 @@
 #include <istream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <qmf/Types.h>
 
@@ -32,14 +33,25 @@ struct DatasetElem {
   Double value = 1.0;
 } __attribute__((aligned(1), __packed__));
 
+/**
+ * The dataset is either text, "userId itemId value" per line, or binary: the
+ * 8 bytes binaryMagic followed by the packed DatasetElem in host byte order.
+ * The format is detected when the file is opened.
+ */
 class DatasetReader {
  public:
+  static const std::string binaryMagic;
+
   // for unit tests
   DatasetReader() = default;
 
   explicit DatasetReader(const std::string& fileName);
 
-  // reads one line from the file
+  bool binary() const {
+    return binary_;
+  }
+
+  // reads one line (or record) from the file
   bool readOne(DatasetElem& elem);
 
   // reads entire file
@@ -47,7 +59,13 @@ class DatasetReader {
   void readAll(std::vector<DatasetElem>& dataset);
 
  private:
+  // skips the magic of the binary dataset, otherwise rewinds to the start
+  void detectFormat();
+
+  void readBinary(std::vector<DatasetElem>& dataset);
+
   std::unique_ptr<std::istream> stream_;
+  bool binary_ = false;
 
   std::string line_;
 
@@ -55,5 +73,7 @@ class DatasetReader {
   FRIEND_TEST(DatasetReader, readOne);
   FRIEND_TEST(DatasetReader, readOneBadFormat);
   FRIEND_TEST(DatasetReader, readAll);
+  FRIEND_TEST(DatasetReader, readBinary);
+  FRIEND_TEST(DatasetReader, readBinaryTruncated);
 };
 } // namespace qmf
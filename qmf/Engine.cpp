@@ -15,6 +15,7 @@
  */
 
 #include <qmf/Engine.h>
+#include <qmf/utils/Instrumentation.h>
 
 #include <algorithm>
 #include <fstream>
@@ -76,6 +77,11 @@ void Engine::computeTestScores(std::vector<std::vector<Double>>& testScores,
                                const FactorData& itemFactors,
                                ParallelExecutor& parallel) {
 
+  static const Histogram scoresTime("engine.test_scores");
+  static const Counter userCount("engine.test_score_users");
+  ScopedTimer timer(scoresTime);
+  userCount.add(testUsers.size());
+
   const size_t ntasks = testUsers.size();
   auto func =
     [&testUsers, &testScores, &userFactors, &itemFactors](const size_t taskId) {
@@ -93,5 +93,8 @@ class Engine {
   FRIEND_TEST(Engine, initAvgTestData);
   FRIEND_TEST(Engine, computeTestScores);
   FRIEND_TEST(Engine, saveFactors);
+
+  // for the microbenchmarks of qmf_bench
+  friend class KernelBench;
 };
 }
@@ -16,10 +16,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <fstream>
+#include <string>
 
 #include <qmf/Matrix.h>
 #include <qmf/Vector.h>
+#include <qmf/utils/ParallelExecutor.h>
 
 #include <glog/logging.h>
 
@@ -35,6 +38,33 @@ class FactorData {
       biases_(withBiases ? nelems : 0) {
   }
 
+  // zeroed by the threads of `parallel`, row i by the thread which solves
+  // task i of parallel.mapReduce(nelems, ...) later, so on a numa machine
+  // each row is placed on the node using it. with padRows each row starts on
+  // a cache line, see Matrix
+  FactorData(ParallelExecutor& parallel,
+             const size_t nelems,
+             const size_t nfactors,
+             const bool withBiases = false,
+             const bool padRows = false)
+    : withBiases_(withBiases),
+      factors_(nelems, nfactors, Matrix::Uninitialized(), padRows),
+      biases_(withBiases ? nelems : 0) {
+    setFactors(parallel);
+  }
+
+  // the factors are stored in a temporary file of mapDir mapped to memory,
+  // for the factors larger than the memory, see Matrix. zero at first
+  FactorData(const std::string& mapDir,
+             const size_t nelems,
+             const size_t nfactors,
+             const bool withBiases = false,
+             const bool padRows = false)
+    : withBiases_(withBiases),
+      factors_(nelems, nfactors, mapDir, padRows),
+      biases_(withBiases ? nelems : 0) {
+  }
+
   Double at(const size_t idx, const size_t fidx) const {
     return factors_(idx, fidx);
   }
@@ -70,6 +100,14 @@ class FactorData {
     }
   }
 
+  // zero pad in parallel
+  void setFactors(ParallelExecutor& parallel) {
+    parallel.execute(nelems(), [this](const size_t idx) {
+      Double* row = factors_.data(idx);
+      std::fill(row, row + factors_.stride(), 0.0);
+    });
+  }
+
   // 从具体的文件初始化
   void setFactors(const std::string& fileName) {
 
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <qmf/Matrix.h>
+#include <qmf/utils/MappedFile.h>
 
 #include <glog/logging.h>
 
@@ -36,26 +39,92 @@ extern "C" void dsysv_(char* uplo,
 }
 
 
+namespace {
+
+size_t paddedCols(const size_t ncols) {
+  const size_t lineCols = kCacheLineSize / sizeof(Double);
+  return (ncols + lineCols - 1) / lineCols * lineCols;
+}
+}
+
 Matrix::Matrix(const size_t nrows, const size_t ncols)
   : nrows_(nrows),
     ncols_(ncols),
-    data_(nrows * ncols, 0.0) {
+    stride_(ncols),
+    data_(nrows * ncols, 0.0),
+    base_(data_.data()) {
   CHECK_GT(nrows * ncols, 0) << "matrix's dimensions should be positive";
 }
 
+Matrix::Matrix(const size_t nrows,
+               const size_t ncols,
+               Uninitialized,
+               const bool padRows)
+  : nrows_(nrows),
+    ncols_(ncols),
+    stride_(padRows ? paddedCols(ncols) : ncols),
+    data_(nrows * stride_),
+    base_(data_.data()) {
+  CHECK_GT(nrows * ncols, 0) << "matrix's dimensions should be positive";
+}
+
+Matrix::Matrix(const size_t nrows,
+               const size_t ncols,
+               const std::string& mapDir,
+               const bool padRows)
+  : nrows_(nrows),
+    ncols_(ncols),
+    stride_(padRows ? paddedCols(ncols) : ncols) {
+  CHECK_GT(nrows * ncols, 0) << "matrix's dimensions should be positive";
+  mapped_ = MappedFile::create(mapDir, nrows * stride_ * sizeof(Double));
+  CHECK(mapped_) << "can not map the matrix to " << mapDir;
+  base_ = static_cast<Double*>(mapped_->data());
+}
+
+Matrix::Matrix(const Matrix& X)
+  : nrows_(X.nrows_), ncols_(X.ncols_), stride_(X.stride_), data_(X.data_) {
+  if (X.mapped_) {
+    data_.assign(X.base_, X.base_ + nrows_ * stride_);
+  }
+  base_ = data_.data();
+}
+
+Matrix& Matrix::operator=(const Matrix& X) {
+  if (this != &X) {
+    *this = Matrix(X);
+  }
+  return *this;
+}
+
 Matrix::Matrix(Matrix&& X) {
   nrows_ = X.nrows_;
   ncols_ = X.ncols_;
+  stride_ = X.stride_;
   data_ = std::move(X.data_);
+  mapped_ = std::move(X.mapped_);
+  base_ = X.base_;
+  X.base_ = nullptr;
 }
 
 Matrix& Matrix::operator=(Matrix&& X) {
   nrows_ = X.nrows_;
   ncols_ = X.ncols_;
+  stride_ = X.stride_;
   data_ = std::move(X.data_);
+  mapped_ = std::move(X.mapped_);
+  base_ = X.base_;
+  X.base_ = nullptr;
   return *this;
 }
 
+void Matrix::prefetchRows(const size_t begin, const size_t end) const {
+  const size_t rowBytes = stride_ * sizeof(Double);
+  const size_t last = std::min(end, nrows_);
+  if (mapped_ && begin < last) {
+    mapped_->prefetch(begin * rowBytes, (last - begin) * rowBytes);
+  }
+}
+
 Matrix Matrix::transpose() const {
   Matrix T(ncols_, nrows_);
   for (size_t i = 0; i < nrows_; ++i) {
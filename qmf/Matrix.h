@@ -16,13 +16,18 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <qmf/Types.h>
 #include <qmf/Vector.h>
+#include <qmf/utils/Allocator.h>
 
 namespace qmf {
 
+class MappedFile;
+
 // class for a row-wise matrix
 class Matrix {
  public:
@@ -30,20 +35,37 @@ class Matrix {
 
   Matrix(const size_t nrows, const size_t ncols);
 
-  // default copy
-  Matrix(const Matrix& X) = default;
-  Matrix& operator=(const Matrix& X) = default;
+  struct Uninitialized {};
+
+  // leaves the data uninitialized, the pages are placed by the first writer.
+  // with padRows each row starts on a cache line, then data() is not
+  // contiguous and the rows should be accessed by data(r)
+  Matrix(const size_t nrows,
+         const size_t ncols,
+         Uninitialized,
+         const bool padRows = false);
+
+  // the rows are stored in a temporary file of mapDir mapped to memory, for
+  // the matrices larger than the memory, see MappedFile. initialized to zero
+  Matrix(const size_t nrows,
+         const size_t ncols,
+         const std::string& mapDir,
+         const bool padRows = false);
+
+  // the copies are in memory
+  Matrix(const Matrix& X);
+  Matrix& operator=(const Matrix& X);
 
   // move semantics
   Matrix(Matrix&& X);
   Matrix& operator=(Matrix&& X);
 
   Double operator()(const size_t r, const size_t c) const {
-    return data_[index(r, c)];
+    return base_[index(r, c)];
   }
 
   Double& operator()(const size_t r, const size_t c) {
-    return data_[index(r, c)];
+    return base_[index(r, c)];
   }
 
   size_t nrows() const {
@@ -54,37 +76,62 @@ class Matrix {
     return ncols_;
   }
 
+  // the distance between the rows, ncols unless padded
+  size_t stride() const {
+    return stride_;
+  }
+
   // clear all data
   void clear() {
-    for (size_t i = 0; i < data_.size(); ++i)
-      data_[i] = Double();
+    for (size_t i = 0; i < nrows_ * stride_; ++i)
+      base_[i] = Double();
+  }
+
+  bool mapped() const {
+    return mapped_ != nullptr;
   }
 
+  // reads the rows [begin, end) of a mapped matrix ahead in the background,
+  // nothing for the matrices in memory
+  void prefetchRows(const size_t begin, const size_t end) const;
+
   // computes matrix transpose, X^T
   Matrix transpose() const;
 
   Matrix operator+(const Matrix& X) const;
 
-  // returns a raw pointer to the data
+  // returns a raw pointer to the data, nrows * stride
   Double* const data() {
-    return &data_[0];
+    return base_;
   }
 
   // returns raw pointer to start line
   Double* const data(const size_t r) {
-    return &data_[r * ncols_];
+    return &base_[r * stride_];
+  }
+
+  const Double* data(const size_t r) const {
+    return &base_[r * stride_];
   }
 
  private:
   size_t index(const size_t r, const size_t c) const {
-    return r * ncols_ + c;
+    return r * stride_ + c;
   }
 
   size_t nrows_;
 
   size_t ncols_;
 
-  std::vector<Double> data_;
+  size_t stride_;
+
+  // empty when mapped
+  std::vector<Double, AlignedAllocator<Double>> data_;
+
+  std::shared_ptr<const MappedFile> mapped_;
+
+  // the data of data_ or mapped_
+  Double* base_;
 };
 
 // solves a system of linear equations, A * x = b.
@@ -19,7 +19,7 @@
 namespace qmf {
 
 Vector::Vector(const size_t n)
-  : data_(n) {
+  : data_(n, 0.0) {
 }
 
 }
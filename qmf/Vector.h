@@ -19,6 +19,7 @@
 #include <vector>
 
 #include <qmf/Types.h>
+#include <qmf/utils/Allocator.h>
 
 namespace qmf {
 
@@ -43,6 +44,6 @@ class Vector {
   }
 
  private:
-  std::vector<Double> data_;
+  std::vector<Double, AlignedAllocator<Double>> data_;
 };
 }
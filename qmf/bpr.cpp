@@ -14,11 +14,15 @@
  * limitations under the License.
  */
 
+#include <csignal>
 #include <fstream>
 
 #include <qmf/bpr/BPREngine.h>
 #include <qmf/DatasetReader.h>
 #include <qmf/metrics/MetricsEngine.h>
+#include <qmf/utils/Allocator.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
 #include <qmf/utils/Util.h>
 
 #include <gflags/gflags.h>
@@ -37,11 +41,18 @@ DEFINE_double(init_distribution_bound, 0.01, "init distirbution bound");
 DEFINE_uint64(num_negative_samples, 3, "number of negative items to sample for each positive item");
 DEFINE_uint64(num_hogwild_threads, 1, "number of parallel threads for hogwild");
 DEFINE_bool(shuffle_training_set, true, "shuffle training set after each epoch");
+DEFINE_string(warm_user_factors, "", "user factors of the previous training "
+                                     "to warm start from");
+DEFINE_string(warm_item_factors, "", "item factors of the previous training "
+                                     "to warm start from");
 
 // settings
 DEFINE_uint64(eval_num_neg, 3, "number of negatives generated per positive in evaluation");
 DEFINE_int32(eval_seed, 42, "random seed for generating evaluation set and test users");
 DEFINE_uint64(nthreads, 16, "number of threads for parallel execution");
+DEFINE_string(huge_pages, "none", "huge pages of the factors: none, madvise "
+                                   "(transparent) or hugetlb (reserved pool)");
+DEFINE_bool(pad_rows, true, "start each factor row on a cache line");
 
 // datasets
 DEFINE_string(train_dataset, "", "filename of training dataset");
@@ -58,6 +69,11 @@ DEFINE_bool(test_always, false, "whether to compute test avg metrics after "
 DEFINE_string(user_factors, "", "filename of user factors");
 DEFINE_string(item_factors, "", "filename of item factors");
 
+// instrumentation
+DEFINE_string(instrumentation_file, "", "writes the timers and counters as "
+                                        "JSON at the end and on SIGUSR2 "
+                                        "(SIGUSR2 logs them if empty)");
+
 int main(int argc, char** argv) {
   //google::SetUsageMessage("bpr");
   //google::ParseCommandLineFlags(&argc, &argv, true);
@@ -83,7 +99,10 @@ int main(int argc, char** argv) {
                         FLAGS_init_distribution_bound,
                         FLAGS_num_negative_samples,
                         FLAGS_num_hogwild_threads,
-                        FLAGS_shuffle_training_set};
+                        FLAGS_shuffle_training_set,
+                        FLAGS_warm_user_factors,
+                        FLAGS_warm_item_factors,
+                        FLAGS_pad_rows};
 
   qmf::MetricsConfig metricsConfig{
     FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed};
@@ -99,26 +118,54 @@ int main(int argc, char** argv) {
     }
   }
 
+  // before the engine allocates the factors
+  qmf::HugePages hugePages;
+  CHECK(qmf::parseHugePages(FLAGS_huge_pages, &hugePages))
+    << "invalid --huge_pages " << FLAGS_huge_pages;
+  qmf::setHugePages(hugePages);
+
+  // before the engine starts its threads
+  qmf::Instrumentation::get().setDumpFile(FLAGS_instrumentation_file);
+  qmf::Instrumentation::get().dumpOnSignal(SIGUSR2);
+
   qmf::BPREngine engine(
     config, metricsEngine, FLAGS_eval_num_neg, FLAGS_eval_seed, FLAGS_nthreads);
 
+  // the wall time of each phase, parsed by e2e_bench
+  qmf::Timer timer;
   LOG(INFO) << "loading training data";
   qmf::DatasetReader trainReader(FLAGS_train_dataset);
-  engine.init(trainReader.readAll());
+  auto dataset = trainReader.readAll();
+  LOG(INFO) << "phase load took " << timer.seconds() << "s, "
+            << dataset.size() << " interactions";
+
+  timer.reset();
+  engine.init(dataset);
+  dataset.clear();
+  dataset.shrink_to_fit();
 
   if (!FLAGS_test_dataset.empty()) {
     LOG(INFO) << "loading test data";
     qmf::DatasetReader testReader(FLAGS_test_dataset);
     engine.initTest(testReader.readAll());
   }
+  LOG(INFO) << "phase init took " << timer.seconds() << "s";
 
   LOG(INFO) << "training";
+  timer.reset();
   engine.optimize();
+  LOG(INFO) << "phase train took " << timer.seconds() << "s";
 
   if (!FLAGS_user_factors.empty() && !FLAGS_item_factors.empty()) {
     LOG(INFO) << "saving model output";
+    timer.reset();
     engine.saveUserFactors(FLAGS_user_factors);
     engine.saveItemFactors(FLAGS_item_factors);
+    LOG(INFO) << "phase save took " << timer.seconds() << "s";
+  }
+
+  if (!FLAGS_instrumentation_file.empty()) {
+    qmf::Instrumentation::get().dump();
   }
 
   return 0;
@@ -15,6 +15,9 @@
  */
 
 #include <qmf/bpr/BPREngine.h>
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
 
 #include <algorithm>
 #include <cmath>
@@ -65,6 +68,8 @@ void BPREngine::saveItemFactors(const std::string& fileName) const {
 void BPREngine::init(const std::vector<DatasetElem>& dataset) {
   CHECK(!userFactors_ && !itemFactors_)
     << "engine was already initialized with train data";
+  static const Histogram initTime("bpr.init");
+  ScopedTimer timer(initTime);
   // populate data
   for (const auto& elem : dataset) {
     if (elem.value < 1.0) {
@@ -88,9 +93,10 @@ void BPREngine::init(const std::vector<DatasetElem>& dataset) {
 
   // initialize model
   learningRate_ = config_.initLearningRate;
-  userFactors_ = std::make_unique<FactorData>(nusers(), config_.nfactors);
-  itemFactors_ =
-    std::make_unique<FactorData>(nitems(), config_.nfactors, config_.useBiases);
+  userFactors_ = std::make_unique<FactorData>(
+    parallel_, nusers(), config_.nfactors, false, config_.padRows);
+  itemFactors_ = std::make_unique<FactorData>(
+    parallel_, nitems(), config_.nfactors, config_.useBiases, config_.padRows);
 
   std::uniform_real_distribution<Double> distr(
     -config_.initDistributionBound, config_.initDistributionBound);
@@ -102,6 +108,17 @@ void BPREngine::init(const std::vector<DatasetElem>& dataset) {
   if (config_.useBiases) {
     itemFactors_->setBiases(genUnif);
   }
+
+  if (!config_.warmStartUserFactors.empty()) {
+    CHECK(FactorReader::warmStart(
+      config_.warmStartUserFactors, userIndex_, *userFactors_))
+      << "warm start from " << config_.warmStartUserFactors << " failed";
+  }
+  if (!config_.warmStartItemFactors.empty()) {
+    CHECK(FactorReader::warmStart(
+      config_.warmStartItemFactors, itemIndex_, *itemFactors_))
+      << "warm start from " << config_.warmStartItemFactors << " failed";
+  }
 }
 
 void BPREngine::initTest(const std::vector<DatasetElem>& testDataset) {
@@ -147,9 +164,15 @@ void BPREngine::optimize() {
   CHECK(userFactors_ && itemFactors_)
     << "no factor data, have you initialized the engine?";
 
+  static const Histogram sgdTime("bpr.sgd");
+  static const Counter updateCount("bpr.updates");
   for (size_t epoch = 1; epoch <= config_.nepochs; ++epoch) {
+    Timer timer;
     // run SGD
-    auto updateOne = [this](const auto& triplet) { update(triplet); };
+    auto updateOne = [this](const auto& triplet) {
+      update(triplet);
+      updateCount.add();
+    };
     if (config_.numHogwildThreads <= 1) {
       iterate(updateOne, config_.numNegativeSamples, gen_);
     } else {
@@ -162,8 +185,15 @@ void BPREngine::optimize() {
       };
       parallel_.execute(numTasks, func);
     }
+    const double seconds = timer.seconds();
+    sgdTime.recordSeconds(seconds);
+    LOG(INFO) << "epoch " << epoch << ": sgd took " << seconds << "s";
 
     evaluate(epoch);
+    if (metricsEngine_) {
+      metricsEngine_->recordInstrumentation(
+        epoch, Instrumentation::get().snapshot());
+    }
 
     // update learning rate/dataset
     if (config_.decayRate < 1.0) {
@@ -244,6 +274,9 @@ Double BPREngine::lossDerivative(const Double scoreDifference) const {
 }
 
 void BPREngine::evaluate(const size_t epoch) {
+  static const Histogram evaluateTime("bpr.evaluate");
+  ScopedTimer timer(evaluateTime);
+
   // evaluate on train/test evaluation sets
   auto evalLoss = [this](const PosNegTriplet& triplet) {
     return loss(predictDifference(
@@ -48,6 +48,12 @@ struct BPRConfig {
   size_t numNegativeSamples;
   size_t numHogwildThreads;
   bool shuffleTrainingSet;
+  // factors of the previous training keyed by id, the unseen ids are still
+  // initialized randomly
+  std::string warmStartUserFactors;
+  std::string warmStartItemFactors;
+  // starts each factor row on a cache line
+  bool padRows = true;
 };
 
 class BPREngine : public Engine {
@@ -153,6 +159,9 @@ class BPREngine : public Engine {
   // for unit tests
   FRIEND_TEST(BPREngine, init);
   FRIEND_TEST(BPREngine, optimize);
+
+  // for the microbenchmarks of qmf_bench
+  friend class KernelBench;
 };
 }
 
@@ -0,0 +1,431 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qmf/utils/Timer.h>
+#include <qmf/utils/Util.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 端到端的性能测试：在同一份数据上依次运行 wals、bpr 和本地的 scheduler +
+ * N 个 labor，从各进程的日志中解析 load、init、每个 epoch 和 save 的耗时
+ * (phase ... took / ... took)，并由 wait4 取得各进程的峰值 RSS。
+ * 数据可以用 gen_dataset 生成，其他的二进制文件默认和本程序在同一目录
+ */
+
+DEFINE_string(train_dataset, "", "dataset to train on, text or binary");
+DEFINE_string(modes, "wals,bpr,distributed", "comma-separated list of "
+                                             "wals, bpr and distributed");
+DEFINE_string(threads, "4", "comma-separated thread counts of wals and bpr");
+DEFINE_string(nlabors, "2", "comma-separated labor counts of distributed");
+DEFINE_uint64(nepochs, 5, "number of epochs");
+DEFINE_uint64(nfactors, 30, "dimension of learned factors");
+DEFINE_string(bin_dir, "", "directory of the binaries (default: the "
+                           "directory of e2e_bench)");
+DEFINE_string(work_dir, "e2e_bench.out", "directory of the logs and factors");
+DEFINE_int32(port, 8960, "scheduler port of the first distributed run, "
+                         "increased by each run");
+DEFINE_int32(timeout, 3600, "seconds to wait for each run");
+DEFINE_string(output, "", "writes the results as JSON if not empty");
+
+namespace {
+
+struct Process {
+  std::string name;
+  std::string log;
+  pid_t pid = -1;
+  int status = 0;
+  // in KB
+  long maxRss = 0;
+};
+
+struct RunResult {
+  std::string mode;
+  size_t workers = 0;
+  bool ok = false;
+  double wallSeconds = 0;
+  uint64_t ninteractions = 0;
+  std::map<std::string, double> phases;
+  std::vector<double> epochs;
+  // in KB, of the biggest process and of all the processes
+  long maxRss = 0;
+  long totalRss = 0;
+
+  double phase(const std::string& name) const {
+    const auto it = phases.find(name);
+    return it == phases.end() ? 0 : it->second;
+  }
+
+  // interactions processed per second of the epochs
+  double throughput() const {
+    double seconds = 0;
+    for (const double epoch : epochs) {
+      seconds += epoch;
+    }
+    return seconds > 0 ? ninteractions * epochs.size() / seconds : 0;
+  }
+};
+
+void spawn(Process& process, const std::vector<std::string>& args) {
+  const pid_t pid = ::fork();
+  PCHECK(pid >= 0) << "fork failed";
+  if (pid == 0) {
+    const int fd = ::open(process.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                          0644);
+    if (fd < 0) {
+      ::_exit(127);
+    }
+    ::dup2(fd, STDOUT_FILENO);
+    ::dup2(fd, STDERR_FILENO);
+    ::close(fd);
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    ::execv(argv[0], argv.data());
+    ::_exit(127);
+  }
+  process.pid = pid;
+}
+
+// waits for the process to exit, optionally killing it first
+void reap(Process& process, const bool kill) {
+  if (process.pid < 0) {
+    return;
+  }
+  if (kill) {
+    ::kill(process.pid, SIGKILL);
+  }
+  struct rusage usage;
+  pid_t pid;
+  do {
+    pid = ::wait4(process.pid, &process.status, 0, &usage);
+  } while (pid < 0 && errno == EINTR);
+  PCHECK(pid == process.pid) << "wait4 " << process.name << " failed";
+  process.maxRss = usage.ru_maxrss;
+  process.pid = -1;
+}
+
+bool exitedOk(const Process& process) {
+  return WIFEXITED(process.status) && WEXITSTATUS(process.status) == 0;
+}
+
+// not reaped, so wait4 still gets its usage
+bool alive(const Process& process) {
+  if (process.pid < 0) {
+    return false;
+  }
+  siginfo_t info;
+  info.si_pid = 0;
+  return ::waitid(P_PID, process.pid, &info, WEXITED | WNOHANG | WNOWAIT) ==
+           0 &&
+         info.si_pid == 0;
+}
+
+std::string readFile(const std::string& fileName) {
+  std::ifstream in(fileName);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// polls the log until it matches the pattern, false if timed out or the
+// process exited
+bool waitForLog(const Process& process,
+                const std::regex& pattern,
+                const double timeout) {
+  qmf::Timer timer;
+  while (timer.seconds() < timeout) {
+    if (std::regex_search(readFile(process.log), pattern)) {
+      return true;
+    }
+    if (!alive(process)) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return false;
+}
+
+// the phase and epoch timings of the log of wals, bpr or the scheduler
+void parseLog(const std::string& log, RunResult& result) {
+  static const std::regex phaseRe("phase (\\w+) took ([-+.0-9eE]+)s");
+  static const std::regex sizeRe("phase load took [^,]*, (\\d+) interactions|"
+                                 "total training dataset size: (\\d+)");
+  // wals and bpr time each epoch, the scheduler each half of the epoch
+  static const std::regex epochRe("epoch (\\d+): [^\\n]*took ([-+.0-9eE]+)s");
+  static const std::regex halfRe(
+    "task \\d+:(\\d+) (?:users|items) train loss = [^\\n]*took "
+    "([-+.0-9eE]+)s");
+
+  const std::string content = readFile(log);
+  for (std::sregex_iterator it(content.begin(), content.end(), phaseRe), end;
+       it != end; ++it) {
+    result.phases[(*it)[1]] += std::stod((*it)[2]);
+  }
+  std::smatch match;
+  if (std::regex_search(content, match, sizeRe)) {
+    result.ninteractions =
+      std::stoull(match[1].matched ? match[1].str() : match[2].str());
+  }
+
+  const bool halves = result.mode == "distributed";
+  for (std::sregex_iterator it(content.begin(), content.end(),
+                               halves ? halfRe : epochRe),
+       end;
+       it != end; ++it) {
+    size_t epoch = std::stoul((*it)[1]);
+    epoch = halves ? (epoch + 1) / 2 : epoch;
+    if (epoch == 0) {
+      continue;
+    }
+    if (result.epochs.size() < epoch) {
+      result.epochs.resize(epoch, 0);
+    }
+    result.epochs[epoch - 1] += std::stod((*it)[2]);
+  }
+}
+
+void collectRss(const std::vector<Process>& processes, RunResult& result) {
+  for (const auto& process : processes) {
+    result.maxRss = std::max(result.maxRss, process.maxRss);
+    result.totalRss += process.maxRss;
+  }
+}
+
+RunResult runLocal(const std::string& binDir,
+                   const std::string& mode,
+                   const size_t nthreads) {
+  RunResult result;
+  result.mode = mode;
+  result.workers = nthreads;
+
+  const std::string prefix =
+    FLAGS_work_dir + "/" + mode + "." + std::to_string(nthreads);
+  Process process;
+  process.name = mode;
+  process.log = prefix + ".log";
+  std::vector<std::string> args = {
+    binDir + "/" + mode,
+    "--train_dataset=" + FLAGS_train_dataset,
+    "--nepochs=" + std::to_string(FLAGS_nepochs),
+    "--nfactors=" + std::to_string(FLAGS_nfactors),
+    "--nthreads=" + std::to_string(nthreads),
+    "--user_factors=" + prefix + ".user",
+    "--item_factors=" + prefix + ".item"};
+  if (mode == "bpr") {
+    args.push_back("--num_hogwild_threads=" + std::to_string(nthreads));
+  }
+
+  qmf::Timer timer;
+  spawn(process, args);
+  reap(process, false);
+  result.wallSeconds = timer.seconds();
+  result.ok = exitedOk(process);
+  LOG_IF(ERROR, !result.ok) << mode << " failed, see " << process.log;
+
+  parseLog(process.log, result);
+  collectRss({process}, result);
+  return result;
+}
+
+RunResult runDistributed(const std::string& binDir,
+                         const size_t nlabors,
+                         const int port) {
+  RunResult result;
+  result.mode = "distributed";
+  result.workers = nlabors;
+
+  const std::string prefix =
+    FLAGS_work_dir + "/distributed." + std::to_string(nlabors);
+  const std::string portFlag = "--scheduler_port=" + std::to_string(port);
+  std::vector<Process> processes(nlabors + 1);
+
+  Process& scheduler = processes[0];
+  scheduler.name = "wals_scheduler";
+  scheduler.log = prefix + ".scheduler.log";
+  spawn(scheduler, {binDir + "/wals_scheduler", portFlag});
+
+  bool ready =
+    waitForLog(scheduler, std::regex("scheduler listen to"), FLAGS_timeout);
+  for (size_t i = 1; ready && i <= nlabors; ++i) {
+    Process& labor = processes[i];
+    labor.name = "wals_labor";
+    labor.log = prefix + ".labor" + std::to_string(i) + ".log";
+    spawn(labor, {binDir + "/wals_labor", portFlag});
+    ready = waitForLog(labor, std::regex("start loop thread"), FLAGS_timeout);
+  }
+
+  qmf::Timer timer;
+  if (ready) {
+    // the task of TextFormat, see distributed/proto/task.proto
+    const std::string taskFile = prefix + ".task.pb";
+    std::ofstream task(taskFile);
+    task << "nepochs: " << FLAGS_nepochs << "\n"
+         << "nfactors: " << FLAGS_nfactors << "\n"
+         << "train_set: \"" << FLAGS_train_dataset << "\"\n"
+         << "user_factors: \"" << prefix << ".user\"\n"
+         << "item_factors: \"" << prefix << ".item\"\n";
+    task.close();
+
+    Process submit;
+    submit.name = "wals_submit";
+    submit.log = prefix + ".submit.log";
+    spawn(submit, {binDir + "/wals_submit", "127.0.0.1", std::to_string(port),
+                   taskFile});
+    reap(submit, false);
+
+    ready = exitedOk(submit) &&
+            waitForLog(scheduler,
+                       std::regex("RunOneTask of .* (successfully|failed)"),
+                       FLAGS_timeout);
+    result.ok = ready && std::regex_search(readFile(scheduler.log),
+                                           std::regex("RunOneTask of .* "
+                                                      "successfully"));
+  }
+  result.wallSeconds = timer.seconds();
+  LOG_IF(ERROR, !result.ok) << "distributed with " << nlabors
+                            << " labors failed, see " << prefix << ".*.log";
+
+  // the scheduler and the labors never exit by themselves
+  for (auto& process : processes) {
+    reap(process, true);
+  }
+  parseLog(scheduler.log, result);
+  collectRss(processes, result);
+  return result;
+}
+
+std::vector<size_t> parseCounts(const std::string& str) {
+  std::vector<size_t> counts;
+  for (const auto& piece : qmf::split(str, ',')) {
+    counts.push_back(std::stoul(piece));
+    CHECK_GT(counts.back(), 0) << "counts must be positive: " << str;
+  }
+  return counts;
+}
+
+void printTable(const std::vector<RunResult>& results) {
+  printf("%-12s %7s %4s %9s %8s %8s %9s %9s %8s %12s %10s %10s\n", "mode",
+         "workers", "ok", "wall(s)", "load(s)", "init(s)", "epoch(s)",
+         "train(s)", "save(s)", "M inter/s", "maxRSS(MB)", "sumRSS(MB)");
+  for (const auto& r : results) {
+    double epochs = 0;
+    for (const double epoch : r.epochs) {
+      epochs += epoch;
+    }
+    printf("%-12s %7zu %4s %9.2f %8.2f %8.2f %9.3f %9.2f %8.2f %12.3f "
+           "%10.1f %10.1f\n",
+           r.mode.c_str(), r.workers, r.ok ? "yes" : "no", r.wallSeconds,
+           r.phase("load"), r.phase("init"),
+           r.epochs.empty() ? 0 : epochs / r.epochs.size(), epochs,
+           r.phase("save"), r.throughput() / 1e6, r.maxRss / 1024.0,
+           r.totalRss / 1024.0);
+  }
+}
+
+void writeJson(const std::vector<RunResult>& results,
+               const std::string& fileName) {
+  FILE* fp = fopen(fileName.c_str(), "w");
+  CHECK(fp) << "can not open " << fileName;
+  fprintf(fp, "{\n  \"train_dataset\": \"%s\",\n  \"nepochs\": %zu,\n"
+              "  \"nfactors\": %zu,\n  \"runs\": [\n",
+          FLAGS_train_dataset.c_str(), static_cast<size_t>(FLAGS_nepochs),
+          static_cast<size_t>(FLAGS_nfactors));
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    fprintf(fp, "    {\"mode\": \"%s\", \"workers\": %zu, \"ok\": %s, "
+                "\"wall_seconds\": %.6f, \"interactions\": %llu, "
+                "\"throughput\": %.3f, \"max_rss_kb\": %ld, "
+                "\"total_rss_kb\": %ld, \"phases\": {",
+            r.mode.c_str(), r.workers, r.ok ? "true" : "false",
+            r.wallSeconds, static_cast<unsigned long long>(r.ninteractions),
+            r.throughput(), r.maxRss, r.totalRss);
+    size_t j = 0;
+    for (const auto& p : r.phases) {
+      fprintf(fp, "%s\"%s\": %.6f", j++ ? ", " : "", p.first.c_str(),
+              p.second);
+    }
+    fprintf(fp, "}, \"epoch_seconds\": [");
+    for (size_t k = 0; k < r.epochs.size(); ++k) {
+      fprintf(fp, "%s%.6f", k ? ", " : "", r.epochs[k]);
+    }
+    fprintf(fp, "]}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  CHECK_EQ(fclose(fp), 0) << "write " << fileName << " failed";
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("e2e_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_train_dataset.empty()) << "missing --train_dataset";
+  CHECK_EQ(::access(FLAGS_train_dataset.c_str(), R_OK), 0)
+    << "can not read " << FLAGS_train_dataset;
+  std::string binDir = FLAGS_bin_dir;
+  if (binDir.empty()) {
+    const std::string self = argv[0];
+    const size_t pos = self.rfind('/');
+    binDir = pos == std::string::npos ? "." : self.substr(0, pos);
+  }
+  ::mkdir(FLAGS_work_dir.c_str(), 0755);
+
+  std::vector<RunResult> results;
+  int port = FLAGS_port;
+  for (const auto& mode : qmf::split(FLAGS_modes, ',')) {
+    if (mode == "wals" || mode == "bpr") {
+      for (const size_t nthreads : parseCounts(FLAGS_threads)) {
+        LOG(INFO) << "running " << mode << " with " << nthreads
+                  << " threads";
+        results.push_back(runLocal(binDir, mode, nthreads));
+      }
+    } else if (mode == "distributed") {
+      for (const size_t nlabors : parseCounts(FLAGS_nlabors)) {
+        LOG(INFO) << "running distributed with " << nlabors << " labors";
+        results.push_back(runDistributed(binDir, nlabors, port++));
+      }
+    } else {
+      LOG(FATAL) << "unknown mode " << mode;
+    }
+  }
+
+  printTable(results);
+  if (!FLAGS_output.empty()) {
+    writeJson(results, FLAGS_output);
+  }
+
+  for (const auto& r : results) {
+    if (!r.ok) {
+      return EXIT_FAILURE;
+    }
+  }
+  return 0;
+}
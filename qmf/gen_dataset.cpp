@@ -0,0 +1,259 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/utils/FactorWriter.h>
+#include <qmf/utils/ParallelExecutor.h>
+#include <qmf/utils/Timer.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 生成用户-物品交互的训练数据：用户和物品的热度服从 Zipf 分布（指数为 0
+ * 时为均匀分布），第 k 热的 id 经过置换打散，不会集中在小的 id 上。
+ * 数据按块并行生成，每块的随机数种子只取决于 seed 和块号，所以结果与线程数
+ * 无关。相同的 (user, item) 可能重复出现，和真实的日志一样
+ */
+
+DEFINE_uint64(nusers, 100000, "number of distinct users");
+DEFINE_uint64(nitems, 10000, "number of distinct items");
+DEFINE_uint64(ninteractions, 0, "number of interactions (0 = by --density)");
+DEFINE_double(density, 0.001, "interactions / (nusers * nitems) when "
+                              "--ninteractions is 0");
+DEFINE_double(user_skew, 0.8, "zipf exponent of the user activity (0 = "
+                              "uniform)");
+DEFINE_double(item_skew, 1.0, "zipf exponent of the item popularity (0 = "
+                              "uniform)");
+DEFINE_uint64(max_value, 1, "values are uniform integers in [1, max_value]");
+DEFINE_uint64(seed, 42, "random seed");
+DEFINE_string(format, "text", "text or binary, see DatasetReader");
+DEFINE_string(output, "dataset.txt", "output filename");
+DEFINE_int32(nthreads, 4, "number of threads for parallel generation");
+DEFINE_uint64(chunk_size, 1 << 20, "interactions generated by each task");
+
+namespace {
+
+/**
+ * Samples k in [1, n] with probability proportional to k^-exponent, by the
+ * rejection-inversion method of Hormann and Derflinger, in O(1) memory.
+ */
+class ZipfSampler {
+ public:
+  ZipfSampler(const uint64_t n, const double exponent)
+    : n_(n), exponent_(exponent) {
+    CHECK_GT(n, 0);
+    CHECK_GE(exponent, 0.0);
+    hIntegralX1_ = hIntegral(1.5) - 1.0;
+    hIntegralN_ = hIntegral(n + 0.5);
+    s_ = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+  }
+
+  template <typename Generator>
+  uint64_t operator()(Generator& gen) const {
+    std::uniform_real_distribution<double> distr(0.0, 1.0);
+    if (exponent_ == 0.0) {
+      return std::min<uint64_t>(1 + distr(gen) * n_, n_);
+    }
+    while (true) {
+      const double u =
+        hIntegralN_ + distr(gen) * (hIntegralX1_ - hIntegralN_);
+      const double x = hIntegralInverse(u);
+      double k = std::floor(x + 0.5);
+      k = std::min(std::max(k, 1.0), static_cast<double>(n_));
+      if (k - x <= s_ || u >= hIntegral(k + 0.5) - h(k)) {
+        return static_cast<uint64_t>(k);
+      }
+    }
+  }
+
+ private:
+  // h(x) = x^-exponent and its integral H
+  double h(const double x) const {
+    return std::exp(-exponent_ * std::log(x));
+  }
+
+  double hIntegral(const double x) const {
+    const double logX = std::log(x);
+    return helper2((1.0 - exponent_) * logX) * logX;
+  }
+
+  double hIntegralInverse(const double x) const {
+    const double t = std::max(x * (1.0 - exponent_), -1.0);
+    return std::exp(helper1(t) * x);
+  }
+
+  // log(1 + x) / x and (exp(x) - 1) / x, stable around 0
+  static double helper1(const double x) {
+    return std::fabs(x) > 1e-8 ? std::log1p(x) / x :
+                                 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+  }
+
+  static double helper2(const double x) {
+    return std::fabs(x) > 1e-8 ?
+             std::expm1(x) / x :
+             1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+  }
+
+  const uint64_t n_;
+  const double exponent_;
+  double hIntegralX1_;
+  double hIntegralN_;
+  double s_;
+};
+
+/**
+ * A bijection of [0, n), so the hot ranks are spread over the ids. It is an
+ * invertible mix of the next power of 2 above n, walked until it falls in
+ * [0, n), which takes less than 2 steps on average.
+ */
+class IdPermutation {
+ public:
+  IdPermutation(const uint64_t n, const uint64_t seed) : n_(n) {
+    CHECK_GT(n, 0);
+    while (bits_ < 64 && (1ULL << bits_) < n) {
+      ++bits_;
+    }
+    mask_ = bits_ == 64 ? ~0ULL : (1ULL << bits_) - 1;
+    key_ = (seed * 0x9E3779B97F4A7C15ULL) & mask_;
+  }
+
+  uint64_t operator()(uint64_t x) const {
+    do {
+      x = mix(x);
+    } while (x >= n_);
+    return x;
+  }
+
+ private:
+  // each step is a bijection of [0, 2^bits_)
+  uint64_t mix(uint64_t x) const {
+    const int shift = std::max(bits_ / 2, 1);
+    x = (x + key_) & mask_;
+    x ^= x >> shift;
+    x = (x * 0xBF58476D1CE4E5B9ULL) & mask_;
+    x ^= x >> shift;
+    x = (x * 0x94D049BB133111EBULL) & mask_;
+    x ^= x >> shift;
+    return x;
+  }
+
+  const uint64_t n_;
+  int bits_ = 0;
+  uint64_t mask_;
+  uint64_t key_;
+};
+
+void generate(const uint64_t chunk,
+              const uint64_t count,
+              const ZipfSampler& users,
+              const ZipfSampler& items,
+              const IdPermutation& userIds,
+              const IdPermutation& itemIds,
+              std::vector<qmf::DatasetElem>& elems) {
+  std::seed_seq seq{FLAGS_seed, chunk};
+  std::mt19937_64 gen(seq);
+  std::uniform_int_distribution<uint64_t> values(1, FLAGS_max_value);
+  elems.resize(count);
+  for (auto& elem : elems) {
+    elem.userId = userIds(users(gen) - 1);
+    elem.itemId = itemIds(items(gen) - 1);
+    elem.value = FLAGS_max_value == 1 ? 1.0 : values(gen);
+  }
+}
+
+void format(const std::vector<qmf::DatasetElem>& elems,
+            const bool binary,
+            std::string& out) {
+  out.clear();
+  if (binary) {
+    out.assign(reinterpret_cast<const char*>(elems.data()),
+               elems.size() * sizeof(qmf::DatasetElem));
+    return;
+  }
+  char line[3 * qmf::FactorWriter::kMaxNumberChars];
+  for (const auto& elem : elems) {
+    char* p = line;
+    p += qmf::FactorWriter::formatInt64(elem.userId, p);
+    *p++ = ' ';
+    p += qmf::FactorWriter::formatInt64(elem.itemId, p);
+    *p++ = ' ';
+    p += qmf::FactorWriter::formatInt64(static_cast<int64_t>(elem.value), p);
+    *p++ = '\n';
+    out.append(line, p - line);
+  }
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("gen_dataset");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK(FLAGS_format == "text" || FLAGS_format == "binary")
+    << "unknown format " << FLAGS_format;
+  CHECK_GT(FLAGS_max_value, 0);
+  CHECK_GT(FLAGS_chunk_size, 0);
+  const bool binary = FLAGS_format == "binary";
+  const uint64_t ninteractions =
+    FLAGS_ninteractions > 0 ?
+      FLAGS_ninteractions :
+      static_cast<uint64_t>(std::llround(
+        FLAGS_density * FLAGS_nusers * static_cast<double>(FLAGS_nitems)));
+  CHECK_GT(ninteractions, 0) << "no interactions, check --density";
+
+  const ZipfSampler users(FLAGS_nusers, FLAGS_user_skew);
+  const ZipfSampler items(FLAGS_nitems, FLAGS_item_skew);
+  const IdPermutation userIds(FLAGS_nusers, FLAGS_seed);
+  const IdPermutation itemIds(FLAGS_nitems, FLAGS_seed + 1);
+
+  FILE* fp = fopen(FLAGS_output.c_str(), "wb");
+  CHECK(fp) << "can not open " << FLAGS_output;
+  if (binary) {
+    CHECK_EQ(fwrite(qmf::DatasetReader::binaryMagic.data(), 1,
+                    qmf::DatasetReader::binaryMagic.size(), fp),
+             qmf::DatasetReader::binaryMagic.size());
+  }
+
+  // generated and formatted in rounds of one chunk per thread, then written
+  // in order
+  qmf::Timer timer;
+  qmf::ParallelExecutor parallel(FLAGS_nthreads);
+  const uint64_t nchunks =
+    (ninteractions + FLAGS_chunk_size - 1) / FLAGS_chunk_size;
+  std::vector<std::vector<qmf::DatasetElem>> elems(FLAGS_nthreads);
+  std::vector<std::string> buffs(FLAGS_nthreads);
+  for (uint64_t first = 0; first < nchunks; first += FLAGS_nthreads) {
+    const size_t ntasks = std::min<uint64_t>(FLAGS_nthreads, nchunks - first);
+    parallel.execute(ntasks, [&](const size_t taskId) {
+      const uint64_t chunk = first + taskId;
+      const uint64_t count = std::min<uint64_t>(
+        FLAGS_chunk_size, ninteractions - chunk * FLAGS_chunk_size);
+      generate(chunk, count, users, items, userIds, itemIds, elems[taskId]);
+      format(elems[taskId], binary, buffs[taskId]);
+    });
+    for (size_t taskId = 0; taskId < ntasks; ++taskId) {
+      const auto& buff = buffs[taskId];
+      CHECK_EQ(fwrite(buff.data(), 1, buff.size(), fp), buff.size())
+        << "write " << FLAGS_output << " failed";
+    }
+  }
+  CHECK_EQ(fclose(fp), 0) << "write " << FLAGS_output << " failed";
+
+  LOG(INFO) << "generated " << ninteractions << " interactions of "
+            << FLAGS_nusers << " users and " << FLAGS_nitems << " items to "
+            << FLAGS_output << " in " << timer.seconds() << "s";
+  return 0;
+}
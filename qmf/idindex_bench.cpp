@@ -0,0 +1,179 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <qmf/utils/IdIndex.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * IdIndex 的构建耗时、查询吞吐和内存：对比原来基于 unordered_map 的实现、
+ * 开放寻址的哈希表，以及排序数组的只读模式。id 为随机的 64 位整数，
+ * 查询分为命中和未命中两组
+ */
+
+DEFINE_uint64(nids, 10000000, "distinct ids indexed");
+DEFINE_uint64(nlookups, 20000000, "lookups of each kind");
+DEFINE_int32(seed, 42, "random seed");
+
+namespace {
+
+// the implementation before the open addressing table
+class LegacyIdIndex {
+ public:
+  size_t idx(const int64_t id) const {
+    const auto it = map_.find(id);
+    return it == map_.end() ? qmf::IdIndex::missingIdx : it->second;
+  }
+
+  size_t getOrSetIdx(const int64_t id) {
+    const auto it = map_.find(id);
+    if (it != map_.end()) {
+      return it->second;
+    }
+    const size_t idx = ids_.size();
+    map_.emplace(id, idx);
+    ids_.push_back(id);
+    return idx;
+  }
+
+  size_t size() const {
+    return ids_.size();
+  }
+
+ private:
+  std::vector<int64_t> ids_;
+  std::unordered_map<int64_t, size_t> map_;
+};
+
+double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+    .count();
+}
+
+// bytes allocated from the heap, 0 if not supported
+size_t heapBytes() {
+#if defined(__GLIBC__) && \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+template <typename Index>
+void lookup(const char* name,
+            const Index& index,
+            const std::vector<int64_t>& hits,
+            const std::vector<int64_t>& misses,
+            const double buildSeconds,
+            const size_t bytes) {
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const int64_t id : hits) {
+    found += index.idx(id) != qmf::IdIndex::missingIdx;
+  }
+  const double hitSeconds = seconds(start);
+  CHECK_EQ(found, hits.size());
+
+  start = std::chrono::steady_clock::now();
+  for (const int64_t id : misses) {
+    found += index.idx(id) != qmf::IdIndex::missingIdx;
+  }
+  const double missSeconds = seconds(start);
+  CHECK_EQ(found, hits.size());
+
+  printf("%-10s %10.3f %14.1f %14.1f %10.1f %12.2f\n", name, buildSeconds,
+         hits.size() / hitSeconds / 1e6, misses.size() / missSeconds / 1e6,
+         bytes / 1048576.0, static_cast<double>(bytes) / index.size());
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("idindex_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK_GT(FLAGS_nids, 0);
+  std::mt19937_64 gen(FLAGS_seed);
+
+  // the ids are even, the misses odd
+  std::vector<int64_t> ids(FLAGS_nids);
+  for (auto& id : ids) {
+    id = static_cast<int64_t>(gen() & ~1ULL);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  std::shuffle(ids.begin(), ids.end(), gen);
+
+  std::vector<int64_t> hits(FLAGS_nlookups);
+  std::vector<int64_t> misses(FLAGS_nlookups);
+  for (size_t i = 0; i < FLAGS_nlookups; ++i) {
+    hits[i] = ids[gen() % ids.size()];
+    misses[i] = static_cast<int64_t>(gen() | 1ULL);
+  }
+
+  printf("%zu ids, %zu lookups\n", ids.size(), hits.size());
+  printf("%-10s %10s %14s %14s %10s %12s\n", "index", "build(s)",
+         "hit(M/s)", "miss(M/s)", "MB", "bytes/id");
+
+  {
+    size_t heap = heapBytes();
+    auto start = std::chrono::steady_clock::now();
+    LegacyIdIndex index;
+    for (const int64_t id : ids) {
+      index.getOrSetIdx(id);
+    }
+    const double buildSeconds = seconds(start);
+    heap = heapBytes() - heap;
+    lookup("legacy", index, hits, misses, buildSeconds, heap);
+  }
+
+  {
+    auto start = std::chrono::steady_clock::now();
+    qmf::IdIndex index;
+    for (const int64_t id : ids) {
+      index.getOrSetIdx(id);
+    }
+    const double buildSeconds = seconds(start);
+    lookup("hash", index, hits, misses, buildSeconds, index.memoryBytes());
+  }
+
+  {
+    auto start = std::chrono::steady_clock::now();
+    qmf::IdIndex index;
+    index.build(ids);
+    const double buildSeconds = seconds(start);
+    lookup("hash-bulk", index, hits, misses, buildSeconds,
+           index.memoryBytes());
+  }
+
+  {
+    std::vector<int64_t> sortedIds = ids;
+    auto start = std::chrono::steady_clock::now();
+    std::sort(sortedIds.begin(), sortedIds.end());
+    qmf::IdIndex index;
+    index.buildSorted(std::move(sortedIds));
+    const double buildSeconds = seconds(start);
+    lookup("sorted", index, hits, misses, buildSeconds, index.memoryBytes());
+  }
+
+  return 0;
+}
@@ -42,4 +42,19 @@ void MetricsEngine::recordMetric(const std::string& metricKey,
               << val;
   }
 }
+
+void MetricsEngine::recordInstrumentation(
+  const size_t epoch,
+  const Instrumentation::Snapshot& snapshot) {
+  for (const auto& counter : snapshot.counters) {
+    metricsMap_["instr_" + counter.first].emplace_back(epoch, counter.second);
+  }
+  for (const auto& histogram : snapshot.histograms) {
+    const std::string prefix = "instr_" + histogram.first;
+    metricsMap_[prefix + "_count"].emplace_back(epoch,
+                                                histogram.second.count);
+    metricsMap_[prefix + "_seconds"].emplace_back(
+      epoch, histogram.second.sumNanos / 1e9);
+  }
+}
 }
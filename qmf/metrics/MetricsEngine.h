@@ -22,6 +22,7 @@
 #include <unordered_map>
 
 #include <qmf/metrics/MetricsManager.h>
+#include <qmf/utils/Instrumentation.h>
 #include <qmf/Types.h>
 
 namespace qmf {
@@ -86,6 +87,19 @@ class MetricsEngine {
     computeAndRecordMetrics(testAvgMetrics_, "test_avg_", epoch, args...);
   }
 
+  // the test avg metric aggregated elsewhere, e.g. by the distributed Labors
+  void recordTestAvgMetric(const std::string& metric,
+                           const size_t epoch,
+                           const Double val) {
+    recordMetric("test_avg_" + metric, epoch, val);
+  }
+
+  // the counters and histograms of the Instrumentation so far, recorded as
+  // "instr_<counter>", "instr_<histogram>_count" and
+  // "instr_<histogram>_seconds" without logging
+  void recordInstrumentation(const size_t epoch,
+                             const Instrumentation::Snapshot& snapshot);
+
   const std::vector<std::string>& trainMetrics() const {
     return trainMetrics_;
   }
@@ -104,6 +118,10 @@ class MetricsEngine {
 
   using MetricVector = std::vector<std::pair<size_t, Double>>;
 
+  const std::unordered_map<std::string, MetricVector>& metricsMap() const {
+    return metricsMap_;
+  }
+
  private:
   bool addMetric(std::vector<std::string>& metrics,
                  const std::string& metric);
@@ -0,0 +1,661 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/bpr/BPREngine.h>
+#include <qmf/metrics/Metrics.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ParallelExecutor.h>
+#include <qmf/wals/WALSEngine.h>
+#include <qmf/wals/WALSSolver.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 热点函数的 microbenchmark，用法和输出仿照 google benchmark：每个用例的
+ * 迭代次数自动增长到 --benchmark_min_time，重复 --benchmark_repetitions 次
+ * 取中位数。数据由固定的随机种子生成，--benchmark_out 输出 JSON，用于
+ * 跨版本对比性能回归
+ */
+
+DEFINE_string(benchmark_filter, ".*", "regex of the benchmarks to run");
+DEFINE_double(benchmark_min_time, 0.5, "minimum seconds of each benchmark");
+DEFINE_uint64(benchmark_repetitions, 3, "repetitions, the median is reported");
+DEFINE_string(benchmark_format, "console", "stdout format: console or json");
+DEFINE_string(benchmark_out, "", "also write the JSON report to the file");
+DEFINE_string(nfactors, "10,30,100", "comma-separated nfactors benchmarked");
+DEFINE_string(threads, "1,2,4,8", "comma-separated thread counts benchmarked");
+DEFINE_int32(seed, 42, "random seed of the generated data");
+
+namespace qmf {
+
+// the running state of a benchmark: the loop `for (auto _ : state)` is timed
+class BenchState {
+ public:
+  explicit BenchState(const size_t iterations) : iterations_(iterations) {
+  }
+
+  class Iterator {
+   public:
+    Iterator(BenchState* state, const size_t remaining)
+      : state_(state), remaining_(remaining) {
+    }
+
+    bool operator!=(const Iterator&) {
+      if (remaining_ != 0) {
+        return true;
+      }
+      state_->stop();
+      return false;
+    }
+
+    void operator++() {
+      --remaining_;
+    }
+
+    // a non-trivial type, the unused loop variable is not warned
+    struct Value {
+      ~Value() {
+      }
+    };
+
+    Value operator*() const {
+      return Value();
+    }
+
+   private:
+    BenchState* state_;
+    size_t remaining_;
+  };
+
+  Iterator begin() {
+    start();
+    return Iterator(this, iterations_);
+  }
+
+  Iterator end() {
+    return Iterator(nullptr, 0);
+  }
+
+  size_t iterations() const {
+    return iterations_;
+  }
+
+  double realSeconds() const {
+    return realSeconds_;
+  }
+
+  double cpuSeconds() const {
+    return cpuSeconds_;
+  }
+
+  // items handled by one iteration, reported as items_per_second
+  void setItemsPerIteration(const size_t items) {
+    itemsPerIteration_ = items;
+  }
+
+  size_t itemsPerIteration() const {
+    return itemsPerIteration_;
+  }
+
+ private:
+  static double cpuNow() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  void start() {
+    cpuStart_ = cpuNow();
+    realStart_ = std::chrono::steady_clock::now();
+  }
+
+  void stop() {
+    realSeconds_ = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - realStart_)
+                     .count();
+    cpuSeconds_ = cpuNow() - cpuStart_;
+  }
+
+  size_t iterations_;
+  size_t itemsPerIteration_ = 0;
+  std::chrono::steady_clock::time_point realStart_;
+  double cpuStart_ = 0.0;
+  double realSeconds_ = 0.0;
+  double cpuSeconds_ = 0.0;
+};
+
+// the private kernels are reached as a friend of the engines
+class KernelBench {
+ public:
+  static void computeXtX(BenchState& state,
+                         const size_t nfactors,
+                         const size_t nthreads);
+
+  static void updateFactorsForOne(BenchState& state, const size_t nfactors);
+
+  static void bprUpdate(BenchState& state, const size_t nfactors);
+
+  static void sampleRandomNegative(BenchState& state);
+
+  static void computeTestScores(BenchState& state,
+                                const size_t nfactors,
+                                const size_t nthreads);
+};
+}
+
+namespace {
+
+using qmf::BenchState;
+using qmf::Double;
+
+// the values of the kernels are consumed, so they are not optimized away
+volatile Double gSink;
+
+const size_t kNumItems = 10000;
+const size_t kNumUsers = 1000;
+const size_t kUserSignals = 50;
+
+std::vector<size_t> parseList(const std::string& list) {
+  std::vector<size_t> values;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t next = list.find(',', pos);
+    if (next == std::string::npos) {
+      next = list.size();
+    }
+    values.push_back(std::stoul(list.substr(pos, next - pos)));
+    pos = next + 1;
+  }
+  return values;
+}
+
+std::unique_ptr<qmf::MetricsEngine> kNullMetricEngine = nullptr;
+
+qmf::Matrix randomMatrix(const size_t nrows,
+                         const size_t ncols,
+                         std::mt19937& gen) {
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  qmf::Matrix m(nrows, ncols);
+  for (size_t i = 0; i < nrows; ++i) {
+    for (size_t j = 0; j < ncols; ++j) {
+      m(i, j) = distr(gen);
+    }
+  }
+  return m;
+}
+
+// Y^t * Y + lambda * I, symmetric positive definite as in WALS
+qmf::Matrix gram(const qmf::Matrix& Y, const Double lambda) {
+  const size_t n = Y.ncols();
+  qmf::Matrix A(n, n);
+  for (size_t k = 0; k < Y.nrows(); ++k) {
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        A(i, j) += Y(k, i) * Y(k, j);
+      }
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    A(i, i) += lambda;
+  }
+  return A;
+}
+
+// kNumUsers users with kUserSignals items each
+std::vector<qmf::DatasetElem> syntheticDataset(std::mt19937& gen) {
+  std::vector<qmf::DatasetElem> dataset;
+  for (size_t u = 0; u < kNumUsers; ++u) {
+    for (size_t i = 0; i < kUserSignals; ++i) {
+      dataset.push_back({static_cast<int64_t>(u),
+                         static_cast<int64_t>(gen() % kNumItems), 1.0});
+    }
+  }
+  return dataset;
+}
+
+qmf::BPRConfig bprConfig(const size_t nfactors) {
+  qmf::BPRConfig config;
+  config.nepochs = 1;
+  config.nfactors = nfactors;
+  config.initLearningRate = 0.05;
+  config.biasLambda = 1.0;
+  config.userLambda = 0.025;
+  config.itemLambda = 0.0025;
+  config.decayRate = 0.9;
+  config.useBiases = true;
+  config.initDistributionBound = 0.01;
+  config.numNegativeSamples = 3;
+  config.numHogwildThreads = 1;
+  config.shuffleTrainingSet = false;
+  return config;
+}
+
+void symmetricSolve(BenchState& state, const size_t nfactors) {
+  std::mt19937 gen(FLAGS_seed);
+  const qmf::Matrix A = gram(randomMatrix(kNumItems, nfactors, gen), 1.0);
+  qmf::Vector b(nfactors);
+  for (size_t i = 0; i < nfactors; ++i) {
+    b(i) = 1.0;
+  }
+  for (auto _ : state) {
+    gSink = qmf::linearSymmetricSolve(A, b)(0);
+  }
+}
+
+void metric(BenchState& state, const qmf::Metric& metric) {
+  // one test user of the evaluation: scores of all items, some positives
+  std::mt19937 gen(FLAGS_seed);
+  std::uniform_real_distribution<Double> distr(0.0, 1.0);
+  std::vector<Double> labels(kNumItems, 0.0);
+  std::vector<Double> scores(kNumItems);
+  for (size_t i = 0; i < kNumItems; ++i) {
+    labels[i] = gen() % 200 == 0 ? 1.0 : 0.0;
+    scores[i] = distr(gen);
+  }
+  labels[0] = 1.0;
+  state.setItemsPerIteration(kNumItems);
+  for (auto _ : state) {
+    gSink = metric.compute(labels, scores);
+  }
+}
+
+void idIndexLookup(BenchState& state, const bool sorted) {
+  const size_t nids = 1000000;
+  const size_t batch = 1024;
+  std::mt19937_64 gen(FLAGS_seed);
+  std::vector<int64_t> ids(nids);
+  for (auto& id : ids) {
+    id = static_cast<int64_t>(gen() >> 1);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  // the batches move over many queries, so the slots are not all cached
+  std::vector<int64_t> queries(batch * 1024);
+  for (auto& q : queries) {
+    q = ids[gen() % ids.size()];
+  }
+
+  qmf::IdIndex index;
+  if (sorted) {
+    index.buildSorted(ids);
+  } else {
+    std::shuffle(ids.begin(), ids.end(), gen);
+    index.build(ids);
+  }
+  state.setItemsPerIteration(batch);
+  size_t start = 0;
+  for (auto _ : state) {
+    size_t sum = 0;
+    for (size_t i = start; i < start + batch; ++i) {
+      sum += index.idx(queries[i]);
+    }
+    gSink = sum;
+    start = (start + batch) % queries.size();
+  }
+}
+
+void datasetReader(BenchState& state) {
+  const size_t nlines = 100000;
+  char fileName[] = "/tmp/qmf_bench.XXXXXX";
+  const int fd = ::mkstemp(fileName);
+  CHECK(fd >= 0) << "mkstemp failed";
+  ::close(fd);
+  {
+    std::mt19937 gen(FLAGS_seed);
+    std::ofstream fout(fileName);
+    for (size_t i = 0; i < nlines; ++i) {
+      fout << gen() % 1000000 << ' ' << gen() % 100000 << ' ' << gen() % 10
+           << '\n';
+    }
+  }
+  state.setItemsPerIteration(nlines);
+  for (auto _ : state) {
+    qmf::DatasetReader reader(fileName);
+    gSink = reader.readAll().size();
+  }
+  ::unlink(fileName);
+}
+
+void parallelExecute(BenchState& state, const size_t nthreads) {
+  qmf::ParallelExecutor parallel(nthreads);
+  std::vector<size_t> touched(nthreads);
+  for (auto _ : state) {
+    parallel.execute(nthreads, [&touched](const size_t taskId) {
+      ++touched[taskId];
+    });
+  }
+  gSink = touched[0];
+}
+
+struct Benchmark {
+  std::string name;
+  std::function<void(BenchState&)> func;
+};
+
+struct Result {
+  std::string name;
+  size_t iterations;
+  double realNs;
+  double cpuNs;
+  double itemsPerSecond;
+};
+
+std::vector<Benchmark> registerBenchmarks() {
+  const auto nfactorsList = parseList(FLAGS_nfactors);
+  const auto threadsList = parseList(FLAGS_threads);
+  std::vector<Benchmark> benchmarks;
+  auto add = [&benchmarks](std::string name,
+                           std::function<void(BenchState&)> func) {
+    benchmarks.push_back(Benchmark{std::move(name), std::move(func)});
+  };
+  auto suffix = [](const char* key, const size_t value) {
+    return std::string("/") + key + ":" + std::to_string(value);
+  };
+
+  for (const size_t f : nfactorsList) {
+    for (const size_t t : threadsList) {
+      add("computeXtX" + suffix("nfactors", f) + suffix("threads", t),
+          [f, t](BenchState& s) { qmf::KernelBench::computeXtX(s, f, t); });
+    }
+  }
+  for (const size_t f : nfactorsList) {
+    add("updateFactorsForOne" + suffix("nfactors", f), [f](BenchState& s) {
+      qmf::KernelBench::updateFactorsForOne(s, f);
+    });
+  }
+  for (const size_t f : nfactorsList) {
+    add("linearSymmetricSolve" + suffix("nfactors", f),
+        [f](BenchState& s) { symmetricSolve(s, f); });
+  }
+  for (const size_t f : nfactorsList) {
+    add("BPREngine::update" + suffix("nfactors", f),
+        [f](BenchState& s) { qmf::KernelBench::bprUpdate(s, f); });
+  }
+  add("sampleRandomNegative",
+      [](BenchState& s) { qmf::KernelBench::sampleRandomNegative(s); });
+  for (const size_t f : nfactorsList) {
+    for (const size_t t : threadsList) {
+      add("computeTestScores" + suffix("nfactors", f) + suffix("threads", t),
+          [f, t](BenchState& s) {
+            qmf::KernelBench::computeTestScores(s, f, t);
+          });
+    }
+  }
+
+  add("Metric/mse",
+      [](BenchState& s) { metric(s, qmf::MeanSquaredError()); });
+  add("Metric/auc", [](BenchState& s) { metric(s, qmf::AUC()); });
+  add("Metric/p@10", [](BenchState& s) { metric(s, qmf::Precision(10)); });
+  add("Metric/r@10", [](BenchState& s) { metric(s, qmf::Recall(10)); });
+  add("Metric/ap", [](BenchState& s) { metric(s, qmf::AveragePrecision()); });
+
+  add("IdIndex::idx/hash", [](BenchState& s) { idIndexLookup(s, false); });
+  add("IdIndex::idx/sorted", [](BenchState& s) { idIndexLookup(s, true); });
+  add("DatasetReader::readAll", [](BenchState& s) { datasetReader(s); });
+  for (const size_t t : threadsList) {
+    add("ParallelExecutor::execute" + suffix("threads", t),
+        [t](BenchState& s) { parallelExecute(s, t); });
+  }
+  return benchmarks;
+}
+
+// grows the iterations until one run takes benchmark_min_time, then repeats
+Result run(const Benchmark& benchmark) {
+  size_t iterations = 1;
+  for (;;) {
+    BenchState state(iterations);
+    benchmark.func(state);
+    const double elapsed = state.realSeconds();
+    if (elapsed >= FLAGS_benchmark_min_time || iterations >= 1000000000) {
+      break;
+    }
+    // 1.4 times of the prediction, at most 10 times per step
+    const double predicted =
+      elapsed > 0 ? FLAGS_benchmark_min_time / elapsed * 1.4 : 10.0;
+    iterations = static_cast<size_t>(
+      iterations * std::max(1.1, std::min(10.0, predicted)) + 1);
+  }
+
+  std::vector<BenchState> states;
+  for (size_t rep = 0; rep < std::max<size_t>(FLAGS_benchmark_repetitions, 1);
+       ++rep) {
+    states.emplace_back(iterations);
+    benchmark.func(states.back());
+  }
+  std::sort(states.begin(), states.end(),
+            [](const BenchState& x, const BenchState& y) {
+              return x.realSeconds() < y.realSeconds();
+            });
+  const BenchState& median = states[states.size() / 2];
+
+  Result result;
+  result.name = benchmark.name;
+  result.iterations = iterations;
+  result.realNs = median.realSeconds() * 1e9 / iterations;
+  result.cpuNs = median.cpuSeconds() * 1e9 / iterations;
+  result.itemsPerSecond =
+    median.itemsPerIteration() * iterations / median.realSeconds();
+  return result;
+}
+
+std::string toJson(const std::vector<Result>& results) {
+  char host[256] = {0};
+  ::gethostname(host, sizeof(host) - 1);
+  char date[64];
+  const time_t now = ::time(nullptr);
+  struct tm tm;
+  ::localtime_r(&now, &tm);
+  ::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+
+  std::string json = "{\n  \"context\": {\n";
+  char buff[512];
+  snprintf(buff, sizeof(buff),
+           "    \"date\": \"%s\",\n"
+           "    \"host_name\": \"%s\",\n"
+           "    \"num_cpus\": %ld,\n"
+           "    \"library_build_type\": \"%s\",\n"
+           "    \"min_time\": %g,\n"
+           "    \"repetitions\": %zu,\n"
+           "    \"seed\": %d\n",
+           date, host, ::sysconf(_SC_NPROCESSORS_ONLN),
+#ifdef NDEBUG
+           "release",
+#else
+           "debug",
+#endif
+           FLAGS_benchmark_min_time,
+           static_cast<size_t>(FLAGS_benchmark_repetitions), FLAGS_seed);
+  json += buff;
+  json += "  },\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    snprintf(buff, sizeof(buff),
+             "    {\n"
+             "      \"name\": \"%s\",\n"
+             "      \"iterations\": %zu,\n"
+             "      \"real_time\": %.3f,\n"
+             "      \"cpu_time\": %.3f,\n"
+             "      \"time_unit\": \"ns\"",
+             r.name.c_str(), r.iterations, r.realNs, r.cpuNs);
+    json += buff;
+    if (r.itemsPerSecond > 0) {
+      snprintf(buff, sizeof(buff), ",\n      \"items_per_second\": %.1f",
+               r.itemsPerSecond);
+      json += buff;
+    }
+    json += i + 1 < results.size() ? "\n    },\n" : "\n    }\n";
+  }
+  json += "  ]\n}\n";
+  return json;
+}
+}
+
+namespace qmf {
+
+void KernelBench::computeXtX(BenchState& state,
+                             const size_t nfactors,
+                             const size_t nthreads) {
+  std::mt19937 gen(FLAGS_seed);
+  const Matrix Y = randomMatrix(kNumItems, nfactors, gen);
+  Matrix out(nfactors, nfactors);
+  omp_set_num_threads(nthreads);
+  state.setItemsPerIteration(kNumItems);
+  for (auto _ : state) {
+    WALSSolver::computeXtX(Y, &out);
+    gSink = out(0, 0);
+  }
+}
+
+void KernelBench::updateFactorsForOne(BenchState& state,
+                                      const size_t nfactors) {
+  std::mt19937 gen(FLAGS_seed);
+  const Matrix Y = randomMatrix(kNumItems, nfactors, gen);
+  const Matrix YtY = gram(Y, 0.0);
+  IdIndex itemIndex;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    itemIndex.getOrSetIdx(i);
+  }
+  std::vector<Signal> signals;
+  for (size_t i = 0; i < kUserSignals; ++i) {
+    signals.push_back(Signal{static_cast<int64_t>(gen() % kNumItems), 1.0});
+  }
+  const SignalGroup group{
+    0, SignalSpan(signals.data(), signals.data() + signals.size())};
+  std::vector<Double> result(nfactors);
+  state.setItemsPerIteration(1);
+  for (auto _ : state) {
+    gSink = WALSSolver::solveRow(result.data(), Y, YtY, itemIndex, group, 1.0,
+                                 0.1);
+  }
+}
+
+void KernelBench::bprUpdate(BenchState& state, const size_t nfactors) {
+  std::mt19937 gen(FLAGS_seed);
+  const BPRConfig config = bprConfig(nfactors);
+  BPREngine engine(config, kNullMetricEngine, 3, FLAGS_seed, 1);
+  engine.init(syntheticDataset(gen));
+
+  std::vector<BPREngine::PosNegTriplet> triplets;
+  for (size_t i = 0; i < 4096; ++i) {
+    const auto& pos = engine.data_[gen() % engine.data_.size()];
+    triplets.push_back(BPREngine::PosNegTriplet{
+      pos.userIdx, pos.posItemIdx, engine.sampleRandomNegative(pos.userIdx, gen)});
+  }
+  size_t i = 0;
+  state.setItemsPerIteration(1);
+  for (auto _ : state) {
+    engine.update(triplets[i++ % triplets.size()]);
+  }
+  gSink = engine.userFactors_->at(0, 0);
+}
+
+void KernelBench::sampleRandomNegative(BenchState& state) {
+  std::mt19937 gen(FLAGS_seed);
+  const BPRConfig config = bprConfig(10);
+  BPREngine engine(config, kNullMetricEngine, 3, FLAGS_seed, 1);
+  engine.init(syntheticDataset(gen));
+  size_t u = 0;
+  size_t sum = 0;
+  state.setItemsPerIteration(1);
+  for (auto _ : state) {
+    sum += engine.sampleRandomNegative(u++ % engine.nusers(), gen);
+  }
+  gSink = sum;
+}
+
+void KernelBench::computeTestScores(BenchState& state,
+                                    const size_t nfactors,
+                                    const size_t nthreads) {
+  std::mt19937 gen(FLAGS_seed);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  auto genUnif = [&](auto...) { return distr(gen); };
+  FactorData userFactors(kNumUsers, nfactors);
+  userFactors.setFactors(genUnif);
+  FactorData itemFactors(kNumItems, nfactors);
+  itemFactors.setFactors(genUnif);
+  std::vector<size_t> testUsers(kNumUsers);
+  for (size_t u = 0; u < kNumUsers; ++u) {
+    testUsers[u] = u;
+  }
+  // sized as initAvgTestData does
+  std::vector<std::vector<Double>> testScores(
+    kNumUsers, std::vector<Double>(kNumItems));
+  ParallelExecutor parallel(nthreads);
+  state.setItemsPerIteration(kNumUsers * kNumItems);
+  for (auto _ : state) {
+    Engine::computeTestScores(
+      testScores, testUsers, userFactors, itemFactors, parallel);
+    gSink = testScores[0][0];
+  }
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("qmf_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+  // the engines log in init
+  FLAGS_minloglevel = 1;
+
+  CHECK(FLAGS_benchmark_format == "console" || FLAGS_benchmark_format == "json")
+    << "unknown --benchmark_format " << FLAGS_benchmark_format;
+  const bool console = FLAGS_benchmark_format == "console";
+
+  const std::regex filter(FLAGS_benchmark_filter);
+  std::vector<Result> results;
+  if (console) {
+    printf("%-48s %14s %14s %12s %16s\n", "Benchmark", "Time(ns)", "CPU(ns)",
+           "Iterations", "items/s");
+  }
+  for (const auto& benchmark : registerBenchmarks()) {
+    if (!std::regex_search(benchmark.name, filter)) {
+      continue;
+    }
+    results.push_back(run(benchmark));
+    const Result& r = results.back();
+    if (console) {
+      printf("%-48s %14.1f %14.1f %12zu", r.name.c_str(), r.realNs, r.cpuNs,
+             r.iterations);
+      if (r.itemsPerSecond > 0) {
+        printf(" %16.4g", r.itemsPerSecond);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+
+  const std::string json = toJson(results);
+  if (!console) {
+    fputs(json.c_str(), stdout);
+  }
+  if (!FLAGS_benchmark_out.empty()) {
+    std::ofstream fout(FLAGS_benchmark_out);
+    fout << json;
+    CHECK(fout.good()) << "write " << FLAGS_benchmark_out << " failed";
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/retrieval/TopKScorer.h>
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/FactorWriter.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+// model input
+DEFINE_string(user_factors, "", "filename of user factors");
+DEFINE_string(item_factors, "", "filename of item factors");
+DEFINE_uint64(nfactors, 30, "dimension of learned factors");
+DEFINE_bool(use_biases, false, "the item factors have biases (bpr)");
+
+// exclusions
+DEFINE_string(train_dataset, "", "the items of the training dataset are not "
+                                 "recommended to the user again");
+
+// settings
+DEFINE_uint64(k, 10, "items recommended for each user");
+DEFINE_uint64(chunk_users, 4096, "users scored and formatted by one task");
+DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+
+// output
+DEFINE_string(output, "", "one line \"user item:score ...\" for each user");
+
+namespace {
+
+void formatChunk(const qmf::IdIndex& userIndex,
+                 const qmf::IdIndex& itemIndex,
+                 const size_t start,
+                 const std::vector<qmf::ScoredItems>& results,
+                 std::string* out) {
+  char buff[qmf::FactorWriter::kMaxNumberChars * 2 + 2];
+  for (size_t u = 0; u < results.size(); ++u) {
+    out->append(buff,
+                qmf::FactorWriter::formatInt64(userIndex.id(start + u), buff));
+    for (const auto& item : results[u]) {
+      char* p = buff;
+      *p++ = ' ';
+      p += qmf::FactorWriter::formatInt64(itemIndex.id(item.second), p);
+      *p++ = ':';
+      p += qmf::FactorWriter::formatDouble(item.first, p);
+      out->append(buff, p - buff);
+    }
+    out->push_back('\n');
+  }
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("recommend");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_user_factors.empty() && !FLAGS_item_factors.empty())
+    << "missing model input (use options --{user,item}_factors)";
+  CHECK(!FLAGS_output.empty()) << "missing --output";
+  CHECK_GT(FLAGS_chunk_users, 0);
+
+  qmf::IdIndex userIndex;
+  std::unique_ptr<qmf::FactorData> userFactors;
+  CHECK(qmf::FactorReader::load(
+    FLAGS_user_factors, FLAGS_nfactors, false, userIndex, userFactors));
+
+  qmf::IdIndex itemIndex;
+  std::unique_ptr<qmf::FactorData> itemFactors;
+  CHECK(qmf::FactorReader::load(FLAGS_item_factors, FLAGS_nfactors,
+                                FLAGS_use_biases, itemIndex, itemFactors));
+
+  std::unique_ptr<qmf::SeenItems> seen;
+  if (!FLAGS_train_dataset.empty()) {
+    LOG(INFO) << "loading training data";
+    qmf::DatasetReader trainReader(FLAGS_train_dataset);
+    seen = std::make_unique<qmf::SeenItems>(
+      qmf::SeenItems::build(trainReader.readAll(), userIndex, itemIndex));
+  }
+
+  // the items are packed into tiles, the original is not needed any more
+  const qmf::TopKScorer scorer(*itemFactors);
+  itemFactors.reset();
+
+  // one task scores and formats a chunk of users
+  qmf::ParallelExecutor parallel(FLAGS_nthreads);
+  const size_t nusers = userFactors->nelems();
+  const size_t nchunks = (nusers + FLAGS_chunk_users - 1) / FLAGS_chunk_users;
+  const bool success = qmf::FactorWriter::writeChunks(
+    FLAGS_output, nchunks,
+    [&](const size_t chunk, std::string* out) {
+      const size_t start = chunk * FLAGS_chunk_users;
+      const size_t end = std::min<size_t>(start + FLAGS_chunk_users, nusers);
+      std::vector<qmf::ScoredItems> results;
+      scorer.score(*userFactors, start, end, FLAGS_k, seen.get(), &results);
+      formatChunk(userIndex, itemIndex, start, results, out);
+    },
+    parallel,
+    [nusers](const size_t chunks) {
+      LOG(INFO) << "recommended "
+                << std::min<size_t>(chunks * FLAGS_chunk_users, nusers)
+                << " of " << nusers << " users";
+    });
+
+  CHECK(success) << "write " << FLAGS_output << " failed";
+  return 0;
+}
@@ -0,0 +1,247 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+#include <qmf/retrieval/IVFIndex.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+Double dot(const Double* x, const Double* y, const size_t n) {
+  Double sum = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// the centroid nearest to x in L2
+size_t nearest(const Double* x,
+               const std::vector<Double>& centroids,
+               const std::vector<Double>& centroidNorms,
+               const size_t dim) {
+  size_t best = 0;
+  Double bestDist = std::numeric_limits<Double>::infinity();
+  for (size_t c = 0; c < centroidNorms.size(); ++c) {
+    // |x - c|^2 without the constant |x|^2
+    const Double dist =
+      centroidNorms[c] - 2 * dot(x, centroids.data() + c * dim, dim);
+    if (dist < bestDist) {
+      bestDist = dist;
+      best = c;
+    }
+  }
+  return best;
+}
+
+// assign the rows to the centroids, in the contiguous ranges of the threads
+void assign(const std::vector<Double>& points,
+            const std::vector<size_t>& rows,
+            const std::vector<Double>& centroids,
+            const std::vector<Double>& centroidNorms,
+            const size_t dim,
+            ParallelExecutor& parallel,
+            std::vector<size_t>* assignment) {
+  assignment->resize(rows.size());
+  const size_t ntasks = parallel.nthreads();
+  const size_t taskSize = (rows.size() + ntasks - 1) / ntasks;
+  parallel.execute(ntasks, [&](const size_t taskId) {
+    const size_t l = taskId * taskSize;
+    const size_t r = std::min(rows.size(), (taskId + 1) * taskSize);
+    for (size_t i = l; i < r; ++i) {
+      (*assignment)[i] = nearest(points.data() + rows[i] * dim, centroids,
+                                 centroidNorms, dim);
+    }
+  });
+}
+}
+
+IVFIndex::IVFIndex(const FactorData& itemFactors,
+                   const size_t nlist,
+                   const size_t niters,
+                   ParallelExecutor& parallel,
+                   const int32_t seed)
+  : nfactors_(itemFactors.nfactors()),
+    withBiases_(itemFactors.withBiases()),
+    dim_(nfactors_ + (withBiases_ ? 1 : 0)) {
+  const size_t nitems = itemFactors.nelems();
+  CHECK_GT(nlist, 0);
+  const size_t nclusters = std::min(nlist, nitems);
+
+  // the items in the augmented space
+  const size_t augDim = dim_ + 1;
+  std::vector<Double> points(nitems * augDim);
+  Double maxNorm = 0.0;
+  for (size_t idx = 0; idx < nitems; ++idx) {
+    Double* p = points.data() + idx * augDim;
+    if (withBiases_) {
+      *p++ = itemFactors.biasAt(idx);
+    }
+    for (size_t fidx = 0; fidx < nfactors_; ++fidx) {
+      *p++ = itemFactors.at(idx, fidx);
+    }
+    const Double* x = points.data() + idx * augDim;
+    maxNorm = std::max(maxNorm, dot(x, x, dim_));
+  }
+  for (size_t idx = 0; idx < nitems; ++idx) {
+    Double* x = points.data() + idx * augDim;
+    x[dim_] = std::sqrt(std::max<Double>(maxNorm - dot(x, x, dim_), 0.0));
+  }
+
+  // k-means on the sampled items, initialized by the first of them
+  std::mt19937 gen(seed);
+  std::vector<size_t> train(nitems);
+  std::iota(train.begin(), train.end(), 0);
+  std::shuffle(train.begin(), train.end(), gen);
+  train.resize(std::min(nitems, nclusters * kTrainPerList));
+
+  centroids_.resize(nclusters * augDim);
+  centroidNorms_.resize(nclusters);
+  for (size_t c = 0; c < nclusters; ++c) {
+    std::copy_n(points.data() + train[c] * augDim, augDim,
+                centroids_.data() + c * augDim);
+  }
+
+  std::vector<size_t> assignment;
+  std::vector<size_t> counts(nclusters);
+  for (size_t iter = 0; iter < niters; ++iter) {
+    for (size_t c = 0; c < nclusters; ++c) {
+      const Double* x = centroids_.data() + c * augDim;
+      centroidNorms_[c] = dot(x, x, augDim);
+    }
+    assign(points, train, centroids_, centroidNorms_, augDim, parallel,
+           &assignment);
+
+    std::fill(centroids_.begin(), centroids_.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t i = 0; i < train.size(); ++i) {
+      const Double* x = points.data() + train[i] * augDim;
+      Double* c = centroids_.data() + assignment[i] * augDim;
+      for (size_t j = 0; j < augDim; ++j) {
+        c[j] += x[j];
+      }
+      ++counts[assignment[i]];
+    }
+    for (size_t c = 0; c < nclusters; ++c) {
+      Double* x = centroids_.data() + c * augDim;
+      if (counts[c] == 0) {
+        // reseed the empty cluster with a random item
+        std::copy_n(points.data() + train[gen() % train.size()] * augDim,
+                    augDim, x);
+        continue;
+      }
+      for (size_t j = 0; j < augDim; ++j) {
+        x[j] /= counts[c];
+      }
+    }
+  }
+  for (size_t c = 0; c < nclusters; ++c) {
+    const Double* x = centroids_.data() + c * augDim;
+    centroidNorms_[c] = dot(x, x, augDim);
+  }
+
+  // all the items grouped by their lists
+  std::vector<size_t> rows(nitems);
+  std::iota(rows.begin(), rows.end(), 0);
+  assign(points, rows, centroids_, centroidNorms_, augDim, parallel,
+         &assignment);
+
+  listOffsets_.assign(nclusters + 1, 0);
+  for (const size_t c : assignment) {
+    ++listOffsets_[c + 1];
+  }
+  std::partial_sum(listOffsets_.begin(), listOffsets_.end(),
+                   listOffsets_.begin());
+
+  listIdxs_.resize(nitems);
+  listVectors_.resize(nitems * dim_);
+  std::vector<size_t> pos(listOffsets_.begin(), listOffsets_.end() - 1);
+  for (size_t idx = 0; idx < nitems; ++idx) {
+    const size_t at = pos[assignment[idx]]++;
+    listIdxs_[at] = idx;
+    std::copy_n(points.data() + idx * augDim, dim_,
+                listVectors_.data() + at * dim_);
+  }
+
+  LOG(INFO) << "built IVF index of " << nitems << " items in " << nclusters
+            << " lists";
+}
+
+void IVFIndex::expand(const Double* query, Double* expanded) const {
+  if (withBiases_) {
+    *expanded++ = 1.0;
+  }
+  std::copy_n(query, nfactors_, expanded);
+}
+
+void IVFIndex::scanList(const size_t list,
+                        const Double* expanded,
+                        TopK& topk) const {
+  for (size_t at = listOffsets_[list]; at < listOffsets_[list + 1]; ++at) {
+    topk.push(dot(expanded, listVectors_.data() + at * dim_, dim_),
+              listIdxs_[at]);
+  }
+}
+
+void IVFIndex::search(const Double* query,
+                      const size_t k,
+                      const size_t nprobe,
+                      ScoredItems* result) const {
+  std::vector<Double> expanded(dim_);
+  expand(query, expanded.data());
+
+  // the query is (q, 0) in the augmented space
+  const size_t augDim = dim_ + 1;
+  std::vector<std::pair<Double, size_t>> dists(nlist());
+  for (size_t c = 0; c < nlist(); ++c) {
+    dists[c] = {centroidNorms_[c] -
+                  2 * dot(expanded.data(), centroids_.data() + c * augDim, dim_),
+                c};
+  }
+  const size_t nprobed = std::min(std::max<size_t>(nprobe, 1), nlist());
+  std::partial_sort(dists.begin(), dists.begin() + nprobed, dists.end());
+
+  TopK topk(k);
+  for (size_t i = 0; i < nprobed; ++i) {
+    scanList(dists[i].second, expanded.data(), topk);
+  }
+  topk.sorted(result);
+}
+
+void IVFIndex::searchExact(const Double* query,
+                           const size_t k,
+                           ScoredItems* result) const {
+  std::vector<Double> expanded(dim_);
+  expand(query, expanded.data());
+
+  TopK topk(k);
+  for (size_t list = 0; list < nlist(); ++list) {
+    scanList(list, expanded.data(), topk);
+  }
+  topk.sorted(result);
+}
+
+void IVFIndex::searchBatch(const FactorData& queries,
+                           const size_t k,
+                           const size_t nprobe,
+                           ParallelExecutor& parallel,
+                           std::vector<ScoredItems>* results) const {
+  CHECK_EQ(queries.nfactors(), nfactors_);
+  results->resize(queries.nelems());
+  const Matrix& Q = queries.getFactors();
+  parallel.execute(queries.nelems(), [&](const size_t taskId) {
+    search(Q.data(taskId), k, nprobe, &(*results)[taskId]);
+  });
+}
+}
@@ -0,0 +1,96 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Inverted file index for maximum inner product search on the item factors.
+ *
+ * The items are mapped to the L2 space by appending sqrt(M^2 - |x|^2), M is
+ * the max norm, so the nearest in L2 of the query (q, 0) is the max inner
+ * product. They are clustered by k-means there, and a query only scans the
+ * items of the nprobe clusters nearest to it, more clusters probed gives
+ * higher recall with more latency.
+ *
+ * With the biases, the item is (bias, factors) and the query is (1, factors).
+ */
+
+#include <vector>
+
+#include <qmf/FactorData.h>
+#include <qmf/Types.h>
+#include <qmf/retrieval/TopK.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+namespace qmf {
+
+class IVFIndex {
+ public:
+  // k-means is trained on at most nlist * kTrainPerList sampled items
+  static const size_t kTrainPerList = 256;
+
+  // nlist clusters, and the k-means runs niters iterations
+  IVFIndex(const FactorData& itemFactors,
+           const size_t nlist,
+           const size_t niters,
+           ParallelExecutor& parallel,
+           const int32_t seed = 42);
+
+  size_t nlist() const {
+    return listOffsets_.size() - 1;
+  }
+
+  size_t nitems() const {
+    return listIdxs_.size();
+  }
+
+  // items in the list, for inspection
+  size_t listSize(const size_t list) const {
+    return listOffsets_[list + 1] - listOffsets_[list];
+  }
+
+  // the top k item idx of the factors for a user's factors
+  void search(const Double* query,
+              const size_t k,
+              const size_t nprobe,
+              ScoredItems* result) const;
+
+  // scan all the items, as the ground truth of the recall
+  void searchExact(const Double* query,
+                   const size_t k,
+                   ScoredItems* result) const;
+
+  // the rows of queries are searched in parallel
+  void searchBatch(const FactorData& queries,
+                   const size_t k,
+                   const size_t nprobe,
+                   ParallelExecutor& parallel,
+                   std::vector<ScoredItems>* results) const;
+
+ private:
+  // query with the bias column prepended
+  void expand(const Double* query, Double* expanded) const;
+
+  void scanList(const size_t list,
+                const Double* expanded,
+                TopK& topk) const;
+
+  const size_t nfactors_;
+  const bool withBiases_;
+  // dimension of the items stored, nfactors_ + withBiases_
+  const size_t dim_;
+
+  // nlist x (dim_ + 1) in the augmented space, and their squared norms
+  std::vector<Double> centroids_;
+  std::vector<Double> centroidNorms_;
+
+  // the items grouped by list, list i is [listOffsets_[i], listOffsets_[i+1])
+  std::vector<size_t> listOffsets_;
+  std::vector<size_t> listIdxs_;
+  std::vector<Double> listVectors_;
+};
+}
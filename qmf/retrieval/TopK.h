@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <qmf/Types.h>
+
+namespace qmf {
+
+// (score, idx) of the retrieved items
+using ScoredItems = std::vector<std::pair<Double, size_t>>;
+
+// keeps the k best (score, idx) seen, the worst one is on the top of the heap
+// so a candidate only needs one comparison. ties are broken by smaller idx
+class TopK {
+ public:
+  explicit TopK(const size_t k) : k_(k) {
+    heap_.reserve(k);
+  }
+
+  // a candidate not greater than it can't get in
+  Double threshold() const {
+    return heap_.size() < k_ ? -std::numeric_limits<Double>::infinity()
+                             : heap_.front().first;
+  }
+
+  void push(const Double score, const size_t idx) {
+    if (heap_.size() < k_) {
+      heap_.emplace_back(score, idx);
+      std::push_heap(heap_.begin(), heap_.end(), better);
+    } else if (k_ > 0 && better({score, idx}, heap_.front())) {
+      std::pop_heap(heap_.begin(), heap_.end(), better);
+      heap_.back() = {score, idx};
+      std::push_heap(heap_.begin(), heap_.end(), better);
+    }
+  }
+
+  // best first, and the heap is cleared for reuse
+  void sorted(ScoredItems* out) {
+    std::sort_heap(heap_.begin(), heap_.end(), better);
+    out->swap(heap_);
+    heap_.clear();
+    heap_.reserve(k_);
+  }
+
+  size_t size() const {
+    return heap_.size();
+  }
+
+ private:
+  static bool better(const std::pair<Double, size_t>& x,
+                     const std::pair<Double, size_t>& y) {
+    return x.first > y.first || (x.first == y.first && x.second < y.second);
+  }
+
+  const size_t k_;
+  ScoredItems heap_;
+};
+}
@@ -0,0 +1,173 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+
+#include <qmf/retrieval/TopKScorer.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+const size_t TopKScorer::kMR;
+const size_t TopKScorer::kNR;
+const size_t TopKScorer::kItemBlock;
+const size_t TopKScorer::kUserBlock;
+
+SeenItems SeenItems::build(const std::vector<DatasetElem>& dataset,
+                           const IdIndex& userIndex,
+                           const IdIndex& itemIndex) {
+  SeenItems seen;
+  seen.offsets.assign(userIndex.size() + 1, 0);
+
+  // counting sort by user, as CSR
+  std::vector<std::pair<size_t, size_t>> pairs;
+  pairs.reserve(dataset.size());
+  for (const auto& elem : dataset) {
+    const size_t userIdx = userIndex.idx(elem.userId);
+    const size_t itemIdx = itemIndex.idx(elem.itemId);
+    if (userIdx == IdIndex::missingIdx || itemIdx == IdIndex::missingIdx) {
+      continue;
+    }
+    pairs.emplace_back(userIdx, itemIdx);
+    ++seen.offsets[userIdx + 1];
+  }
+  for (size_t i = 0; i < userIndex.size(); ++i) {
+    seen.offsets[i + 1] += seen.offsets[i];
+  }
+
+  seen.items.resize(pairs.size());
+  std::vector<size_t> pos(seen.offsets.begin(), seen.offsets.end() - 1);
+  for (const auto& p : pairs) {
+    seen.items[pos[p.first]++] = p.second;
+  }
+  for (size_t i = 0; i < userIndex.size(); ++i) {
+    std::sort(seen.items.begin() + seen.offsets[i],
+              seen.items.begin() + seen.offsets[i + 1]);
+  }
+  return seen;
+}
+
+TopKScorer::TopKScorer(const FactorData& itemFactors)
+  : nitems_(itemFactors.nelems()),
+    nfactors_(itemFactors.nfactors()),
+    withBiases_(itemFactors.withBiases()),
+    ntiles_((nitems_ + kItemBlock - 1) / kItemBlock),
+    tiles_(ntiles_ * nfactors_ * kItemBlock, 0.0),
+    biases_(ntiles_ * kItemBlock, 0.0) {
+  static_assert(kItemBlock % kNR == 0, "tile should be multiple of kNR");
+  static_assert(kUserBlock % kMR == 0, "block should be multiple of kMR");
+
+  for (size_t idx = 0; idx < nitems_; ++idx) {
+    const size_t tile = idx / kItemBlock;
+    const size_t j = idx % kItemBlock;
+    Double* packed = tiles_.data() + tile * nfactors_ * kItemBlock;
+    for (size_t fidx = 0; fidx < nfactors_; ++fidx) {
+      packed[fidx * kItemBlock + j] = itemFactors.at(idx, fidx);
+    }
+    biases_[idx] = itemFactors.biasAt(idx);
+  }
+}
+
+void TopKScorer::scoreTile(const Double* users,
+                           const size_t nusers,
+                           const size_t tile,
+                           Double* scores) const {
+  const Double* packed = tiles_.data() + tile * nfactors_ * kItemBlock;
+  const Double* bias = biases_.data() + tile * kItemBlock;
+
+  for (size_t j0 = 0; j0 < kItemBlock; j0 += kNR) {
+    for (size_t u0 = 0; u0 < nusers; u0 += kMR) {
+      Double acc[kMR][kNR];
+      for (size_t r = 0; r < kMR; ++r) {
+        for (size_t c = 0; c < kNR; ++c) {
+          acc[r][c] = bias[j0 + c];
+        }
+      }
+      for (size_t fidx = 0; fidx < nfactors_; ++fidx) {
+        const Double* b = packed + fidx * kItemBlock + j0;
+        const Double* a = users + fidx * kUserBlock + u0;
+        for (size_t r = 0; r < kMR; ++r) {
+          for (size_t c = 0; c < kNR; ++c) {
+            acc[r][c] += a[r] * b[c];
+          }
+        }
+      }
+      for (size_t r = 0; r < kMR; ++r) {
+        for (size_t c = 0; c < kNR; ++c) {
+          scores[(u0 + r) * kItemBlock + j0 + c] = acc[r][c];
+        }
+      }
+    }
+  }
+}
+
+void TopKScorer::score(const FactorData& userFactors,
+                       const size_t start,
+                       const size_t end,
+                       const size_t k,
+                       const SeenItems* seen,
+                       std::vector<ScoredItems>* results) const {
+  CHECK_EQ(userFactors.nfactors(), nfactors_);
+  CHECK_LE(end, userFactors.nelems());
+  results->resize(end - start);
+
+  std::vector<Double> users(nfactors_ * kUserBlock);
+  std::vector<Double> scores(kUserBlock * kItemBlock);
+  std::vector<TopK> topks;
+  // the next seen item of each user in the block
+  std::vector<size_t> cursors(kUserBlock);
+
+  for (size_t u0 = start; u0 < end; u0 += kUserBlock) {
+    const size_t nusers = std::min(kUserBlock, end - u0);
+    const size_t padded = (nusers + kMR - 1) / kMR * kMR;
+
+    // pack the block transposed, the padded users are zero
+    std::fill(users.begin(), users.end(), 0.0);
+    for (size_t u = 0; u < nusers; ++u) {
+      for (size_t fidx = 0; fidx < nfactors_; ++fidx) {
+        users[fidx * kUserBlock + u] = userFactors.at(u0 + u, fidx);
+      }
+    }
+
+    topks.clear();
+    for (size_t u = 0; u < nusers; ++u) {
+      topks.emplace_back(k);
+      cursors[u] = seen ? seen->offsets[u0 + u] : 0;
+    }
+
+    for (size_t tile = 0; tile < ntiles_; ++tile) {
+      scoreTile(users.data(), padded, tile, scores.data());
+
+      const size_t base = tile * kItemBlock;
+      const size_t nvalid = std::min(kItemBlock, nitems_ - base);
+      for (size_t u = 0; u < nusers; ++u) {
+        const Double* row = scores.data() + u * kItemBlock;
+        TopK& topk = topks[u];
+        size_t& cursor = cursors[u];
+        const size_t seenEnd = seen ? seen->offsets[u0 + u + 1] : 0;
+        for (size_t j = 0; j < nvalid; ++j) {
+          if (cursor < seenEnd && seen->items[cursor] == base + j) {
+            // skip the duplicates of the dataset too
+            while (cursor < seenEnd && seen->items[cursor] == base + j) {
+              ++cursor;
+            }
+            continue;
+          }
+          if (row[j] >= topk.threshold()) {
+            topk.push(row[j], base + j);
+          }
+        }
+      }
+    }
+
+    for (size_t u = 0; u < nusers; ++u) {
+      topks[u].sorted(&(*results)[u0 - start + u]);
+    }
+  }
+}
+}
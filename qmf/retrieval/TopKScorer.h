@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Exact top K of the users over all the items. The scores of a user block
+ * and an item tile are computed as a small GEMM: both sides are packed
+ * transposed and zero padded, so the micro kernel keeps kMR x kNR
+ * accumulators in registers and the compiler vectorizes the kNR columns.
+ * The scores of one tile are then pushed to the per-user bounded heaps,
+ * except the items seen by the user in training.
+ */
+
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/FactorData.h>
+#include <qmf/Types.h>
+#include <qmf/retrieval/TopK.h>
+#include <qmf/utils/IdIndex.h>
+
+namespace qmf {
+
+// the sorted item idxs of each user idx, user i is [offsets[i], offsets[i+1])
+struct SeenItems {
+  std::vector<size_t> offsets;
+  std::vector<size_t> items;
+
+  // the elems of unknown users or items are skipped
+  static SeenItems build(const std::vector<DatasetElem>& dataset,
+                         const IdIndex& userIndex,
+                         const IdIndex& itemIndex);
+};
+
+class TopKScorer {
+ public:
+  // the micro kernel of kMR users x kNR items
+  static const size_t kMR = 4;
+  static const size_t kNR = 8;
+
+  // items in one tile, a packed tile of 30 factors is 120KB and stays in L2
+  static const size_t kItemBlock = 512;
+  // users scored together against a tile
+  static const size_t kUserBlock = 64;
+
+  // the items are packed once, itemFactors can be released then
+  explicit TopKScorer(const FactorData& itemFactors);
+
+  size_t nitems() const {
+    return nitems_;
+  }
+
+  // the top k (score, item idx) of the users [start, end) of userFactors to
+  // results[0, end - start), seen can be null. safe to call concurrently
+  void score(const FactorData& userFactors,
+             const size_t start,
+             const size_t end,
+             const size_t k,
+             const SeenItems* seen,
+             std::vector<ScoredItems>* results) const;
+
+ private:
+  // scores(kUserBlock x kItemBlock) = users(nfactors x kUserBlock)^T *
+  // tile(nfactors x kItemBlock) + bias, nusers padded to kMR
+  void scoreTile(const Double* users,
+                 const size_t nusers,
+                 const size_t tile,
+                 Double* scores) const;
+
+  const size_t nitems_;
+  const size_t nfactors_;
+  const bool withBiases_;
+  const size_t ntiles_;
+
+  // ntiles_ x nfactors_ x kItemBlock, the factor f of the item j in a tile
+  // is at f * kItemBlock + j, the padded items are zero
+  std::vector<Double> tiles_;
+  // ntiles_ x kItemBlock
+  std::vector<Double> biases_;
+};
+}
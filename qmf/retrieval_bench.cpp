@@ -0,0 +1,156 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <qmf/retrieval/IVFIndex.h>
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/Util.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * IVF 索引的查询吞吐和召回率：召回率以暴力扫描全部 item 的 top K 为准，
+ * 对每个 nprobe 分别统计，item factors 可以从 saveItemFactors 的输出
+ * 读取，否则随机生成
+ */
+
+// factors
+DEFINE_string(item_factors, "", "item factors, generated if empty");
+DEFINE_string(user_factors, "", "user factors as the queries, generated if "
+                                "empty");
+DEFINE_uint64(nfactors, 30, "dimension of the factors");
+DEFINE_bool(with_biases, false, "the item factors have biases");
+DEFINE_uint64(nitems, 1000000, "generated items");
+DEFINE_uint64(nqueries, 2000, "queries searched");
+
+// index
+DEFINE_uint64(nlist, 1024, "lists of the IVF index");
+DEFINE_uint64(niters, 10, "iterations of k-means");
+DEFINE_string(nprobes, "1,2,4,8,16,32,64", "comma-separated nprobe tested");
+DEFINE_uint64(k, 10, "top K retrieved");
+
+// settings
+DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+DEFINE_int32(seed, 42, "random seed");
+
+namespace {
+
+// the factors around random centers as the trained factors look like
+std::unique_ptr<qmf::FactorData> generate(const size_t nelems,
+                                          const bool withBiases,
+                                          std::mt19937& gen) {
+  const size_t ncenters = 256;
+  std::normal_distribution<qmf::Double> normal;
+  std::vector<qmf::Double> centers(ncenters * FLAGS_nfactors);
+  for (auto& x : centers) {
+    x = normal(gen);
+  }
+  auto factors =
+    std::make_unique<qmf::FactorData>(nelems, FLAGS_nfactors, withBiases);
+  for (size_t idx = 0; idx < nelems; ++idx) {
+    const qmf::Double* center = &centers[gen() % ncenters * FLAGS_nfactors];
+    for (size_t fidx = 0; fidx < FLAGS_nfactors; ++fidx) {
+      factors->at(idx, fidx) = center[fidx] + 0.5 * normal(gen);
+    }
+    if (withBiases) {
+      factors->biasAt(idx) = normal(gen);
+    }
+  }
+  return factors;
+}
+
+std::unique_ptr<qmf::FactorData> load(const std::string& fileName,
+                                      const bool withBiases) {
+  qmf::IdIndex index;
+  std::unique_ptr<qmf::FactorData> factors;
+  CHECK(qmf::FactorReader::load(
+    fileName, FLAGS_nfactors, withBiases, index, factors));
+  return factors;
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+    .count();
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("retrieval_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  std::mt19937 gen(FLAGS_seed);
+  auto items = FLAGS_item_factors.empty()
+                 ? generate(FLAGS_nitems, FLAGS_with_biases, gen)
+                 : load(FLAGS_item_factors, FLAGS_with_biases);
+  auto users = FLAGS_user_factors.empty()
+                 ? generate(FLAGS_nqueries, false, gen)
+                 : load(FLAGS_user_factors, false);
+
+  // the queries sampled from the users
+  qmf::FactorData queries(std::min<size_t>(FLAGS_nqueries, users->nelems()),
+                          FLAGS_nfactors);
+  for (size_t q = 0; q < queries.nelems(); ++q) {
+    const size_t idx = gen() % users->nelems();
+    for (size_t fidx = 0; fidx < FLAGS_nfactors; ++fidx) {
+      queries.at(q, fidx) = users->at(idx, fidx);
+    }
+  }
+
+  qmf::ParallelExecutor parallel(FLAGS_nthreads);
+  auto start = std::chrono::steady_clock::now();
+  const qmf::IVFIndex index(*items, FLAGS_nlist, FLAGS_niters, parallel,
+                            FLAGS_seed);
+  printf("build %zu items in %zu lists: %.3f s\n", index.nitems(),
+         index.nlist(), seconds(start));
+
+  // the ground truth by brute force
+  std::vector<qmf::ScoredItems> truth(queries.nelems());
+  start = std::chrono::steady_clock::now();
+  parallel.execute(queries.nelems(), [&](const size_t q) {
+    index.searchExact(queries.getFactors().data(q), FLAGS_k, &truth[q]);
+  });
+  const double exactSeconds = seconds(start);
+
+  printf("%-10s %12s %10s %10s\n", "nprobe", "qps", "speedup", "recall");
+  printf("%-10s %12.1f %10.2f %10.4f\n", "exact",
+         queries.nelems() / exactSeconds, 1.0, 1.0);
+
+  std::vector<qmf::ScoredItems> results;
+  for (const auto& nprobeStr : qmf::split(FLAGS_nprobes, ',')) {
+    const size_t nprobe = std::stoul(nprobeStr);
+    start = std::chrono::steady_clock::now();
+    index.searchBatch(queries, FLAGS_k, nprobe, parallel, &results);
+    const double elapsed = seconds(start);
+
+    size_t hits = 0;
+    size_t total = 0;
+    for (size_t q = 0; q < queries.nelems(); ++q) {
+      std::set<size_t> expected;
+      for (const auto& item : truth[q]) {
+        expected.insert(item.second);
+      }
+      for (const auto& item : results[q]) {
+        hits += expected.count(item.second);
+      }
+      total += expected.size();
+    }
+    printf("%-10zu %12.1f %10.2f %10.4f\n", nprobe, queries.nelems() / elapsed,
+           exactSeconds / elapsed, total ? double(hits) / total : 0.0);
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <qmf/utils/Allocator.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+bool aligned(const void* ptr, const size_t alignment) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+}
+
+TEST(Allocator, parseHugePages) {
+  HugePages mode = HugePages::kNone;
+  EXPECT_TRUE(parseHugePages("madvise", &mode));
+  EXPECT_EQ(mode, HugePages::kAdvise);
+  EXPECT_TRUE(parseHugePages("hugetlb", &mode));
+  EXPECT_EQ(mode, HugePages::kExplicit);
+  EXPECT_TRUE(parseHugePages("none", &mode));
+  EXPECT_EQ(mode, HugePages::kNone);
+  EXPECT_FALSE(parseHugePages("always", &mode));
+}
+
+TEST(Allocator, blocks) {
+  for (const auto mode :
+       {HugePages::kNone, HugePages::kAdvise, HugePages::kExplicit}) {
+    setHugePages(mode);
+    for (const size_t bytes :
+         {size_t(8), size_t(100), kHugePageSize - 1, kHugePageSize,
+          3 * kHugePageSize + 5}) {
+      char* ptr = static_cast<char*>(allocateBlock(bytes));
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_TRUE(aligned(ptr, kCacheLineSize)) << bytes;
+      if (bytes >= kHugePageSize) {
+        EXPECT_TRUE(aligned(ptr, kHugePageSize)) << bytes;
+      }
+      ptr[0] = 1;
+      ptr[bytes - 1] = 2;
+      // the mode may change before the block is freed
+      setHugePages(HugePages::kNone);
+      deallocateBlock(ptr, bytes);
+      setHugePages(mode);
+    }
+  }
+  setHugePages(HugePages::kNone);
+}
+
+TEST(Allocator, vector) {
+  std::vector<double, AlignedAllocator<double>> values(1000, 1.5);
+  EXPECT_TRUE(aligned(values.data(), kCacheLineSize));
+  values.resize(kHugePageSize / sizeof(double) + 1, 2.5);
+  EXPECT_TRUE(aligned(values.data(), kHugePageSize));
+  EXPECT_EQ(values[999], 1.5);
+  EXPECT_EQ(values.back(), 2.5);
+
+  std::vector<double, AlignedAllocator<double>> copy = values;
+  EXPECT_EQ(copy, values);
+  EXPECT_THROW(allocateBlock(size_t(1) << 62), std::bad_alloc);
+}
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <distributed/common/BigData.h>
+
+#include <gtest/gtest.h>
+
+using distributed::BigData;
+using distributed::kLaborPrefetch;
+using distributed::kMaxBucketSize;
+using distributed::kMinBucketSize;
+
+TEST(BigData, initBucketSize) {
+  BigData bigdata;
+  bigdata.set_bucket(0.5, 5000);
+
+  // no cost measured yet
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 1000000, 4), 5000);
+
+  // without bucket_seconds, the measured cost is not used
+  bigdata.set_bucket(0, 5000);
+  bigdata.record_cost(true, 1000, 1.0);
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 1000000, 4), 5000);
+}
+
+TEST(BigData, tuneByCost) {
+  BigData bigdata;
+  bigdata.set_bucket(2.0, 5000);
+
+  // the first sample is taken as it is, the later ones are weighted by 0.2
+  bigdata.record_cost(true, 1000, 0.1);
+  EXPECT_DOUBLE_EQ(bigdata.row_cost(true), 1e-4);
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 10000000, 1), 20000);
+
+  bigdata.record_cost(true, 1000, 0.6);
+  EXPECT_DOUBLE_EQ(bigdata.row_cost(true), 1e-4 * 0.8 + 6e-4 * 0.2);
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 10000000, 1), 10000);
+
+  // the empty or invalid samples are ignored
+  bigdata.record_cost(true, 0, 1.0);
+  bigdata.record_cost(true, 1000, 0);
+  EXPECT_DOUBLE_EQ(bigdata.row_cost(true), 2e-4);
+
+  // users and items are measured separately
+  EXPECT_EQ(bigdata.row_cost(false), 0);
+  EXPECT_EQ(bigdata.tune_bucket_size(false, 10000000, 1), 5000);
+}
+
+TEST(BigData, tuneClamp) {
+  BigData bigdata;
+  bigdata.set_bucket(1.0, 5000);
+
+  // too slow, at least kMinBucketSize
+  bigdata.record_cost(true, 10, 10.0);
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 10000000, 1), kMinBucketSize);
+
+  // too fast, at most kMaxBucketSize
+  bigdata.record_cost(false, 1000000000, 1.0);
+  EXPECT_EQ(bigdata.tune_bucket_size(false, 1ULL << 40, 1), kMaxBucketSize);
+}
+
+TEST(BigData, prefetchCap) {
+  BigData bigdata;
+  bigdata.set_bucket(0, 5000);
+
+  // each Labor still gets kLaborPrefetch buckets
+  const uint64_t nrows = 20000;
+  EXPECT_EQ(bigdata.tune_bucket_size(true, nrows, 4),
+            nrows / (4 * kLaborPrefetch));
+  EXPECT_EQ(bigdata.tune_bucket_size(true, nrows, 100), kMinBucketSize);
+
+  // no Labor connected yet counts as one
+  EXPECT_EQ(bigdata.tune_bucket_size(true, 8000, 0), 8000 / kLaborPrefetch);
+}
@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <distributed/common/BucketBits.h>
+
+#include <gtest/gtest.h>
+
+using distributed::BucketBits;
+
+TEST(BucketBits, setAndCount) {
+  BucketBits bits;
+  EXPECT_EQ(bits.size(), 0);
+  EXPECT_TRUE(bits.all());
+  EXPECT_FALSE(bits.set(0));
+
+  // across the word boundaries
+  bits.reset(130);
+  EXPECT_EQ(bits.size(), 130);
+  EXPECT_EQ(bits.count(), 0);
+  EXPECT_FALSE(bits.all());
+
+  for (size_t pos : {0, 63, 64, 129}) {
+    EXPECT_FALSE(bits.test(pos));
+    EXPECT_TRUE(bits.set(pos));
+    EXPECT_TRUE(bits.test(pos));
+  }
+  EXPECT_EQ(bits.count(), 4);
+
+  // set again, or out of range, does not count
+  EXPECT_FALSE(bits.set(64));
+  EXPECT_FALSE(bits.set(130));
+  EXPECT_FALSE(bits.test(130));
+  EXPECT_EQ(bits.count(), 4);
+
+  for (size_t pos = 0; pos < 130; ++pos) {
+    bits.set(pos);
+  }
+  EXPECT_EQ(bits.count(), 130);
+  EXPECT_TRUE(bits.all());
+}
+
+TEST(BucketBits, reset) {
+  BucketBits bits;
+  bits.reset(100);
+  for (size_t pos = 0; pos < 100; pos += 3) {
+    bits.set(pos);
+  }
+  EXPECT_EQ(bits.count(), 34);
+
+  // the next half epcho may have another bucket number
+  bits.reset(10);
+  EXPECT_EQ(bits.size(), 10);
+  EXPECT_EQ(bits.count(), 0);
+  for (size_t pos = 0; pos < 10; ++pos) {
+    EXPECT_FALSE(bits.test(pos));
+  }
+  EXPECT_FALSE(bits.test(99));
+
+  bits.reset(0);
+  EXPECT_EQ(bits.size(), 0);
+  EXPECT_TRUE(bits.all());
+}
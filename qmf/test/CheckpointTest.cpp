@@ -0,0 +1,212 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+
+#include <distributed/scheduler/Checkpoint.h>
+
+#include <gtest/gtest.h>
+
+using distributed::scheduler::Checkpoint;
+using distributed::scheduler::CheckpointHeader;
+
+namespace {
+
+const uint64_t kRatings = 12345;
+
+qmf::Matrix makeFactors(size_t nrows, size_t ncols, double base) {
+  qmf::Matrix factors(nrows, ncols);
+  for (size_t r = 0; r < nrows; ++r) {
+    for (size_t c = 0; c < ncols; ++c) {
+      factors(r, c) = base + r * ncols + c;
+    }
+  }
+  return factors;
+}
+
+bool equal(const qmf::Matrix& X, const qmf::Matrix& Y) {
+  if (X.nrows() != Y.nrows() || X.ncols() != Y.ncols()) {
+    return false;
+  }
+  for (size_t r = 0; r < X.nrows(); ++r) {
+    for (size_t c = 0; c < X.ncols(); ++c) {
+      if (X(r, c) != Y(r, c)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// an empty directory for each test
+std::string makeDir() {
+  char dir[] = "/tmp/CheckpointTest.XXXXXX";
+  EXPECT_NE(::mkdtemp(dir), nullptr);
+  return dir;
+}
+
+void removeDir(const std::string& dir) {
+  ::unlink(Checkpoint::path(dir, true).c_str());
+  ::unlink(Checkpoint::path(dir, false).c_str());
+  ::rmdir(dir.c_str());
+}
+
+} // namespace
+
+TEST(Checkpoint, roundTrip) {
+  const std::string dir = makeDir();
+  const std::string path = Checkpoint::path(dir, true);
+  const qmf::Matrix factors = makeFactors(100, 8, 0.5);
+  ASSERT_TRUE(Checkpoint::save(path, 7, kRatings, factors));
+
+  // written by the header and raw factors, no temporary left
+  struct stat st;
+  ASSERT_EQ(::stat(path.c_str(), &st), 0);
+  EXPECT_EQ(st.st_size,
+            sizeof(CheckpointHeader) + 100 * 8 * sizeof(qmf::Double));
+  EXPECT_NE(::access((path + ".tmp").c_str(), F_OK), 0);
+
+  qmf::Matrix loaded(100, 8);
+  uint32_t epchoid = 0;
+  ASSERT_TRUE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+  EXPECT_EQ(epchoid, 7);
+  EXPECT_TRUE(equal(loaded, factors));
+
+  // overwrite the previous one
+  ASSERT_TRUE(Checkpoint::save(path, 9, kRatings, makeFactors(100, 8, 2.0)));
+  ASSERT_TRUE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+  EXPECT_EQ(epchoid, 9);
+  EXPECT_TRUE(equal(loaded, makeFactors(100, 8, 2.0)));
+
+  removeDir(dir);
+}
+
+TEST(Checkpoint, mismatch) {
+  const std::string dir = makeDir();
+  const std::string path = Checkpoint::path(dir, false);
+  ASSERT_TRUE(Checkpoint::save(path, 2, kRatings, makeFactors(100, 8, 0)));
+
+  const qmf::Matrix untouched = makeFactors(100, 8, 1000);
+  qmf::Matrix loaded = untouched;
+  uint32_t epchoid = 0;
+  EXPECT_FALSE(Checkpoint::load(path, kRatings + 1, &loaded, &epchoid));
+
+  qmf::Matrix moreRows(101, 8);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &moreRows, &epchoid));
+  qmf::Matrix moreCols(100, 9);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &moreCols, &epchoid));
+
+  EXPECT_FALSE(Checkpoint::load(dir + "/absent.ckpt", kRatings, &loaded,
+                                &epchoid));
+  EXPECT_TRUE(equal(loaded, untouched));
+  EXPECT_EQ(epchoid, 0);
+
+  removeDir(dir);
+}
+
+TEST(Checkpoint, truncated) {
+  const std::string dir = makeDir();
+  const std::string path = Checkpoint::path(dir, true);
+  ASSERT_TRUE(Checkpoint::save(path, 3, kRatings, makeFactors(100, 8, 0)));
+
+  qmf::Matrix loaded(100, 8);
+  uint32_t epchoid = 0;
+  const off_t size = sizeof(CheckpointHeader) + 100 * 8 * sizeof(qmf::Double);
+
+  // crashed in the middle of the factors, or of the header
+  ASSERT_EQ(::truncate(path.c_str(), size - sizeof(qmf::Double)), 0);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+  ASSERT_EQ(::truncate(path.c_str(), sizeof(CheckpointHeader) / 2), 0);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+  ASSERT_EQ(::truncate(path.c_str(), 0), 0);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+
+  // the trailing garbage is also rejected
+  ASSERT_EQ(::truncate(path.c_str(), size + 1), 0);
+  EXPECT_FALSE(Checkpoint::load(path, kRatings, &loaded, &epchoid));
+  EXPECT_EQ(epchoid, 0);
+
+  removeDir(dir);
+}
+
+TEST(Checkpoint, resume) {
+  const qmf::Matrix initUser = makeFactors(30, 4, -100);
+  const qmf::Matrix initItem = makeFactors(20, 4, -200);
+  const qmf::Matrix user1 = makeFactors(30, 4, 1);
+  const qmf::Matrix user3 = makeFactors(30, 4, 3);
+  const qmf::Matrix item2 = makeFactors(20, 4, 2);
+  const qmf::Matrix item4 = makeFactors(20, 4, 4);
+
+  struct Case {
+    int userEpcho; // 0 for no checkpoint
+    int itemEpcho;
+    uint32_t expected;
+    const qmf::Matrix* user; // the factors after resume
+    const qmf::Matrix* item;
+  };
+
+  const Case cases[] = {
+    // nothing to resume
+    {0, 0, 0, &initUser, &initItem},
+    // only the users of the first half epcho
+    {1, 0, 1, &user1, &initItem},
+    // the users are the latest, the items are the ones they were solved with
+    {3, 2, 3, &user3, &item2},
+    // the items are the latest
+    {3, 4, 4, &user3, &item4},
+    // the users are stale, keep the initialized ones
+    {1, 4, 4, &initUser, &item4},
+    // the items are stale for the latest users
+    {3, 0, 3, &user3, &initItem},
+  };
+
+  for (const auto& c : cases) {
+    const std::string dir = makeDir();
+    if (c.userEpcho) {
+      ASSERT_TRUE(Checkpoint::save(Checkpoint::path(dir, true), c.userEpcho,
+                                   kRatings, c.userEpcho == 1 ? user1 : user3));
+    }
+    if (c.itemEpcho) {
+      ASSERT_TRUE(Checkpoint::save(Checkpoint::path(dir, false), c.itemEpcho,
+                                   kRatings, c.itemEpcho == 2 ? item2 : item4));
+    }
+
+    qmf::Matrix user = initUser;
+    qmf::Matrix item = initItem;
+    EXPECT_EQ(Checkpoint::resume(dir, kRatings, &user, &item), c.expected)
+      << "user " << c.userEpcho << ", item " << c.itemEpcho;
+    EXPECT_TRUE(equal(user, *c.user));
+    EXPECT_TRUE(equal(item, *c.item));
+    removeDir(dir);
+  }
+}
+
+TEST(Checkpoint, resumeWrongParity) {
+  // a user checkpoint is never produced at even epcho, nor item at odd
+  const std::string dir = makeDir();
+  ASSERT_TRUE(Checkpoint::save(Checkpoint::path(dir, true), 2, kRatings,
+                               makeFactors(30, 4, 1)));
+  ASSERT_TRUE(Checkpoint::save(Checkpoint::path(dir, false), 3, kRatings,
+                               makeFactors(20, 4, 2)));
+
+  const qmf::Matrix initUser = makeFactors(30, 4, -100);
+  qmf::Matrix user = initUser;
+  qmf::Matrix item(20, 4);
+  EXPECT_EQ(Checkpoint::resume(dir, kRatings, &user, &item), 0);
+  EXPECT_TRUE(equal(user, initUser));
+
+  // nor the checkpoint of another dataset
+  ASSERT_TRUE(Checkpoint::save(Checkpoint::path(dir, true), 5, kRatings + 1,
+                               makeFactors(30, 4, 1)));
+  EXPECT_EQ(Checkpoint::resume(dir, kRatings, &user, &item), 0);
+  EXPECT_TRUE(equal(user, initUser));
+  removeDir(dir);
+}
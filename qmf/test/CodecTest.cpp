@@ -0,0 +1,228 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <distributed/common/Codec.h>
+#include <distributed/common/RecvOps.h>
+#include <distributed/common/SendOps.h>
+
+#include <gtest/gtest.h>
+
+using distributed::ChunkHead;
+using distributed::Codec;
+using distributed::Encoding;
+using distributed::Head;
+using distributed::kEncodingLZ;
+using distributed::kStreamLength;
+using distributed::OpCode;
+using distributed::RecvOps;
+using distributed::SendOps;
+
+namespace {
+
+std::string join(const std::vector<std::string>& chunks) {
+  std::string payload;
+  for (const auto& chunk : chunks) {
+    payload.append(chunk);
+  }
+  return payload;
+}
+
+std::vector<qmf::DatasetElem> decodeRating(uint8_t encoding,
+                                           const std::string& payload) {
+  std::vector<qmf::DatasetElem> result;
+  std::string scratch;
+  size_t offset = 0;
+  while (offset < payload.size()) {
+    ChunkHead head;
+    ::memcpy(&head, payload.data() + offset, sizeof(head));
+    offset += sizeof(head);
+
+    const size_t start = result.size();
+    result.resize(start + head.rows);
+    EXPECT_TRUE(Codec::decode_rating_chunk(encoding, head,
+                                           payload.data() + offset,
+                                           result.data() + start, &scratch));
+    offset += head.bytes;
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(Codec, lz) {
+  std::string plain;
+  for (int i = 0; i < 100000; ++i) {
+    plain.append(std::to_string(i % 977));
+  }
+
+  std::string compressed(Codec::lz_bound(plain.size()), '\0');
+  compressed.resize(
+    Codec::lz_compress(plain.data(), plain.size(), &compressed[0]));
+  EXPECT_LT(compressed.size(), plain.size() / 2);
+
+  std::string result(plain.size(), '\0');
+  EXPECT_TRUE(Codec::lz_decompress(compressed.data(), compressed.size(),
+                                   &result[0], result.size()));
+  EXPECT_EQ(result, plain);
+
+  // truncated input must be detected
+  EXPECT_FALSE(Codec::lz_decompress(compressed.data(), compressed.size() / 2,
+                                    &result[0], result.size()));
+}
+
+TEST(Codec, rating) {
+  std::vector<qmf::DatasetElem> dataset;
+  for (int64_t u = 0; u < 5000; ++u) {
+    for (int64_t i = 0; i < 20; ++i) {
+      dataset.push_back({u * 7 + 100, (u + i * 13) % 3000, (i % 5) + 1.0});
+    }
+  }
+  dataset.push_back({-3, 1LL << 40, 0.25});
+
+  for (uint8_t encoding :
+       {static_cast<uint8_t>(Encoding::kVarint),
+        static_cast<uint8_t>(static_cast<uint8_t>(Encoding::kVarint) |
+                             kEncodingLZ)}) {
+    std::vector<std::string> chunks;
+    const uint64_t len =
+      Codec::encode_rating(encoding, dataset.data(), dataset.size(), &chunks);
+    EXPECT_GT(chunks.size(), 1);
+    EXPECT_LT(len, dataset.size() * sizeof(qmf::DatasetElem) / 3);
+
+    const auto result = decodeRating(encoding, join(chunks));
+    ASSERT_EQ(result.size(), dataset.size());
+    for (size_t k = 0; k < dataset.size(); ++k) {
+      EXPECT_EQ(result[k].userId, dataset[k].userId);
+      EXPECT_EQ(result[k].itemId, dataset[k].itemId);
+      EXPECT_DOUBLE_EQ(result[k].value, dataset[k].value);
+    }
+  }
+}
+
+TEST(Codec, factors) {
+  const uint64_t nrows = 30000;
+  const uint32_t ncols = 10;
+  std::vector<qmf::Double> factors(nrows * ncols);
+  for (size_t i = 0; i < factors.size(); ++i) {
+    factors[i] = std::sin(static_cast<double>(i)) * 0.01;
+  }
+
+  const std::vector<std::pair<Encoding, double>> tolerances = {
+    {Encoding::kRaw, 0.0},
+    {Encoding::kFloat32, 1e-9},
+    {Encoding::kBFloat16, 1e-4},
+    {Encoding::kInt8, 1e-4}};
+
+  for (const auto& tolerance : tolerances) {
+    for (uint8_t lz : {0, static_cast<int>(kEncodingLZ)}) {
+      const uint8_t encoding = static_cast<uint8_t>(tolerance.first) | lz;
+
+      // plain kRaw is sent unchunked, by SendOps::send_bulk
+      if (encoding == 0) {
+        std::vector<qmf::Double> result(factors.size());
+        EXPECT_TRUE(Codec::decode_factors(
+          encoding, reinterpret_cast<const char*>(factors.data()),
+          factors.size() * sizeof(qmf::Double), result.data(), nrows, ncols));
+        EXPECT_EQ(result, factors);
+        continue;
+      }
+
+      std::vector<std::string> chunks;
+      Codec::encode_factors(encoding, factors.data(), nrows, ncols, &chunks);
+      const std::string payload = join(chunks);
+
+      std::vector<qmf::Double> result(factors.size());
+      ASSERT_TRUE(Codec::decode_factors(encoding, payload.data(),
+                                        payload.size(), result.data(), nrows,
+                                        ncols));
+      for (size_t i = 0; i < factors.size(); ++i) {
+        EXPECT_NEAR(result[i], factors[i], tolerance.second);
+      }
+
+      // the decoded rows must match exactly
+      EXPECT_FALSE(Codec::decode_factors(encoding, payload.data(),
+                                         payload.size(), result.data(),
+                                         nrows + 1, ncols));
+    }
+  }
+}
+
+TEST(Codec, negotiate) {
+  const uint8_t bf16 = static_cast<uint8_t>(Encoding::kBFloat16);
+  EXPECT_EQ(Codec::negotiate(bf16 | kEncodingLZ, Codec::supported_mask()),
+            bf16 | kEncodingLZ);
+  EXPECT_EQ(Codec::negotiate(bf16 | kEncodingLZ, 1 << bf16), bf16);
+  EXPECT_EQ(Codec::negotiate(bf16, 1), 0);
+}
+
+TEST(Codec, stream) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  // more chunks than one batch, so they are encoded while being sent
+  const uint64_t nrows = 300000;
+  const uint32_t ncols = 10;
+  std::vector<qmf::Double> factors(nrows * ncols);
+  for (size_t i = 0; i < factors.size(); ++i) {
+    factors[i] = std::cos(static_cast<double>(i)) * 0.01;
+  }
+  const uint8_t encoding =
+    static_cast<uint8_t>(Encoding::kFloat32) | kEncodingLZ;
+  ASSERT_GT(Codec::factor_chunks(nrows, ncols),
+            distributed::kStreamBatchChunks);
+
+  auto recvHead = [&fds]() {
+    Head head;
+    bool critical = false;
+    while (!RecvOps::try_recv_head(fds[1], &head, &critical)) {
+      EXPECT_FALSE(critical);
+    }
+    return head;
+  };
+
+  std::thread sender([&]() {
+    EXPECT_TRUE(SendOps::send_factors(fds[0], OpCode::kPushFixed,
+                                      factors.data(), nrows, ncols, encoding));
+    EXPECT_TRUE(SendOps::send_factors(fds[0], OpCode::kPushFixed,
+                                      factors.data(), nrows, ncols, encoding));
+    EXPECT_TRUE(SendOps::send_message(fds[0], OpCode::kCalc, "CA"));
+  });
+
+  Head head = recvHead();
+  EXPECT_EQ(head.length, kStreamLength);
+  uint64_t rows = 0;
+  std::vector<qmf::Double> result(factors.size());
+  ASSERT_TRUE(RecvOps::recv_factors(fds[1], head, result.data(), nrows, ncols,
+                                    [&rows](uint64_t row, uint64_t count) {
+                                      EXPECT_EQ(row, rows);
+                                      rows += count;
+                                    }));
+  EXPECT_EQ(rows, nrows);
+  for (size_t i = 0; i < factors.size(); ++i) {
+    EXPECT_NEAR(result[i], factors[i], 1e-9);
+  }
+
+  // the dropped payload keeps the stream in sync
+  EXPECT_TRUE(RecvOps::drop_payload(fds[1], recvHead()));
+  head = recvHead();
+  EXPECT_EQ(head.opcode, static_cast<uint8_t>(OpCode::kCalc));
+  std::string message(head.length, '\0');
+  EXPECT_TRUE(RecvOps::recv_message(fds[1], head, &message[0]));
+  EXPECT_EQ(message, "CA");
+
+  sender.join();
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
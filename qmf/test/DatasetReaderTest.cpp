@@ -56,4 +56,45 @@ TEST(DatasetReader, readAll) {
     EXPECT_DOUBLE_EQ(elem.value, 3);
   }
 }
+
+TEST(DatasetReader, readBinary) {
+  const std::vector<DatasetElem> expected = {{1, 2, 3.5}, {-4, 5}, {6, 7, 0}};
+  std::string str = DatasetReader::binaryMagic;
+  str.append(reinterpret_cast<const char*>(expected.data()),
+             expected.size() * sizeof(DatasetElem));
+
+  DatasetReader reader;
+  reader.stream_ = std::make_unique<std::istringstream>(str);
+  reader.detectFormat();
+  EXPECT_TRUE(reader.binary());
+  DatasetElem elem;
+  EXPECT_TRUE(reader.readOne(elem));
+  EXPECT_EQ(elem.userId, 1);
+  EXPECT_EQ(elem.itemId, 2);
+  EXPECT_DOUBLE_EQ(elem.value, 3.5);
+
+  // the rest are read in bulk
+  std::vector<DatasetElem> dataset = reader.readAll();
+  ASSERT_EQ(dataset.size(), 2);
+  for (size_t i = 0; i < dataset.size(); ++i) {
+    EXPECT_EQ(dataset[i].userId, expected[i + 1].userId);
+    EXPECT_EQ(dataset[i].itemId, expected[i + 1].itemId);
+    EXPECT_DOUBLE_EQ(dataset[i].value, expected[i + 1].value);
+  }
+
+  // text is rewound after the detection
+  reader.stream_ = std::make_unique<std::istringstream>("1 2 3\n4 5 6\n");
+  reader.detectFormat();
+  EXPECT_FALSE(reader.binary());
+  EXPECT_EQ(reader.readAll().size(), 2);
+}
+
+TEST(DatasetReader, readBinaryTruncated) {
+  DatasetReader reader;
+  reader.stream_ = std::make_unique<std::istringstream>(
+    DatasetReader::binaryMagic + std::string(sizeof(DatasetElem) + 3, '\0'));
+  reader.detectFormat();
+  EXPECT_TRUE(reader.binary());
+  EXPECT_DEATH(reader.readAll(), "truncated");
+}
 }
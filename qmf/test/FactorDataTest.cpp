@@ -61,3 +61,21 @@ TEST(FactorData, noBiases) {
   EXPECT_DEATH(
     fd.biasAt(0) = 1.0, ".*withBiases = false");
 }
+
+TEST(FactorData, parallel) {
+  qmf::ParallelExecutor parallel(4);
+  qmf::FactorData fd(parallel, 101, 3, /*withBiases=*/true);
+
+  EXPECT_EQ(fd.nelems(), 101);
+  EXPECT_EQ(fd.nfactors(), 3);
+  for (size_t i = 0; i < fd.nelems(); ++i) {
+    for (size_t f = 0; f < fd.nfactors(); ++f) {
+      EXPECT_EQ(fd.at(i, f), 0.0);
+    }
+    EXPECT_EQ(fd.biasAt(i), 0.0);
+  }
+
+  fd.at(7, 2) = 1.5;
+  fd.setFactors(parallel);
+  EXPECT_EQ(fd.at(7, 2), 0.0);
+}
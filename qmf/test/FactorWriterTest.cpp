@@ -0,0 +1,182 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/FactorWriter.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+std::string formatDouble(const Double value) {
+  char buff[FactorWriter::kMaxNumberChars];
+  return std::string(buff, FactorWriter::formatDouble(value, buff));
+}
+
+std::string printfDouble(const Double value) {
+  char buff[512];
+  snprintf(buff, sizeof(buff), "%.9f", value);
+  return buff;
+}
+
+// the iostream formatting of Engine::saveFactors
+std::string streamRows(const FactorData& factorData, const IdIndex& index) {
+  std::ostringstream sout;
+  sout << std::fixed << std::setprecision(9);
+  for (size_t idx = 0; idx < factorData.nelems(); ++idx) {
+    sout << index.id(idx);
+    if (factorData.withBiases()) {
+      sout << ' ' << factorData.biasAt(idx);
+    }
+    for (size_t fidx = 0; fidx < factorData.nfactors(); ++fidx) {
+      sout << ' ' << factorData.at(idx, fidx);
+    }
+    sout << '\n';
+  }
+  return sout.str();
+}
+
+std::string readFile(const std::string& fileName) {
+  std::ifstream fin(fileName);
+  std::stringstream ss;
+  ss << fin.rdbuf();
+  return ss.str();
+}
+}
+
+TEST(FactorWriter, formatDouble) {
+  for (const Double value :
+       {0.0, -0.0, 1.0, -1.0, 0.5, -0.25, 123.456, 1e-10, -1e-10, 0.1, 2.5e5,
+        999999.9999999999, 1e6, -3.5e12, 1e300}) {
+    EXPECT_EQ(formatDouble(value), printfDouble(value)) << value;
+  }
+
+  // including the exact halfway cases
+  for (int i = -5000; i < 5000; ++i) {
+    const Double value = i / 1024.0;
+    EXPECT_EQ(formatDouble(value), printfDouble(value)) << value;
+  }
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<Double> unif(-10.0, 10.0);
+  for (int i = 0; i < 100000; ++i) {
+    const Double value = unif(gen);
+    EXPECT_EQ(formatDouble(value), printfDouble(value)) << value;
+  }
+}
+
+TEST(FactorWriter, formatInt64) {
+  char buff[FactorWriter::kMaxNumberChars];
+  for (const int64_t value : {int64_t(0), int64_t(7), int64_t(-42),
+                              std::numeric_limits<int64_t>::max(),
+                              std::numeric_limits<int64_t>::min()}) {
+    EXPECT_EQ(std::string(buff, FactorWriter::formatInt64(value, buff)),
+              std::to_string(value));
+  }
+}
+
+TEST(FactorWriter, writeChunks) {
+  const std::string fileName = "/tmp/FactorWriterTest.writeChunks";
+  ParallelExecutor parallel(3);
+  std::vector<size_t> rounds;
+  EXPECT_TRUE(FactorWriter::writeChunks(
+    fileName, 7,
+    [](const size_t chunk, std::string* out) {
+      out->append(chunk + 1, 'a' + chunk);
+    },
+    parallel, [&rounds](const size_t chunks) { rounds.push_back(chunks); }));
+  EXPECT_EQ(readFile(fileName), "abbcccddddeeeeeffffffggggggg");
+  EXPECT_EQ(rounds, std::vector<size_t>({3, 6, 7}));
+
+  // nothing to write
+  EXPECT_TRUE(FactorWriter::writeChunks(
+    fileName, 0, [](const size_t, std::string*) {}, parallel));
+  EXPECT_EQ(readFile(fileName), "");
+  ::unlink(fileName.c_str());
+
+  EXPECT_FALSE(FactorWriter::writeChunks(
+    "/nonexistent/FactorWriterTest", 1, [](const size_t, std::string*) {},
+    parallel));
+}
+
+TEST(FactorWriter, save) {
+  const size_t nelems = FactorWriter::kChunkRows * 5 + 17;
+  const size_t nfactors = 4;
+  IdIndex index;
+  for (size_t i = 0; i < nelems; ++i) {
+    index.getOrSetIdx(i * 7 - 100);
+  }
+
+  for (const bool withBiases : {false, true}) {
+    FactorData factorData(nelems, nfactors, withBiases);
+    factorData.setFactors(
+      [](size_t i, size_t j) { return (i * nfactors + j) / 1024.0 - 3; });
+    if (withBiases) {
+      factorData.setBiases([](size_t i) { return i / 8.0; });
+    }
+
+    const std::string expected = streamRows(factorData, index);
+
+    const std::string fileName = "/tmp/FactorWriterTest.save";
+    ParallelExecutor parallel(3);
+    EXPECT_TRUE(FactorWriter::save(factorData, index, fileName, parallel));
+    EXPECT_EQ(readFile(fileName), expected);
+
+    // read back
+    IdIndex loadedIndex;
+    std::unique_ptr<FactorData> loaded;
+    EXPECT_TRUE(FactorReader::load(fileName, nfactors, withBiases, loadedIndex,
+                                   loaded));
+    ASSERT_EQ(loadedIndex.ids(), index.ids());
+    EXPECT_EQ(streamRows(*loaded, loadedIndex), expected);
+    IdIndex wrongIndex;
+    EXPECT_FALSE(FactorReader::load(fileName, nfactors + 1, withBiases,
+                                    wrongIndex, loaded));
+
+    // the shards concatenated are the whole file
+    const size_t split = FactorWriter::kChunkRows + 3;
+    EXPECT_TRUE(FactorWriter::saveShard(factorData, index, 0, split,
+                                        fileName + ".0"));
+    EXPECT_TRUE(FactorWriter::saveShard(factorData, index, split, nelems,
+                                        fileName + ".1"));
+    EXPECT_EQ(readFile(fileName + ".0") + readFile(fileName + ".1"),
+              expected);
+
+    // the same shard written concurrently is still complete
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 4; ++i) {
+      writers.emplace_back([&]() {
+        EXPECT_TRUE(FactorWriter::saveShard(factorData, index, 0, nelems,
+                                            fileName + ".2"));
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    EXPECT_EQ(readFile(fileName + ".2"), expected);
+
+    ::unlink(fileName.c_str());
+    ::unlink((fileName + ".0").c_str());
+    ::unlink((fileName + ".1").c_str());
+    ::unlink((fileName + ".2").c_str());
+  }
+}
+}
@@ -0,0 +1,141 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <random>
+#include <set>
+
+#include <qmf/retrieval/IVFIndex.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+// the items around a few centers, so the clusters are meaningful
+void clustered(FactorData& factors, const int32_t seed) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<Double> normal;
+  const size_t ncenters = 8;
+  std::vector<Double> centers(ncenters * factors.nfactors());
+  for (auto& x : centers) {
+    x = normal(gen);
+  }
+  for (size_t idx = 0; idx < factors.nelems(); ++idx) {
+    const size_t center = idx % ncenters;
+    for (size_t fidx = 0; fidx < factors.nfactors(); ++fidx) {
+      factors.at(idx, fidx) =
+        centers[center * factors.nfactors() + fidx] + 0.3 * normal(gen);
+    }
+    if (factors.withBiases()) {
+      factors.biasAt(idx) = 0.5 * normal(gen);
+    }
+  }
+}
+
+ScoredItems bruteForce(const FactorData& items,
+                       const FactorData& queries,
+                       const size_t q,
+                       const size_t k) {
+  ScoredItems all;
+  for (size_t idx = 0; idx < items.nelems(); ++idx) {
+    Double score = items.biasAt(idx);
+    for (size_t fidx = 0; fidx < items.nfactors(); ++fidx) {
+      score += items.at(idx, fidx) * queries.at(q, fidx);
+    }
+    all.emplace_back(score, idx);
+  }
+  std::sort(all.begin(), all.end(), [](const auto& x, const auto& y) {
+    return x.first > y.first || (x.first == y.first && x.second < y.second);
+  });
+  all.resize(k);
+  return all;
+}
+}
+
+TEST(TopK, push) {
+  TopK topk(3);
+  for (const size_t idx : {5, 1, 7, 3, 9, 0}) {
+    topk.push(static_cast<Double>(idx % 4), idx);
+  }
+  ScoredItems result;
+  topk.sorted(&result);
+  // scores 1, 1, 3, 3, 1, 0 by idx 5, 1, 7, 3, 9, 0
+  ASSERT_EQ(result.size(), 3);
+  EXPECT_EQ(result[0], std::make_pair(Double(3), size_t(3)));
+  EXPECT_EQ(result[1], std::make_pair(Double(3), size_t(7)));
+  EXPECT_EQ(result[2], std::make_pair(Double(1), size_t(1)));
+  EXPECT_EQ(topk.size(), 0);
+
+  TopK empty(0);
+  empty.push(1.0, 1);
+  EXPECT_EQ(empty.size(), 0);
+}
+
+TEST(IVFIndex, search) {
+  const size_t k = 10;
+  for (const bool withBiases : {false, true}) {
+    FactorData items(2000, 8, withBiases);
+    clustered(items, 1);
+    FactorData queries(50, 8);
+    clustered(queries, 2);
+
+    ParallelExecutor parallel(4);
+    IVFIndex index(items, 16, 10, parallel);
+    EXPECT_EQ(index.nlist(), 16);
+    EXPECT_EQ(index.nitems(), 2000);
+    size_t total = 0;
+    for (size_t list = 0; list < index.nlist(); ++list) {
+      total += index.listSize(list);
+    }
+    EXPECT_EQ(total, 2000);
+
+    std::vector<ScoredItems> all;
+    index.searchBatch(queries, k, index.nlist(), parallel, &all);
+    std::vector<ScoredItems> probed;
+    index.searchBatch(queries, k, 4, parallel, &probed);
+
+    size_t hits = 0;
+    for (size_t q = 0; q < queries.nelems(); ++q) {
+      const ScoredItems expected = bruteForce(items, queries, q, k);
+      ScoredItems exact;
+      index.searchExact(&queries.getFactors()(q, 0), k, &exact);
+
+      // probing all the lists is exact
+      ASSERT_EQ(exact.size(), k);
+      ASSERT_EQ(all[q].size(), k);
+      for (size_t i = 0; i < k; ++i) {
+        EXPECT_EQ(exact[i].second, expected[i].second);
+        EXPECT_NEAR(exact[i].first, expected[i].first, 1e-9);
+        EXPECT_EQ(all[q][i].second, expected[i].second);
+      }
+
+      std::set<size_t> truth;
+      for (const auto& item : expected) {
+        truth.insert(item.second);
+      }
+      for (const auto& item : probed[q]) {
+        hits += truth.count(item.second);
+      }
+    }
+    EXPECT_GT(hits, 0.8 * k * queries.nelems());
+  }
+}
+
+TEST(IVFIndex, smallLists) {
+  // more lists than the items
+  FactorData items(5, 3);
+  clustered(items, 3);
+  ParallelExecutor parallel(2);
+  IVFIndex index(items, 100, 5, parallel);
+  EXPECT_EQ(index.nlist(), 5);
+
+  ScoredItems result;
+  index.search(&items.getFactors()(0, 0), 10, 100, &result);
+  EXPECT_EQ(result.size(), 5);
+}
+}
@@ -0,0 +1,117 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <limits>
+#include <random>
+#include <unordered_map>
+
+#include <qmf/utils/IdIndex.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+TEST(IdIndex, getOrSetIdx) {
+  IdIndex index;
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_EQ(index.idx(1), IdIndex::missingIdx);
+
+  // compared with the unordered_map, through a few rehashes
+  std::mt19937_64 gen(7);
+  std::unordered_map<int64_t, size_t> expected;
+  std::vector<int64_t> ids;
+  for (size_t i = 0; i < 10000; ++i) {
+    // sequential, random and the extreme ids
+    int64_t id = i % 3 == 0 ? static_cast<int64_t>(i)
+                            : static_cast<int64_t>(gen() % 5000) - 2500;
+    if (i == 1) {
+      id = std::numeric_limits<int64_t>::min();
+    } else if (i == 2) {
+      id = std::numeric_limits<int64_t>::max();
+    }
+    const auto pos = expected.find(id);
+    const size_t idx = index.getOrSetIdx(id);
+    if (pos == expected.end()) {
+      EXPECT_EQ(idx, expected.size());
+      expected.emplace(id, idx);
+      ids.push_back(id);
+    } else {
+      EXPECT_EQ(idx, pos->second);
+    }
+  }
+
+  EXPECT_EQ(index.size(), expected.size());
+  EXPECT_EQ(index.ids(), ids);
+  for (const auto& p : expected) {
+    EXPECT_EQ(index.idx(p.first), p.second);
+    EXPECT_EQ(index.id(p.second), p.first);
+  }
+  EXPECT_EQ(index.idx(123456789), IdIndex::missingIdx);
+
+  // a copy is independent
+  IdIndex copy = index;
+  copy.getOrSetIdx(123456789);
+  EXPECT_EQ(index.idx(123456789), IdIndex::missingIdx);
+  EXPECT_EQ(copy.idx(123456789), expected.size());
+
+  index.reset();
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_EQ(index.idx(0), IdIndex::missingIdx);
+  EXPECT_EQ(index.getOrSetIdx(42), 0);
+}
+
+TEST(IdIndex, reserve) {
+  IdIndex index;
+  index.reserve(1000);
+  const size_t bytes = index.memoryBytes();
+  for (int64_t id = 0; id < 1000; ++id) {
+    EXPECT_EQ(index.getOrSetIdx(id * 1024), id);
+  }
+  // no rehashing
+  EXPECT_EQ(index.memoryBytes(), bytes);
+}
+
+TEST(IdIndex, build) {
+  const std::vector<int64_t> ids = {30, -5, 7, 1 << 20};
+  IdIndex index;
+  index.getOrSetIdx(99);
+  index.build(ids);
+  EXPECT_FALSE(index.sorted());
+  EXPECT_EQ(index.size(), 4);
+  EXPECT_EQ(index.idx(99), IdIndex::missingIdx);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(index.idx(ids[i]), i);
+  }
+  EXPECT_EQ(index.getOrSetIdx(8), 4);
+
+  IdIndex duplicated;
+  EXPECT_DEATH(duplicated.build({1, 2, 1}), ".*");
+}
+
+TEST(IdIndex, buildSorted) {
+  IdIndex index;
+  index.buildSorted({-7, 0, 3, 100});
+  EXPECT_TRUE(index.sorted());
+  EXPECT_EQ(index.size(), 4);
+  EXPECT_EQ(index.idx(-7), 0);
+  EXPECT_EQ(index.idx(3), 2);
+  EXPECT_EQ(index.idx(100), 3);
+  EXPECT_EQ(index.idx(4), IdIndex::missingIdx);
+  EXPECT_EQ(index.idx(101), IdIndex::missingIdx);
+  EXPECT_EQ(index.getOrSetIdx(0), 1);
+  EXPECT_EQ(index.memoryBytes(), 4 * sizeof(int64_t));
+
+  // immutable
+  EXPECT_DEATH(index.getOrSetIdx(5), ".*");
+  IdIndex unsorted;
+  EXPECT_DEATH(unsorted.buildSorted({1, 3, 2}), ".*");
+
+  index.reset();
+  EXPECT_FALSE(index.sorted());
+  EXPECT_EQ(index.getOrSetIdx(5), 0);
+}
+}
@@ -0,0 +1,150 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <thread>
+#include <vector>
+
+#include <qmf/metrics/MetricsEngine.h>
+#include <qmf/utils/Instrumentation.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+uint64_t counterValue(const Instrumentation::Snapshot& snapshot,
+                      const std::string& name) {
+  for (const auto& counter : snapshot.counters) {
+    if (counter.first == name) {
+      return counter.second;
+    }
+  }
+  ADD_FAILURE() << "missing counter " << name;
+  return 0;
+}
+
+Instrumentation::HistogramSnapshot histogramValue(
+  const Instrumentation::Snapshot& snapshot,
+  const std::string& name) {
+  for (const auto& histogram : snapshot.histograms) {
+    if (histogram.first == name) {
+      return histogram.second;
+    }
+  }
+  ADD_FAILURE() << "missing histogram " << name;
+  return {};
+}
+}
+
+TEST(Instrumentation, counter) {
+  const Counter counter("test.counter");
+  // the same name shares the slot
+  const Counter same("test.counter");
+  Instrumentation::get().reset();
+
+  // the threads exit before the snapshot, their shards are still summed
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 8; ++t) {
+    threads.emplace_back([&counter, &same]() {
+      for (size_t i = 0; i < 10000; ++i) {
+        counter.add();
+      }
+      same.add(5);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  counter.add(2);
+
+  EXPECT_EQ(
+    counterValue(Instrumentation::get().snapshot(), "test.counter"),
+    8 * 10000 + 8 * 5 + 2);
+
+  Instrumentation::get().reset();
+  EXPECT_EQ(
+    counterValue(Instrumentation::get().snapshot(), "test.counter"), 0);
+}
+
+TEST(Instrumentation, histogram) {
+  const Histogram histogram("test.histogram");
+  Instrumentation::get().reset();
+
+  // 90 fast ones in [1024, 2048) ns, 10 slow ones of 1 ms
+  for (size_t i = 0; i < 90; ++i) {
+    histogram.record(1500);
+  }
+  std::thread([&histogram]() {
+    for (size_t i = 0; i < 10; ++i) {
+      histogram.recordSeconds(1e-3);
+    }
+  }).join();
+
+  const auto h = histogramValue(Instrumentation::get().snapshot(),
+                                "test.histogram");
+  EXPECT_EQ(h.count, 100);
+  EXPECT_EQ(h.sumNanos, 90 * 1500 + 10 * 1000000);
+  EXPECT_EQ(h.maxNanos, 1000000);
+  EXPECT_EQ(h.buckets[10], 90);
+  EXPECT_EQ(h.buckets[19], 10);
+  EXPECT_DOUBLE_EQ(h.percentileSeconds(0.5), 2048e-9);
+  EXPECT_DOUBLE_EQ(h.percentileSeconds(0.9), 2048e-9);
+  // capped by the max
+  EXPECT_DOUBLE_EQ(h.percentileSeconds(0.99), 1e-3);
+
+  {
+    ScopedTimer timer(histogram);
+  }
+  EXPECT_EQ(histogramValue(Instrumentation::get().snapshot(),
+                           "test.histogram")
+              .count,
+            101);
+}
+
+TEST(Instrumentation, json) {
+  const Counter counter("test.json_counter");
+  const Histogram histogram("test.json_histogram");
+  Instrumentation::get().reset();
+  counter.add(3);
+  histogram.record(100);
+
+  const std::string json = Instrumentation::get().snapshot().toJson();
+  EXPECT_NE(json.find("\"test.json_counter\": 3"), std::string::npos);
+  EXPECT_NE(json.find("\"test.json_histogram\": {\"count\": 1,"),
+            std::string::npos);
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_EQ(json.substr(json.size() - 2), "}\n");
+
+  Instrumentation::Snapshot empty;
+  EXPECT_EQ(empty.toJson(), "{\n  \"counters\": {},\n  \"histograms\": {}\n}\n");
+}
+
+TEST(Instrumentation, metricsEngine) {
+  const Counter counter("test.metrics_counter");
+  const Histogram histogram("test.metrics_histogram");
+  Instrumentation::get().reset();
+  counter.add(7);
+  histogram.recordSeconds(0.5);
+
+  MetricsConfig config{0, false, 42};
+  MetricsEngine metricsEngine(config, false);
+  metricsEngine.recordInstrumentation(1, Instrumentation::get().snapshot());
+  counter.add(1);
+  metricsEngine.recordInstrumentation(2, Instrumentation::get().snapshot());
+
+  const auto& metrics = metricsEngine.metricsMap();
+  const auto& counts = metrics.at("instr_test.metrics_counter");
+  ASSERT_EQ(counts.size(), 2);
+  EXPECT_EQ(counts[0], std::make_pair(size_t(1), Double(7)));
+  EXPECT_EQ(counts[1], std::make_pair(size_t(2), Double(8)));
+  EXPECT_DOUBLE_EQ(
+    metrics.at("instr_test.metrics_histogram_seconds")[0].second, 0.5);
+  EXPECT_DOUBLE_EQ(
+    metrics.at("instr_test.metrics_histogram_count")[0].second, 1);
+}
+}
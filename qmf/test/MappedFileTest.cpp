@@ -0,0 +1,54 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <dirent.h>
+
+#include <cstring>
+#include <string>
+
+#include <qmf/utils/MappedFile.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+size_t countFiles(const std::string& dir) {
+  size_t count = 0;
+  DIR* dp = ::opendir(dir.c_str());
+  while (dirent* entry = ::readdir(dp)) {
+    count += strncmp(entry->d_name, "qmf_factors_", 12) == 0;
+  }
+  ::closedir(dp);
+  return count;
+}
+}
+
+TEST(MappedFile, create) {
+  const size_t bytes = (8 << 20) + 3;
+  const size_t files = countFiles("/tmp");
+  auto file = MappedFile::create("/tmp", bytes);
+  ASSERT_NE(file, nullptr);
+  EXPECT_EQ(file->size(), bytes);
+  // unlinked at once
+  EXPECT_EQ(countFiles("/tmp"), files);
+
+  char* data = static_cast<char*>(file->data());
+  EXPECT_EQ(data[0], 0);
+  EXPECT_EQ(data[bytes - 1], 0);
+  memset(data + 4096, 'x', 8192);
+  file->prefetch(0, bytes);
+  file->prefetch(5000, 1);
+  file->prefetch(bytes - 1, 100);
+  file->prefetch(bytes, 100);
+  EXPECT_EQ(data[4096 + 8191], 'x');
+  EXPECT_EQ(data[4096 + 8192], 0);
+
+  EXPECT_EQ(MappedFile::create("/nonexistent/dir", bytes), nullptr);
+}
+}
@@ -114,3 +114,63 @@ TEST(Matrix, linearSolve) {
     EXPECT_NEAR(b(i), prod, 1e-8);
   }
 }
+
+TEST(Matrix, padRows) {
+  const size_t nrows = 5;
+  const size_t ncols = 10;
+  qmf::Matrix X(nrows, ncols, qmf::Matrix::Uninitialized(), true);
+  EXPECT_EQ(X.nrows(), nrows);
+  EXPECT_EQ(X.ncols(), ncols);
+  EXPECT_EQ(X.stride(), 16);
+  for (size_t i = 0; i < nrows; ++i) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(X.data(i)) % 64, 0);
+    for (size_t j = 0; j < ncols; ++j) {
+      X(i, j) = i * ncols + j;
+    }
+  }
+  for (size_t i = 0; i < nrows; ++i) {
+    EXPECT_EQ(X.data(i)[3], i * ncols + 3);
+  }
+
+  // the copies keep the layout, the results are not padded
+  qmf::Matrix C = X;
+  EXPECT_EQ(C.stride(), 16);
+  EXPECT_EQ(C(4, 9), 49);
+  qmf::Matrix T = X.transpose();
+  EXPECT_EQ(T.stride(), nrows);
+  EXPECT_EQ(T(9, 4), 49);
+
+  EXPECT_EQ(qmf::Matrix(3, 8, qmf::Matrix::Uninitialized(), true).stride(), 8);
+  EXPECT_EQ(qmf::Matrix(3, 10).stride(), 10);
+}
+
+TEST(Matrix, mapped) {
+  const size_t nrows = 1000;
+  const size_t ncols = 10;
+  qmf::Matrix X(nrows, ncols, "/tmp", true);
+  EXPECT_TRUE(X.mapped());
+  EXPECT_EQ(X.stride(), 16);
+  for (size_t i = 0; i < nrows; ++i) {
+    for (size_t j = 0; j < ncols; ++j) {
+      EXPECT_EQ(X(i, j), 0.0);
+      X(i, j) = i * ncols + j;
+    }
+  }
+  X.prefetchRows(100, 200);
+  X.prefetchRows(900, 2000);
+  EXPECT_EQ(X(999, 9), 9999);
+
+  // the copies are in memory, the moves keep the mapping
+  qmf::Matrix C = X;
+  EXPECT_FALSE(C.mapped());
+  EXPECT_EQ(C.stride(), 16);
+  EXPECT_EQ(C(500, 5), 5005);
+  qmf::Matrix M = std::move(X);
+  EXPECT_TRUE(M.mapped());
+  EXPECT_EQ(M(500, 5), 5005);
+  C = M;
+  EXPECT_FALSE(C.mapped());
+  EXPECT_EQ(C(999, 9), 9999);
+
+  EXPECT_DEATH(qmf::Matrix(3, 3, "/nonexistent/dir"), ".*");
+}
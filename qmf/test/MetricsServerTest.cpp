@@ -0,0 +1,111 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdio>
+#include <string>
+
+#include <distributed/common/MetricsServer.h>
+#include <distributed/common/NetStats.h>
+
+#include <gtest/gtest.h>
+
+using distributed::MetricsServer;
+
+namespace {
+
+// the output of the command, the curl installed is required
+std::string run(const std::string& command) {
+  std::string output;
+  FILE* fp = ::popen(command.c_str(), "r");
+  if (!fp) {
+    ADD_FAILURE() << "popen " << command << " failed";
+    return output;
+  }
+  char buff[4096];
+  size_t len = 0;
+  while ((len = ::fread(buff, 1, sizeof(buff), fp)) > 0) {
+    output.append(buff, len);
+  }
+  ::pclose(fp);
+  return output;
+}
+
+bool contains(const std::string& text, const std::string& line) {
+  return text.find(line) != std::string::npos;
+}
+}
+
+TEST(MetricsServer, metricName) {
+  EXPECT_EQ(MetricsServer::metric_name("scheduler.handle.calc_rsp"),
+            "qmf_scheduler_handle_calc_rsp");
+  EXPECT_EQ(MetricsServer::metric_name("a-b c"), "qmf_a_b_c");
+}
+
+TEST(MetricsServer, render) {
+  const qmf::Counter counter("test.server_counter");
+  const qmf::Histogram histogram("test.server_histogram");
+  qmf::Instrumentation::get().reset();
+  counter.add(5);
+  histogram.recordSeconds(0.5);
+
+  distributed::Head head(distributed::OpCode::kCalc);
+  head.length = 100;
+  distributed::NetStats::sent(head);
+
+  MetricsServer server("127.0.0.1", 0,
+                       [](const qmf::Instrumentation::Snapshot&,
+                          std::string* out) {
+                         MetricsServer::append_gauge(out, "qmf_test_gauge",
+                                                     "A test gauge.", 0.25);
+                       });
+  const std::string text = server.render();
+
+  EXPECT_TRUE(contains(text, "# TYPE qmf_test_server_counter_total counter\n"
+                             "qmf_test_server_counter_total 5\n"));
+  EXPECT_TRUE(contains(text, "# TYPE qmf_test_server_histogram_seconds "
+                             "summary\n"));
+  EXPECT_TRUE(contains(
+    text, "qmf_test_server_histogram_seconds{quantile=\"0.5\"} 0.5\n"));
+  EXPECT_TRUE(contains(text, "qmf_test_server_histogram_seconds_sum 0.5\n"));
+  EXPECT_TRUE(contains(text, "qmf_test_server_histogram_seconds_count 1\n"));
+  EXPECT_TRUE(contains(text, "qmf_net_sent_messages_calc_total 1\n"));
+  EXPECT_TRUE(
+    contains(text, "qmf_net_sent_bytes_calc_total " +
+                     std::to_string(distributed::kHeadSize + 100) + "\n"));
+  EXPECT_TRUE(contains(text, "# TYPE process_resident_memory_bytes gauge\n"));
+  EXPECT_TRUE(contains(text, "# TYPE qmf_test_gauge gauge\n"
+                             "qmf_test_gauge 0.25\n"));
+  EXPECT_FALSE(contains(text, "process_resident_memory_bytes 0\n"));
+}
+
+TEST(MetricsServer, curl) {
+  const qmf::Counter counter("test.curl_counter");
+  qmf::Instrumentation::get().reset();
+  counter.add(42);
+
+  MetricsServer server("127.0.0.1", 0, nullptr);
+  ASSERT_TRUE(server.start());
+  ASSERT_GT(server.port(), 0);
+  const std::string url =
+    "http://127.0.0.1:" + std::to_string(server.port());
+
+  const std::string text = run("curl -s " + url + "/metrics");
+  EXPECT_TRUE(contains(text, "qmf_test_curl_counter_total 42\n"));
+  EXPECT_TRUE(contains(text, "# TYPE process_cpu_seconds_total counter\n"));
+
+  EXPECT_EQ(run("curl -s -o /dev/null -w '%{http_code}' " + url + "/metrics"),
+            "200");
+  EXPECT_EQ(run("curl -s -o /dev/null -w '%{http_code}' " + url + "/other"),
+            "404");
+  EXPECT_EQ(
+    run("curl -s -o /dev/null -w '%{http_code}' -X POST " + url + "/metrics"),
+    "405");
+
+  server.stop();
+  EXPECT_EQ(run("curl -s -o /dev/null -w '%{http_code}' " + url + "/metrics"),
+            "000");
+}
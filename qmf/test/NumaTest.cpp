@@ -0,0 +1,48 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sched.h>
+
+#include <thread>
+#include <vector>
+
+#include <qmf/utils/Numa.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+TEST(NumaTopology, parseCpuList) {
+  EXPECT_EQ(NumaTopology::parseCpuList("0"), std::vector<int>({0}));
+  EXPECT_EQ(NumaTopology::parseCpuList("0-3,8-9,12\n"),
+            std::vector<int>({0, 1, 2, 3, 8, 9, 12}));
+  EXPECT_TRUE(NumaTopology::parseCpuList("").empty());
+}
+
+TEST(NumaTopology, get) {
+  const NumaTopology& topology = NumaTopology::get();
+  ASSERT_GT(topology.nnodes(), 0);
+  for (size_t node = 0; node < topology.nnodes(); ++node) {
+    EXPECT_FALSE(topology.cpus(node).empty());
+  }
+}
+
+TEST(NumaTopology, bindThread) {
+  const NumaTopology& topology = NumaTopology::get();
+  std::thread thread([&topology]() {
+    ASSERT_TRUE(topology.bindThread(0));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(set), &set), 0);
+    EXPECT_EQ(CPU_COUNT(&set), topology.cpus(0).size());
+    for (const int cpu : topology.cpus(0)) {
+      EXPECT_TRUE(CPU_ISSET(cpu, &set));
+    }
+  });
+  thread.join();
+}
+}
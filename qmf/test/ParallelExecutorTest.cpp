@@ -15,6 +15,8 @@
  */
 
 #include <functional>
+#include <set>
+#include <thread>
 #include <vector>
 #include <utility>
 
@@ -61,3 +63,47 @@ TEST(ParallelExecutor, mapReduceElems) {
   }, std::plus<int>(), 0);
   EXPECT_EQ(sum, (ntasks - 1) * ntasks * (2 * ntasks - 1) / 6);
 }
+
+TEST(ParallelExecutor, numa) {
+  const size_t nthreads = 5;
+  const size_t ntasks = 1000;
+  // two nodes of the first cpu, 3 and 2 threads
+  const qmf::NumaTopology topology({{0}, {0}});
+  qmf::ParallelExecutor parallel(nthreads, topology);
+  EXPECT_EQ(parallel.nthreads(), nthreads);
+
+  std::vector<std::thread::id> executed(ntasks);
+  parallel.execute(ntasks, [&executed](const size_t taskId) {
+    executed[taskId] = std::this_thread::get_id();
+  });
+  std::vector<std::thread::id> mapped(ntasks);
+  const int sum = parallel.mapReduce(ntasks, [&mapped](const size_t taskId) {
+    mapped[taskId] = std::this_thread::get_id();
+    return taskId * taskId;
+  }, std::plus<int>(), 0);
+  EXPECT_EQ(sum, (ntasks - 1) * ntasks * (2 * ntasks - 1) / 6);
+
+  // the first 3/5 of the tasks run on the threads of the first node, the
+  // others on the threads of the second one
+  const size_t split = ntasks * 3 / nthreads;
+  std::set<std::thread::id> first, second;
+  for (size_t taskId = 0; taskId < ntasks; ++taskId) {
+    auto& ids = taskId < split ? first : second;
+    ids.insert(executed[taskId]);
+    ids.insert(mapped[taskId]);
+  }
+  EXPECT_LE(first.size(), 3);
+  EXPECT_LE(second.size(), 2);
+  for (const auto& id : second) {
+    EXPECT_EQ(first.count(id), 0);
+  }
+
+  std::vector<std::pair<int, int>> elems;
+  for (size_t i = 0; i < ntasks; ++i) {
+    elems.emplace_back(i, i);
+  }
+  const int elemSum = parallel.mapReduce(elems, [](const auto& p) {
+    return p.first * p.second;
+  }, std::plus<int>(), 0);
+  EXPECT_EQ(elemSum, (ntasks - 1) * ntasks * (2 * ntasks - 1) / 6);
+}
@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+#include <qmf/wals/SignalMatrix.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+using Grouped = std::map<int64_t, std::vector<std::pair<int64_t, Double>>>;
+
+void expectGrouped(const SignalMatrix& signals,
+                   const IdIndex& index,
+                   const Grouped& expected) {
+  ASSERT_EQ(signals.size(), expected.size());
+  ASSERT_EQ(index.size(), expected.size());
+  size_t i = 0;
+  for (const auto& p : expected) {
+    const SignalGroup group = signals[i];
+    EXPECT_EQ(group.sourceId, p.first);
+    EXPECT_EQ(index.idx(p.first), i);
+    ASSERT_EQ(group.group.size(), p.second.size());
+    for (size_t j = 0; j < p.second.size(); ++j) {
+      EXPECT_EQ(group.group[j].id, p.second[j].first);
+      EXPECT_EQ(group.group[j].value, p.second[j].second);
+    }
+    ++i;
+  }
+}
+}
+
+TEST(SignalMatrix, build) {
+  // skewed ids, much more elems than threads and buckets
+  std::mt19937 gen(7);
+  std::vector<DatasetElem> dataset;
+  Grouped byUser;
+  Grouped byItem;
+  for (size_t i = 0; i < 50000; ++i) {
+    const int64_t userId = static_cast<int64_t>(gen() % 3000) - 1000;
+    const int64_t itemId = static_cast<int64_t>(gen() % 100) *
+                           static_cast<int64_t>(gen() % 100);
+    const Double value = gen() % 5;
+    dataset.push_back({userId, itemId, value});
+    byUser[userId].emplace_back(itemId, value);
+    byItem[itemId].emplace_back(userId, value);
+  }
+  for (auto* grouped : {&byUser, &byItem}) {
+    for (auto& p : *grouped) {
+      std::sort(p.second.begin(), p.second.end());
+    }
+  }
+
+  for (const size_t nthreads : {1, 3, 8}) {
+    ParallelExecutor parallel(nthreads);
+    IdIndex userIndex;
+    IdIndex itemIndex;
+    SignalMatrix userSignals;
+    SignalMatrix itemSignals;
+    SignalMatrix::build(
+      dataset, userIndex, itemIndex, userSignals, itemSignals, parallel);
+    EXPECT_EQ(userSignals.nsignals(), dataset.size());
+    EXPECT_EQ(itemSignals.nsignals(), dataset.size());
+    expectGrouped(userSignals, userIndex, byUser);
+    expectGrouped(itemSignals, itemIndex, byItem);
+
+    // a copy owns its signals
+    SignalMatrix copy = userSignals;
+    userSignals.clear();
+    expectGrouped(copy, userIndex, byUser);
+  }
+}
+
+TEST(SignalMatrix, small) {
+  ParallelExecutor parallel(4);
+  IdIndex userIndex;
+  IdIndex itemIndex;
+  SignalMatrix userSignals;
+  SignalMatrix itemSignals;
+
+  // fewer elems than threads
+  SignalMatrix::build({{5, 7, 2.0}, {3, 7}}, userIndex, itemIndex,
+                      userSignals, itemSignals, parallel);
+  expectGrouped(userSignals, userIndex, {{3, {{7, 1.0}}}, {5, {{7, 2.0}}}});
+  expectGrouped(itemSignals, itemIndex, {{7, {{3, 1.0}, {5, 2.0}}}});
+
+  SignalMatrix::build(
+    {}, userIndex, itemIndex, userSignals, itemSignals, parallel);
+  EXPECT_TRUE(userSignals.empty());
+  EXPECT_TRUE(itemSignals.empty());
+  EXPECT_EQ(userIndex.size(), 0);
+}
+}
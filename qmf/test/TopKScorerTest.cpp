@@ -0,0 +1,124 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+#include <qmf/retrieval/TopKScorer.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+ScoredItems bruteForce(const FactorData& users,
+                       const size_t u,
+                       const FactorData& items,
+                       const std::set<size_t>& excluded,
+                       const size_t k) {
+  ScoredItems all;
+  for (size_t idx = 0; idx < items.nelems(); ++idx) {
+    if (excluded.count(idx)) {
+      continue;
+    }
+    Double score = items.biasAt(idx);
+    for (size_t fidx = 0; fidx < items.nfactors(); ++fidx) {
+      score += users.at(u, fidx) * items.at(idx, fidx);
+    }
+    all.emplace_back(score, idx);
+  }
+  std::sort(all.begin(), all.end(), [](const auto& x, const auto& y) {
+    return x.first > y.first || (x.first == y.first && x.second < y.second);
+  });
+  all.resize(std::min(k, all.size()));
+  return all;
+}
+}
+
+TEST(SeenItems, build) {
+  IdIndex userIndex;
+  IdIndex itemIndex;
+  for (int64_t id : {10, 20, 30}) {
+    userIndex.getOrSetIdx(id);
+    itemIndex.getOrSetIdx(id * 10);
+  }
+  const std::vector<DatasetElem> dataset = {
+    {20, 300}, {10, 200}, {20, 100}, {40, 100}, {10, 999}};
+  const SeenItems seen = SeenItems::build(dataset, userIndex, itemIndex);
+  EXPECT_EQ(seen.offsets, (std::vector<size_t>{0, 1, 3, 3}));
+  EXPECT_EQ(seen.items, (std::vector<size_t>{1, 0, 2}));
+}
+
+TEST(TopKScorer, score) {
+  // sizes not aligned to the blocks
+  const size_t nusers = TopKScorer::kUserBlock * 2 + 5;
+  const size_t nitems = TopKScorer::kItemBlock * 2 + 37;
+  const size_t nfactors = 7;
+  const size_t k = 20;
+
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  auto genUnif = [&](auto...) { return distr(gen); };
+
+  for (const bool withBiases : {false, true}) {
+    FactorData users(nusers, nfactors);
+    users.setFactors(genUnif);
+    FactorData items(nitems, nfactors, withBiases);
+    items.setFactors(genUnif);
+    if (withBiases) {
+      items.setBiases(genUnif);
+    }
+
+    // every user has seen some items, and a duplicate
+    IdIndex userIndex;
+    IdIndex itemIndex;
+    for (size_t i = 0; i < nitems; ++i) {
+      itemIndex.getOrSetIdx(i);
+    }
+    std::vector<DatasetElem> dataset;
+    std::vector<std::set<size_t>> excluded(nusers);
+    for (size_t u = 0; u < nusers; ++u) {
+      userIndex.getOrSetIdx(u);
+      for (size_t i = 0; i < 30; ++i) {
+        const size_t item = gen() % nitems;
+        dataset.push_back({static_cast<int64_t>(u), static_cast<int64_t>(item)});
+        excluded[u].insert(item);
+      }
+      dataset.push_back(dataset.back());
+    }
+    const SeenItems seen = SeenItems::build(dataset, userIndex, itemIndex);
+
+    TopKScorer scorer(items);
+    EXPECT_EQ(scorer.nitems(), nitems);
+
+    std::vector<ScoredItems> results;
+    const size_t start = 3;
+    scorer.score(users, start, nusers, k, &seen, &results);
+    ASSERT_EQ(results.size(), nusers - start);
+    for (size_t u = start; u < nusers; ++u) {
+      const ScoredItems expected =
+        bruteForce(users, u, items, excluded[u], k);
+      ASSERT_EQ(results[u - start].size(), k);
+      for (size_t i = 0; i < k; ++i) {
+        EXPECT_EQ(results[u - start][i].second, expected[i].second);
+        EXPECT_NEAR(results[u - start][i].first, expected[i].first, 1e-9);
+      }
+    }
+
+    // without the exclusions, k larger than the items
+    scorer.score(users, 0, 1, nitems + 10, nullptr, &results);
+    ASSERT_EQ(results.size(), 1);
+    const ScoredItems expected = bruteForce(users, 0, items, {}, nitems);
+    ASSERT_EQ(results[0].size(), nitems);
+    for (size_t i = 0; i < nitems; ++i) {
+      EXPECT_EQ(results[0][i].second, expected[i].second);
+    }
+  }
+}
+}
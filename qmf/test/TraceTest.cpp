@@ -0,0 +1,115 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qmf/utils/Trace.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+std::vector<std::string> readLines(const std::string& fileName) {
+  std::ifstream in(fileName);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+size_t countLines(const std::vector<std::string>& lines,
+                  const std::string& pattern) {
+  size_t count = 0;
+  for (const auto& line : lines) {
+    count += line.find(pattern) != std::string::npos;
+  }
+  return count;
+}
+
+int64_t field(const std::string& line, const std::string& name) {
+  const size_t pos = line.find("\"" + name + "\":");
+  EXPECT_NE(pos, std::string::npos) << name << " not in " << line;
+  return std::stoll(line.substr(pos + name.size() + 3));
+}
+}
+
+TEST(Trace, disabled) {
+  Trace& trace = Trace::get();
+  ASSERT_FALSE(trace.enabled());
+  // nothing happens
+  trace.complete("test", "nothing", trace.now());
+  TraceScope scope("test", "nothing");
+  trace.close();
+}
+
+TEST(Trace, events) {
+  const std::string fileName = "/tmp/qmf_trace_test.json";
+  Trace& trace = Trace::get();
+  ASSERT_TRUE(trace.open(fileName, "trace \"test\""));
+  ASSERT_TRUE(trace.enabled());
+
+  trace.setClockOffset(-1000000);
+  const int64_t before = Trace::wallMicros() - 1000000;
+  {
+    TraceScope scope("test", "scope", "\"k\":1");
+  }
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&trace, t]() {
+      trace.nameThread("worker " + std::to_string(t));
+      for (size_t i = 0; i < 100; ++i) {
+        trace.async("test", "bucket", t * 100 + i, trace.now());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  trace.instant("test", "mark");
+  trace.setClockOffset(0);
+  trace.close();
+  EXPECT_FALSE(trace.enabled());
+
+  const auto lines = readLines(fileName);
+  ASSERT_GT(lines.size(), 2);
+  EXPECT_EQ(lines.front(), "[");
+  EXPECT_EQ(lines.back(), "]");
+  // every event but the last one is followed by a comma
+  for (size_t i = 1; i + 2 < lines.size(); ++i) {
+    EXPECT_EQ(lines[i].back(), ',') << lines[i];
+  }
+  EXPECT_EQ(lines[lines.size() - 2].back(), '}');
+
+  EXPECT_EQ(countLines(lines, "\"name\":\"trace \\\"test\\\"\""), 1);
+  EXPECT_EQ(countLines(lines, "\"thread_name\""), 4);
+  EXPECT_EQ(countLines(lines, "\"ph\":\"b\""), 400);
+  EXPECT_EQ(countLines(lines, "\"ph\":\"e\""), 400);
+  EXPECT_EQ(countLines(lines, "\"name\":\"mark\""), 1);
+
+  for (const auto& line : lines) {
+    if (line.find("\"name\":\"scope\"") == std::string::npos) {
+      continue;
+    }
+    EXPECT_NE(line.find("\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(line.find("\"args\":{\"k\":1}"), std::string::npos);
+    // shifted by the offset
+    EXPECT_GE(field(line, "ts"), before);
+    EXPECT_LT(field(line, "ts"), before + 60 * 1000000LL);
+    EXPECT_GE(field(line, "dur"), 0);
+  }
+  std::remove(fileName.c_str());
+}
+}
@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
-#include <random>
+#include <unistd.h>
+
+#include <fstream>
 
 #include <qmf/wals/WALSEngine.h>
 
@@ -109,98 +111,90 @@ TEST(WALSEngine, initTest) {
   EXPECT_DEATH(engine.initTest(testDataset), ".*");
 }
 
-TEST(WALSEngine, computeXtX) {
-  const std::vector<size_t> nthreadsTests {1, 2, 3, 5, 7, 8, 10, 16, 32};
-  const size_t nfactors = 5;
-  const size_t n = 17;
-  for (size_t nthreads : nthreadsTests) {
-    WALSConfig config;
-    config.nfactors = nfactors;
-    WALSEngine engine(config, kNullMetricEngine, nthreads);
-
-    std::mt19937 gen(123);
-    std::uniform_real_distribution<Double> distr(-1.0, 1.0);
-    Matrix X(n, nfactors);
-    for (size_t i = 0; i < n; ++i) {
-      for (size_t j = 0; j < nfactors; ++j) {
-        X(i, j) = distr(gen);
-      }
-    }
-
-    Matrix XtX = engine.computeXtX(X);
-    EXPECT_EQ(XtX.nrows(), nfactors);
-    EXPECT_EQ(XtX.ncols(), nfactors);
-    for (size_t i = 0; i < nfactors; ++i) {
-      for (size_t j = 0; j < nfactors; ++j) {
-        Double value = 0.0;
-        for (size_t k = 0; k < n; ++k) {
-          value += X(k, i) * X(k, j);
-        }
-        EXPECT_NEAR(XtX(i, j), value, 1e-8);
-      }
-    }
+TEST(WALSEngine, warmStart) {
+  // item 3 is unseen, item 9 is gone
+  const std::string fileName = "/tmp/WALSEngineTest.warmStart";
+  {
+    std::ofstream fout(fileName);
+    fout << "2 0.5 -0.5\n"
+         << "9 1.0 1.0\n"
+         << "1 0.25 0.75\n";
   }
-}
 
-TEST(WALSEngine, updateFactorsForOne) {
-  const size_t nusers = 3;
-  const size_t nitems = 2;
-  const size_t nfactors = 3;
+  WALSConfig config;
+  config.nfactors = 2;
+  config.initDistributionBound = 0.01;
+  config.warmStartItemFactors = fileName;
+  WALSEngine engine(config, kNullMetricEngine, 2);
 
-  Matrix X(nusers, nfactors);
-  Matrix Y(nitems, nfactors);
-  for (size_t i = 0; i < nitems; ++i) {
-    for (size_t j = 0; j < nfactors; ++j) {
-      Y(i, j) = 0.1;
-    }
-  }
+  std::vector<DatasetElem> dataset = {{1, 1}, {1, 2}, {2, 3}};
+  engine.init(dataset);
+  ::unlink(fileName.c_str());
+
+  const auto& itemIndex = engine.itemIndex_;
+  const auto& itemFactors = *engine.itemFactors_;
+  EXPECT_EQ(itemFactors.at(itemIndex.idx(1), 0), 0.25);
+  EXPECT_EQ(itemFactors.at(itemIndex.idx(1), 1), 0.75);
+  EXPECT_EQ(itemFactors.at(itemIndex.idx(2), 0), 0.5);
+  EXPECT_EQ(itemFactors.at(itemIndex.idx(2), 1), -0.5);
+  EXPECT_LE(std::abs(itemFactors.at(itemIndex.idx(3), 0)), 0.01);
+  EXPECT_LE(std::abs(itemFactors.at(itemIndex.idx(3), 1)), 0.01);
+
+  // the file is removed. the engine is created in the death test child, the
+  // threads of its pool are not forked
+  EXPECT_DEATH(
+    {
+      WALSEngine missing(config, kNullMetricEngine, 2);
+      missing.init(dataset);
+    },
+    ".*");
+}
 
-  IdIndex userIndex;
-  for (size_t i = 0; i < nusers; ++i) {
-    userIndex.getOrSetIdx(static_cast<int64_t>(i));
-  }
-  IdIndex itemIndex;
-  for (size_t i = 0; i < nitems; ++i) {
-    itemIndex.getOrSetIdx(static_cast<int64_t>(i));
-  }
-  Matrix YtY(nfactors, nfactors);
-  for (size_t i = 0; i < nfactors; ++i) {
-    for (size_t j = 0; j < nfactors; ++j) {
-      for (size_t k = 0; k < nitems; ++k) {
-        YtY(i, j) += Y(k, i) * Y(k, j);
-      }
+TEST(WALSEngine, mappedFactors) {
+  const std::string fileName = "/tmp/qmf_wals_mapped_items.txt";
+  {
+    std::ofstream fout(fileName);
+    for (size_t item = 1; item <= 4; ++item) {
+      fout << item << " " << 0.1 * item << " " << -0.05 * item << "\n";
     }
   }
 
-  WALSEngine::SignalGroup signalGroup{0, {{0, 1.0}, {1, 1.0}}};
-
-  const Double loss = WALSEngine::updateFactorsForOne(
-    X, userIndex, Y, itemIndex, signalGroup, YtY, 1.0, 1.0);
-
-  for (size_t i = 0; i < nfactors; ++i) {
-    EXPECT_NEAR(X(0, i), 0.357, 1e-2);
-  }
+  WALSConfig config;
+  config.nepochs = 3;
+  config.nfactors = 2;
+  config.regularizationLambda = 0.05;
+  config.confidenceWeight = 40;
+  config.initDistributionBound = 0.01;
+  config.warmStartItemFactors = fileName;
+  std::vector<DatasetElem> dataset = {
+    {1, 1}, {1, 2}, {1, 3}, {2, 1}, {2, 3}, {3, 4}};
 
-  for (size_t i = 1; i < nusers; ++i) {
-    for (size_t j = 0; j < nfactors; ++j) {
-      EXPECT_NEAR(X(i, j), 0.0, 1e-8);
+  WALSEngine engine(config, kNullMetricEngine, 2);
+  engine.init(dataset);
+  engine.optimize();
+
+  WALSConfig mappedConfig = config;
+  mappedConfig.factorDir = "/tmp";
+  WALSEngine mapped(mappedConfig, kNullMetricEngine, 2);
+  mapped.init(dataset);
+  ::unlink(fileName.c_str());
+  EXPECT_TRUE(mapped.userFactors_->getFactors().mapped());
+  EXPECT_TRUE(mapped.itemFactors_->getFactors().mapped());
+  mapped.optimize();
+
+  // the same solution as in memory
+  EXPECT_DOUBLE_EQ(mapped.loss(), engine.loss());
+  for (size_t idx = 0; idx < engine.nusers(); ++idx) {
+    for (size_t fidx = 0; fidx < config.nfactors; ++fidx) {
+      EXPECT_DOUBLE_EQ(mapped.userFactors_->at(idx, fidx),
+                       engine.userFactors_->at(idx, fidx));
     }
   }
-
-  Double trueLoss = 0.0;
-  for (size_t i = 0; i < nusers; ++i) {
-    for (size_t j = 0; j < nitems; ++j) {
-      Double pred = 0.0;
-      for (size_t k = 0; k < nfactors; ++k) {
-        pred += X(i, k) * Y(j, k);
-      }
-      if (i == 0) { // both items liked for this user
-        trueLoss += 2.0 * (1.0 - pred) * (1.0 - pred);
-      } else {
-        trueLoss += (0.0 - pred) * (0.0 - pred);
-      }
+  for (size_t idx = 0; idx < engine.nitems(); ++idx) {
+    for (size_t fidx = 0; fidx < config.nfactors; ++fidx) {
+      EXPECT_DOUBLE_EQ(mapped.itemFactors_->at(idx, fidx),
+                       engine.itemFactors_->at(idx, fidx));
     }
   }
-  EXPECT_NEAR(loss, trueLoss, 1e-2);
 }
 }
@@ -0,0 +1,140 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <random>
+
+#include <qmf/wals/WALSFoldIn.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+void randomFactors(FactorData& factorData, IdIndex& index) {
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  factorData.setFactors([&](auto...) { return distr(gen); });
+  for (size_t i = 0; i < factorData.nelems(); ++i) {
+    index.getOrSetIdx(static_cast<int64_t>(i * 10));
+  }
+}
+}
+
+TEST(WALSFoldIn, computeYtY) {
+  const size_t nitems = 17;
+  const size_t nfactors = 5;
+  FactorData itemFactors(nitems, nfactors);
+  IdIndex itemIndex;
+  randomFactors(itemFactors, itemIndex);
+
+  const Matrix YtY = WALSFoldIn::computeYtY(itemFactors);
+  for (size_t i = 0; i < nfactors; ++i) {
+    for (size_t j = 0; j < nfactors; ++j) {
+      Double value = 0.0;
+      for (size_t k = 0; k < nitems; ++k) {
+        value += itemFactors.at(k, i) * itemFactors.at(k, j);
+      }
+      EXPECT_NEAR(YtY(i, j), value, 1e-8);
+    }
+  }
+}
+
+TEST(WALSFoldIn, solve) {
+  // the same case of WALSSolver.solveRow
+  const size_t nitems = 2;
+  const size_t nfactors = 3;
+  FactorData itemFactors(nitems, nfactors);
+  itemFactors.setFactors([](auto...) { return 0.1; });
+  IdIndex itemIndex;
+  itemIndex.getOrSetIdx(0);
+  itemIndex.getOrSetIdx(1);
+
+  const Matrix YtY = WALSFoldIn::computeYtY(itemFactors);
+  WALSFoldIn foldIn(itemFactors, itemIndex, YtY, 1.0, 1.0);
+
+  Double x[nfactors];
+  foldIn.solve({0, 1}, {1.0, 1.0}, x);
+  for (size_t i = 0; i < nfactors; ++i) {
+    EXPECT_NEAR(x[i], 0.357, 1e-2);
+  }
+
+  // satisfies (YtY + Yt(C - I)Y + lambda * I) x = YtCp
+  FactorData randomItems(7, nfactors);
+  IdIndex randomIndex;
+  randomFactors(randomItems, randomIndex);
+  const Double alpha = 40.0;
+  const Double lambda = 0.05;
+  const Matrix randomYtY = WALSFoldIn::computeYtY(randomItems);
+  WALSFoldIn randomFoldIn(randomItems, randomIndex, randomYtY, alpha, lambda);
+
+  const std::vector<size_t> items = {1, 4, 6};
+  const std::vector<Double> values = {1.0, 2.0, 0.5};
+  randomFoldIn.solve(items, values, x);
+  for (size_t i = 0; i < nfactors; ++i) {
+    Double lhs = lambda * x[i];
+    Double rhs = 0.0;
+    for (size_t j = 0; j < nfactors; ++j) {
+      lhs += randomYtY(i, j) * x[j];
+    }
+    for (size_t k = 0; k < items.size(); ++k) {
+      Double pred = 0.0;
+      for (size_t j = 0; j < nfactors; ++j) {
+        pred += randomItems.at(items[k], j) * x[j];
+      }
+      lhs += randomItems.at(items[k], i) * alpha * values[k] * pred;
+      rhs += randomItems.at(items[k], i) * (1.0 + alpha * values[k]);
+    }
+    EXPECT_NEAR(lhs, rhs, 1e-6);
+  }
+}
+
+TEST(WALSFoldIn, foldIn) {
+  const size_t nitems = 9;
+  const size_t nfactors = 4;
+  FactorData itemFactors(nitems, nfactors);
+  IdIndex itemIndex;
+  randomFactors(itemFactors, itemIndex);
+
+  ParallelExecutor parallel(3);
+  const Matrix YtY = WALSFoldIn::computeYtY(itemFactors);
+  WALSFoldIn foldIn(itemFactors, itemIndex, YtY, 10.0, 0.1);
+
+  // item 5 is unknown, user 8 only has the unknown item
+  const std::vector<DatasetElem> batch = {
+    {7, 10, 1.0}, {3, 0, 2.0}, {7, 5, 1.0}, {8, 5, 1.0}, {7, 30, 3.0}};
+
+  IdIndex userIndex;
+  std::unique_ptr<FactorData> userFactors;
+  size_t ignored = 0;
+  foldIn.foldIn(batch, userIndex, userFactors, parallel, &ignored);
+
+  EXPECT_EQ(ignored, 2);
+  ASSERT_EQ(userIndex.size(), 3);
+  EXPECT_EQ(userIndex.id(0), 7);
+  EXPECT_EQ(userIndex.id(1), 3);
+  EXPECT_EQ(userIndex.id(2), 8);
+  ASSERT_EQ(userFactors->nelems(), 3);
+  EXPECT_EQ(userFactors->nfactors(), nfactors);
+
+  Double x[nfactors];
+  foldIn.solve({1, 3}, {1.0, 3.0}, x);
+  for (size_t i = 0; i < nfactors; ++i) {
+    EXPECT_DOUBLE_EQ(userFactors->at(0, i), x[i]);
+  }
+  foldIn.solve({0}, {2.0}, x);
+  for (size_t i = 0; i < nfactors; ++i) {
+    EXPECT_DOUBLE_EQ(userFactors->at(1, i), x[i]);
+    EXPECT_EQ(userFactors->at(2, i), 0.0);
+  }
+
+  // index and factors are reset by the next batch
+  foldIn.foldIn({{5, 20, 1.0}}, userIndex, userFactors, parallel);
+  EXPECT_EQ(userIndex.size(), 1);
+  EXPECT_EQ(userFactors->nelems(), 1);
+}
+}
@@ -0,0 +1,202 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cmath>
+#include <thread>
+
+#include <qmf/wals/WALSFoldIn.h>
+#include <qmf/wals/WALSOnline.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+WALSConfig onlineConfig() {
+  WALSConfig config;
+  config.nepochs = 3;
+  config.nfactors = 4;
+  config.regularizationLambda = 0.05;
+  config.confidenceWeight = 10;
+  config.initDistributionBound = 0.1;
+  return config;
+}
+
+std::vector<Double> row(const SnapshotFactors& factors, const size_t idx) {
+  std::vector<Double> result;
+  for (size_t fidx = 0; fidx < factors.nfactors(); ++fidx) {
+    result.push_back(factors.at(idx, fidx));
+  }
+  return result;
+}
+
+FactorData toFactorData(const SnapshotFactors& factors) {
+  FactorData result(factors.nelems(), factors.nfactors());
+  result.setFactors(
+    [&factors](size_t idx, size_t fidx) { return factors.at(idx, fidx); });
+  return result;
+}
+}
+
+TEST(WALSOnline, update) {
+  const WALSConfig config = onlineConfig();
+  WALSOnline online(config, 3);
+
+  std::vector<DatasetElem> dataset;
+  for (int64_t user = 0; user < 20; ++user) {
+    for (int64_t item = user % 3; item < 10; item += 3) {
+      dataset.push_back({user, item, 1.0});
+    }
+  }
+  online.init(dataset);
+
+  const auto before = online.snapshot();
+  ASSERT_TRUE(before != nullptr);
+  EXPECT_EQ(before->version, 0);
+  EXPECT_EQ(before->userIndex->size(), 20);
+  EXPECT_EQ(before->itemIndex->size(), 10);
+
+  // nothing queued
+  EXPECT_EQ(online.update(), 0);
+  EXPECT_EQ(online.snapshot(), before);
+
+  // a new user of the known items
+  online.append({{100, 1, 2.0}, {100, 4, 1.0}});
+  EXPECT_EQ(online.update(), 1 + 2);
+
+  const auto after = online.snapshot();
+  EXPECT_EQ(after->version, 1);
+  ASSERT_EQ(after->userIndex->size(), 21);
+  EXPECT_EQ(after->userIndex->id(20), 100);
+
+  // the previous snapshot is untouched
+  EXPECT_EQ(before->userIndex->size(), 20);
+
+  // the new user is solved against the previous items, as fold-in does
+  ParallelExecutor parallel(2);
+  const FactorData itemFactors = toFactorData(before->itemFactors);
+  const Matrix YtY = WALSFoldIn::computeYtY(itemFactors);
+  WALSFoldIn foldIn(itemFactors, *before->itemIndex, YtY,
+                    config.confidenceWeight, config.regularizationLambda);
+  IdIndex userIndex;
+  std::unique_ptr<FactorData> userFactors;
+  foldIn.foldIn({{100, 1, 2.0}, {100, 4, 1.0}}, userIndex, userFactors,
+                parallel);
+  for (size_t fidx = 0; fidx < config.nfactors; ++fidx) {
+    EXPECT_NEAR(after->userFactors.at(20, fidx), userFactors->at(0, fidx),
+                1e-9);
+  }
+
+  // a new item of a known user
+  online.append({{5, 200, 1.0}});
+  EXPECT_EQ(online.update(), 1 + 1);
+  const auto added = online.snapshot();
+  ASSERT_EQ(added->itemIndex->size(), 11);
+  EXPECT_EQ(added->itemIndex->id(10), 200);
+
+  // the users untouched keep their factors
+  for (size_t idx = 0; idx < 21; ++idx) {
+    if (idx != 5) {
+      EXPECT_EQ(row(added->userFactors, idx), row(after->userFactors, idx));
+    }
+  }
+
+  // the value of an existing pair is accumulated
+  online.append({{100, 1, 1.0}});
+  EXPECT_EQ(online.update(), 2);
+  EXPECT_EQ(online.snapshot()->userIndex->size(), 21);
+  EXPECT_EQ(online.snapshot()->version, 3);
+}
+
+TEST(WALSOnline, grow) {
+  const WALSConfig config = onlineConfig();
+  WALSOnline online(config, 2);
+  online.init({{1, 1, 1.0}, {2, 2, 1.0}});
+
+  // many new rows with the factors storage grown several times
+  for (int64_t round = 0; round < 5; ++round) {
+    std::vector<DatasetElem> events;
+    for (int64_t i = 0; i < 50; ++i) {
+      events.push_back({1000 + round * 50 + i, i % 7, 1.0});
+    }
+    online.append(events);
+    online.update();
+  }
+
+  const auto snapshot = online.snapshot();
+  EXPECT_EQ(snapshot->version, 5);
+  EXPECT_EQ(snapshot->userIndex->size(), 2 + 250);
+  EXPECT_EQ(snapshot->userFactors.nelems(), 2 + 250);
+  EXPECT_EQ(snapshot->itemIndex->size(), 7);
+  EXPECT_EQ(snapshot->itemFactors.nelems(), 7);
+  for (size_t idx = 0; idx < snapshot->userFactors.nelems(); ++idx) {
+    for (size_t fidx = 0; fidx < config.nfactors; ++fidx) {
+      EXPECT_TRUE(std::isfinite(snapshot->userFactors.at(idx, fidx)));
+    }
+  }
+}
+
+TEST(WALSOnline, shareBlocks) {
+  const WALSConfig config = onlineConfig();
+  WALSOnline online(config, 2);
+
+  const size_t nusers = SnapshotFactors::kBlockRows * 2 + 10;
+  std::vector<DatasetElem> dataset;
+  for (int64_t user = 0; user < static_cast<int64_t>(nusers); ++user) {
+    dataset.push_back({user, user % 5, 1.0});
+  }
+  online.init(dataset);
+  const auto before = online.snapshot();
+
+  // a known pair, only the block of the user is copied
+  online.append({{5, 0, 1.0}});
+  online.update();
+  const auto after = online.snapshot();
+  EXPECT_EQ(after->userIndex, before->userIndex);
+  EXPECT_EQ(after->itemIndex, before->itemIndex);
+  EXPECT_FALSE(after->userFactors.sharesBlock(before->userFactors, 5));
+  EXPECT_TRUE(after->userFactors.sharesBlock(before->userFactors,
+                                             SnapshotFactors::kBlockRows));
+  EXPECT_TRUE(after->userFactors.sharesBlock(before->userFactors, nusers - 1));
+  EXPECT_NE(row(after->userFactors, 5), row(before->userFactors, 5));
+  EXPECT_EQ(row(after->userFactors, 6), row(before->userFactors, 6));
+
+  // a new user grows the index and the last block
+  online.append({{-1, 1, 1.0}});
+  online.update();
+  const auto grown = online.snapshot();
+  EXPECT_NE(grown->userIndex, after->userIndex);
+  EXPECT_EQ(after->userIndex->size(), nusers);
+  EXPECT_EQ(grown->userFactors.nelems(), nusers + 1);
+  EXPECT_TRUE(grown->userFactors.sharesBlock(after->userFactors, 5));
+  EXPECT_FALSE(grown->userFactors.sharesBlock(after->userFactors, nusers));
+  EXPECT_EQ(row(grown->userFactors, nusers - 1),
+            row(after->userFactors, nusers - 1));
+}
+
+TEST(WALSOnline, appendConcurrently) {
+  const WALSConfig config = onlineConfig();
+  WALSOnline online(config, 2);
+  online.init({{1, 1, 1.0}});
+
+  std::vector<std::thread> threads;
+  for (int64_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&online, t]() {
+      for (int64_t i = 0; i < 100; ++i) {
+        online.append({{10000 + t * 1000 + i, i % 5, 1.0}});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  online.update();
+  EXPECT_EQ(online.snapshot()->userIndex->size(), 1 + 400);
+}
+}
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <omp.h>
+
+#include <random>
+#include <vector>
+
+#include <qmf/wals/WALSSolver.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+Matrix randomMatrix(const size_t nrows, const size_t ncols) {
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  Matrix X(nrows, ncols);
+  for (size_t i = 0; i < nrows; ++i) {
+    for (size_t j = 0; j < ncols; ++j) {
+      X(i, j) = distr(gen);
+    }
+  }
+  return X;
+}
+}
+
+TEST(WALSSolver, computeXtX) {
+  const size_t nfactors = 5;
+  const size_t n = 17;
+  const Matrix X = randomMatrix(n, nfactors);
+  for (int nthreads : {1, 2, 3, 8, 32}) {
+    omp_set_num_threads(nthreads);
+
+    // the previous content is overwritten
+    Matrix XtX(nfactors, nfactors);
+    XtX(0, 0) = 100.0;
+    WALSSolver::computeXtX(X, &XtX);
+    for (size_t i = 0; i < nfactors; ++i) {
+      for (size_t j = 0; j < nfactors; ++j) {
+        Double value = 0.0;
+        for (size_t k = 0; k < n; ++k) {
+          value += X(k, i) * X(k, j);
+        }
+        EXPECT_NEAR(XtX(i, j), value, 1e-8);
+      }
+    }
+
+    // the pieces sum up to the whole
+    Matrix pieces(nfactors, nfactors);
+    WALSSolver::accumulateXtX(X, 0, 6, &pieces);
+    WALSSolver::accumulateXtX(X, 6, 7, &pieces);
+    WALSSolver::accumulateXtX(X, 7, n, &pieces);
+    for (size_t i = 0; i < nfactors; ++i) {
+      for (size_t j = 0; j < nfactors; ++j) {
+        EXPECT_NEAR(pieces(i, j), XtX(i, j), 1e-8);
+      }
+    }
+  }
+}
+
+TEST(WALSSolver, solveRow) {
+  const size_t nusers = 3;
+  const size_t nitems = 2;
+  const size_t nfactors = 3;
+
+  Matrix X(nusers, nfactors);
+  Matrix Y(nitems, nfactors);
+  for (size_t i = 0; i < nitems; ++i) {
+    for (size_t j = 0; j < nfactors; ++j) {
+      Y(i, j) = 0.1;
+    }
+  }
+
+  IdIndex itemIndex;
+  for (size_t i = 0; i < nitems; ++i) {
+    itemIndex.getOrSetIdx(static_cast<int64_t>(i));
+  }
+  Matrix YtY(nfactors, nfactors);
+  WALSSolver::computeXtX(Y, &YtY);
+
+  const Signal signals[] = {{0, 1.0}, {1, 1.0}};
+  const SignalGroup signalGroup{0, SignalSpan(signals, signals + 2)};
+
+  const Double loss = WALSSolver::solveRow(X.data(0), Y, YtY, itemIndex,
+                                           signalGroup, 1.0, 1.0);
+
+  for (size_t i = 0; i < nfactors; ++i) {
+    EXPECT_NEAR(X(0, i), 0.357, 1e-2);
+  }
+
+  for (size_t i = 1; i < nusers; ++i) {
+    for (size_t j = 0; j < nfactors; ++j) {
+      EXPECT_NEAR(X(i, j), 0.0, 1e-8);
+    }
+  }
+
+  Double trueLoss = 0.0;
+  for (size_t i = 0; i < nusers; ++i) {
+    for (size_t j = 0; j < nitems; ++j) {
+      Double pred = 0.0;
+      for (size_t k = 0; k < nfactors; ++k) {
+        pred += X(i, k) * Y(j, k);
+      }
+      if (i == 0) { // both items liked for this user
+        trueLoss += 2.0 * (1.0 - pred) * (1.0 - pred);
+      } else {
+        trueLoss += (0.0 - pred) * (0.0 - pred);
+      }
+    }
+  }
+  EXPECT_NEAR(loss, trueLoss, 1e-2);
+
+  // the row indexes give the same row
+  Double result[nfactors];
+  EXPECT_DOUBLE_EQ(
+    WALSSolver::solveRow(result, Y, YtY, {0, 1}, {1.0, 1.0}, 1.0, 1.0), loss);
+  for (size_t i = 0; i < nfactors; ++i) {
+    EXPECT_DOUBLE_EQ(result[i], X(0, i));
+  }
+}
+}
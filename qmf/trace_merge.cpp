@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fstream>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 合并 wals_scheduler / wals_labor 的 --trace_file 写出的 trace 为一个文件，
+ * 在 chrome://tracing 或 Perfetto 中打开即是整个集群的一条时间线。Labor 的
+ * 时间戳在记录时已经校正到 Scheduler 的时钟，这里只是拼接事件，被 kill 的
+ * 进程写出的不完整文件也可以合并。
+ *
+ *   trace_merge --output=all.json scheduler.json labor1.json labor2.json
+ */
+
+DEFINE_string(output, "trace.json", "the merged trace");
+
+namespace {
+
+// the trace files has one event per line, see qmf/utils/Trace.h
+bool appendEvents(const std::string& fileName,
+                  std::ofstream& out,
+                  size_t& nevents) {
+  std::ifstream in(fileName);
+  if (!in) {
+    LOG(ERROR) << "can not open " << fileName;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] != '{') {
+      continue;
+    }
+    if (line.back() == ',') {
+      line.pop_back();
+    }
+    // the last line of a killed process may be cut
+    if (line.back() != '}') {
+      LOG(WARNING) << "skip the truncated event in " << fileName;
+      continue;
+    }
+    out << (nevents++ ? ",\n" : "") << line;
+  }
+  return true;
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("trace_merge --output=<file> <trace files ...>");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK_GT(argc, 1) << "no trace files to merge";
+  std::ofstream out(FLAGS_output);
+  CHECK(out) << "can not open " << FLAGS_output;
+
+  out << "[\n";
+  size_t nevents = 0;
+  for (int i = 1; i < argc; ++i) {
+    CHECK(appendEvents(argv[i], out, nevents));
+  }
+  out << "\n]\n";
+  out.close();
+  CHECK(out) << "write " << FLAGS_output << " failed";
+
+  LOG(INFO) << "merged " << nevents << " events of " << argc - 1
+            << " files to " << FLAGS_output;
+  return 0;
+}
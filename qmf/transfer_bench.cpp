@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <distributed/common/Message.h>
+#include <distributed/common/NetUtil.h>
+#include <distributed/common/RecvOps.h>
+#include <distributed/common/SendOps.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 测量loopback下bulk传输的吞吐量，对比原来的 write 循环和新增的
+ * writev / MSG_ZEROCOPY / sendfile / splice 传输路径
+ */
+
+DEFINE_uint64(size_mb, 512, "payload size of each message in MB");
+DEFINE_uint64(rounds, 5, "messages sent for each method");
+DEFINE_string(tmpfile, "/tmp/transfer_bench.dat", "file used by sendfile");
+
+using namespace distributed;
+
+namespace {
+
+enum class Method {
+  kLegacy,   // Head and body with two write loops, received into buffer
+  kWritev,   // Head and body coalesced with writev
+  kZeroCopy, // body sent with MSG_ZEROCOPY
+  kSendFile, // body sent from page cache with sendfile
+  kDropRead, // writev, receiver drops with read into buffer
+  kDropSplice, // writev, receiver drops with splice to /dev/null
+};
+
+const char* method_name(Method method) {
+  switch (method) {
+  case Method::kLegacy:
+    return "legacy write";
+  case Method::kWritev:
+    return "writev";
+  case Method::kZeroCopy:
+    return "MSG_ZEROCOPY";
+  case Method::kSendFile:
+    return "sendfile";
+  case Method::kDropRead:
+    return "drop by read";
+  case Method::kDropSplice:
+    return "drop by splice";
+  }
+  return "unknown";
+}
+
+// returns the connected (sender, receiver) pair over loopback
+bool connect_pair(int* sender, int* receiver) {
+
+  int listenfd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  socklen_t len = sizeof(addr);
+  if (::bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      ::listen(listenfd, 1) < 0 ||
+      ::getsockname(listenfd, (struct sockaddr*)&addr, &len) < 0) {
+    LOG(ERROR) << "listen on loopback failed: " << strerror(errno);
+    ::close(listenfd);
+    return false;
+  }
+
+  *sender = ::socket(AF_INET, SOCK_STREAM, 0);
+  NetUtil::optimize_send_recv_buff(*sender);
+  if (::connect(*sender, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    LOG(ERROR) << "connect loopback failed: " << strerror(errno);
+    ::close(listenfd);
+    return false;
+  }
+
+  *receiver = ::accept(listenfd, NULL, NULL);
+  ::close(listenfd);
+  if (*receiver < 0) {
+    LOG(ERROR) << "accept loopback failed: " << strerror(errno);
+    return false;
+  }
+
+  NetUtil::optimize_send_recv_buff(*receiver);
+  return true;
+}
+
+bool send_one(Method method, int socketfd, int filefd,
+              const std::vector<char>& payload) {
+
+  switch (method) {
+
+  case Method::kLegacy: {
+    Head head(OpCode::kPushFixed);
+    head.length = payload.size();
+    head.to_net_endian();
+    return SendOps::send_lite(socketfd, reinterpret_cast<const char*>(&head),
+                              kHeadSize) &&
+           SendOps::send_lite(socketfd, payload.data(), payload.size());
+  }
+
+  case Method::kSendFile:
+    return SendOps::send_file(socketfd, OpCode::kPushFixed, filefd, 0,
+                              payload.size());
+
+  case Method::kWritev:
+  case Method::kZeroCopy:
+  case Method::kDropRead:
+  case Method::kDropSplice:
+    return SendOps::send_bulk(socketfd, OpCode::kPushFixed, payload.data(),
+                              payload.size());
+  }
+
+  return false;
+}
+
+bool recv_one(Method method, int socketfd, std::vector<char>& buff) {
+
+  Head head{};
+  bool critical = false;
+  while (!RecvOps::try_recv_head(socketfd, &head, &critical)) {
+    if (critical)
+      return false;
+  }
+
+  if (method == Method::kDropRead)
+    return RecvOps::drop_by_read(socketfd, head.length);
+
+  if (method == Method::kDropSplice)
+    return RecvOps::recv_and_drop(socketfd, head.length);
+
+  buff.resize(head.length);
+  return RecvOps::recv_message(socketfd, head, buff.data());
+}
+
+void run(Method method, int filefd, const std::vector<char>& payload) {
+
+  int sender = -1;
+  int receiver = -1;
+  if (!connect_pair(&sender, &receiver))
+    return;
+
+  if (method == Method::kZeroCopy && !NetUtil::enable_zerocopy(sender)) {
+    LOG(ERROR) << "SO_ZEROCOPY not supported, skip " << method_name(method);
+    NetUtil::close_socket(sender);
+    ::close(receiver);
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  auto done = std::async(std::launch::async, [method, receiver]() {
+    std::vector<char> buff;
+    for (size_t i = 0; i < FLAGS_rounds; ++i) {
+      if (!recv_one(method, receiver, buff))
+        return false;
+    }
+    return true;
+  });
+
+  bool success = true;
+  for (size_t i = 0; i < FLAGS_rounds && success; ++i) {
+    success = send_one(method, sender, filefd, payload);
+  }
+
+  success = done.get() && success;
+  auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                .count();
+
+  const double total = static_cast<double>(payload.size()) * FLAGS_rounds;
+  if (success) {
+    ::printf("%-16s %8.3f GB/s  (%.0f MB in %.3f s)\n", method_name(method),
+             total / cost / (1 << 30), total / (1 << 20), cost);
+  } else {
+    ::printf("%-16s failed\n", method_name(method));
+  }
+
+  NetUtil::close_socket(sender);
+  ::close(receiver);
+}
+
+} // end namespace
+
+int main(int argc, char** argv) {
+
+  gflags::SetUsageMessage("transfer_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  std::vector<char> payload(FLAGS_size_mb << 20);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = static_cast<char>(i * 131);
+  }
+
+  int filefd = ::open(FLAGS_tmpfile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (filefd < 0 ||
+      !SendOps::send_lite(filefd, payload.data(), payload.size())) {
+    LOG(ERROR) << "prepare " << FLAGS_tmpfile << " failed.";
+    return EXIT_FAILURE;
+  }
+
+  ::printf("payload %lu MB x %lu rounds over loopback\n", FLAGS_size_mb,
+           FLAGS_rounds);
+
+  for (auto method :
+       {Method::kLegacy, Method::kWritev, Method::kZeroCopy,
+        Method::kSendFile, Method::kDropRead, Method::kDropSplice}) {
+    run(method, filefd, payload);
+  }
+
+  ::close(filefd);
+  ::unlink(FLAGS_tmpfile.c_str());
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include <qmf/utils/Allocator.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+std::atomic<HugePages> hugePagesMode{HugePages::kNone};
+
+size_t mappedBytes(const size_t bytes) {
+  return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+}
+
+// maps the bytes aligned to kHugePageSize, so the transparent huge pages can
+// back all of them
+void* mapAligned(const size_t bytes) {
+  void* ptr = mmap(nullptr, bytes + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return nullptr;
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t aligned =
+    (start + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  if (aligned > start) {
+    munmap(ptr, aligned - start);
+  }
+  if (start + kHugePageSize > aligned) {
+    munmap(reinterpret_cast<void*>(aligned + bytes),
+           start + kHugePageSize - aligned);
+  }
+  return reinterpret_cast<void*>(aligned);
+}
+
+void* mapBlock(const size_t bytes, const HugePages mode) {
+  if (mode == HugePages::kExplicit) {
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      return ptr;
+    }
+    static std::atomic<bool> warned{false};
+    LOG_IF(WARNING, !warned.exchange(true))
+      << "no reserved huge pages for " << bytes
+      << " bytes, see vm.nr_hugepages, fall back to madvise";
+  }
+  void* ptr = mapAligned(bytes);
+  if (ptr && mode != HugePages::kNone &&
+      madvise(ptr, bytes, MADV_HUGEPAGE) != 0) {
+    static std::atomic<bool> warned{false};
+    LOG_IF(WARNING, !warned.exchange(true))
+      << "madvise(MADV_HUGEPAGE) failed, transparent huge pages disabled?";
+  }
+  return ptr;
+}
+}
+
+void setHugePages(const HugePages mode) {
+  hugePagesMode = mode;
+}
+
+HugePages hugePages() {
+  return hugePagesMode;
+}
+
+bool parseHugePages(const std::string& name, HugePages* mode) {
+  if (name == "none") {
+    *mode = HugePages::kNone;
+  } else if (name == "madvise") {
+    *mode = HugePages::kAdvise;
+  } else if (name == "hugetlb") {
+    *mode = HugePages::kExplicit;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void* allocateBlock(const size_t bytes) {
+  void* ptr = nullptr;
+  // mapped by the size only, so the mode can change between the allocation
+  // and the deallocation
+  if (bytes >= kHugePageSize) {
+    ptr = mapBlock(mappedBytes(bytes), hugePagesMode);
+  } else if (posix_memalign(&ptr, kCacheLineSize, bytes) != 0) {
+    ptr = nullptr;
+  }
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void deallocateBlock(void* ptr, const size_t bytes) {
+  if (!ptr) {
+    return;
+  }
+  if (bytes >= kHugePageSize) {
+    munmap(ptr, mappedBytes(bytes));
+  } else {
+    free(ptr);
+  }
+}
+}
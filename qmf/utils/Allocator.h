@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace qmf {
+
+// every block starts on a cache line
+constexpr size_t kCacheLineSize = 64;
+
+// the blocks of at least it are mapped, aligned to it and may be backed by
+// huge pages
+constexpr size_t kHugePageSize = 2 << 20;
+
+enum class HugePages {
+  // normal pages
+  kNone,
+  // madvise(MADV_HUGEPAGE), transparent huge pages when the kernel has some
+  kAdvise,
+  // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), kAdvise if empty
+  kExplicit,
+};
+
+// the huge pages of the blocks allocated later, process wide
+void setHugePages(const HugePages mode);
+
+HugePages hugePages();
+
+// parses "none", "madvise" or "hugetlb"
+bool parseHugePages(const std::string& name, HugePages* mode);
+
+// throws std::bad_alloc as operator new does
+void* allocateBlock(const size_t bytes);
+
+// bytes should be the size of the allocation
+void deallocateBlock(void* ptr, const size_t bytes);
+
+// the allocator of Matrix and Vector. the value construction leaves the
+// element uninitialized, so std::vector<T, AlignedAllocator<T>>(n) does not
+// touch the pages and they can be first written by the threads using them
+template <typename T>
+class AlignedAllocator {
+ public:
+  using value_type = T;
+
+  AlignedAllocator() = default;
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) noexcept {
+  }
+
+  T* allocate(const size_t n) {
+    return static_cast<T*>(allocateBlock(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, const size_t n) noexcept {
+    deallocateBlock(ptr, n * sizeof(T));
+  }
+
+  template <typename U>
+  void construct(U* ptr) noexcept {
+    ::new (static_cast<void*>(ptr)) U;
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* ptr, Args&&... args) {
+    ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return false;
+}
+}
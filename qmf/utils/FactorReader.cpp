@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <qmf/utils/FactorReader.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+bool FactorReader::load(const std::string& fileName,
+                        const size_t nfactors,
+                        const bool withBiases,
+                        IdIndex& index,
+                        std::unique_ptr<FactorData>& factors) {
+  CHECK_EQ(index.size(), 0);
+
+  std::ifstream fin(fileName);
+  if (!fin) {
+    LOG(ERROR) << "open " << fileName << " failed: " << strerror(errno);
+    return false;
+  }
+
+  const size_t ncols = nfactors + (withBiases ? 1 : 0);
+  std::vector<Double> values;
+  std::string line;
+  size_t lineno = 0;
+  while (std::getline(fin, line)) {
+    ++lineno;
+    if (line.empty()) {
+      continue;
+    }
+
+    const char* p = line.c_str();
+    char* end = nullptr;
+    const int64_t id = strtoll(p, &end, 10);
+    if (end == p) {
+      LOG(ERROR) << fileName << ":" << lineno << " bad id: " << line;
+      return false;
+    }
+
+    size_t count = 0;
+    for (p = end; count <= ncols; ++count, p = end) {
+      const Double value = strtod(p, &end);
+      if (end == p) {
+        break;
+      }
+      values.push_back(value);
+    }
+    if (count != ncols) {
+      LOG(ERROR) << fileName << ":" << lineno << " expect " << ncols
+                 << " values, but got " << count;
+      return false;
+    }
+
+    if (index.getOrSetIdx(id) != index.size() - 1) {
+      LOG(ERROR) << fileName << ":" << lineno << " duplicate id " << id;
+      return false;
+    }
+  }
+
+  factors = std::make_unique<FactorData>(index.size(), nfactors, withBiases);
+  const Double* value = values.data();
+  for (size_t idx = 0; idx < index.size(); ++idx) {
+    if (withBiases) {
+      factors->biasAt(idx) = *value++;
+    }
+    for (size_t fidx = 0; fidx < nfactors; ++fidx) {
+      factors->at(idx, fidx) = *value++;
+    }
+  }
+
+  LOG(INFO) << "loaded " << index.size() << " factors from " << fileName;
+  return true;
+}
+
+bool FactorReader::warmStart(const std::string& fileName,
+                             const IdIndex& index,
+                             FactorData& factors,
+                             size_t* matched) {
+  CHECK_EQ(factors.nelems(), index.size());
+
+  IdIndex prevIndex;
+  std::unique_ptr<FactorData> prevFactors;
+  if (!load(fileName, factors.nfactors(), factors.withBiases(), prevIndex,
+            prevFactors)) {
+    return false;
+  }
+
+  size_t count = 0;
+  for (size_t prevIdx = 0; prevIdx < prevIndex.size(); ++prevIdx) {
+    const size_t idx = index.idx(prevIndex.id(prevIdx));
+    if (idx == IdIndex::missingIdx) {
+      continue;
+    }
+    if (factors.withBiases()) {
+      factors.biasAt(idx) = prevFactors->biasAt(prevIdx);
+    }
+    for (size_t fidx = 0; fidx < factors.nfactors(); ++fidx) {
+      factors.at(idx, fidx) = prevFactors->at(prevIdx, fidx);
+    }
+    ++count;
+  }
+
+  LOG(INFO) << "warm start " << count << " of " << index.size()
+            << " factors from " << fileName;
+  if (matched) {
+    *matched = count;
+  }
+  return true;
+}
+}
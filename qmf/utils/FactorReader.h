@@ -0,0 +1,41 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Read back the factors text written by Engine::saveFactors or FactorWriter,
+ * one line "id [bias] factor ..." per row.
+ */
+
+#include <memory>
+#include <string>
+
+#include <qmf/FactorData.h>
+#include <qmf/utils/IdIndex.h>
+
+namespace qmf {
+
+class FactorReader {
+ public:
+  // the rows are indexed in the order of the file, nfactors must match the
+  // columns of every line. index should be empty
+  static bool load(const std::string& fileName,
+                   const size_t nfactors,
+                   const bool withBiases,
+                   IdIndex& index,
+                   std::unique_ptr<FactorData>& factors);
+
+  // copy the rows of fileName to the same ids of index in factors, the ids
+  // not in the file keep their values, so they can be initialized randomly
+  // before. matched returns the count of the copied rows
+  static bool warmStart(const std::string& fileName,
+                        const IdIndex& index,
+                        FactorData& factors,
+                        size_t* matched = nullptr);
+};
+}
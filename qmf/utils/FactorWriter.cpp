@@ -0,0 +1,234 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <qmf/utils/FactorWriter.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+const uint64_t kFracScale = 1000000000ULL;
+const int kFracDigits = 9;
+
+size_t formatUint64(uint64_t value, char* buff) {
+  char digits[24];
+  size_t len = 0;
+  do {
+    digits[len++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  for (size_t idx = 0; idx < len; ++idx) {
+    buff[idx] = digits[len - 1 - idx];
+  }
+  return len;
+}
+
+// the shard directory may be shared by the Labors on several hosts, and a
+// bucket dispatched again may be written concurrently, so the temporary file
+// is unique to the host, the process and the call
+std::string tmpSuffix() {
+  static std::atomic<uint64_t> sequence{0};
+  char host[256]{};
+  ::gethostname(host, sizeof(host) - 1);
+  return std::string(".tmp.") + host + "." + std::to_string(::getpid()) + "." +
+         std::to_string(sequence++);
+}
+}
+
+bool FactorWriter::writeAll(const int fd,
+                            const std::string& buff,
+                            const off_t offset) {
+  size_t written = 0;
+  while (written < buff.size()) {
+    const ssize_t retval = ::pwrite(fd, buff.data() + written,
+                                    buff.size() - written, offset + written);
+    if (retval < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    written += retval;
+  }
+  return true;
+}
+
+size_t FactorWriter::formatDouble(const Double value, char* buff) {
+  // the scaled value and its fraction are exact only when it is below 2^52,
+  // the factors are always small in practice
+  if (!(std::fabs(value) < 1e6)) {
+    return snprintf(buff, kMaxNumberChars, "%.9f", value);
+  }
+
+  size_t len = 0;
+  if (std::signbit(value)) {
+    buff[len++] = '-';
+  }
+
+  // round to nearest, ties to even as printf does, the residual of the
+  // product is exact by fma and decides the halfway cases
+  const Double product = std::fabs(value) * kFracScale;
+  const Double residual = std::fma(std::fabs(value), kFracScale, -product);
+  uint64_t scaled = static_cast<uint64_t>(product);
+  const Double frac = product - scaled;
+  if (frac > 0.5 || (frac == 0.5 && (residual > 0 ||
+                                     (residual == 0 && (scaled & 1))))) {
+    ++scaled;
+  }
+  len += formatUint64(scaled / kFracScale, buff + len);
+  buff[len++] = '.';
+
+  uint64_t digits = scaled % kFracScale;
+  for (int idx = kFracDigits - 1; idx >= 0; --idx) {
+    buff[len + idx] = '0' + digits % 10;
+    digits /= 10;
+  }
+  return len + kFracDigits;
+}
+
+size_t FactorWriter::formatInt64(const int64_t value, char* buff) {
+  if (value < 0) {
+    buff[0] = '-';
+    // negate in unsigned to handle int64_t min
+    return 1 + formatUint64(-static_cast<uint64_t>(value), buff + 1);
+  }
+  return formatUint64(value, buff);
+}
+
+void FactorWriter::formatRows(const FactorData& factorData,
+                              const IdIndex& index,
+                              const size_t start,
+                              const size_t end,
+                              std::string* out) {
+  const size_t nfactors = factorData.nfactors();
+  const bool withBiases = factorData.withBiases();
+  const size_t lineChars = (nfactors + 2) * (kMaxNumberChars + 1) + 1;
+
+  std::vector<char> line(lineChars);
+  for (size_t idx = start; idx < end; ++idx) {
+    char* p = line.data();
+    p += formatInt64(index.id(idx), p);
+    if (withBiases) {
+      *p++ = ' ';
+      p += formatDouble(factorData.biasAt(idx), p);
+    }
+    for (size_t fidx = 0; fidx < nfactors; ++fidx) {
+      *p++ = ' ';
+      p += formatDouble(factorData.at(idx, fidx), p);
+    }
+    *p++ = '\n';
+    out->append(line.data(), p - line.data());
+  }
+}
+
+bool FactorWriter::writeChunks(const std::string& fileName,
+                               const size_t nchunks,
+                               const FormatChunk& format,
+                               ParallelExecutor& parallel,
+                               const Progress& progress) {
+  const int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "open " << fileName << " failed: " << strerror(errno);
+    return false;
+  }
+
+  const size_t nthreads = parallel.nthreads();
+  std::vector<std::string> buffs(nthreads);
+  std::vector<off_t> offsets(nthreads);
+  std::atomic<bool> success{true};
+
+  off_t offset = 0;
+  for (size_t round = 0; round < nchunks && success; round += nthreads) {
+    const size_t ntasks = std::min(nthreads, nchunks - round);
+
+    parallel.execute(ntasks, [&](const size_t taskId) {
+      buffs[taskId].clear();
+      format(round + taskId, &buffs[taskId]);
+    });
+
+    // the offsets prefix summed from the sizes
+    for (size_t taskId = 0; taskId < ntasks; ++taskId) {
+      offsets[taskId] = offset;
+      offset += buffs[taskId].size();
+    }
+
+    parallel.execute(ntasks, [&](const size_t taskId) {
+      if (!writeAll(fd, buffs[taskId], offsets[taskId])) {
+        success = false;
+      }
+    });
+
+    if (progress) {
+      progress(round + ntasks);
+    }
+  }
+
+  if (!success) {
+    LOG(ERROR) << "write " << fileName << " failed: " << strerror(errno);
+  }
+
+  ::close(fd);
+  return success;
+}
+
+bool FactorWriter::save(const FactorData& factorData,
+                        const IdIndex& index,
+                        const std::string& fileName,
+                        ParallelExecutor& parallel) {
+  CHECK_EQ(factorData.nelems(), index.size());
+
+  const size_t nrows = factorData.nelems();
+  const size_t nchunks = (nrows + kChunkRows - 1) / kChunkRows;
+  return writeChunks(fileName, nchunks,
+                     [&](const size_t chunk, std::string* out) {
+                       const size_t start = chunk * kChunkRows;
+                       const size_t end = std::min(start + kChunkRows, nrows);
+                       formatRows(factorData, index, start, end, out);
+                     },
+                     parallel);
+}
+
+bool FactorWriter::saveShard(const FactorData& factorData,
+                             const IdIndex& index,
+                             const size_t start,
+                             const size_t end,
+                             const std::string& fileName) {
+  std::string buff;
+  formatRows(factorData, index, start, end, &buff);
+
+  const std::string tmpFile = fileName + tmpSuffix();
+  const int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "open " << tmpFile << " failed: " << strerror(errno);
+    return false;
+  }
+
+  const bool success = writeAll(fd, buff, 0);
+  ::close(fd);
+
+  if (!success || ::rename(tmpFile.c_str(), fileName.c_str()) < 0) {
+    LOG(ERROR) << "write shard " << fileName << " failed: " << strerror(errno);
+    ::unlink(tmpFile.c_str());
+    return false;
+  }
+  return true;
+}
+}
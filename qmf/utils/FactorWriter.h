@@ -0,0 +1,83 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Write the factors as the same text of Engine::saveFactors, but the rows are
+ * formatted concurrently into per-thread buffers, and written by pwrite at
+ * the offsets prefix summed from the buffers' sizes.
+ */
+
+#include <sys/types.h>
+
+#include <functional>
+#include <string>
+
+#include <qmf/FactorData.h>
+#include <qmf/Types.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+namespace qmf {
+
+class FactorWriter {
+ public:
+  // rows formatted by one task
+  static const size_t kChunkRows = 4096;
+
+  // "%.9f" of the max double has 309 integral digits
+  static const size_t kMaxNumberChars = 328;
+
+  // same as "%.9f", values not smaller than 1e6 fall back to snprintf
+  static size_t formatDouble(const Double value, char* buff);
+
+  static size_t formatInt64(const int64_t value, char* buff);
+
+  // pwrite the whole buff at offset, retried on EINTR
+  static bool writeAll(const int fd,
+                       const std::string& buff,
+                       const off_t offset);
+
+  // append the lines "id [bias] factor ...\n" of rows [start, end)
+  static void formatRows(const FactorData& factorData,
+                         const IdIndex& index,
+                         const size_t start,
+                         const size_t end,
+                         std::string* out);
+
+  // appends the text of chunk [0, nchunks) to out, called concurrently
+  using FormatChunk = std::function<void(const size_t chunk, std::string* out)>;
+
+  // called with the chunks written so far after each round
+  using Progress = std::function<void(const size_t chunks)>;
+
+  // the chunks in order to fileName. one round formats nthreads chunks, then
+  // writes them at their offsets concurrently, so the memory is bounded by
+  // the threads rather than the file size
+  static bool writeChunks(const std::string& fileName,
+                          const size_t nchunks,
+                          const FormatChunk& format,
+                          ParallelExecutor& parallel,
+                          const Progress& progress = nullptr);
+
+  // the whole factors to fileName
+  static bool save(const FactorData& factorData,
+                   const IdIndex& index,
+                   const std::string& fileName,
+                   ParallelExecutor& parallel);
+
+  // only rows [start, end) to fileName, written to a temporary file unique to
+  // the host and process and renamed, so a shard is either complete or missing
+  // even when written by several Labors at the same time
+  static bool saveShard(const FactorData& factorData,
+                        const IdIndex& index,
+                        const size_t start,
+                        const size_t end,
+                        const std::string& fileName);
+};
+}
@@ -14,19 +14,90 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <qmf/utils/IdIndex.h>
 
+#include <glog/logging.h>
+
 namespace qmf {
 
+const size_t IdIndex::missingIdx;
+
 size_t IdIndex::getOrSetIdx(const int64_t id) {
-  const auto pos = idxMap_.find(id);
-  if (pos != idxMap_.end()) {
-    return pos->second;
-  } else {
-    const size_t idx = ids_.size();
-    ids_.push_back(id);
-    idxMap_.emplace(id, idx);
+  if (sorted_) {
+    const size_t idx = sortedIdx(id);
+    CHECK_NE(idx, missingIdx) << "can't add id " << id << " to sorted index";
     return idx;
   }
+
+  if (ids_.size() + 1 > slots_.size() / 4 * 3) {
+    rehash(capacityFor(ids_.size() + 1));
+  }
+
+  size_t pos = hash(id) & mask_;
+  for (; slots_[pos].idx != missingIdx; pos = (pos + 1) & mask_) {
+    if (slots_[pos].id == id) {
+      return slots_[pos].idx;
+    }
+  }
+
+  const size_t idx = ids_.size();
+  ids_.push_back(id);
+  slots_[pos] = Slot{id, idx};
+  return idx;
+}
+
+void IdIndex::reserve(const size_t n) {
+  CHECK(!sorted_) << "sorted index is immutable";
+  ids_.reserve(n);
+  if (n > slots_.size() / 4 * 3) {
+    rehash(capacityFor(n));
+  }
+}
+
+void IdIndex::build(const std::vector<int64_t>& ids) {
+  reset();
+  ids_ = ids;
+  rehash(capacityFor(ids_.size()));
+}
+
+void IdIndex::buildSorted(std::vector<int64_t> ids) {
+  for (size_t i = 1; i < ids.size(); ++i) {
+    CHECK_LT(ids[i - 1], ids[i]) << "ids should be strictly ascending";
+  }
+  reset();
+  ids_ = std::move(ids);
+  sorted_ = true;
+}
+
+size_t IdIndex::capacityFor(const size_t n) {
+  size_t capacity = 16;
+  while (capacity / 4 * 3 < n) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+size_t IdIndex::sortedIdx(const int64_t id) const {
+  const auto pos = std::lower_bound(ids_.begin(), ids_.end(), id);
+  return (pos != ids_.end() && *pos == id) ? pos - ids_.begin() : missingIdx;
+}
+
+void IdIndex::insert(const size_t idx) {
+  const int64_t id = ids_[idx];
+  size_t pos = hash(id) & mask_;
+  for (; slots_[pos].idx != missingIdx; pos = (pos + 1) & mask_) {
+    CHECK_NE(slots_[pos].id, id) << "duplicate id " << id;
+  }
+  slots_[pos] = Slot{id, idx};
+}
+
+void IdIndex::rehash(const size_t capacity) {
+  slots_.assign(capacity, Slot{0, missingIdx});
+  mask_ = capacity - 1;
+  for (size_t idx = 0; idx < ids_.size(); ++idx) {
+    insert(idx);
+  }
 }
 }
@@ -16,14 +16,19 @@
 
 #pragma once
 
+#include <cstdint>
 #include <limits>
 #include <vector>
-#include <unordered_map>
 
 namespace qmf {
 
 // helper class for converting from raw ids ("id") to contiguous indices
 // ("idx").
+//
+// the ids are kept in an open addressing table of (id, idx) slots with
+// linear probing, one lookup usually touches a single cache line. an
+// immutable index can be built as a sorted array instead, which only keeps
+// the ids and looks up by binary search.
 class IdIndex {
  public:
   static const size_t missingIdx = std::numeric_limits<size_t>::max();
@@ -35,13 +40,39 @@ class IdIndex {
   }
 
   size_t idx(const int64_t id) const {
-    const auto pos = idxMap_.find(id);
-    return (pos != idxMap_.end() ? pos->second : missingIdx);
+    if (sorted_) {
+      return sortedIdx(id);
+    }
+    if (slots_.empty()) {
+      return missingIdx;
+    }
+    for (size_t pos = hash(id) & mask_;; pos = (pos + 1) & mask_) {
+      const Slot& slot = slots_[pos];
+      if (slot.idx == missingIdx || slot.id == id) {
+        return slot.idx;
+      }
+    }
   }
 
   // returns idx if it is present, otherwise adds an entry.
+  // the sorted index is immutable, only the present ids are accepted
   size_t getOrSetIdx(const int64_t id);
 
+  // room for n ids without rehashing
+  void reserve(const size_t n);
+
+  // replace the index with the unique ids, idx is the position in ids. it
+  // saves the rehashing and the lookups of the getOrSetIdx one by one
+  void build(const std::vector<int64_t>& ids);
+
+  // replace the index with the strictly ascending ids as an immutable
+  // sorted array, idx is the position in ids
+  void buildSorted(std::vector<int64_t> ids);
+
+  bool sorted() const {
+    return sorted_;
+  }
+
   size_t size() const {
     return ids_.size();
   }
@@ -50,14 +81,47 @@ class IdIndex {
     return ids_;
   }
 
+  // heap bytes of the index
+  size_t memoryBytes() const {
+    return ids_.capacity() * sizeof(int64_t) + slots_.capacity() * sizeof(Slot);
+  }
+
   void reset() {
     ids_.clear();
-    idxMap_.clear();
+    slots_.clear();
+    mask_ = 0;
+    sorted_ = false;
   }
 
  private:
+  struct Slot {
+    int64_t id;
+    size_t idx;
+  };
+
+  // the table is grown when it is more than 3/4 full
+  static size_t capacityFor(const size_t n);
+
+  // the finalizer of splitmix64, the raw ids are often sequential
+  static size_t hash(const int64_t id) {
+    uint64_t x = static_cast<uint64_t>(id);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  size_t sortedIdx(const int64_t id) const;
+
+  // place idx of ids_ to the table, which has room
+  void insert(const size_t idx);
+
+  void rehash(const size_t capacity);
+
   std::vector<int64_t> ids_;
 
-  std::unordered_map<int64_t, size_t> idxMap_;
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+
+  bool sorted_ = false;
 };
 }
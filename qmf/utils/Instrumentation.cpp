@@ -0,0 +1,231 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include <qmf/utils/Instrumentation.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+size_t bucketOf(const uint64_t nanos) {
+  const size_t bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+  return std::min(bucket, Instrumentation::kHistogramBuckets - 1);
+}
+}
+
+double Instrumentation::HistogramSnapshot::percentileSeconds(
+  const double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count));
+  uint64_t seen = 0;
+  for (size_t b = 0; b < buckets.size(); ++b) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return std::min<double>(2.0 * (1ULL << b), maxNanos) / 1e9;
+    }
+  }
+  return maxNanos / 1e9;
+}
+
+std::string Instrumentation::Snapshot::toJson() const {
+  std::string json = "{\n  \"counters\": {";
+  char buff[512];
+  for (size_t i = 0; i < counters.size(); ++i) {
+    snprintf(buff, sizeof(buff), "%s\n    \"%s\": %llu", i ? "," : "",
+             counters[i].first.c_str(),
+             static_cast<unsigned long long>(counters[i].second));
+    json += buff;
+  }
+  json += counters.empty() ? "},\n" : "\n  },\n";
+
+  json += "  \"histograms\": {";
+  for (size_t i = 0; i < histograms.size(); ++i) {
+    const auto& h = histograms[i].second;
+    snprintf(buff, sizeof(buff),
+             "%s\n    \"%s\": {\"count\": %llu, \"sum_seconds\": %.9f, "
+             "\"mean_seconds\": %.9f, \"max_seconds\": %.9f, "
+             "\"p50_seconds\": %.9f, \"p90_seconds\": %.9f, "
+             "\"p99_seconds\": %.9f}",
+             i ? "," : "", histograms[i].first.c_str(),
+             static_cast<unsigned long long>(h.count), h.sumNanos / 1e9,
+             h.count ? h.sumNanos / 1e9 / h.count : 0.0, h.maxNanos / 1e9,
+             h.percentileSeconds(0.5), h.percentileSeconds(0.9),
+             h.percentileSeconds(0.99));
+    json += buff;
+  }
+  json += histograms.empty() ? "}\n}\n" : "\n  }\n}\n";
+  return json;
+}
+
+Instrumentation& Instrumentation::get() {
+  // never destroyed, the thread local shards may outlive the statics
+  static Instrumentation* instance = new Instrumentation();
+  return *instance;
+}
+
+size_t Instrumentation::registerCounter(const std::string& name) {
+  return registerEntry(name, false);
+}
+
+size_t Instrumentation::registerHistogram(const std::string& name) {
+  return registerEntry(name, true);
+}
+
+size_t Instrumentation::registerEntry(const std::string& name,
+                                      const bool histogram) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = entryIdxs_.find(name);
+  if (it != entryIdxs_.end()) {
+    const Entry& entry = entries_[it->second];
+    CHECK_EQ(entry.histogram, histogram)
+      << name << " is registered as another kind";
+    return entry.slot;
+  }
+
+  const size_t nslots = histogram ? 3 + kHistogramBuckets : 1;
+  CHECK_LE(nslots_ + nslots, kMaxSlots) << "too many instruments";
+  entryIdxs_[name] = entries_.size();
+  entries_.push_back(Entry{name, histogram, nslots_});
+  nslots_ += nslots;
+  return entries_.back().slot;
+}
+
+Instrumentation::ShardHolder::ShardHolder()
+  : shard(Instrumentation::get().acquireShard()) {
+}
+
+Instrumentation::ShardHolder::~ShardHolder() {
+  Instrumentation::get().releaseShard(shard);
+}
+
+Instrumentation::Shard* Instrumentation::acquireShard() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!freeShards_.empty()) {
+    Shard* shard = freeShards_.back();
+    freeShards_.pop_back();
+    return shard;
+  }
+  shards_.push_back(std::make_unique<Shard>());
+  for (auto& slot : shards_.back()->slots) {
+    slot.store(0, std::memory_order_relaxed);
+  }
+  return shards_.back().get();
+}
+
+void Instrumentation::releaseShard(Shard* shard) {
+  // the values stay in the snapshots
+  std::lock_guard<std::mutex> lock(mutex_);
+  freeShards_.push_back(shard);
+}
+
+Instrumentation::Snapshot Instrumentation::snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint64_t> sums(nslots_, 0);
+  std::vector<uint64_t> maxs(nslots_, 0);
+  for (const auto& shard : shards_) {
+    for (size_t slot = 0; slot < nslots_; ++slot) {
+      const uint64_t value = shard->slots[slot].load(std::memory_order_relaxed);
+      sums[slot] += value;
+      maxs[slot] = std::max(maxs[slot], value);
+    }
+  }
+
+  Snapshot snapshot;
+  for (const auto& entry : entries_) {
+    if (!entry.histogram) {
+      snapshot.counters.emplace_back(entry.name, sums[entry.slot]);
+      continue;
+    }
+    HistogramSnapshot h;
+    h.count = sums[entry.slot];
+    h.sumNanos = sums[entry.slot + 1];
+    h.maxNanos = maxs[entry.slot + 2];
+    h.buckets.assign(sums.begin() + entry.slot + 3,
+                     sums.begin() + entry.slot + 3 + kHistogramBuckets);
+    snapshot.histograms.emplace_back(entry.name, std::move(h));
+  }
+  std::sort(snapshot.counters.begin(), snapshot.counters.end());
+  std::sort(snapshot.histograms.begin(), snapshot.histograms.end(),
+            [](const auto& x, const auto& y) { return x.first < y.first; });
+  return snapshot;
+}
+
+void Instrumentation::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& shard : shards_) {
+    for (auto& slot : shard->slots) {
+      slot.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void Instrumentation::setDumpFile(const std::string& fileName) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  dumpFile_ = fileName;
+}
+
+bool Instrumentation::dump() const {
+  std::string fileName;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fileName = dumpFile_;
+  }
+  const std::string json = snapshot().toJson();
+  if (fileName.empty()) {
+    LOG(INFO) << "instrumentation: " << json;
+    return true;
+  }
+
+  FILE* fp = fopen(fileName.c_str(), "w");
+  if (!fp) {
+    LOG(ERROR) << "can not open " << fileName;
+    return false;
+  }
+  const bool written = fwrite(json.data(), 1, json.size(), fp) == json.size();
+  if (fclose(fp) != 0 || !written) {
+    LOG(ERROR) << "write " << fileName << " failed";
+    return false;
+  }
+  LOG(INFO) << "instrumentation dumped to " << fileName;
+  return true;
+}
+
+void Histogram::record(const uint64_t nanos) const {
+  Instrumentation& instrumentation = Instrumentation::get();
+  instrumentation.add(slot_, 1);
+  instrumentation.add(slot_ + 1, nanos);
+  instrumentation.max(slot_ + 2, nanos);
+  instrumentation.add(slot_ + 3 + bucketOf(nanos), 1);
+}
+
+void Instrumentation::dumpOnSignal(const int signo) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  CHECK_EQ(pthread_sigmask(SIG_BLOCK, &set, nullptr), 0);
+
+  std::thread([this, set]() {
+    while (true) {
+      int sig = 0;
+      if (sigwait(&set, &sig) == 0) {
+        dump();
+      }
+    }
+  }).detach();
+}
+}
@@ -0,0 +1,183 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace qmf {
+
+/**
+ * Counters and latency histograms of the process. Each of them owns some
+ * slots, and each thread adds to the slots of its own shard, so recording
+ * takes no lock and no contended cache line. A snapshot sums the shards,
+ * including the shards of the exited threads, which are reused by the new
+ * ones.
+ *
+ * Counter and Histogram are cheap handles to the slots, usually function
+ * local statics:
+ *
+ *   static const Histogram solveTime("wals.solve_row");
+ *   ScopedTimer timer(solveTime);
+ */
+class Instrumentation {
+ public:
+  static const size_t kMaxSlots = 4096;
+  // bucket b holds the latencies in [2^b, 2^(b + 1)) nanoseconds
+  static const size_t kHistogramBuckets = 48;
+
+  struct HistogramSnapshot {
+    uint64_t count = 0;
+    uint64_t sumNanos = 0;
+    uint64_t maxNanos = 0;
+    std::vector<uint64_t> buckets;
+
+    // the upper bound of the bucket of the q quantile, not above the max
+    double percentileSeconds(const double q) const;
+  };
+
+  struct Snapshot {
+    // sorted by name
+    std::vector<std::pair<std::string, uint64_t>> counters;
+    std::vector<std::pair<std::string, HistogramSnapshot>> histograms;
+
+    std::string toJson() const;
+  };
+
+  static Instrumentation& get();
+
+  // the first slot of the counter or histogram, the same name gets the same
+  // slots
+  size_t registerCounter(const std::string& name);
+  size_t registerHistogram(const std::string& name);
+
+  void add(const size_t slot, const uint64_t value) {
+    std::atomic<uint64_t>& s = localShard().slots[slot];
+    // only this thread writes the slot
+    s.store(s.load(std::memory_order_relaxed) + value,
+            std::memory_order_relaxed);
+  }
+
+  void max(const size_t slot, const uint64_t value) {
+    std::atomic<uint64_t>& s = localShard().slots[slot];
+    if (value > s.load(std::memory_order_relaxed)) {
+      s.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  Snapshot snapshot() const;
+
+  // zeros all the slots, only when nothing is recording, e.g. in tests
+  void reset();
+
+  // writes the JSON snapshot to the dump file, or logs it if no dump file
+  void setDumpFile(const std::string& fileName);
+  bool dump() const;
+
+  // dumps whenever the process receives the signal. it is blocked in the
+  // calling thread and waited by a background thread, so call it before
+  // creating any other thread, which inherits the mask
+  void dumpOnSignal(const int signo);
+
+ private:
+  struct Entry {
+    std::string name;
+    bool histogram;
+    size_t slot;
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> slots[kMaxSlots];
+  };
+
+  // returns the shard to the pool when the thread exits
+  struct ShardHolder {
+    ShardHolder();
+    ~ShardHolder();
+
+    Shard* shard;
+  };
+
+  Instrumentation() = default;
+
+  size_t registerEntry(const std::string& name, const bool histogram);
+
+  static Shard& localShard() {
+    static thread_local ShardHolder holder;
+    return *holder.shard;
+  }
+
+  Shard* acquireShard();
+  void releaseShard(Shard* shard);
+
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+  std::unordered_map<std::string, size_t> entryIdxs_;
+  size_t nslots_ = 0;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::vector<Shard*> freeShards_;
+  std::string dumpFile_;
+};
+
+class Counter {
+ public:
+  explicit Counter(const std::string& name)
+    : slot_(Instrumentation::get().registerCounter(name)) {
+  }
+
+  void add(const uint64_t value = 1) const {
+    Instrumentation::get().add(slot_, value);
+  }
+
+ private:
+  const size_t slot_;
+};
+
+class Histogram {
+ public:
+  explicit Histogram(const std::string& name)
+    : slot_(Instrumentation::get().registerHistogram(name)) {
+  }
+
+  void record(const uint64_t nanos) const;
+
+  void recordSeconds(const double seconds) const {
+    record(seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0);
+  }
+
+ private:
+  // count, sum, max and the buckets
+  const size_t slot_;
+};
+
+// records the wall time of the scope to the histogram
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(const Histogram& histogram)
+    : histogram_(histogram), start_(std::chrono::steady_clock::now()) {
+  }
+
+  ~ScopedTimer() {
+    histogram_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count());
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  const Histogram& histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+}
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <qmf/utils/MappedFile.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string& dir,
+                                               const size_t bytes) {
+  CHECK_GT(bytes, 0);
+  const std::string pattern = dir + "/qmf_factors_XXXXXX";
+  std::vector<char> fileName(pattern.begin(), pattern.end());
+  fileName.push_back('\0');
+  const int fd = ::mkstemp(fileName.data());
+  if (fd < 0) {
+    LOG(ERROR) << "create file in " << dir << " failed: " << strerror(errno);
+    return nullptr;
+  }
+  ::unlink(fileName.data());
+
+  // a sparse file, the blocks are allocated when the rows are written
+  void* data = MAP_FAILED;
+  if (::ftruncate(fd, bytes) == 0) {
+    data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  const int err = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "map " << bytes << " bytes of " << fileName.data()
+               << " failed: " << strerror(err);
+    return nullptr;
+  }
+
+  LOG(INFO) << "mapped " << bytes << " bytes of " << fileName.data();
+  return std::unique_ptr<MappedFile>(new MappedFile(data, bytes));
+}
+
+MappedFile::~MappedFile() {
+  ::munmap(data_, size_);
+}
+
+void MappedFile::prefetch(const size_t offset, const size_t bytes) const {
+  static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  if (offset >= size_ || bytes == 0) {
+    return;
+  }
+  const size_t begin = offset / pageSize * pageSize;
+  const size_t end = std::min(offset + bytes, size_);
+  if (::madvise(static_cast<char*>(data_) + begin, end - begin,
+                MADV_WILLNEED) != 0) {
+    LOG(WARNING) << "madvise(MADV_WILLNEED) failed: " << strerror(errno);
+  }
+}
+}
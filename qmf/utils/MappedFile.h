@@ -0,0 +1,50 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace qmf {
+
+// a temporary file mapped to memory, the storage of the matrices larger than
+// the memory. the file is unlinked once created, so its space is freed with
+// the mapping, even if the process is killed
+class MappedFile {
+ public:
+  // `bytes` of zeros in a file of dir, nullptr on failure
+  static std::unique_ptr<MappedFile> create(const std::string& dir,
+                                            const size_t bytes);
+
+  ~MappedFile();
+
+  // not copyable, not movable
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  void* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // madvise(MADV_WILLNEED), the kernel reads the pages of [offset,
+  // offset + bytes) in the background
+  void prefetch(const size_t offset, const size_t bytes) const;
+
+ private:
+  MappedFile(void* data, const size_t size) : data_(data), size_(size) {
+  }
+
+  void* data_;
+
+  size_t size_;
+};
+}
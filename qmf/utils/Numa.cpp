@@ -0,0 +1,105 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <qmf/utils/Numa.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+const char* kNodeDir = "/sys/devices/system/node";
+
+// the cpus of the nodes with cpus, the memory only nodes are skipped
+std::vector<std::vector<int>> readNodes() {
+  std::vector<int> online;
+  std::ifstream onlineFile(std::string(kNodeDir) + "/online");
+  std::string list;
+  if (onlineFile && std::getline(onlineFile, list)) {
+    online = NumaTopology::parseCpuList(list);
+  }
+
+  std::vector<std::vector<int>> nodes;
+  for (const int node : online) {
+    std::ifstream cpuFile(std::string(kNodeDir) + "/node" +
+                          std::to_string(node) + "/cpulist");
+    if (cpuFile && std::getline(cpuFile, list)) {
+      auto cpus = NumaTopology::parseCpuList(list);
+      if (!cpus.empty()) {
+        nodes.push_back(std::move(cpus));
+      }
+    }
+  }
+
+  if (nodes.empty()) {
+    const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nodes.emplace_back();
+    for (long cpu = 0; cpu < std::max(ncpus, 1L); ++cpu) {
+      nodes.back().push_back(cpu);
+    }
+  }
+  return nodes;
+}
+}
+
+NumaTopology::NumaTopology(std::vector<std::vector<int>> nodes)
+  : nodes_(std::move(nodes)) {
+  CHECK(!nodes_.empty()) << "no numa node";
+  for (const auto& cpus : nodes_) {
+    CHECK(!cpus.empty()) << "numa node without cpus";
+  }
+}
+
+const NumaTopology& NumaTopology::get() {
+  static const NumaTopology topology(readNodes());
+  return topology;
+}
+
+bool NumaTopology::bindThread(const size_t node) const {
+  CHECK_LT(node, nodes_.size());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : nodes_[node]) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    LOG(WARNING) << "bind thread to numa node " << node << " failed: " << err;
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> NumaTopology::parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    char* end = nullptr;
+    const long first = strtol(range.c_str(), &end, 10);
+    const long last = *end == '-' ? strtol(end + 1, nullptr, 10) : first;
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+}
@@ -0,0 +1,49 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace qmf {
+
+/**
+ * The NUMA nodes of the machine and their cpus, read from
+ * /sys/devices/system/node. A machine without the sysfs entries is one node
+ * of all the cpus.
+ *
+ * The pages of a buffer are placed on the node of the thread first writes
+ * them, so the threads bound to a node and writing the rows they will solve
+ * later keep the rows local, see ParallelExecutor and FactorData.
+ */
+class NumaTopology {
+ public:
+  // the cpus of each node
+  explicit NumaTopology(std::vector<std::vector<int>> nodes);
+
+  // the topology of this machine, read once
+  static const NumaTopology& get();
+
+  size_t nnodes() const {
+    return nodes_.size();
+  }
+
+  const std::vector<int>& cpus(const size_t node) const {
+    return nodes_[node];
+  }
+
+  // binds the calling thread to the cpus of the node
+  bool bindThread(const size_t node) const;
+
+  // parses the cpu list of sysfs, e.g. "0-3,8-11"
+  static std::vector<int> parseCpuList(const std::string& list);
+
+ private:
+  std::vector<std::vector<int>> nodes_;
+};
+}
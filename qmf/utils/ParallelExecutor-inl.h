@@ -16,18 +16,44 @@
 
 namespace qmf {
 
+inline ParallelExecutor::ParallelExecutor(const size_t nthreads,
+                                          const NumaTopology& topology)
+  : nthreads_(nthreads) {
+  CHECK_GT(nthreads, 0) << "the number of threads should be positive";
+  const size_t nnodes = std::min(topology.nnodes(), nthreads);
+  threadOffsets_.push_back(0);
+  for (size_t node = 0; node < nnodes; ++node) {
+    const size_t poolThreads =
+      nthreads / nnodes + (node < nthreads % nnodes ? 1 : 0);
+    threadPools_.push_back(std::make_unique<ThreadPool>(
+      poolThreads, [topology, node]() { topology.bindThread(node); }));
+    threadOffsets_.push_back(threadOffsets_.back() + poolThreads);
+  }
+}
+
+inline std::pair<size_t, size_t> ParallelExecutor::taskRange(
+  const size_t pool,
+  const size_t ntasks) const {
+  return {ntasks * threadOffsets_[pool] / nthreads_,
+          ntasks * threadOffsets_[pool + 1] / nthreads_};
+}
+
 template <typename FuncT>
 void ParallelExecutor::execute(const size_t ntasks, FuncT&& func) {
-  const size_t nthreads = threadPool_->nthreads();
   std::vector<std::future<void>> futures;
-  futures.reserve(nthreads);
-  for (size_t threadId = 0; threadId < nthreads; ++threadId) {
-    auto task = [threadId, func, nthreads, ntasks]() {
-      for (size_t taskId = threadId; taskId < ntasks; taskId += nthreads) {
-        func(taskId);
-      }
-    };
-    futures.emplace_back(threadPool_->addTask(task));
+  futures.reserve(nthreads_);
+  for (size_t pool = 0; pool < threadPools_.size(); ++pool) {
+    const auto range = taskRange(pool, ntasks);
+    const size_t nthreads = threadPools_[pool]->nthreads();
+    for (size_t threadId = 0; threadId < nthreads; ++threadId) {
+      auto task = [threadId, func, nthreads, range]() {
+        for (size_t taskId = range.first + threadId; taskId < range.second;
+             taskId += nthreads) {
+          func(taskId);
+        }
+      };
+      futures.emplace_back(threadPools_[pool]->addTask(task));
+    }
   }
   for (auto& future : futures) {
     future.get();
@@ -39,18 +65,22 @@ T ParallelExecutor::mapReduce(const size_t ntasks,
                               MapperT&& mapper,
                               ReducerT&& reducer,
                               T neutral) {
-  const size_t nthreads = threadPool_->nthreads();
   std::vector<std::future<T>> futures;
-  futures.reserve(nthreads);
-  for (size_t threadId = 0; threadId < nthreads; ++threadId) {
-    auto task = [threadId, mapper, reducer, neutral, nthreads, ntasks]() {
-      T res = neutral;
-      for (size_t taskId = threadId; taskId < ntasks; taskId += nthreads) {
-        res = reducer(res, mapper(taskId));
-      }
-      return res;
-    };
-    futures.emplace_back(threadPool_->addTask(task));
+  futures.reserve(nthreads_);
+  for (size_t pool = 0; pool < threadPools_.size(); ++pool) {
+    const auto range = taskRange(pool, ntasks);
+    const size_t nthreads = threadPools_[pool]->nthreads();
+    for (size_t threadId = 0; threadId < nthreads; ++threadId) {
+      auto task = [threadId, mapper, reducer, neutral, nthreads, range]() {
+        T res = neutral;
+        for (size_t taskId = range.first + threadId; taskId < range.second;
+             taskId += nthreads) {
+          res = reducer(res, mapper(taskId));
+        }
+        return res;
+      };
+      futures.emplace_back(threadPools_[pool]->addTask(task));
+    }
   }
   return std::accumulate(
     futures.begin(), futures.end(), neutral,
@@ -63,21 +93,24 @@ T ParallelExecutor::mapReduce(const std::vector<ElemT>& elems,
                               ReducerT&& reducer,
                               T neutral) {
   const size_t nelems = elems.size();
-  const size_t nthreads = threadPool_->nthreads();
+  const size_t nthreads = nthreads_;
   std::vector<std::future<T>> futures;
   futures.reserve(nthreads);
-  for (size_t threadId = 0; threadId < nthreads; ++threadId) {
-    auto task =
-      [&elems, threadId, mapper, reducer, neutral, nthreads, nelems]() {
-        const size_t blockSize = nelems / nthreads;
-        return std::accumulate(
-          elems.begin() + threadId * blockSize,
-          elems.begin() + std::min((threadId + 1) * blockSize, nelems),
-          neutral, [mapper, reducer](T res, const auto& elem) {
-            return reducer(res, mapper(elem));
-          });
-      };
-    futures.emplace_back(threadPool_->addTask(task));
+  for (size_t pool = 0; pool < threadPools_.size(); ++pool) {
+    for (size_t threadId = threadOffsets_[pool];
+         threadId < threadOffsets_[pool + 1]; ++threadId) {
+      auto task =
+        [&elems, threadId, mapper, reducer, neutral, nthreads, nelems]() {
+          const size_t blockSize = nelems / nthreads;
+          return std::accumulate(
+            elems.begin() + threadId * blockSize,
+            elems.begin() + std::min((threadId + 1) * blockSize, nelems),
+            neutral, [mapper, reducer](T res, const auto& elem) {
+              return reducer(res, mapper(elem));
+            });
+        };
+      futures.emplace_back(threadPools_[pool]->addTask(task));
+    }
   }
   return std::accumulate(
     futures.begin(), futures.end(), neutral,
@@ -18,6 +18,7 @@
 
 #include <numeric>
 
+#include <qmf/utils/Numa.h>
 #include <qmf/utils/ThreadPool.h>
 
 namespace qmf {
@@ -26,9 +27,15 @@ namespace qmf {
 class ParallelExecutor {
  public:
   explicit ParallelExecutor(const size_t nthreads)
-    : threadPool_(std::make_unique<ThreadPool>(nthreads)) {
+    : threadOffsets_({0, nthreads}), nthreads_(nthreads) {
+    threadPools_.push_back(std::make_unique<ThreadPool>(nthreads));
   }
 
+  // one pool per numa node with the threads bound to the node, the threads
+  // split evenly. the tasks are split to contiguous ranges of the nodes, so
+  // task i runs on the same node by every call with the same ntasks
+  ParallelExecutor(const size_t nthreads, const NumaTopology& topology);
+
   // executes `func` on `ntasks` tasks.
   // `func`'s signature is void(const size_t taskId)
   template <typename FuncT>
@@ -53,11 +60,20 @@ class ParallelExecutor {
               T neutral);
 
   size_t nthreads() const {
-    return threadPool_->nthreads();
+    return nthreads_;
   }
 
  private:
-  std::unique_ptr<ThreadPool> threadPool_;
+  // the tasks [begin, end) of the pool
+  std::pair<size_t, size_t> taskRange(const size_t pool,
+                                      const size_t ntasks) const;
+
+  std::vector<std::unique_ptr<ThreadPool>> threadPools_;
+
+  // the first thread of each pool, and the total at the end
+  std::vector<size_t> threadOffsets_;
+
+  size_t nthreads_;
 };
 }
 
@@ -18,10 +18,15 @@
 
 namespace qmf {
 
-ThreadPool::ThreadPool(const size_t nthreads) : poison_(false) {
+ThreadPool::ThreadPool(const size_t nthreads) : ThreadPool(nthreads, Task()) {
+}
+
+ThreadPool::ThreadPool(const size_t nthreads, Task threadInit)
+  : poison_(false) {
   CHECK_GT(nthreads, 0) << "the number of threads should be positive";
   for (size_t i = 0; i < nthreads; ++i) {
-    threads_.emplace_back(std::bind(&ThreadPool::threadRun, this));
+    threads_.emplace_back(
+      [this, threadInit]() { this->threadRun(threadInit); });
   }
 }
 
@@ -35,7 +40,10 @@ ThreadPool::~ThreadPool() {
   }
 }
 
-void ThreadPool::threadRun() {
+void ThreadPool::threadRun(const Task& threadInit) {
+  if (threadInit) {
+    threadInit();
+  }
   while (true) {
     Task task;
     {
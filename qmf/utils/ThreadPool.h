@@ -38,6 +38,9 @@ class ThreadPool {
   // nthreads is the number of threads in the pool to be used during the execution
   explicit ThreadPool(const size_t nthreads);
 
+  // threadInit runs first in each thread, e.g. to bind it to some cpus
+  ThreadPool(const size_t nthreads, Task threadInit);
+
   ~ThreadPool();
 
   // not copyable, not movable
@@ -55,7 +58,7 @@ class ThreadPool {
     -> std::future<typename std::result_of<FuncT(Args...)>::type>;
 
  private:
-  void threadRun();
+  void threadRun(const Task& threadInit);
 
   std::queue<Task> tasks_;
 
@@ -0,0 +1,33 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace qmf {
+
+// wall time elapsed since constructed or reset
+class Timer {
+ public:
+  Timer() : start_(std::chrono::steady_clock::now()) {
+  }
+
+  void reset() {
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+      .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+}
@@ -0,0 +1,190 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <qmf/utils/Trace.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+// the events buffered at most, the later ones are dropped until flushed
+const size_t kMaxBufferBytes = 64 << 20;
+
+const auto kFlushInterval = std::chrono::milliseconds(200);
+
+std::string escape(const std::string& str) {
+  std::string escaped;
+  escaped.reserve(str.size());
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+std::string argsOf(const std::string& args) {
+  return args.empty() ? "" : ",\"args\":{" + args + "}";
+}
+}
+
+Trace& Trace::get() {
+  // never destroyed, the events may be recorded at exit
+  static Trace* instance = new Trace();
+  return *instance;
+}
+
+int64_t Trace::wallMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+int Trace::threadId() {
+  static std::atomic<int> nextId{1};
+  static thread_local const int id = nextId.fetch_add(1);
+  return id;
+}
+
+bool Trace::open(const std::string& fileName, const std::string& processName) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(!fp_) << "trace is already open";
+  fp_ = fopen(fileName.c_str(), "w");
+  if (!fp_) {
+    LOG(ERROR) << "can not open " << fileName;
+    return false;
+  }
+
+  pid_ = getpid();
+  buffer_ = "[\n";
+  buffer_ += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" +
+             std::to_string(pid_) + ",\"tid\":0,\"args\":{\"name\":\"" +
+             escape(processName) + "\"}},\n";
+  stop_ = false;
+  flushThread_ = std::thread(&Trace::flushRun, this);
+  enabled_ = true;
+  LOG(INFO) << "tracing to " << fileName;
+  return true;
+}
+
+void Trace::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!fp_) {
+      return;
+    }
+    enabled_ = false;
+    stop_ = true;
+  }
+  notify_.notify_all();
+  flushThread_.join();
+
+  // the last event has no trailing comma
+  std::string tail = "{\"name\":\"trace_end\",\"ph\":\"i\",\"s\":\"p\",\"ts\":" +
+                     std::to_string(now()) +
+                     ",\"pid\":" + std::to_string(pid_) + ",\"tid\":0}\n]\n";
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffer_ += tail;
+  flush(buffer_);
+  fclose(fp_);
+  fp_ = nullptr;
+  LOG_IF(WARNING, dropped_ > 0) << "trace dropped " << dropped_ << " events";
+}
+
+void Trace::nameThread(const std::string& name) {
+  if (!enabled()) {
+    return;
+  }
+  append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" +
+         std::to_string(pid_) + ",\"tid\":" + std::to_string(threadId()) +
+         ",\"args\":{\"name\":\"" + escape(name) + "\"}}");
+}
+
+void Trace::complete(const char* cat,
+                     const std::string& name,
+                     const int64_t start,
+                     const std::string& args) {
+  if (!enabled()) {
+    return;
+  }
+  const int64_t end = now();
+  append("{\"name\":\"" + escape(name) + "\",\"cat\":\"" + cat +
+         "\",\"ph\":\"X\",\"ts\":" + std::to_string(start) +
+         ",\"dur\":" + std::to_string(std::max<int64_t>(end - start, 0)) +
+         ",\"pid\":" + std::to_string(pid_) +
+         ",\"tid\":" + std::to_string(threadId()) + argsOf(args) + "}");
+}
+
+void Trace::async(const char* cat,
+                  const std::string& name,
+                  const uint64_t id,
+                  const int64_t start,
+                  const std::string& args) {
+  if (!enabled()) {
+    return;
+  }
+  const std::string common = "{\"name\":\"" + escape(name) + "\",\"cat\":\"" +
+                             cat + "\",\"id\":\"" + std::to_string(id) +
+                             "\",\"pid\":" + std::to_string(pid_) +
+                             ",\"tid\":" + std::to_string(threadId());
+  append(common + ",\"ph\":\"b\",\"ts\":" + std::to_string(start) +
+         argsOf(args) + "},\n" + common + ",\"ph\":\"e\",\"ts\":" +
+         std::to_string(now()) + "}");
+}
+
+void Trace::instant(const char* cat,
+                    const std::string& name,
+                    const std::string& args) {
+  if (!enabled()) {
+    return;
+  }
+  append("{\"name\":\"" + escape(name) + "\",\"cat\":\"" + cat +
+         "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" + std::to_string(now()) +
+         ",\"pid\":" + std::to_string(pid_) +
+         ",\"tid\":" + std::to_string(threadId()) + argsOf(args) + "}");
+}
+
+void Trace::append(const std::string& event) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffer_.size() + event.size() > kMaxBufferBytes) {
+    ++dropped_;
+    return;
+  }
+  buffer_ += event;
+  buffer_ += ",\n";
+}
+
+void Trace::flushRun() {
+  std::string buffer;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    notify_.wait_for(lock, kFlushInterval);
+    buffer.swap(buffer_);
+    lock.unlock();
+    flush(buffer);
+    buffer.clear();
+    lock.lock();
+  }
+}
+
+void Trace::flush(std::string& buffer) {
+  // only the flush thread, or close() after it stopped, writes the file
+  if (!buffer.empty() &&
+      (fwrite(buffer.data(), 1, buffer.size(), fp_) != buffer.size() ||
+       fflush(fp_) != 0)) {
+    LOG(ERROR) << "write trace failed";
+  }
+}
+}
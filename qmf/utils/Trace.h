@@ -0,0 +1,125 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace qmf {
+
+/**
+ * Records the trace events of the process in the Chrome trace-event JSON
+ * array format, which chrome://tracing and Perfetto open directly. The events
+ * are streamed to the file by a background thread, one event per line, so a
+ * killed process still leaves a readable trace. It does nothing until open().
+ *
+ * The timestamps are the wall clock in microseconds plus the clock offset,
+ * the Labors set their offset to the Scheduler's clock, so the traces of all
+ * the processes can be merged into one timeline, see trace_merge.
+ *
+ *   TraceScope scope("labor", "calc", "\"bucket\":3");
+ */
+class Trace {
+ public:
+  static Trace& get();
+
+  // starts writing to the file, the process is named in the viewer
+  bool open(const std::string& fileName, const std::string& processName);
+  // writes the buffered events and closes the file
+  void close();
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // the wall clock, without the offset
+  static int64_t wallMicros();
+
+  // the trace clock, the wall clock plus the offset
+  int64_t now() const {
+    return wallMicros() + offset_.load(std::memory_order_relaxed);
+  }
+
+  void setClockOffset(const int64_t micros) {
+    offset_.store(micros, std::memory_order_relaxed);
+  }
+
+  // names the current thread in the viewer
+  void nameThread(const std::string& name);
+
+  // args is the content of a JSON object, e.g. "\"taskid\":1", may be empty
+
+  // a slice from start to now
+  void complete(const char* cat,
+                const std::string& name,
+                const int64_t start,
+                const std::string& args = "");
+  // a slice from start to now on its own track, may overlap with the others
+  // of the same name, e.g. the buckets inflight in one Labor
+  void async(const char* cat,
+             const std::string& name,
+             const uint64_t id,
+             const int64_t start,
+             const std::string& args = "");
+  void instant(const char* cat,
+               const std::string& name,
+               const std::string& args = "");
+
+ private:
+  Trace() = default;
+
+  static int threadId();
+
+  void append(const std::string& event);
+  void flushRun();
+  void flush(std::string& buffer);
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64_t> offset_{0};
+  int pid_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable notify_;
+  std::string buffer_;
+  uint64_t dropped_ = 0;
+  bool stop_ = false;
+
+  FILE* fp_ = nullptr;
+  std::thread flushThread_;
+};
+
+// records a slice of the scope if the trace is enabled
+class TraceScope {
+ public:
+  TraceScope(const char* cat, std::string name, std::string args = "")
+    : cat_(cat),
+      name_(std::move(name)),
+      args_(std::move(args)),
+      start_(Trace::get().enabled() ? Trace::get().now() : -1) {
+  }
+
+  ~TraceScope() {
+    if (start_ >= 0) {
+      Trace::get().complete(cat_, name_, start_, args_);
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* cat_;
+  const std::string name_;
+  const std::string args_;
+  const int64_t start_;
+};
+}
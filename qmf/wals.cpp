@@ -14,9 +14,14 @@
  * limitations under the License.
  */
 
+#include <csignal>
+
 #include <qmf/wals/WALSEngine.h>
 #include <qmf/DatasetReader.h>
 #include <qmf/metrics/MetricsEngine.h>
+#include <qmf/utils/Allocator.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
 #include <qmf/utils/Util.h>
 
 #include <gflags/gflags.h>
@@ -29,9 +34,22 @@ DEFINE_double(regularization_lambda, 0.05, "regularization param");
 DEFINE_double(confidence_weight, 40, "confidence weight");
 DEFINE_double(init_distribution_bound, 0.01, "init distirbution bound");
 DEFINE_string(distribution_file, "", "uniform distribution file, for repeatable result");
+DEFINE_string(warm_item_factors, "", "item factors of the previous training "
+                                     "to warm start from");
+DEFINE_double(tolerance, 0, "stop when the relative improvement of train "
+                            "loss is below it (0 = run all epochs)");
 
 // settings
 DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+DEFINE_string(huge_pages, "none", "huge pages of the factors: none, madvise "
+                                   "(transparent) or hugetlb (reserved pool)");
+DEFINE_bool(pad_rows, true, "start each factor row on a cache line");
+DEFINE_string(factor_dir, "", "maps the factors to temporary files of this "
+                              "directory, e.g. on a local SSD, for the "
+                              "factors larger than the memory (empty = in "
+                              "memory)");
+DEFINE_bool(numa, false, "split the threads over the numa nodes and keep the "
+                         "factor rows on the node solving them");
 
 // datasets
 DEFINE_string(train_dataset, "", "filename of training dataset");
@@ -49,6 +67,11 @@ DEFINE_bool(test_always, false, "whether to compute test avg metrics after "
 DEFINE_string(user_factors, "", "filename of user factors");
 DEFINE_string(item_factors, "", "filename of item factors");
 
+// instrumentation
+DEFINE_string(instrumentation_file, "", "writes the timers and counters as "
+                                        "JSON at the end and on SIGUSR2 "
+                                        "(SIGUSR2 logs them if empty)");
+
 int main(int argc, char** argv) {
   gflags::SetUsageMessage("wals");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -66,7 +89,11 @@ int main(int argc, char** argv) {
                          FLAGS_regularization_lambda,
                          FLAGS_confidence_weight,
                          FLAGS_init_distribution_bound,
-                         FLAGS_distribution_file};
+                         FLAGS_distribution_file,
+                         FLAGS_warm_item_factors,
+                         FLAGS_tolerance,
+                         FLAGS_pad_rows,
+                         FLAGS_factor_dir};
 
   qmf::MetricsConfig metricsConfig{
     FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed};
@@ -82,25 +109,53 @@ int main(int argc, char** argv) {
     }
   }
 
-  qmf::WALSEngine engine(config, metricsEngine, FLAGS_nthreads);
+  // before the engine allocates the factors
+  qmf::HugePages hugePages;
+  CHECK(qmf::parseHugePages(FLAGS_huge_pages, &hugePages))
+    << "invalid --huge_pages " << FLAGS_huge_pages;
+  qmf::setHugePages(hugePages);
+
+  // before the engine starts its threads
+  qmf::Instrumentation::get().setDumpFile(FLAGS_instrumentation_file);
+  qmf::Instrumentation::get().dumpOnSignal(SIGUSR2);
+
+  qmf::WALSEngine engine(config, metricsEngine, FLAGS_nthreads, FLAGS_numa);
 
+  // the wall time of each phase, parsed by e2e_bench
+  qmf::Timer timer;
   LOG(INFO) << "loading training data";
   qmf::DatasetReader trainReader(FLAGS_train_dataset);
-  engine.init(trainReader.readAll());
+  auto dataset = trainReader.readAll();
+  LOG(INFO) << "phase load took " << timer.seconds() << "s, "
+            << dataset.size() << " interactions";
+
+  timer.reset();
+  engine.init(dataset);
+  dataset.clear();
+  dataset.shrink_to_fit();
 
   if (!FLAGS_test_dataset.empty()) {
     LOG(INFO) << "loading test data";
     qmf::DatasetReader testReader(FLAGS_test_dataset);
     engine.initTest(testReader.readAll());
   }
+  LOG(INFO) << "phase init took " << timer.seconds() << "s";
 
   LOG(INFO) << "training";
+  timer.reset();
   engine.optimize();
+  LOG(INFO) << "phase train took " << timer.seconds() << "s";
 
   if (!FLAGS_user_factors.empty() && !FLAGS_item_factors.empty()) {
     LOG(INFO) << "saving model output";
+    timer.reset();
     engine.saveUserFactors(FLAGS_user_factors);
     engine.saveItemFactors(FLAGS_item_factors);
+    LOG(INFO) << "phase save took " << timer.seconds() << "s";
+  }
+
+  if (!FLAGS_instrumentation_file.empty()) {
+    qmf::Instrumentation::get().dump();
   }
 
   return 0;
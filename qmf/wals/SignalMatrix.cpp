@@ -0,0 +1,188 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include <qmf/wals/SignalMatrix.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+// buckets of rows of each thread, the hot rows are balanced among them
+const size_t kBucketsPerThread = 64;
+
+int64_t sourceOf(const DatasetElem& elem, const bool byUser) {
+  return byUser ? elem.userId : elem.itemId;
+}
+
+int64_t targetOf(const DatasetElem& elem, const bool byUser) {
+  return byUser ? elem.itemId : elem.userId;
+}
+}
+
+void SignalMatrix::build(const std::vector<DatasetElem>& dataset,
+                         IdIndex& userIndex,
+                         IdIndex& itemIndex,
+                         SignalMatrix& userSignals,
+                         SignalMatrix& itemSignals,
+                         ParallelExecutor& parallel) {
+  CHECK_NE(&userSignals, &itemSignals);
+  userSignals.group(dataset, true, userIndex, parallel);
+  itemSignals.group(dataset, false, itemIndex, parallel);
+}
+
+std::vector<int64_t> SignalMatrix::mergeIds(
+  std::vector<std::vector<int64_t>> lists,
+  ParallelExecutor& parallel) {
+  const size_t nlists = lists.size();
+  parallel.execute(nlists, [&](const size_t taskId) {
+    std::sort(lists[taskId].begin(), lists[taskId].end());
+  });
+
+  // merged pairwise in log2(nlists) rounds
+  for (size_t step = 1; step < nlists; step *= 2) {
+    const size_t npairs = (nlists + 2 * step - 1) / (2 * step);
+    parallel.execute(npairs, [&](const size_t taskId) {
+      const size_t left = taskId * 2 * step;
+      const size_t right = left + step;
+      if (right >= nlists) {
+        return;
+      }
+      std::vector<int64_t> merged;
+      merged.reserve(lists[left].size() + lists[right].size());
+      std::set_union(lists[left].begin(), lists[left].end(),
+                     lists[right].begin(), lists[right].end(),
+                     std::back_inserter(merged));
+      lists[left].swap(merged);
+      std::vector<int64_t>().swap(lists[right]);
+    });
+  }
+  return std::move(lists[0]);
+}
+
+void SignalMatrix::group(const std::vector<DatasetElem>& dataset,
+                         const bool byUser,
+                         IdIndex& index,
+                         ParallelExecutor& parallel) {
+  const size_t nelems = dataset.size();
+  const size_t nchunks = parallel.nthreads();
+  const size_t chunkSize = (nelems + nchunks - 1) / nchunks;
+
+  // each chunk indexes its own ids at first, rows[i] is the idx of the local
+  // index. then only the unique ids of the chunks are looked up globally
+  std::vector<size_t> rows(nelems);
+  std::vector<std::vector<int64_t>> chunkIds(nchunks);
+  parallel.execute(nchunks, [&](const size_t taskId) {
+    const size_t start = std::min(taskId * chunkSize, nelems);
+    const size_t end = std::min(start + chunkSize, nelems);
+    IdIndex local;
+    for (size_t i = start; i < end; ++i) {
+      rows[i] = local.getOrSetIdx(sourceOf(dataset[i], byUser));
+    }
+    chunkIds[taskId] = local.ids();
+  });
+
+  ids_ = mergeIds(chunkIds, parallel);
+  index.build(ids_);
+
+  const size_t nrows = ids_.size();
+  offsets_.assign(nrows + 1, 0);
+  signals_.resize(nelems);
+  if (nelems == 0) {
+    return;
+  }
+
+  const size_t rowsPerBucket =
+    (nrows + nchunks * kBucketsPerThread - 1) / (nchunks * kBucketsPerThread);
+  const size_t nbuckets = (nrows + rowsPerBucket - 1) / rowsPerBucket;
+  CHECK_LE(rowsPerBucket, std::numeric_limits<uint32_t>::max());
+
+  // the rows of each chunk to the global idxs, and the signals of each chunk
+  // to each bucket are counted and turned to the offsets to scatter them.
+  // bucket major, so the chunks of a bucket are in order
+  std::vector<size_t> counts(nchunks * nbuckets, 0);
+  parallel.execute(nchunks, [&](const size_t taskId) {
+    const size_t start = std::min(taskId * chunkSize, nelems);
+    const size_t end = std::min(start + chunkSize, nelems);
+    std::vector<size_t> globalIdxs(chunkIds[taskId].size());
+    for (size_t j = 0; j < globalIdxs.size(); ++j) {
+      globalIdxs[j] = index.idx(chunkIds[taskId][j]);
+    }
+    size_t* chunkCounts = counts.data() + taskId * nbuckets;
+    for (size_t i = start; i < end; ++i) {
+      rows[i] = globalIdxs[rows[i]];
+      ++chunkCounts[rows[i] / rowsPerBucket];
+    }
+  });
+
+  std::vector<size_t> bucketOffsets(nbuckets + 1);
+  size_t offset = 0;
+  for (size_t bucket = 0; bucket < nbuckets; ++bucket) {
+    bucketOffsets[bucket] = offset;
+    for (size_t chunk = 0; chunk < nchunks; ++chunk) {
+      const size_t count = counts[chunk * nbuckets + bucket];
+      counts[chunk * nbuckets + bucket] = offset;
+      offset += count;
+    }
+  }
+  bucketOffsets[nbuckets] = offset;
+
+  // scatter to the buckets with the row in the bucket
+  std::vector<Signal> scattered(nelems);
+  std::vector<uint32_t> localRows(nelems);
+  parallel.execute(nchunks, [&](const size_t taskId) {
+    const size_t start = std::min(taskId * chunkSize, nelems);
+    const size_t end = std::min(start + chunkSize, nelems);
+    size_t* positions = counts.data() + taskId * nbuckets;
+    for (size_t i = start; i < end; ++i) {
+      const auto& elem = dataset[i];
+      const size_t row = rows[i];
+      const size_t bucket = row / rowsPerBucket;
+      const size_t pos = positions[bucket]++;
+      scattered[pos] = Signal{targetOf(elem, byUser), elem.value};
+      localRows[pos] = row - bucket * rowsPerBucket;
+    }
+  });
+
+  // counting sort the bucket to its rows, then sort each row by id
+  parallel.execute(nbuckets, [&](const size_t bucket) {
+    const size_t firstRow = bucket * rowsPerBucket;
+    const size_t nlocal = std::min(rowsPerBucket, nrows - firstRow);
+    const size_t begin = bucketOffsets[bucket];
+    const size_t end = bucketOffsets[bucket + 1];
+
+    std::vector<size_t> rowOffsets(nlocal + 1, 0);
+    for (size_t pos = begin; pos < end; ++pos) {
+      ++rowOffsets[localRows[pos] + 1];
+    }
+    rowOffsets[0] = begin;
+    for (size_t r = 0; r < nlocal; ++r) {
+      rowOffsets[r + 1] += rowOffsets[r];
+      offsets_[firstRow + r] = rowOffsets[r];
+    }
+
+    std::vector<size_t> positions(rowOffsets.begin(), rowOffsets.end() - 1);
+    for (size_t pos = begin; pos < end; ++pos) {
+      signals_[positions[localRows[pos]]++] = scattered[pos];
+    }
+
+    for (size_t r = 0; r < nlocal; ++r) {
+      std::sort(signals_.begin() + rowOffsets[r],
+                signals_.begin() + rowOffsets[r + 1],
+                [](const Signal& x, const Signal& y) {
+                  return x.id < y.id || (x.id == y.id && x.value < y.value);
+                });
+    }
+  });
+  offsets_[nrows] = nelems;
+}
+}
@@ -0,0 +1,121 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/Types.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+namespace qmf {
+
+/**
+ * The signals of the dataset grouped by user (CSR) or by item (CSC). Group
+ * i belongs to the i-th smallest source id, which is also its idx in the
+ * index, and its signals are sorted by id. Both sides are built in parallel
+ * from the dataset directly: the ids are deduplicated per chunk and merged,
+ * then the signals are counting sorted to buckets of rows and to the rows
+ * inside each bucket, no copy of the dataset is sorted.
+ */
+
+struct Signal {
+  int64_t id;
+  Double value;
+};
+
+// a view of the signals of one group
+class SignalSpan {
+ public:
+  SignalSpan(const Signal* begin, const Signal* end)
+    : begin_(begin), end_(end) {
+  }
+
+  const Signal* begin() const {
+    return begin_;
+  }
+
+  const Signal* end() const {
+    return end_;
+  }
+
+  size_t size() const {
+    return end_ - begin_;
+  }
+
+  const Signal& operator[](const size_t i) const {
+    return begin_[i];
+  }
+
+ private:
+  const Signal* begin_;
+  const Signal* end_;
+};
+
+struct SignalGroup {
+  int64_t sourceId;
+  SignalSpan group;
+};
+
+class SignalMatrix {
+ public:
+  SignalMatrix() = default;
+
+  // groups by userId to userSignals and by itemId to itemSignals, the
+  // indexes are replaced by the sorted unique ids
+  static void build(const std::vector<DatasetElem>& dataset,
+                    IdIndex& userIndex,
+                    IdIndex& itemIndex,
+                    SignalMatrix& userSignals,
+                    SignalMatrix& itemSignals,
+                    ParallelExecutor& parallel);
+
+  size_t size() const {
+    return ids_.size();
+  }
+
+  bool empty() const {
+    return ids_.empty();
+  }
+
+  // the signals of all the groups
+  size_t nsignals() const {
+    return signals_.size();
+  }
+
+  SignalGroup operator[](const size_t i) const {
+    const Signal* base = signals_.data();
+    return SignalGroup{
+      ids_[i], SignalSpan(base + offsets_[i], base + offsets_[i + 1])};
+  }
+
+  void clear() {
+    ids_.clear();
+    offsets_.clear();
+    signals_.clear();
+  }
+
+ private:
+  // the sorted union of the unique ids of the chunks
+  static std::vector<int64_t> mergeIds(std::vector<std::vector<int64_t>> lists,
+                                       ParallelExecutor& parallel);
+
+  // groups by userId or itemId, the index is replaced
+  void group(const std::vector<DatasetElem>& dataset,
+             const bool byUser,
+             IdIndex& index,
+             ParallelExecutor& parallel);
+
+  // sourceId of each group
+  std::vector<int64_t> ids_;
+  // group i is [offsets_[i], offsets_[i + 1]) of signals_
+  std::vector<size_t> offsets_;
+  std::vector<Signal> signals_;
+};
+}
@@ -19,14 +19,28 @@
 
 #include <omp.h>
 
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
 #include <qmf/wals/WALSEngine.h>
+#include <qmf/wals/WALSSolver.h>
 
 namespace qmf {
 
+namespace {
+
+// the rows of mapped factors read ahead of the solving
+const size_t kPrefetchBytes = 16 << 20;
+}
+
 WALSEngine::WALSEngine(const WALSConfig& config,
                        const std::unique_ptr<MetricsEngine>& metricsEngine,
-                       const size_t nthreads)
-  : config_(config), metricsEngine_(metricsEngine), parallel_(nthreads) {
+                       const size_t nthreads,
+                       const bool numa)
+  : config_(config),
+    metricsEngine_(metricsEngine),
+    parallel_(numa ? ParallelExecutor(nthreads, NumaTopology::get())
+                   : ParallelExecutor(nthreads)) {
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
       metricsEngine_->config().numTestUsers == 0) {
     LOG(WARNING) << "computing average test metrics on all users can be slow! "
@@ -37,23 +51,26 @@ WALSEngine::WALSEngine(const WALSConfig& config,
 void WALSEngine::init(const std::vector<DatasetElem>& dataset) {
   CHECK(!userFactors_ && !itemFactors_)
     << "engine was already initialized with train data";
-  auto mutableDataset = dataset;
-  groupSignals(userSignals_, userIndex_, mutableDataset);
-  // swap userId with itemId
-  for (auto& elem : mutableDataset) {
-    // g++ will complain for "cannot bind packed field to xxx&"
-#if !defined(__GNUC__)
-    std::swap(elem.userId, elem.itemId);
-#else
-    auto tmp = elem.userId;
-    elem.userId = elem.itemId;
-    elem.itemId = tmp;
-#endif
+  static const Histogram initTime("wals.init");
+  static const Histogram groupTime("wals.group_signals");
+  ScopedTimer timer(initTime);
+  {
+    ScopedTimer groupTimer(groupTime);
+    SignalMatrix::build(
+      dataset, userIndex_, itemIndex_, userSignals_, itemSignals_, parallel_);
   }
-  groupSignals(itemSignals_, itemIndex_, mutableDataset);
 
-  userFactors_ = std::make_unique<FactorData>(nusers(), config_.nfactors);
-  itemFactors_ = std::make_unique<FactorData>(nitems(), config_.nfactors);
+  // the rows are first touched by the threads solving them
+  auto makeFactors = [this](const size_t nelems) {
+    return config_.factorDir.empty()
+             ? std::make_unique<FactorData>(
+                 parallel_, nelems, config_.nfactors, false, config_.padRows)
+             : std::make_unique<FactorData>(config_.factorDir, nelems,
+                                            config_.nfactors, false,
+                                            config_.padRows);
+  };
+  userFactors_ = makeFactors(nusers());
+  itemFactors_ = makeFactors(nitems());
 
   if (config_.DistributionFile.empty()) {
     std::random_device rd;
@@ -66,6 +83,14 @@ void WALSEngine::init(const std::vector<DatasetElem>& dataset) {
   } else {
     itemFactors_->setFactors(config_.DistributionFile);
   }
+
+  // the user factors are solved from the item factors at first, so only the
+  // item factors need to be warm started
+  if (!config_.warmStartItemFactors.empty()) {
+    CHECK(FactorReader::warmStart(
+      config_.warmStartItemFactors, itemIndex_, *itemFactors_))
+      << "warm start from " << config_.warmStartItemFactors << " failed";
+  }
 }
 
 void WALSEngine::initTest(const std::vector<DatasetElem>& testDataset) {
@@ -83,15 +108,34 @@ void WALSEngine::optimize() {
   CHECK(userFactors_ && itemFactors_)
     << "no factor data, have you initialized the engine?";
 
+  epochs_ = 0;
+  converged_ = false;
   for (size_t epoch = 1; epoch <= config_.nepochs; ++epoch) {
+    Timer timer;
     // fix item factors, update user factors
     iterate(*userFactors_, userIndex_, userSignals_, *itemFactors_, itemIndex_);
     // fix user factors, update item factors
     const Double loss = iterate(
       *itemFactors_, itemIndex_, itemSignals_, *userFactors_, userIndex_);
-    LOG(INFO) << "epoch " << epoch << ": train loss = " << loss;
+    LOG(INFO) << "epoch " << epoch << ": train loss = " << loss << ", took "
+              << timer.seconds() << "s";
+
+    converged_ = config_.tolerance > 0 && epoch > 1 &&
+                 loss_ - loss < config_.tolerance * loss_;
+    epochs_ = epoch;
+    loss_ = loss;
     // evaluate
     evaluate(epoch);
+    if (metricsEngine_) {
+      metricsEngine_->recordInstrumentation(
+        epoch, Instrumentation::get().snapshot());
+    }
+
+    if (converged_) {
+      LOG(INFO) << "converged at epoch " << epoch << " with tolerance "
+                << config_.tolerance;
+      break;
+    }
   }
 }
 
@@ -99,8 +143,11 @@ void WALSEngine::evaluate(const size_t epoch) {
   // evaluate test average metrics
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
       !testUsers_.empty() &&
-      (metricsEngine_->config().alwaysCompute || epoch == config_.nepochs)) {
+      (metricsEngine_->config().alwaysCompute || epoch == config_.nepochs ||
+       converged_)) {
 
+    static const Histogram evaluateTime("wals.evaluate");
+    ScopedTimer timer(evaluateTime);
     LOG(INFO) << "do compute evaluate ..." << std::endl;
     computeTestScores(
       testScores_, testUsers_, *userFactors_, *itemFactors_, parallel_);
@@ -127,55 +174,32 @@ size_t WALSEngine::nitems() const {
   return itemIndex_.size();
 }
 
-void WALSEngine::groupSignals(std::vector<SignalGroup>& signals,
-                              IdIndex& index,
-                              std::vector<DatasetElem>& dataset) {
-  sortDataset(dataset);
-  const int64_t InvalidId = std::numeric_limits<int64_t>::min();
-  int64_t prevId = InvalidId;
-  std::vector<Signal> group;
-  for (const auto& elem : dataset) {
-    if (elem.userId != prevId) {
-      if (prevId != InvalidId) {
-        signals.emplace_back(SignalGroup{prevId, group});
-      }
-      prevId = elem.userId;
-      group.clear();
-    }
-    group.emplace_back(Signal{elem.itemId, elem.value});
-  }
-  if (prevId != InvalidId) {
-    signals.emplace_back(SignalGroup{prevId, group});
-  }
-  for (size_t i = 0; i < signals.size(); ++i) {
-    const size_t idx = index.getOrSetIdx(signals[i].sourceId);
-    CHECK_EQ(idx, i);
-  }
-}
-
-void WALSEngine::sortDataset(std::vector<DatasetElem>& dataset) {
-  std::sort(dataset.begin(), dataset.end(), [](const auto& x, const auto& y) {
-    if (x.userId != y.userId) {
-      return x.userId < y.userId;
-    }
-    return x.itemId < y.itemId;
-  });
-}
-
 Double WALSEngine::iterate(FactorData& leftData,
                            const IdIndex& leftIndex,
-                           const std::vector<SignalGroup>& leftSignals,
+                           const SignalMatrix& leftSignals,
                            const FactorData& rightData,
                            const IdIndex& rightIndex) {
-  auto genZero = [](auto...) { return 0.0; };
-  leftData.setFactors(genZero);
+  static const Histogram iterateTime("wals.iterate");
+  static const Histogram xtxTime("wals.xtx");
+  static const Histogram solveTime("wals.solve_row");
+  static const Counter signalCount("wals.signals");
+  ScopedTimer timer(iterateTime);
 
   Matrix& X = leftData.getFactors();
   const Matrix& Y = rightData.getFactors();
 
+  // every row is solved below, zeroing a mapped X is only a pass more over
+  // the file
+  if (!X.mapped()) {
+    leftData.setFactors(parallel_);
+  }
+
   // Matrix YtY = computeXtX(Y);
   Matrix YtY(X.ncols(), X.ncols());
-  computeXtX(Y, &YtY);
+  {
+    ScopedTimer xtxTimer(xtxTime);
+    WALSSolver::computeXtX(Y, &YtY);
+  }
 
 #if 0
 
@@ -193,8 +217,8 @@ Double WALSEngine::iterate(FactorData& leftData,
 #pragma omp for
     for (size_t i = 0; i < count; ++i) {
       const size_t leftIdx = leftIndex.idx(leftSignals[i].sourceId);
-      loss += updateFactorsForOne(X.data(leftIdx), X.ncols(), Y, rightIndex,
-                                  leftSignals[i], YtY, alpha, lambda);
+      loss += WALSSolver::solveRow(X.data(leftIdx), Y, YtY, rightIndex,
+                                   leftSignals[i], alpha, lambda);
     }
   }
 
@@ -202,156 +226,38 @@ Double WALSEngine::iterate(FactorData& leftData,
 
 #else
 
-  auto map = [&X, &leftIndex, &Y, &rightIndex, &leftSignals, YtY,
+  // task i solves row i, so a mapped X is written from the first row to the
+  // last. each window of rows is read in when the previous one is started
+  const size_t window =
+    std::max<size_t>(kPrefetchBytes / (X.stride() * sizeof(Double)), 1);
+  X.prefetchRows(0, window);
+
+  auto map = [&X, &leftIndex, &Y, &rightIndex, &leftSignals, &YtY, window,
               alpha = config_.confidenceWeight,
               lambda = config_.regularizationLambda](const size_t taskId) {
-    return updateFactorsForOne(
-      X, leftIndex, Y, rightIndex, leftSignals[taskId], YtY, alpha, lambda);
+    if (taskId % window == 0) {
+      X.prefetchRows(taskId + window, taskId + 2 * window);
+    }
+    const SignalGroup signalGroup = leftSignals[taskId];
+    return WALSSolver::solveRow(X.data(leftIndex.idx(signalGroup.sourceId)), Y,
+                                YtY, rightIndex, signalGroup, alpha, lambda);
   };
 
   auto reduce = [](Double sum, Double x) { return sum + x; };
 
+  // timed once per iterate rather than per row, the hot loop stays free of
+  // clock reads. the recorded figure is the mean solve time of one row on one
+  // thread
+  Timer solveTimer;
   Double loss = parallel_.mapReduce(leftSignals.size(), map, reduce, 0.0);
+  if (leftSignals.size() > 0) {
+    solveTime.recordSeconds(solveTimer.seconds() * parallel_.nthreads() /
+                            leftSignals.size());
+  }
+  signalCount.add(leftSignals.nsignals());
   return loss / nusers() / nitems();
 
 #endif
 }
 
-Matrix WALSEngine::computeXtX(const Matrix& X) {
-  const size_t nrows = X.nrows();
-  const size_t ntasks = parallel_.nthreads();
-  const size_t taskSize = (nrows + ntasks - 1) / ntasks;
-
-  auto map = [&X, taskSize](const size_t taskId) {
-    const size_t ncols = X.ncols();
-    Matrix XtX(ncols, ncols);
-    const size_t l = taskId * taskSize;
-    const size_t r = std::min(X.nrows(), (taskId + 1) * taskSize);
-    for (size_t k = l; k < r; ++k) {
-      for (size_t i = 0; i < ncols; ++i) {
-        for (size_t j = 0; j < ncols; ++j) {
-          XtX(i, j) += X(k, i) * X(k, j);
-        }
-      }
-    }
-    return XtX;
-  };
-
-  auto reduce = [](const Matrix& S, const Matrix& X) { return S + X; };
-
-  Matrix O(X.ncols(), X.ncols());
-  return parallel_.mapReduce(ntasks, map, reduce, O);
-}
-
-void WALSEngine::computeXtX(const Matrix& X, Matrix* out) {
-
-  // assert X and out samesize
-
-  // omp_set_num_threads(16);
-  
-  out->clear();
-  const size_t nrows = X.nrows();
-  const size_t ncols = X.ncols();
-
-#pragma omp parallel for
-  for (size_t k = 0; k < nrows; ++k) {
-    for (size_t i = 0; i < ncols; ++i) {
-      for (size_t j = 0; j < ncols; ++j) {
-        (*out)(i, j) += X(k, i) * X(k, j);
-      }
-    }
-  }
-}
-
-Double WALSEngine::updateFactorsForOne(Matrix& X,
-                                       const IdIndex& leftIndex,
-                                       const Matrix& Y,
-                                       const IdIndex& rightIndex,
-                                       const SignalGroup& signalGroup,
-                                       Matrix A,
-                                       const Double alpha,
-                                       const Double lambda) {
-  Double loss = 0.0;
-  const size_t n = X.ncols();
-  Vector b(n);
-  for (const auto& signal : signalGroup.group) {
-    const size_t rightIdx = rightIndex.idx(signal.id);
-    for (size_t i = 0; i < n; ++i) {
-      b(i) += Y(rightIdx, i) * (1.0 + alpha * signal.value);
-      for (size_t j = 0; j < n; ++j) {
-        A(i, j) += Y(rightIdx, i) * alpha * signal.value * Y(rightIdx, j);
-      }
-    }
-    // for term p^t * C * p
-    loss += 1.0 + alpha * signal.value;
-  }
-  // B = Y^t * C * Y
-  Matrix B = A;
-  for (size_t i = 0; i < n; ++i) {
-    A(i, i) += lambda;
-  }
-  // A * x = b
-  Vector x = linearSymmetricSolve(A, b);
-  // x^t * Y^t * C * Y * x
-  for (size_t i = 0; i < n; ++i) {
-    for (size_t j = 0; j < n; ++j) {
-      loss += B(i, j) * x(i) * x(j);
-    }
-  }
-  // -2 * x^t * Y^t * C * p
-  for (size_t i = 0; i < n; ++i) {
-    loss -= 2 * x(i) * b(i);
-  }
-  const size_t leftIdx = leftIndex.idx(signalGroup.sourceId);
-  for (size_t i = 0; i < n; ++i) {
-    X(leftIdx, i) = x(i);
-  }
-  return loss;
-}
-
-Double WALSEngine::updateFactorsForOne(Double* result,
-                                       const size_t n,
-                                       const Matrix& Y,
-                                       const IdIndex& rightIndex,
-                                       const SignalGroup& signalGroup,
-                                       Matrix A,
-                                       const Double alpha,
-                                       const Double lambda) {
-  Double loss = 0.0;
-  Vector b(n);
-  for (const auto& signal : signalGroup.group) {
-    const size_t rightIdx = rightIndex.idx(signal.id);
-    for (size_t i = 0; i < n; ++i) {
-      b(i) += Y(rightIdx, i) * (1.0 + alpha * signal.value);
-      for (size_t j = 0; j < n; ++j) {
-        A(i, j) += Y(rightIdx, i) * alpha * signal.value * Y(rightIdx, j);
-      }
-    }
-    // for term p^t * C * p
-    loss += 1.0 + alpha * signal.value;
-  }
-  // B = Y^t * C * Y
-  Matrix B = A;
-  for (size_t i = 0; i < n; ++i) {
-    A(i, i) += lambda;
-  }
-  // A * x = b
-  Vector x = linearSymmetricSolve(A, b);
-  // x^t * Y^t * C * Y * x
-  for (size_t i = 0; i < n; ++i) {
-    for (size_t j = 0; j < n; ++j) {
-      loss += B(i, j) * x(i) * x(j);
-    }
-  }
-  // -2 * x^t * Y^t * C * p
-  for (size_t i = 0; i < n; ++i) {
-    loss -= 2 * x(i) * b(i);
-  }
-
-  for (size_t i = 0; i < n; ++i) {
-    *(result + i) = x(i);
-  }
-  return loss;
-}
-
 } // namespace qmf
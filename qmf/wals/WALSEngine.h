@@ -25,6 +25,7 @@
 #include <qmf/Types.h>
 #include <qmf/utils/IdIndex.h>
 #include <qmf/utils/ParallelExecutor.h>
+#include <qmf/wals/SignalMatrix.h>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -39,13 +40,24 @@ struct WALSConfig {
   Double confidenceWeight;
   Double initDistributionBound;
   std::string DistributionFile;
+  // item factors of the previous training keyed by id, the unseen ids are
+  // still initialized randomly
+  std::string warmStartItemFactors;
+  // stop when the relative improvement of the train loss is below it
+  Double tolerance = 0.0;
+  // starts each factor row on a cache line, WALSEngine only
+  bool padRows = true;
+  // maps the factors to temporary files of this directory instead of the
+  // memory, for the factors larger than it, WALSEngine only
+  std::string factorDir;
 };
 
 class WALSEngine : public Engine {
  public:
   explicit WALSEngine(const WALSConfig& config,
                       const std::unique_ptr<MetricsEngine>& metricsEngine,
-                      const size_t nthreads = 16);
+                      const size_t nthreads = 16,
+                      const bool numa = false);
 
   void init(const std::vector<DatasetElem>& dataset) override;
 
@@ -59,64 +71,36 @@ class WALSEngine : public Engine {
 
   size_t nitems() const;
 
+  // epochs run by the last optimize, fewer than nepochs if converged
+  size_t epochs() const {
+    return epochs_;
+  }
+
+  Double loss() const {
+    return loss_;
+  }
+
   void saveUserFactors(const std::string& fileName) const override;
 
   void saveItemFactors(const std::string& fileName) const override;
 
  private:
-  struct Signal {
-    int64_t id;
-    Double value;
-  };
-
-  struct SignalGroup {
-    int64_t sourceId;
-    std::vector<Signal> group;
-  };
-
-  static void groupSignals(std::vector<SignalGroup>& signals,
-                           IdIndex& index,
-                           std::vector<DatasetElem>& dataset);
-
-  static void sortDataset(std::vector<DatasetElem>& dataset);
-
   Double iterate(FactorData& leftData,
                  const IdIndex& leftIndex,
-                 const std::vector<SignalGroup>& leftSignals,
+                 const SignalMatrix& leftSignals,
                  const FactorData& rightData,
                  const IdIndex& rightIndex);
 
-  Matrix computeXtX(const Matrix& X);
-  void computeXtX(const Matrix& X, Matrix* out);
-
-  /*
-   *
-   */
-  static Double updateFactorsForOne(Matrix& X,
-                                    const IdIndex& leftIndex,
-                                    const Matrix& Y,
-                                    const IdIndex& rightIndex,
-                                    const SignalGroup& signalGroup,
-                                    Matrix A,
-                                    const Double alpha,
-                                    const Double lambda);
-
-  static Double
-    updateFactorsForOne(Double* result,
-                        const size_t n,
-                        const Matrix& Y,
-                        const IdIndex& rightIndex,
-                        const SignalGroup& signalGroup, /* signal_id & value */
-                        Matrix A,                       /*YtY copy*/
-                        const Double alpha,
-                        const Double lambda);
-
   const WALSConfig& config_;
 
   const std::unique_ptr<MetricsEngine>& metricsEngine_;
 
   ParallelExecutor parallel_;
 
+  size_t epochs_ = 0;
+  Double loss_ = 0.0;
+  bool converged_ = false;
+
   // indexes
   IdIndex userIndex_;
   IdIndex itemIndex_;
@@ -126,8 +110,8 @@ class WALSEngine : public Engine {
   std::unique_ptr<FactorData> itemFactors_;
 
   // signals
-  std::vector<SignalGroup> userSignals_;
-  std::vector<SignalGroup> itemSignals_;
+  SignalMatrix userSignals_;
+  SignalMatrix itemSignals_;
 
   // test data
   std::vector<size_t> testUsers_; // indexes of test users
@@ -137,7 +121,10 @@ class WALSEngine : public Engine {
   // for unit tests
   FRIEND_TEST(WALSEngine, init);
   FRIEND_TEST(WALSEngine, initTest);
-  FRIEND_TEST(WALSEngine, computeXtX);
-  FRIEND_TEST(WALSEngine, updateFactorsForOne);
+  FRIEND_TEST(WALSEngine, warmStart);
+  FRIEND_TEST(WALSEngine, mappedFactors);
+
+  // for the microbenchmarks of qmf_bench
+  friend class KernelBench;
 };
 } // namespace qmf
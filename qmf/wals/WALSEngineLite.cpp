@@ -18,35 +18,27 @@
 
 #include <omp.h>
 
+#include <qmf/utils/FactorWriter.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Timer.h>
 #include <qmf/wals/WALSEngineLite.h>
+#include <qmf/wals/WALSSolver.h>
 
 namespace qmf {
 
-// 这个对象会被多次使用，所以需要保证初始化后是完全干净的
+// 每次都重新建立，之前共享出去的索引保持不变
 void WALSEngineLite::init() {
 
-  userIndex_.reset();
-  itemIndex_.reset();
+  static const Histogram initTime("wals_lite.init");
+  ScopedTimer timer(initTime);
 
-  userSignals_.clear();
-  itemSignals_.clear();
-
-  // 拷贝过来，建立索引
-  auto mutableDataset = bigdata_ptr_->rating_vec_;
-  groupSignals(userSignals_, userIndex_, mutableDataset);
-
-  // swap userId with itemId
-  for (auto& elem : mutableDataset) {
-// g++ will complain for "cannot bind packed field to xxx&"
-#if !defined(__GNUC__)
-    std::swap(elem.userId, elem.itemId);
-#else
-    auto tmp = elem.userId;
-    elem.userId = elem.itemId;
-    elem.itemId = tmp;
-#endif
-  }
-  groupSignals(itemSignals_, itemIndex_, mutableDataset);
+  // 直接从 rating 并行分组建立索引，不再拷贝整个数据集排序
+  auto dataset = std::make_shared<Dataset>();
+  ParallelExecutor parallel(thread_num_);
+  SignalMatrix::build(*bigdata_ptr_->rating_ptr_, dataset->userIndex,
+                      dataset->itemIndex, dataset->userSignals,
+                      dataset->itemSignals, parallel);
+  dataset_ = std::move(dataset);
 }
 
 void WALSEngineLite::optimize() {
@@ -81,69 +73,29 @@ void WALSEngineLite::evaluate(const size_t epoch) {
 #endif
 }
 
-void WALSEngineLite::saveFactors(const FactorData& factorData,
+bool WALSEngineLite::saveFactors(const FactorData& factorData,
                                  const IdIndex& index,
                                  const std::string& fileName) const {
-  std::ofstream fout(fileName);
-
-  CHECK_EQ(factorData.nelems(), index.size());
-  fout << std::fixed;
-  fout << std::setprecision(9);
-  for (size_t idx = 0; idx < factorData.nelems(); ++idx) {
-    const int64_t id = index.id(idx);
-    fout << id;
-    if (factorData.withBiases()) {
-      fout << ' ' << factorData.biasAt(idx);
-    }
-    for (size_t fidx = 0; fidx < factorData.nfactors(); ++fidx) {
-      fout << ' ' << factorData.at(idx, fidx);
-    }
-    fout << '\n';
-  }
+  ParallelExecutor parallel(thread_num_);
+  return FactorWriter::save(factorData, index, fileName, parallel);
 }
 
-void WALSEngineLite::saveUserFactors(const std::string& fileName) const {
+bool WALSEngineLite::saveUserFactors(const std::string& fileName) const {
   CHECK(bigdata_ptr_->user_factor_ptr_) << "user factors wasn't initialized";
-  saveFactors(*bigdata_ptr_->user_factor_ptr_, userIndex_, fileName);
+  return saveFactors(*bigdata_ptr_->user_factor_ptr_, userIndex(), fileName);
 }
 
-void WALSEngineLite::saveItemFactors(const std::string& fileName) const {
+bool WALSEngineLite::saveItemFactors(const std::string& fileName) const {
   CHECK(bigdata_ptr_->item_factor_ptr_) << "item factors wasn't initialized";
-  saveFactors(*bigdata_ptr_->item_factor_ptr_, itemIndex_, fileName);
+  return saveFactors(*bigdata_ptr_->item_factor_ptr_, itemIndex(), fileName);
 }
 
 size_t WALSEngineLite::nusers() const {
-  return userIndex_.size();
+  return dataset_ ? dataset_->userIndex.size() : 0;
 }
 
 size_t WALSEngineLite::nitems() const {
-  return itemIndex_.size();
-}
-
-void WALSEngineLite::groupSignals(std::vector<SignalGroup>& signals,
-                                  IdIndex& index,
-                                  std::vector<DatasetElem>& dataset) {
-  sortDataset(dataset);
-  const int64_t InvalidId = std::numeric_limits<int64_t>::min();
-  int64_t prevId = InvalidId;
-  std::vector<Signal> group;
-  for (const auto& elem : dataset) {
-    if (elem.userId != prevId) {
-      if (prevId != InvalidId) {
-        signals.emplace_back(SignalGroup{prevId, group});
-      }
-      prevId = elem.userId;
-      group.clear();
-    }
-    group.emplace_back(Signal{elem.itemId, elem.value});
-  }
-  if (prevId != InvalidId) {
-    signals.emplace_back(SignalGroup{prevId, group});
-  }
-  for (size_t i = 0; i < signals.size(); ++i) {
-    const size_t idx = index.getOrSetIdx(signals[i].sourceId);
-    CHECK_EQ(idx, i);
-  }
+  return dataset_ ? dataset_->itemIndex.size() : 0;
 }
 
 void WALSEngineLite::sortDataset(std::vector<DatasetElem>& dataset) {
@@ -159,7 +111,7 @@ Double WALSEngineLite::iterate(uint64_t start_index,
                                uint64_t end_index,
                                FactorData& leftData,
                                const IdIndex& leftIndex,
-                               const std::vector<SignalGroup>& leftSignals,
+                               const SignalMatrix& leftSignals,
                                const FactorData& rightData,
                                const IdIndex& rightIndex) {
 
@@ -173,90 +125,38 @@ Double WALSEngineLite::iterate(uint64_t start_index,
 //  omp_set_num_threads(16);
 #endif
 
+  static const Histogram solveTime("wals_lite.solve_row");
+  static const Counter signalCount("wals_lite.signals");
+
   Double loss = 0.0;
   const auto alpha = bigdata_ptr_->confidence();
   const auto lambda = bigdata_ptr_->lambda();
 
 #pragma omp parallel reduction(+ : loss)
   {
+    // timed once per thread chunk rather than per row, nowait keeps the
+    // barrier out of the chunk time
+    Timer timer;
+    uint64_t rows = 0;
+    uint64_t signals = 0;
 
-#pragma omp for
+#pragma omp for nowait
     for (uint64_t i = start_index; i < end_index; ++i) {
-      const size_t leftIdx = leftIndex.idx(leftSignals[i].sourceId);
-      loss += updateFactorsForOne(X.data(leftIdx), X.ncols(), Y, rightIndex,
-                                  leftSignals[i], *(bigdata_ptr_->YtY_ptr_),
-                                  alpha, lambda);
+      const SignalGroup signalGroup = leftSignals[i];
+      const size_t leftIdx = leftIndex.idx(signalGroup.sourceId);
+      loss += WALSSolver::solveRow(X.data(leftIdx), Y, *bigdata_ptr_->YtY_ptr_,
+                                   rightIndex, signalGroup, alpha, lambda);
+      ++rows;
+      signals += signalGroup.group.size();
     }
-  }
-
-  return loss / Y.nrows() / (end_index - start_index);
-}
 
-void WALSEngineLite::computeXtX(const Matrix& X, Matrix* out) {
-
-  // assert X and out samesize
-
-#if defined(__GNUC__)
-//  omp_set_num_threads(16);
-#endif
-
-  const size_t nrows = X.nrows();
-  const size_t ncols = X.ncols();
-  out->clear();
-
-#pragma omp parallel for
-  for (size_t k = 0; k < nrows; ++k) {
-    for (size_t i = 0; i < ncols; ++i) {
-      for (size_t j = 0; j < ncols; ++j) {
-        (*out)(i, j) += X(k, i) * X(k, j);
-      }
-    }
-  }
-}
-
-Double WALSEngineLite::updateFactorsForOne(Double* result,
-                                           const size_t n,
-                                           const Matrix& Y,
-                                           const IdIndex& rightIndex,
-                                           const SignalGroup& signalGroup,
-                                           Matrix A,
-                                           const Double alpha,
-                                           const Double lambda) {
-  Double loss = 0.0;
-  Vector b(n);
-  for (const auto& signal : signalGroup.group) {
-    const size_t rightIdx = rightIndex.idx(signal.id);
-    for (size_t i = 0; i < n; ++i) {
-      b(i) += Y(rightIdx, i) * (1.0 + alpha * signal.value);
-      for (size_t j = 0; j < n; ++j) {
-        A(i, j) += Y(rightIdx, i) * alpha * signal.value * Y(rightIdx, j);
-      }
+    if (rows > 0) {
+      solveTime.recordSeconds(timer.seconds() / rows);
+      signalCount.add(signals);
     }
-    // for term p^t * C * p
-    loss += 1.0 + alpha * signal.value;
-  }
-  // B = Y^t * C * Y
-  Matrix B = A;
-  for (size_t i = 0; i < n; ++i) {
-    A(i, i) += lambda;
-  }
-  // A * x = b
-  Vector x = linearSymmetricSolve(A, b);
-  // x^t * Y^t * C * Y * x
-  for (size_t i = 0; i < n; ++i) {
-    for (size_t j = 0; j < n; ++j) {
-      loss += B(i, j) * x(i) * x(j);
-    }
-  }
-  // -2 * x^t * Y^t * C * p
-  for (size_t i = 0; i < n; ++i) {
-    loss -= 2 * x(i) * b(i);
   }
 
-  for (size_t i = 0; i < n; ++i) {
-    *(result + i) = x(i);
-  }
-  return loss;
+  return loss / Y.nrows() / (end_index - start_index);
 }
 
 } // namespace qmf
@@ -29,6 +29,7 @@
 #include <qmf/metrics/MetricsEngine.h>
 #include <qmf/Types.h>
 #include <qmf/utils/IdIndex.h>
+#include <qmf/wals/SignalMatrix.h>
 
 #include <distributed/common/BigData.h>
 
@@ -54,8 +55,34 @@ class WALSEngineLite {
     : bigdata_ptr_(bigdata), thread_num_(nthreads) {
   }
 
+  // build the indexes and signals from the rating
   void init();
 
+  // use the indexes and signals of another engine on the same rating
+  void share(const WALSEngineLite& other) {
+    dataset_ = other.dataset_;
+  }
+
+  bool initialized() const {
+    return dataset_ != nullptr;
+  }
+
+  const IdIndex& userIndex() const {
+    return dataset_->userIndex;
+  }
+
+  const IdIndex& itemIndex() const {
+    return dataset_->itemIndex;
+  }
+
+  const SignalMatrix& userSignals() const {
+    return dataset_->userSignals;
+  }
+
+  const SignalMatrix& itemSignals() const {
+    return dataset_->itemSignals;
+  }
+
   void optimize();
 
   void evaluate(const size_t epoch);
@@ -64,27 +91,15 @@ class WALSEngineLite {
 
   size_t nitems() const;
 
-  void saveUserFactors(const std::string& fileName) const;
-  void saveItemFactors(const std::string& fileName) const;
-  void saveFactors(const FactorData& factorData,
+  // formatted and written in parallel by FactorWriter
+  bool saveUserFactors(const std::string& fileName) const;
+  bool saveItemFactors(const std::string& fileName) const;
+  bool saveFactors(const FactorData& factorData,
                    const IdIndex& index,
                    const std::string& fileName) const;
 
  // private:
-  struct Signal {
-    int64_t id;
-    Double value;
-  };
-
-  struct SignalGroup {
-    int64_t sourceId;
-    std::vector<Signal> group;
-  };
-
-  static void groupSignals(std::vector<SignalGroup>& signals,
-                           IdIndex& index,
-                           std::vector<DatasetElem>& dataset);
-
+  // sorted by (userId, itemId), the test ratings of the Scheduler
   static void sortDataset(std::vector<DatasetElem>& dataset);
 
   // 分布式场景下使用
@@ -92,29 +107,21 @@ class WALSEngineLite {
                  uint64_t end_index,
                  FactorData& leftData,
                  const IdIndex& leftIndex,
-                 const std::vector<SignalGroup>& leftSignals,
+                 const SignalMatrix& leftSignals,
                  const FactorData& rightData,
                  const IdIndex& rightIndex);
 
-  void computeXtX(const Matrix& X, Matrix* out);
-
-  static Double
-    updateFactorsForOne(Double* result,
-                        const size_t n,
-                        const Matrix& Y,
-                        const IdIndex& rightIndex,
-                        const SignalGroup& signalGroup, /* signal_id & value */
-                        Matrix A,                       /*YtY copy*/
-                        const Double alpha,
-                        const Double lambda);
-
-  // indexes
-  IdIndex userIndex_;
-  IdIndex itemIndex_;
-
-  // signals
-  std::vector<SignalGroup> userSignals_;
-  std::vector<SignalGroup> itemSignals_;
+  // read only after built, shared by the tasks on the same rating
+  struct Dataset {
+    // indexes
+    IdIndex userIndex;
+    IdIndex itemIndex;
+
+    // signals
+    SignalMatrix userSignals;
+    SignalMatrix itemSignals;
+  };
+  std::shared_ptr<const Dataset> dataset_;
 
   std::unique_ptr<distributed::BigData>& bigdata_ptr_;
   const size_t thread_num_;
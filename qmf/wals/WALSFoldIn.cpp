@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <qmf/wals/WALSFoldIn.h>
+#include <qmf/wals/WALSSolver.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+WALSFoldIn::WALSFoldIn(const FactorData& itemFactors,
+                       const IdIndex& itemIndex,
+                       const Matrix& YtY,
+                       const Double confidenceWeight,
+                       const Double regularizationLambda)
+  : itemFactors_(itemFactors),
+    itemIndex_(itemIndex),
+    YtY_(YtY),
+    alpha_(confidenceWeight),
+    lambda_(regularizationLambda) {
+  CHECK_GE(itemFactors_.nelems(), itemIndex_.size());
+  CHECK_EQ(YtY_.nrows(), itemFactors_.nfactors());
+  CHECK_EQ(YtY_.ncols(), itemFactors_.nfactors());
+}
+
+Matrix WALSFoldIn::computeYtY(const FactorData& itemFactors) {
+  Matrix YtY(itemFactors.nfactors(), itemFactors.nfactors());
+  WALSSolver::computeXtX(itemFactors.getFactors(), &YtY);
+  return YtY;
+}
+
+void WALSFoldIn::foldIn(const std::vector<DatasetElem>& batch,
+                        IdIndex& userIndex,
+                        std::unique_ptr<FactorData>& userFactors,
+                        ParallelExecutor& parallel,
+                        size_t* ignored) const {
+  userIndex.reset();
+
+  // group by user without sorting, the batch is expected to be small
+  std::vector<std::vector<size_t>> items;
+  std::vector<std::vector<Double>> values;
+  size_t unknown = 0;
+  for (const auto& elem : batch) {
+    const size_t idx = userIndex.getOrSetIdx(elem.userId);
+    if (idx == items.size()) {
+      items.emplace_back();
+      values.emplace_back();
+    }
+
+    const size_t itemIdx = itemIndex_.idx(elem.itemId);
+    if (itemIdx == IdIndex::missingIdx) {
+      ++unknown;
+      continue;
+    }
+    items[idx].push_back(itemIdx);
+    values[idx].push_back(elem.value);
+  }
+
+  if (ignored) {
+    *ignored = unknown;
+  }
+
+  userFactors =
+    std::make_unique<FactorData>(userIndex.size(), itemFactors_.nfactors());
+  Matrix& X = userFactors->getFactors();
+  parallel.execute(userIndex.size(), [&](const size_t taskId) {
+    solve(items[taskId], values[taskId], X.data(taskId));
+  });
+}
+
+Double WALSFoldIn::solve(const std::vector<size_t>& items,
+                         const std::vector<Double>& values,
+                         Double* result) const {
+  const size_t n = itemFactors_.nfactors();
+  if (items.empty()) {
+    for (size_t i = 0; i < n; ++i) {
+      result[i] = 0.0;
+    }
+    return 0.0;
+  }
+
+  return WALSSolver::solveRow(result, itemFactors_.getFactors(), YtY_, items,
+                              values, alpha_, lambda_);
+}
+}
@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Fold-in: solve the factors of new or updated users against the fixed item
+ * factors, the same least squares of one WALSEngine user update (WALSSolver),
+ * so no retraining is needed until the next full job.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/FactorData.h>
+#include <qmf/Matrix.h>
+#include <qmf/Types.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+namespace qmf {
+
+class WALSFoldIn {
+ public:
+  // YtY should be computed from itemFactors, the caller keeps all of them
+  // alive during the lifetime of WALSFoldIn. itemFactors may have zero rows
+  // after the ones of itemIndex
+  WALSFoldIn(const FactorData& itemFactors,
+             const IdIndex& itemIndex,
+             const Matrix& YtY,
+             const Double confidenceWeight,
+             const Double regularizationLambda);
+
+  // the gram matrix of itemFactors by WALSSolver::computeXtX
+  static Matrix computeYtY(const FactorData& itemFactors);
+
+  // solve the users of batch (user, item, value) in parallel, userIndex and
+  // userFactors are reset to the users in order of their first appearance.
+  // the interactions of the unknown items are skipped and counted in ignored,
+  // a user without any known items gets zero factors
+  void foldIn(const std::vector<DatasetElem>& batch,
+              IdIndex& userIndex,
+              std::unique_ptr<FactorData>& userFactors,
+              ParallelExecutor& parallel,
+              size_t* ignored = nullptr) const;
+
+  // solve one user of the item indexes and values to result by
+  // WALSSolver::solveRow, returns the loss term of the user
+  Double solve(const std::vector<size_t>& items,
+               const std::vector<Double>& values,
+               Double* result) const;
+
+ private:
+  const FactorData& itemFactors_;
+  const IdIndex& itemIndex_;
+  const Matrix& YtY_;
+  const Double alpha_;
+  const Double lambda_;
+};
+}
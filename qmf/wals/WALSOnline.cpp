@@ -0,0 +1,289 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <numeric>
+
+#include <qmf/utils/FactorReader.h>
+#include <qmf/wals/WALSFoldIn.h>
+#include <qmf/wals/WALSOnline.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+WALSOnline::WALSOnline(const WALSConfig& config, const size_t nthreads)
+  : config_(config), parallel_(nthreads), gen_(std::random_device()()) {
+}
+
+void WALSOnline::init(const std::vector<DatasetElem>& dataset) {
+  CHECK(!users_.factors && !items_.factors)
+    << "engine was already initialized with train data";
+  CHECK(!dataset.empty()) << "empty train data";
+
+  // grouped in parallel as WALSEngine does, the later events are inserted
+  // to the groups one by one
+  SignalMatrix userSignals;
+  SignalMatrix itemSignals;
+  SignalMatrix::build(dataset, users_.index, items_.index, userSignals,
+                      itemSignals, parallel_);
+  setSignals(users_, userSignals, items_.index);
+  setSignals(items_, itemSignals, users_.index);
+
+  users_.factors =
+    std::make_unique<FactorData>(users_.index.size(), config_.nfactors);
+  items_.factors =
+    std::make_unique<FactorData>(items_.index.size(), config_.nfactors);
+
+  std::uniform_real_distribution<Double> distr(
+    -config_.initDistributionBound, config_.initDistributionBound);
+  items_.factors->setFactors([this, &distr](auto...) { return distr(gen_); });
+  if (!config_.warmStartItemFactors.empty()) {
+    CHECK(FactorReader::warmStart(
+      config_.warmStartItemFactors, items_.index, *items_.factors))
+      << "warm start from " << config_.warmStartItemFactors << " failed";
+  }
+
+  std::vector<size_t> allUsers(users_.index.size());
+  std::iota(allUsers.begin(), allUsers.end(), 0);
+  std::vector<size_t> allItems(items_.index.size());
+  std::iota(allItems.begin(), allItems.end(), 0);
+  for (size_t epoch = 1; epoch <= config_.nepochs; ++epoch) {
+    solve(users_, allUsers, items_);
+    const Double loss = solve(items_, allItems, users_);
+    LOG(INFO) << "epoch " << epoch << ": train loss = "
+              << loss / allUsers.size() / allItems.size();
+  }
+
+  // all the blocks are copied by the first snapshot
+  publish();
+  for (Side* side : {&users_, &items_}) {
+    side->dirty.clear();
+    side->isDirty.assign(side->index.size(), false);
+  }
+}
+
+void WALSOnline::append(const std::vector<DatasetElem>& events) {
+  std::lock_guard<std::mutex> lock(pendingMutex_);
+  pending_.insert(pending_.end(), events.begin(), events.end());
+}
+
+size_t WALSOnline::update() {
+  CHECK(users_.factors && items_.factors)
+    << "no factor data, have you initialized the engine?";
+
+  std::vector<DatasetElem> events;
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    events.swap(pending_);
+  }
+  if (events.empty()) {
+    return 0;
+  }
+
+  for (const auto& elem : events) {
+    addEvent(elem);
+  }
+
+  // the touched users first, then the touched items against them
+  solve(users_, users_.dirty, items_);
+  solve(items_, items_.dirty, users_);
+
+  const size_t nrows = users_.dirty.size() + items_.dirty.size();
+  LOG(INFO) << "applied " << events.size() << " events, re-solved "
+            << users_.dirty.size() << " users and " << items_.dirty.size()
+            << " items";
+
+  ++version_;
+  publish();
+
+  for (Side* side : {&users_, &items_}) {
+    for (const size_t idx : side->dirty) {
+      side->isDirty[idx] = false;
+    }
+    side->dirty.clear();
+  }
+  return nrows;
+}
+
+std::shared_ptr<const WALSSnapshot> WALSOnline::snapshot() const {
+  std::lock_guard<std::mutex> lock(snapshotMutex_);
+  return snapshot_;
+}
+
+void WALSOnline::setSignals(Side& side,
+                            const SignalMatrix& matrix,
+                            const IdIndex& otherIndex) {
+  side.signals.assign(matrix.size(), Signals());
+  side.isDirty.assign(matrix.size(), false);
+
+  // the signals of a group are sorted by id, so are the idxs of the sorted
+  // index, and the duplicate ones are adjacent
+  parallel_.execute(matrix.size(), [&](const size_t taskId) {
+    const SignalGroup signalGroup = matrix[taskId];
+    Signals& signals = side.signals[taskId];
+    signals.idxs.reserve(signalGroup.group.size());
+    signals.values.reserve(signalGroup.group.size());
+    for (const auto& signal : signalGroup.group) {
+      const size_t idx = otherIndex.idx(signal.id);
+      if (!signals.idxs.empty() && signals.idxs.back() == idx) {
+        signals.values.back() += signal.value;
+      } else {
+        signals.idxs.push_back(idx);
+        signals.values.push_back(signal.value);
+      }
+    }
+  });
+}
+
+size_t WALSOnline::addRow(Side& side, const int64_t id, const bool random) {
+  const size_t idx = side.index.getOrSetIdx(id);
+  if (idx < side.signals.size()) {
+    return idx;
+  }
+  side.signals.emplace_back();
+  side.isDirty.push_back(false);
+
+  if (!side.factors) {
+    return idx;
+  }
+  if (idx >= side.factors->nelems()) {
+    // the new rows are zero
+    auto grown = std::make_unique<FactorData>(
+      std::max(side.factors->nelems() * 2, idx + 1), config_.nfactors);
+    const FactorData& prev = *side.factors;
+    for (size_t row = 0; row < prev.nelems(); ++row) {
+      for (size_t fidx = 0; fidx < config_.nfactors; ++fidx) {
+        grown->at(row, fidx) = prev.at(row, fidx);
+      }
+    }
+    side.factors = std::move(grown);
+  }
+  if (random) {
+    std::uniform_real_distribution<Double> distr(
+      -config_.initDistributionBound, config_.initDistributionBound);
+    for (size_t fidx = 0; fidx < config_.nfactors; ++fidx) {
+      side.factors->at(idx, fidx) = distr(gen_);
+    }
+  }
+  return idx;
+}
+
+void WALSOnline::addEvent(const DatasetElem& elem) {
+  // only the new items need random factors, the users are solved first
+  const size_t userIdx = addRow(users_, elem.userId, false);
+  const size_t itemIdx = addRow(items_, elem.itemId, true);
+
+  // binary searched and inserted in place, so each row stays sorted
+  auto add = [](Signals& signals, const size_t idx, const Double value) {
+    const auto pos =
+      std::lower_bound(signals.idxs.begin(), signals.idxs.end(), idx);
+    const size_t k = pos - signals.idxs.begin();
+    if (pos != signals.idxs.end() && *pos == idx) {
+      signals.values[k] += value;
+      return;
+    }
+    signals.idxs.insert(pos, idx);
+    signals.values.insert(signals.values.begin() + k, value);
+  };
+  add(users_.signals[userIdx], itemIdx, elem.value);
+  add(items_.signals[itemIdx], userIdx, elem.value);
+
+  auto touch = [](Side& side, const size_t idx) {
+    if (!side.isDirty[idx]) {
+      side.isDirty[idx] = true;
+      side.dirty.push_back(idx);
+    }
+  };
+  touch(users_, userIdx);
+  touch(items_, itemIdx);
+}
+
+Double WALSOnline::solve(Side& left,
+                         const std::vector<size_t>& rows,
+                         const Side& right) {
+  const FactorData& Y = *right.factors;
+  const Matrix YtY = WALSFoldIn::computeYtY(Y);
+  const WALSFoldIn foldIn(Y, right.index, YtY, config_.confidenceWeight,
+                          config_.regularizationLambda);
+
+  Matrix& X = left.factors->getFactors();
+  auto map = [&](const size_t taskId) {
+    const size_t idx = rows[taskId];
+    const Signals& signals = left.signals[idx];
+    return foldIn.solve(signals.idxs, signals.values, X.data(idx));
+  };
+  auto reduce = [](Double sum, Double x) { return sum + x; };
+  return parallel_.mapReduce(rows.size(), map, reduce, 0.0);
+}
+
+void WALSOnline::publishSide(const Side& side,
+                             const std::shared_ptr<const IdIndex>& prevIndex,
+                             const SnapshotFactors& prevFactors,
+                             std::shared_ptr<const IdIndex>* index,
+                             SnapshotFactors* factors) {
+  // the ids are only appended, the same size means the same index
+  const size_t nelems = side.index.size();
+  if (prevIndex && prevIndex->size() == nelems) {
+    *index = prevIndex;
+  } else {
+    *index = std::make_shared<const IdIndex>(side.index);
+  }
+
+  const size_t blockRows = SnapshotFactors::kBlockRows;
+  const size_t nblocks = (nelems + blockRows - 1) / blockRows;
+  factors->nelems_ = nelems;
+  factors->nfactors_ = config_.nfactors;
+  factors->blocks_ = prevFactors.blocks_;
+  factors->blocks_.resize(nblocks);
+
+  // the blocks of the solved rows, the new ones and the grown last one
+  std::vector<bool> isDirty(nblocks, false);
+  for (const size_t idx : side.dirty) {
+    isDirty[idx / blockRows] = true;
+  }
+  std::vector<size_t> blocks;
+  for (size_t block = 0; block < nblocks; ++block) {
+    const size_t nrows = std::min(blockRows, nelems - block * blockRows);
+    const auto& prev = factors->blocks_[block];
+    if (isDirty[block] || !prev || prev->nrows() != nrows) {
+      blocks.push_back(block);
+    }
+  }
+
+  const FactorData& live = *side.factors;
+  parallel_.execute(blocks.size(), [&](const size_t taskId) {
+    const size_t start = blocks[taskId] * blockRows;
+    const size_t nrows = std::min(blockRows, nelems - start);
+    auto block = std::make_shared<Matrix>(nrows, config_.nfactors);
+    for (size_t row = 0; row < nrows; ++row) {
+      for (size_t fidx = 0; fidx < config_.nfactors; ++fidx) {
+        (*block)(row, fidx) = live.at(start + row, fidx);
+      }
+    }
+    factors->blocks_[blocks[taskId]] = std::move(block);
+  });
+}
+
+void WALSOnline::publish() {
+  // only this thread replaces the snapshot
+  const auto prev = snapshot();
+  const SnapshotFactors none;
+
+  auto snapshot = std::make_shared<WALSSnapshot>();
+  snapshot->version = version_;
+  publishSide(users_, prev ? prev->userIndex : nullptr,
+              prev ? prev->userFactors : none, &snapshot->userIndex,
+              &snapshot->userFactors);
+  publishSide(items_, prev ? prev->itemIndex : nullptr,
+              prev ? prev->itemFactors : none, &snapshot->itemIndex,
+              &snapshot->itemFactors);
+
+  std::lock_guard<std::mutex> lock(snapshotMutex_);
+  snapshot_ = std::move(snapshot);
+}
+}
@@ -0,0 +1,153 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * Online WALS: after the full epochs of init, the interaction deltas are
+ * appended to the in memory signals, and each update pass recomputes the
+ * Gram matrices and re-solves only the users and items touched since the
+ * last pass. Readers get the factors from an immutable snapshot, which
+ * shares the rows not solved by the pass with the previous one.
+ */
+
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/FactorData.h>
+#include <qmf/Matrix.h>
+#include <qmf/Types.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ParallelExecutor.h>
+#include <qmf/wals/SignalMatrix.h>
+#include <qmf/wals/WALSEngine.h>
+
+namespace qmf {
+
+// the factors of one side in blocks of kBlockRows rows, a pass copies only
+// the blocks of the rows it solved and shares the others
+class SnapshotFactors {
+ public:
+  static const size_t kBlockRows = 1024;
+
+  size_t nelems() const {
+    return nelems_;
+  }
+
+  size_t nfactors() const {
+    return nfactors_;
+  }
+
+  Double at(const size_t idx, const size_t fidx) const {
+    return (*blocks_[idx / kBlockRows])(idx % kBlockRows, fidx);
+  }
+
+  // the blocks of the same row range in both are the same object
+  bool sharesBlock(const SnapshotFactors& other, const size_t idx) const {
+    return blocks_[idx / kBlockRows] == other.blocks_[idx / kBlockRows];
+  }
+
+ private:
+  friend class WALSOnline;
+
+  size_t nelems_ = 0;
+  size_t nfactors_ = 0;
+  std::vector<std::shared_ptr<const Matrix>> blocks_;
+};
+
+struct WALSSnapshot {
+  // increased by each update pass with events
+  uint64_t version;
+  // shared with the previous snapshot unless the pass added new ids
+  std::shared_ptr<const IdIndex> userIndex;
+  std::shared_ptr<const IdIndex> itemIndex;
+  SnapshotFactors userFactors;
+  SnapshotFactors itemFactors;
+};
+
+class WALSOnline {
+ public:
+  explicit WALSOnline(const WALSConfig& config, const size_t nthreads = 16);
+
+  // build the signals and run config.nepochs full epochs, the item factors
+  // are warm started if config.warmStartItemFactors is set
+  void init(const std::vector<DatasetElem>& dataset);
+
+  // queue the events for the next update, can be called from any thread.
+  // the value of an existing (user, item) is added by the event
+  void append(const std::vector<DatasetElem>& events);
+
+  // apply the queued events and re-solve the touched users, then the touched
+  // items, returns the count of the rows solved
+  size_t update();
+
+  // the factors of the last init or update
+  std::shared_ptr<const WALSSnapshot> snapshot() const;
+
+ private:
+  // sorted by idxs, one entry of each (user, item)
+  struct Signals {
+    std::vector<size_t> idxs;
+    std::vector<Double> values;
+  };
+
+  // the factors rows grow by doubling, only [0, index.size()) are valid and
+  // the others are zero, so they don't contribute to the Gram matrix
+  struct Side {
+    IdIndex index;
+    std::vector<Signals> signals;
+    std::unique_ptr<FactorData> factors;
+    // rows touched since the last pass
+    std::vector<size_t> dirty;
+    std::vector<bool> isDirty;
+  };
+
+  // the signals of the SignalMatrix groups to side, the ids of the signals
+  // mapped by otherIndex and the duplicate ones merged
+  void setSignals(Side& side,
+                  const SignalMatrix& matrix,
+                  const IdIndex& otherIndex);
+
+  size_t addRow(Side& side, const int64_t id, const bool random);
+
+  void addEvent(const DatasetElem& elem);
+
+  // re-solve rows of left against the whole right
+  Double solve(Side& left, const std::vector<size_t>& rows, const Side& right);
+
+  // the index and the factors of side, the index if not grown and the
+  // blocks without dirty rows are shared with the previous ones
+  void publishSide(const Side& side,
+                   const std::shared_ptr<const IdIndex>& prevIndex,
+                   const SnapshotFactors& prevFactors,
+                   std::shared_ptr<const IdIndex>* index,
+                   SnapshotFactors* factors);
+
+  // called before the dirty rows are cleared
+  void publish();
+
+  const WALSConfig& config_;
+
+  ParallelExecutor parallel_;
+
+  std::mt19937 gen_;
+
+  Side users_;
+  Side items_;
+
+  uint64_t version_ = 0;
+
+  std::mutex pendingMutex_;
+  std::vector<DatasetElem> pending_;
+
+  mutable std::mutex snapshotMutex_;
+  std::shared_ptr<const WALSSnapshot> snapshot_;
+};
+}
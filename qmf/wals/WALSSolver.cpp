@@ -0,0 +1,117 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <qmf/Vector.h>
+#include <qmf/wals/WALSSolver.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+namespace {
+
+// forEach(f) calls f(rightIdx, value) for each signal of the row
+template <typename ForEach>
+Double solve(Double* result,
+             const Matrix& Y,
+             const Matrix& YtY,
+             const ForEach& forEach,
+             const Double alpha,
+             const Double lambda) {
+  const size_t n = Y.ncols();
+  Matrix A = YtY;
+  Double loss = 0.0;
+  Vector b(n);
+  forEach([&](const size_t rightIdx, const Double value) {
+    for (size_t i = 0; i < n; ++i) {
+      b(i) += Y(rightIdx, i) * (1.0 + alpha * value);
+      for (size_t j = 0; j < n; ++j) {
+        A(i, j) += Y(rightIdx, i) * alpha * value * Y(rightIdx, j);
+      }
+    }
+    // for term p^t * C * p
+    loss += 1.0 + alpha * value;
+  });
+  // B = Y^t * C * Y
+  Matrix B = A;
+  for (size_t i = 0; i < n; ++i) {
+    A(i, i) += lambda;
+  }
+  // A * x = b
+  Vector x = linearSymmetricSolve(A, b);
+  // x^t * Y^t * C * Y * x
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      loss += B(i, j) * x(i) * x(j);
+    }
+  }
+  // -2 * x^t * Y^t * C * p
+  for (size_t i = 0; i < n; ++i) {
+    loss -= 2 * x(i) * b(i);
+    result[i] = x(i);
+  }
+  return loss;
+}
+}
+
+void WALSSolver::computeXtX(const Matrix& X, Matrix* out) {
+  out->clear();
+  accumulateXtX(X, 0, X.nrows(), out);
+}
+
+void WALSSolver::accumulateXtX(const Matrix& X,
+                               const size_t start,
+                               const size_t end,
+                               Matrix* out) {
+  CHECK_EQ(out->nrows(), X.ncols());
+  CHECK_EQ(out->ncols(), X.ncols());
+
+  const size_t ncols = X.ncols();
+#pragma omp parallel for
+  for (size_t i = 0; i < ncols; ++i) {
+    for (size_t k = start; k < end; ++k) {
+      const Double xi = X(k, i);
+      for (size_t j = 0; j < ncols; ++j) {
+        (*out)(i, j) += xi * X(k, j);
+      }
+    }
+  }
+}
+
+Double WALSSolver::solveRow(Double* result,
+                            const Matrix& Y,
+                            const Matrix& YtY,
+                            const IdIndex& rightIndex,
+                            const SignalGroup& signalGroup,
+                            const Double alpha,
+                            const Double lambda) {
+  return solve(result, Y, YtY,
+               [&](const auto& f) {
+                 for (const auto& signal : signalGroup.group) {
+                   f(rightIndex.idx(signal.id), signal.value);
+                 }
+               },
+               alpha, lambda);
+}
+
+Double WALSSolver::solveRow(Double* result,
+                            const Matrix& Y,
+                            const Matrix& YtY,
+                            const std::vector<size_t>& rightIdxs,
+                            const std::vector<Double>& values,
+                            const Double alpha,
+                            const Double lambda) {
+  CHECK_EQ(rightIdxs.size(), values.size());
+  return solve(result, Y, YtY,
+               [&](const auto& f) {
+                 for (size_t k = 0; k < rightIdxs.size(); ++k) {
+                   f(rightIdxs[k], values[k]);
+                 }
+               },
+               alpha, lambda);
+}
+}
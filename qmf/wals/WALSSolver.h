@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#pragma once
+
+/**
+ * The kernels of one WALS half epoch shared by WALSEngine, WALSEngineLite and
+ * WALSFoldIn: the gram matrix of the fixed factors, and the least squares of
+ * one row against them.
+ */
+
+#include <vector>
+
+#include <qmf/Matrix.h>
+#include <qmf/Types.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/wals/SignalMatrix.h>
+
+namespace qmf {
+
+class WALSSolver {
+ public:
+  // out = X^t * X
+  static void computeXtX(const Matrix& X, Matrix* out);
+
+  // out += X[start, end)^t * X[start, end), used when X arrives in pieces.
+  // the OpenMP threads own distinct rows of out, no reduction needed
+  static void accumulateXtX(const Matrix& X,
+                            const size_t start,
+                            const size_t end,
+                            Matrix* out);
+
+  // solve the row of the signals, whose ids are mapped by rightIndex, against
+  // the fixed factors Y to result. YtY should be computed from Y, returns the
+  // loss term of the row
+  static Double solveRow(Double* result,
+                         const Matrix& Y,
+                         const Matrix& YtY,
+                         const IdIndex& rightIndex,
+                         const SignalGroup& signalGroup,
+                         const Double alpha,
+                         const Double lambda);
+
+  // same as above, with the row indexes of Y and their values
+  static Double solveRow(Double* result,
+                         const Matrix& Y,
+                         const Matrix& YtY,
+                         const std::vector<size_t>& rightIdxs,
+                         const std::vector<Double>& values,
+                         const Double alpha,
+                         const Double lambda);
+};
+}
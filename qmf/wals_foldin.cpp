@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdio>
+
+#include <qmf/wals/WALSFoldIn.h>
+#include <qmf/DatasetReader.h>
+#include <qmf/utils/FactorReader.h>
+#include <qmf/utils/FactorWriter.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+// model arguments, should be the same as training
+DEFINE_uint64(nfactors, 30, "dimension of learned factors");
+DEFINE_double(regularization_lambda, 0.05, "regularization param");
+DEFINE_double(confidence_weight, 40, "confidence weight");
+
+// settings
+DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+DEFINE_uint64(batch_size, 10000, "interactions solved together, a user's "
+                                 "interactions should be consecutive in the "
+                                 "stream");
+
+// input
+DEFINE_string(item_factors, "", "filename of the trained item factors");
+DEFINE_string(interactions, "/dev/stdin", "stream of new interactions, "
+                                          "\"user item value\" per line");
+
+// output
+DEFINE_string(user_factors, "/dev/stdout", "filename of folded user factors");
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("wals_foldin");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_item_factors.empty()) << "missing --item_factors";
+  CHECK_GT(FLAGS_batch_size, 0);
+
+  qmf::IdIndex itemIndex;
+  std::unique_ptr<qmf::FactorData> itemFactors;
+  CHECK(qmf::FactorReader::load(
+    FLAGS_item_factors, FLAGS_nfactors, false, itemIndex, itemFactors));
+
+  qmf::ParallelExecutor parallel(FLAGS_nthreads);
+  const qmf::Matrix YtY = qmf::WALSFoldIn::computeYtY(*itemFactors);
+  const qmf::WALSFoldIn foldIn(*itemFactors, itemIndex, YtY,
+                               FLAGS_confidence_weight,
+                               FLAGS_regularization_lambda);
+
+  FILE* fout = fopen(FLAGS_user_factors.c_str(), "w");
+  CHECK(fout) << "open " << FLAGS_user_factors << " failed";
+
+  qmf::DatasetReader reader(FLAGS_interactions);
+  std::vector<qmf::DatasetElem> batch;
+  batch.reserve(FLAGS_batch_size);
+  qmf::IdIndex userIndex;
+  std::unique_ptr<qmf::FactorData> userFactors;
+  std::string buff;
+  size_t nusers = 0;
+  size_t nignored = 0;
+
+  auto flush = [&]() {
+    size_t ignored = 0;
+    foldIn.foldIn(batch, userIndex, userFactors, parallel, &ignored);
+
+    buff.clear();
+    qmf::FactorWriter::formatRows(
+      *userFactors, userIndex, 0, userIndex.size(), &buff);
+    CHECK_EQ(fwrite(buff.data(), 1, buff.size(), fout), buff.size())
+      << "write " << FLAGS_user_factors << " failed";
+    // the consumers see the users as soon as the batch is solved
+    fflush(fout);
+
+    nusers += userIndex.size();
+    nignored += ignored;
+    batch.clear();
+  };
+
+  // never cut the batch inside the consecutive interactions of one user
+  qmf::DatasetElem elem;
+  while (reader.readOne(elem)) {
+    if (batch.size() >= FLAGS_batch_size &&
+        batch.back().userId != elem.userId) {
+      flush();
+    }
+    batch.push_back(elem);
+  }
+  if (!batch.empty()) {
+    flush();
+  }
+
+  fclose(fout);
+  LOG(INFO) << "folded in " << nusers << " users, ignored " << nignored
+            << " interactions of the unknown items";
+  return 0;
+}
@@ -14,19 +14,39 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
 #include <memory>
 
+#include <qmf/utils/Allocator.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Trace.h>
 #include <qmf/utils/Util.h>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <distributed/common/MetricsServer.h>
 #include <distributed/labor/Labor.h>
 
 // scheduler network
 DEFINE_string(scheduler_ip, "127.0.0.1", "scheduler ip address");
 DEFINE_int32(scheduler_port, 8900, "scheduler listen port");
 
+// memory
+DEFINE_string(huge_pages, "none", "huge pages of the factors: none, madvise "
+                                   "(transparent) or hugetlb (reserved pool)");
+
+// instrumentation
+DEFINE_string(metrics_ip, "0.0.0.0", "metrics server ip address");
+DEFINE_int32(metrics_port, 0, "serves GET /metrics in the Prometheus text "
+                              "format on this port (0 = disabled)");
+DEFINE_string(trace_file, "", "records the trace events of the labor in the "
+                             "Chrome trace-event JSON format, see trace_merge");
+DEFINE_string(instrumentation_file, "", "writes the timers and counters as "
+                                        "JSON at exit and on SIGUSR2 (logs "
+                                        "them if empty)");
+
 
 std::unique_ptr<distributed::labor::Labor> labor;
 
@@ -59,6 +79,26 @@ int main(int argc, char** argv) {
   ::signal(SIGINT, ::signal_handler);
   ::signal(SIGCHLD, SIG_IGN);
 
+  qmf::HugePages hugePages;
+  CHECK(qmf::parseHugePages(FLAGS_huge_pages, &hugePages))
+    << "invalid --huge_pages " << FLAGS_huge_pages;
+  qmf::setHugePages(hugePages);
+
+  // before any thread is created
+  qmf::Instrumentation::get().setDumpFile(FLAGS_instrumentation_file);
+  qmf::Instrumentation::get().dumpOnSignal(SIGUSR2);
+
+  if (!FLAGS_trace_file.empty()) {
+    char host[256]{};
+    ::gethostname(host, sizeof(host) - 1);
+    if (!qmf::Trace::get().open(FLAGS_trace_file,
+                                std::string("labor ") + host + ":" +
+                                  std::to_string(::getpid()))) {
+      LOG(ERROR) << "open trace file failed.";
+      return EXIT_FAILURE;
+    }
+  }
+
   labor = std::make_unique<distributed::labor::Labor>(
     FLAGS_scheduler_ip, FLAGS_scheduler_port);
   if (!labor || !labor->init()) {
@@ -66,7 +106,22 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  std::unique_ptr<distributed::MetricsServer> metrics_server;
+  if (FLAGS_metrics_port > 0) {
+    metrics_server = std::make_unique<distributed::MetricsServer>(
+      FLAGS_metrics_ip, FLAGS_metrics_port,
+      [](const qmf::Instrumentation::Snapshot& snapshot, std::string* out) {
+        labor->collect_metrics(snapshot, out);
+      });
+    if (!metrics_server->start()) {
+      LOG(ERROR) << "start metrics server failed.";
+      return EXIT_FAILURE;
+    }
+  }
+
   labor->loop();
+  qmf::Instrumentation::get().dump();
+  qmf::Trace::get().close();
 
   return 0;
 }
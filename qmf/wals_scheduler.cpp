@@ -17,8 +17,11 @@
 #include <qmf/wals/WALSEngine.h>
 #include <qmf/DatasetReader.h>
 #include <qmf/metrics/MetricsEngine.h>
+#include <qmf/utils/Instrumentation.h>
+#include <qmf/utils/Trace.h>
 #include <qmf/utils/Util.h>
 
+#include <distributed/common/MetricsServer.h>
 #include <distributed/scheduler/Scheduler.h>
 
 #include <gflags/gflags.h>
@@ -28,6 +31,16 @@
 DEFINE_string(scheduler_ip, "0.0.0.0", "scheduler ip address");
 DEFINE_int32(scheduler_port, 8900, "scheduler listen port");
 
+// instrumentation
+DEFINE_string(metrics_ip, "0.0.0.0", "metrics server ip address");
+DEFINE_int32(metrics_port, 0, "serves GET /metrics in the Prometheus text "
+                              "format on this port (0 = disabled)");
+DEFINE_string(trace_file, "", "records the trace events of the scheduler in the "
+                             "Chrome trace-event JSON format, see trace_merge");
+DEFINE_string(instrumentation_file, "", "writes the timers and counters as "
+                                        "JSON after each task and on SIGUSR2 "
+                                        "(logs them if empty)");
+
 std::unique_ptr<distributed::scheduler::Scheduler> scheduler;
 
 static void signal_handler(int signal) {
@@ -58,11 +71,21 @@ int main(int argc, char** argv) {
   ::signal(SIGINT, ::signal_handler);
   ::signal(SIGCHLD, SIG_IGN);
 
+  // before any thread is created
+  qmf::Instrumentation::get().setDumpFile(FLAGS_instrumentation_file);
+  qmf::Instrumentation::get().dumpOnSignal(SIGUSR2);
+
   // GLOG_v=1,2,3
   VLOG(1) << "1111";
   VLOG(2) << "2222";
   VLOG(3) << "3333";
 
+  if (!FLAGS_trace_file.empty() &&
+      !qmf::Trace::get().open(FLAGS_trace_file, "scheduler")) {
+    LOG(ERROR) << "open trace file failed.";
+    return EXIT_FAILURE;
+  }
+
   scheduler = std::make_unique<distributed::scheduler::Scheduler>(
     FLAGS_scheduler_ip, FLAGS_scheduler_port);
   if (!scheduler || !scheduler->init()) {
@@ -70,7 +93,22 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  std::unique_ptr<distributed::MetricsServer> metrics_server;
+  if (FLAGS_metrics_port > 0) {
+    metrics_server = std::make_unique<distributed::MetricsServer>(
+      FLAGS_metrics_ip, FLAGS_metrics_port,
+      [](const qmf::Instrumentation::Snapshot&, std::string* out) {
+        scheduler->collect_metrics(out);
+      });
+    if (!metrics_server->start()) {
+      LOG(ERROR) << "start metrics server failed.";
+      return EXIT_FAILURE;
+    }
+  }
+
   scheduler->select_loop();
+  qmf::Instrumentation::get().dump();
+  qmf::Trace::get().close();
 
   return 0;
 }
@@ -0,0 +1,156 @@
+/*-
+ * Copyright (c) 2020 taozhijiang@gmail.com
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <qmf/wals/WALSEngine.h>
+#include <qmf/DatasetReader.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+/**
+ * 对比每日小增量数据上的冷启动和热启动训练，统计收敛需要的 epoch 数：
+ * 先在 day1 数据上训练到收敛并保存 item factors，day2 在 day1 之上增加
+ * 少量新交互（包括新的用户和物品），分别从随机初始化和 day1 的 factors
+ * 开始训练到同样的收敛条件
+ */
+
+// dataset
+DEFINE_uint64(nusers, 50000, "users of day1");
+DEFINE_uint64(nitems, 10000, "items of day1");
+DEFINE_uint64(ngroups, 50, "latent groups of users and items");
+DEFINE_uint64(interactions, 20, "average interactions per user");
+DEFINE_double(delta_ratio, 0.01, "interactions added by day2, in ratio of day1");
+DEFINE_double(new_ratio, 0.2, "ratio of the delta from new users and items");
+DEFINE_int32(seed, 42, "random seed of the dataset");
+
+// model arguments
+DEFINE_uint64(max_epochs, 50, "max epochs of each training");
+DEFINE_uint64(nfactors, 20, "dimension of learned factors");
+DEFINE_double(regularization_lambda, 0.05, "regularization param");
+DEFINE_double(confidence_weight, 40, "confidence weight");
+DEFINE_double(init_distribution_bound, 0.01, "init distirbution bound");
+DEFINE_double(tolerance, 0.001, "convergence tolerance of train loss");
+
+// settings
+DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+DEFINE_string(tmpfile, "/tmp/warmstart_bench.item", "day1 item factors");
+
+namespace {
+
+struct Generator {
+  explicit Generator(int seed) : gen(seed) {
+  }
+
+  // mostly the items of the user's group, with some noise
+  qmf::DatasetElem sample(int64_t user, size_t nitems) {
+    std::uniform_real_distribution<double> unif;
+    std::uniform_int_distribution<int> value(1, 5);
+    const size_t group = user % FLAGS_ngroups;
+    size_t item = gen() % nitems;
+    if (unif(gen) < 0.8) {
+      item = item - item % FLAGS_ngroups + group;
+      if (item >= nitems) {
+        item = group;
+      }
+    }
+    return qmf::DatasetElem{user, static_cast<int64_t>(item),
+                            static_cast<qmf::Double>(value(gen))};
+  }
+
+  std::mt19937_64 gen;
+};
+
+struct Result {
+  size_t epochs;
+  qmf::Double loss;
+  double seconds;
+};
+
+Result train(const std::vector<qmf::DatasetElem>& dataset,
+             const std::string& warmStart,
+             const std::string& saveItems) {
+  qmf::WALSConfig config{FLAGS_max_epochs,
+                         FLAGS_nfactors,
+                         FLAGS_regularization_lambda,
+                         FLAGS_confidence_weight,
+                         FLAGS_init_distribution_bound,
+                         "",
+                         warmStart,
+                         FLAGS_tolerance,
+                         /* padRows */ true,
+                         /* factorDir */ ""};
+  const std::unique_ptr<qmf::MetricsEngine> metricsEngine;
+  qmf::WALSEngine engine(config, metricsEngine, FLAGS_nthreads);
+
+  const auto start = std::chrono::steady_clock::now();
+  engine.init(dataset);
+  engine.optimize();
+  const auto end = std::chrono::steady_clock::now();
+
+  if (!saveItems.empty()) {
+    engine.saveItemFactors(saveItems);
+  }
+  return Result{engine.epochs(), engine.loss(),
+                std::chrono::duration<double>(end - start).count()};
+}
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("warmstart_bench");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  Generator generator(FLAGS_seed);
+  std::vector<qmf::DatasetElem> day1;
+  day1.reserve(FLAGS_nusers * FLAGS_interactions);
+  for (size_t user = 0; user < FLAGS_nusers; ++user) {
+    for (size_t i = 0; i < FLAGS_interactions; ++i) {
+      day1.push_back(generator.sample(user, FLAGS_nitems));
+    }
+  }
+
+  // the new users and items have the ids after day1's
+  auto day2 = day1;
+  const size_t ndelta = day1.size() * FLAGS_delta_ratio;
+  const size_t nnew = ndelta * FLAGS_new_ratio;
+  const size_t newUsers = std::max<size_t>(nnew / FLAGS_interactions, 1);
+  const size_t newItems = std::max<size_t>(FLAGS_nitems * FLAGS_delta_ratio, 1);
+  for (size_t i = 0; i < ndelta; ++i) {
+    const int64_t user = i < nnew ? FLAGS_nusers + i % newUsers
+                                  : generator.gen() % FLAGS_nusers;
+    day2.push_back(generator.sample(user, FLAGS_nitems + newItems));
+  }
+
+  LOG(INFO) << "day1 " << day1.size() << " interactions, day2 adds " << ndelta
+            << " with " << newUsers << " new users, " << newItems
+            << " new items";
+
+  const Result base = train(day1, "", FLAGS_tmpfile);
+  const Result cold = train(day2, "", "");
+  const Result warm = train(day2, FLAGS_tmpfile, "");
+  ::unlink(FLAGS_tmpfile.c_str());
+
+  printf("%-12s %8s %14s %10s\n", "training", "epochs", "train loss",
+         "seconds");
+  printf("%-12s %8zu %14.9f %10.3f\n", "day1 cold", base.epochs, base.loss,
+         base.seconds);
+  printf("%-12s %8zu %14.9f %10.3f\n", "day2 cold", cold.epochs, cold.loss,
+         cold.seconds);
+  printf("%-12s %8zu %14.9f %10.3f\n", "day2 warm", warm.epochs, warm.loss,
+         warm.seconds);
+  return 0;
+}